@@ -9,8 +9,36 @@ pub fn build(b: *std.Build) void {
         .optimize = optimize,
     });
 
-    const source_files = &.{"src/ipcrypt2.c"};
+    const source_files = &.{
+        "src/ipcrypt2.c",
+        "src/ipcrypt2_pool.c",
+        "src/ipcrypt2_keyring.c",
+        "src/ipcrypt2_log.c",
+        "src/ipcrypt2_packet.c",
+        "src/ipcrypt2_pcap.c",
+        "src/ipcrypt2_csv.c",
+        "src/ipcrypt2_dnstap.c",
+        "src/ipcrypt2_stats.c",
+        "src/ipcrypt2_blob.c",
+        "src/ipcrypt2_flow.c",
+    };
+    // The file pipeline and the record files use pread(), pwrite() and mmap(), the relay uses
+    // recvmsg() and sendmsg().
+    const posix_source_files = &.{
+        "src/ipcrypt2_file.c",
+        "src/ipcrypt2_records.c",
+        "src/ipcrypt2_relay.c",
+    };
+    // Per-thread counters are opt-in, so that they cost nothing by default.
+    const stats = b.option(bool, "stats", "Count operations in per-thread counters") orelse false;
+
     lib_mod.addCSourceFiles(.{ .files = source_files });
+    if (stats) {
+        lib_mod.addCMacro("IPCRYPT_STATS", "1");
+    }
+    if (target.result.os.tag != .windows) {
+        lib_mod.addCSourceFiles(.{ .files = posix_source_files });
+    }
 
     const lib = b.addLibrary(.{
         .linkage = .static,
@@ -41,6 +69,25 @@ pub fn build(b: *std.Build) void {
 
     main_tests.addIncludePath(b.path("src/include"));
     main_tests.linkLibrary(lib);
+
+    // The inline kernels are compared with the library, compiled once with AES instructions and
+    // once without. AArch64 targets only get the kernels if their CPU features include AES.
+    const x86 = target.result.cpu.arch == .x86 or target.result.cpu.arch == .x86_64;
+    main_tests.addIncludePath(b.path("src/test"));
+    main_tests.root_module.addCSourceFile(.{
+        .file = b.path("src/test/inline_kernels.c"),
+        .flags = if (x86)
+            &.{ "-maes", "-mssse3", "-DIPCRYPT_TEST_INLINE_PREFIX=ipcrypt_test_inline_aes" }
+        else
+            &.{"-DIPCRYPT_TEST_INLINE_PREFIX=ipcrypt_test_inline_aes"},
+    });
+    main_tests.root_module.addCSourceFile(.{
+        .file = b.path("src/test/inline_kernels.c"),
+        .flags = if (x86)
+            &.{ "-mno-aes", "-DIPCRYPT_TEST_INLINE_PREFIX=ipcrypt_test_inline_lib" }
+        else
+            &.{ "-DIPCRYPT_SOFTAES", "-DIPCRYPT_TEST_INLINE_PREFIX=ipcrypt_test_inline_lib" },
+    });
     if (target.result.os.tag == .windows) {
         main_tests.linkSystemLibrary("ws2_32");
     }
@@ -49,4 +96,221 @@ pub fn build(b: *std.Build) void {
 
     const test_step = b.step("test", "Run library tests");
     test_step.dependOn(&run_main_tests.step);
+
+    // The C++ interface is header-only, and only compiled by its own test, with pedantic warnings.
+    const test_cpp = b.addExecutable(.{
+        .name = "test-cpp",
+        .root_module = b.createModule(.{
+            .target = target,
+            .optimize = optimize,
+            .link_libcpp = true,
+        }),
+    });
+    test_cpp.root_module.addCSourceFiles(.{
+        .files = &.{"src/test/cpp.cpp"},
+        .flags = &.{ "-std=c++20", "-Wall", "-Wextra", "-Wpedantic" },
+    });
+    test_cpp.root_module.addIncludePath(b.path("src/include"));
+    test_cpp.root_module.linkLibrary(lib);
+    if (target.result.os.tag == .windows) {
+        test_cpp.root_module.linkSystemLibrary("ws2_32", .{});
+    }
+    test_step.dependOn(&b.addRunArtifact(test_cpp).step);
+
+    const test_sessions = b.addExecutable(.{
+        .name = "test-sessions",
+        .root_module = b.createModule(.{
+            .target = target,
+            .optimize = optimize,
+            .link_libc = true,
+        }),
+    });
+    test_sessions.root_module.addCSourceFiles(.{ .files = &.{"src/test/sessions.c"} });
+    test_sessions.root_module.addIncludePath(b.path("src/include"));
+    test_sessions.root_module.linkLibrary(lib);
+    if (target.result.os.tag == .windows) {
+        test_sessions.root_module.linkSystemLibrary("ws2_32", .{});
+    }
+    test_step.dependOn(&b.addRunArtifact(test_sessions).step);
+
+    const bench_micro = b.addExecutable(.{
+        .name = "bench-micro",
+        .root_module = b.createModule(.{
+            .target = target,
+            .optimize = optimize,
+            .link_libc = true,
+        }),
+    });
+    bench_micro.root_module.addCSourceFiles(.{ .files = &.{"src/bench/micro.c"} });
+    bench_micro.root_module.addIncludePath(b.path("src/include"));
+    bench_micro.root_module.linkLibrary(lib);
+
+    // The library sources are compiled directly into a second benchmark, with the software AES
+    // implementation.
+    const bench_micro_softaes = b.addExecutable(.{
+        .name = "bench-micro-softaes",
+        .root_module = b.createModule(.{
+            .target = target,
+            .optimize = optimize,
+            .link_libc = true,
+        }),
+    });
+    bench_micro_softaes.root_module.addCSourceFiles(.{ .files = &.{"src/bench/micro.c"} });
+    bench_micro_softaes.root_module.addCSourceFiles(.{ .files = source_files });
+    if (target.result.os.tag != .windows) {
+        bench_micro_softaes.root_module.addCSourceFiles(.{ .files = posix_source_files });
+    }
+    bench_micro_softaes.root_module.addCMacro("IPCRYPT_SOFTAES", "1");
+    if (stats) {
+        bench_micro_softaes.root_module.addCMacro("IPCRYPT_STATS", "1");
+    }
+    bench_micro_softaes.root_module.addIncludePath(b.path("src/include"));
+
+    if (target.result.os.tag == .windows) {
+        bench_micro.root_module.linkSystemLibrary("ws2_32", .{});
+        bench_micro_softaes.root_module.linkSystemLibrary("ws2_32", .{});
+    }
+
+    const run_bench_micro = b.addRunArtifact(bench_micro);
+    const run_bench_micro_softaes = b.addRunArtifact(bench_micro_softaes);
+    if (b.args) |args| {
+        run_bench_micro.addArgs(args);
+        run_bench_micro_softaes.addArgs(args);
+    }
+    run_bench_micro_softaes.step.dependOn(&run_bench_micro.step);
+
+    const bench_step = b.step("bench", "Run the microbenchmarks for every backend");
+    bench_step.dependOn(&run_bench_micro_softaes.step);
+
+    const bench_pool = b.addExecutable(.{
+        .name = "bench-pool",
+        .root_module = b.createModule(.{
+            .target = target,
+            .optimize = optimize,
+            .link_libc = true,
+        }),
+    });
+    bench_pool.root_module.addCSourceFiles(.{ .files = &.{"src/bench/pool.c"} });
+    bench_pool.root_module.addIncludePath(b.path("src/include"));
+    bench_pool.root_module.linkLibrary(lib);
+
+    const run_bench_pool = b.addRunArtifact(bench_pool);
+    if (b.args) |args| {
+        run_bench_pool.addArgs(args);
+    }
+
+    const bench_pool_step = b.step("bench-pool", "Run the thread pool scaling benchmark");
+    bench_pool_step.dependOn(&run_bench_pool.step);
+
+    const bench_flow = b.addExecutable(.{
+        .name = "bench-flow",
+        .root_module = b.createModule(.{
+            .target = target,
+            .optimize = optimize,
+            .link_libc = true,
+        }),
+    });
+    bench_flow.root_module.addCSourceFiles(.{ .files = &.{"src/bench/flow.c"} });
+    bench_flow.root_module.addIncludePath(b.path("src/include"));
+    bench_flow.root_module.linkLibrary(lib);
+
+    const run_bench_flow = b.addRunArtifact(bench_flow);
+    if (b.args) |args| {
+        run_bench_flow.addArgs(args);
+    }
+
+    const bench_flow_step = b.step("bench-flow", "Run the flow record anonymizer benchmark");
+    bench_flow_step.dependOn(&run_bench_flow.step);
+
+    // The end-to-end benchmark uses POSIX threads.
+    if (target.result.os.tag != .windows) {
+        const bench_e2e = b.addExecutable(.{
+            .name = "bench-e2e",
+            .root_module = b.createModule(.{
+                .target = target,
+                .optimize = optimize,
+                .link_libc = true,
+            }),
+        });
+        bench_e2e.root_module.addCSourceFiles(.{ .files = &.{"src/bench/e2e.c"} });
+        bench_e2e.root_module.addIncludePath(b.path("src/include"));
+        bench_e2e.root_module.linkLibrary(lib);
+
+        const run_bench_e2e = b.addRunArtifact(bench_e2e);
+        if (b.args) |args| {
+            run_bench_e2e.addArgs(args);
+        }
+
+        const bench_e2e_step = b.step("bench-e2e", "Run the end-to-end anonymization benchmark");
+        bench_e2e_step.dependOn(&run_bench_e2e.step);
+
+        // The load generator for ipcryptd only talks to the service, and doesn't use the library.
+        const bench_daemon = b.addExecutable(.{
+            .name = "bench-daemon",
+            .root_module = b.createModule(.{
+                .target = target,
+                .optimize = optimize,
+                .link_libc = true,
+            }),
+        });
+        bench_daemon.root_module.addCSourceFiles(.{ .files = &.{"src/bench/daemon.c"} });
+        b.installArtifact(bench_daemon);
+    }
+
+    // The command-line tools use POSIX threads, and map files with mmap().
+    if (target.result.os.tag != .windows) {
+        const tool_ipcrypt = b.addExecutable(.{
+            .name = "ipcrypt",
+            .root_module = b.createModule(.{
+                .target = target,
+                .optimize = optimize,
+                .link_libc = true,
+            }),
+        });
+        tool_ipcrypt.root_module.addCSourceFiles(.{ .files = &.{"src/tools/ipcrypt.c"} });
+        tool_ipcrypt.root_module.addIncludePath(b.path("src/include"));
+        tool_ipcrypt.root_module.linkLibrary(lib);
+        b.installArtifact(tool_ipcrypt);
+
+        const tool_pcap = b.addExecutable(.{
+            .name = "ipcrypt-pcap",
+            .root_module = b.createModule(.{
+                .target = target,
+                .optimize = optimize,
+                .link_libc = true,
+            }),
+        });
+        tool_pcap.root_module.addCSourceFiles(.{ .files = &.{"src/tools/pcap.c"} });
+        tool_pcap.root_module.addIncludePath(b.path("src/include"));
+        tool_pcap.root_module.linkLibrary(lib);
+        b.installArtifact(tool_pcap);
+
+        const tool_daemon = b.addExecutable(.{
+            .name = "ipcryptd",
+            .root_module = b.createModule(.{
+                .target = target,
+                .optimize = optimize,
+                .link_libc = true,
+            }),
+        });
+        tool_daemon.root_module.addCSourceFiles(.{ .files = &.{"src/tools/ipcryptd.c"} });
+        tool_daemon.root_module.addIncludePath(b.path("src/include"));
+        tool_daemon.root_module.linkLibrary(lib);
+        b.installArtifact(tool_daemon);
+
+        const test_daemon = b.addExecutable(.{
+            .name = "test-daemon",
+            .root_module = b.createModule(.{
+                .target = target,
+                .optimize = optimize,
+                .link_libc = true,
+            }),
+        });
+        test_daemon.root_module.addCSourceFiles(.{ .files = &.{"src/test/daemon.c"} });
+        test_daemon.root_module.addIncludePath(b.path("src/include"));
+        test_daemon.root_module.linkLibrary(lib);
+        const run_test_daemon = b.addRunArtifact(test_daemon);
+        run_test_daemon.addArtifactArg(tool_daemon);
+        test_step.dependOn(&run_test_daemon.step);
+    }
 }
@@ -0,0 +1,373 @@
+/**
+ * Load generator for the ipcryptd service.
+ *
+ * Every thread opens a connection, and keeps a window of requests in flight. Addresses are
+ * encrypted, their ciphertexts are decrypted, and the decrypted addresses are compared with the
+ * original ones. The throughput and the round trip latencies seen by the clients are reported,
+ * followed by the statistics of the service.
+ *
+ * With a window of 1, every client waits for a response before sending the next request, like a
+ * binding processing one address at a time.
+ *
+ * Usage: bench-daemon --socket PATH [--mode M] [--threads N] [--requests N] [--window N]
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#    define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HEADER_BYTES 8U
+#define MAX_WINDOW   1024U
+#define HIST_BUCKETS 40
+
+enum { OP_ENCRYPT, OP_DECRYPT, OP_STATS };
+
+static const char *const mode_names[4] = { "deterministic", "pfx", "nd", "ndx" };
+
+typedef struct Options {
+    const char  *socket_path;
+    unsigned int mode;
+    unsigned int threads;
+    uint64_t     requests;
+    size_t       window;
+} Options;
+
+typedef struct Slot {
+    uint8_t  ip16[16];
+    uint64_t sent_ns;
+} Slot;
+
+typedef struct Client {
+    pthread_t      thread;
+    const Options *opts;
+    uint64_t       latency[HIST_BUCKETS];
+    uint64_t       round_trips;
+    uint64_t       errors;
+    uint32_t       seed;
+} Client;
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000U + (uint64_t) ts.tv_nsec;
+}
+
+static int
+connect_to(const char *path)
+{
+    struct sockaddr_un addr;
+    int                fd;
+
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof addr.sun_path || (fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        return -1;
+    }
+    memcpy(addr.sun_path, path, strlen(path));
+    if (connect(fd, (const struct sockaddr *) &addr, sizeof addr) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int
+write_all(int fd, const uint8_t *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = write(fd, buf, len)) <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+/**
+ * append_request appends a request to `out`, and returns its size.
+ */
+static size_t
+append_request(uint8_t *out, uint32_t id, unsigned int op, unsigned int mode,
+               const uint8_t *payload, size_t len)
+{
+    out[0] = (uint8_t) id;
+    out[1] = (uint8_t) (id >> 8);
+    out[2] = (uint8_t) (id >> 16);
+    out[3] = (uint8_t) (id >> 24);
+    out[4] = (uint8_t) op;
+    out[5] = (uint8_t) mode;
+    out[6] = (uint8_t) len;
+    out[7] = (uint8_t) (len >> 8);
+    memcpy(out + HEADER_BYTES, payload, len);
+    return HEADER_BYTES + len;
+}
+
+/**
+ * new_address fills a slot with a random address, alternating IPv4-mapped and IPv6 addresses.
+ */
+static void
+new_address(Client *client, Slot *slot)
+{
+    size_t i;
+
+    for (i = 0; i < 16; i++) {
+        client->seed = client->seed * 1103515245U + 12345U;
+        slot->ip16[i] = (uint8_t) (client->seed >> 16);
+    }
+    if (client->seed & 0x100) {
+        memset(slot->ip16, 0, 10);
+        slot->ip16[10] = slot->ip16[11] = 0xff;
+    }
+}
+
+static void *
+client_run(void *client_)
+{
+    Client *const        client = (Client *) client_;
+    const Options *const opts   = client->opts;
+    Slot                *slots;
+    uint8_t              in[65536], out[MAX_WINDOW * 48];
+    size_t               in_len = 0, out_len, pos, len, i;
+    uint64_t             sent = 0, elapsed;
+    uint32_t             id;
+    unsigned int         b;
+    ssize_t              n;
+    int                  fd;
+
+    if ((fd = connect_to(opts->socket_path)) == -1 ||
+        (slots = (Slot *) calloc(opts->window, sizeof *slots)) == NULL) {
+        fprintf(stderr, "%s: %s\n", opts->socket_path, strerror(errno));
+        exit(1);
+    }
+    // Ids are (slot << 1) | direction.
+    out_len = 0;
+    for (i = 0; i < opts->window && sent < opts->requests; i++, sent++) {
+        new_address(client, &slots[i]);
+        slots[i].sent_ns = now_ns();
+        out_len += append_request(out + out_len, (uint32_t) (i << 1), OP_ENCRYPT, opts->mode,
+                                  slots[i].ip16, 16);
+    }
+    while (client->round_trips < opts->requests) {
+        if (out_len > 0 && write_all(fd, out, out_len) != 0) {
+            break;
+        }
+        out_len = 0;
+        if ((n = read(fd, in + in_len, sizeof in - in_len)) <= 0) {
+            break;
+        }
+        in_len += (size_t) n;
+        for (pos = 0; in_len - pos >= HEADER_BYTES; pos += HEADER_BYTES + len) {
+            len = (size_t) in[pos + 6] | ((size_t) in[pos + 7] << 8);
+            if (in_len - pos < HEADER_BYTES + len) {
+                break;
+            }
+            id = (uint32_t) in[pos] | ((uint32_t) in[pos + 1] << 8) |
+                 ((uint32_t) in[pos + 2] << 16) | ((uint32_t) in[pos + 3] << 24);
+            i  = id >> 1;
+            if (i >= opts->window) {
+                goto done;
+            }
+            if ((id & 1) == OP_ENCRYPT && in[pos + 4] == 0) {
+                out_len += append_request(out + out_len, id | OP_DECRYPT, OP_DECRYPT, opts->mode,
+                                          in + pos + HEADER_BYTES, len);
+                continue;
+            }
+            elapsed = now_ns() - slots[i].sent_ns;
+            for (b = 0; b < HIST_BUCKETS - 1 && (elapsed >> (b + 1)) != 0; b++) {
+            }
+            client->latency[b]++;
+            client->round_trips++;
+            if (in[pos + 4] != 0 || len != 16 ||
+                memcmp(in + pos + HEADER_BYTES, slots[i].ip16, 16) != 0) {
+                client->errors++;
+            }
+            if (sent < opts->requests) {
+                new_address(client, &slots[i]);
+                slots[i].sent_ns = now_ns();
+                out_len += append_request(out + out_len, id & ~1U, OP_ENCRYPT, opts->mode,
+                                          slots[i].ip16, 16);
+                sent++;
+            }
+        }
+        memmove(in, in + pos, in_len - pos);
+        in_len -= pos;
+    }
+done:
+    client->errors += opts->requests - client->round_trips;
+    free(slots);
+    close(fd);
+
+    return NULL;
+}
+
+static double
+percentile_us(const uint64_t *hist, uint64_t count, double q)
+{
+    const uint64_t target = (uint64_t) ((double) count * q);
+    uint64_t       seen   = 0;
+    unsigned int   i;
+
+    for (i = 0; i < HIST_BUCKETS - 1; i++) {
+        seen += hist[i];
+        if (seen > target) {
+            break;
+        }
+    }
+    return (double) (((uint64_t) 2 << i) - 1) / 1e3;
+}
+
+/**
+ * print_server_stats requests the statistics of the service, and prints them.
+ */
+static void
+print_server_stats(const char *path)
+{
+    static uint8_t buf[HEADER_BYTES + 65535];
+    uint8_t        request[HEADER_BYTES];
+    size_t         got = 0, len;
+    ssize_t        n;
+    int            fd;
+
+    if ((fd = connect_to(path)) == -1) {
+        return;
+    }
+    append_request(request, 0, OP_STATS, 0, NULL, 0);
+    if (write_all(fd, request, sizeof request) == 0) {
+        while ((got < HEADER_BYTES ||
+                got < HEADER_BYTES + ((size_t) buf[6] | ((size_t) buf[7] << 8))) &&
+               (n = read(fd, buf + got, sizeof buf - got)) > 0) {
+            got += (size_t) n;
+        }
+        if (got >= HEADER_BYTES) {
+            len = (size_t) buf[6] | ((size_t) buf[7] << 8);
+            if (len > got - HEADER_BYTES) {
+                len = got - HEADER_BYTES;
+            }
+            printf("\nService statistics:\n%.*s", (int) len, (const char *) buf + HEADER_BYTES);
+        }
+    }
+    close(fd);
+}
+
+static int
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s --socket PATH [--mode deterministic|pfx|nd|ndx] [--threads N]\n"
+            "       [--requests N] [--window N]\n",
+            prog);
+    return 1;
+}
+
+static int
+parse_options(Options *opts, int argc, char *argv[])
+{
+    int arg;
+
+    opts->socket_path = NULL;
+    opts->mode        = 0;
+    opts->threads     = 4;
+    opts->requests    = 100000;
+    opts->window      = 1;
+    for (arg = 1; arg < argc; arg++) {
+        if (arg + 1 >= argc) {
+            return -1;
+        }
+        if (strcmp(argv[arg], "--socket") == 0) {
+            opts->socket_path = argv[++arg];
+        } else if (strcmp(argv[arg], "--threads") == 0) {
+            opts->threads = (unsigned int) strtoul(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "--requests") == 0) {
+            opts->requests = strtoull(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "--window") == 0) {
+            opts->window = (size_t) strtoul(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "--mode") == 0) {
+            arg++;
+            for (opts->mode = 0; opts->mode < 4; opts->mode++) {
+                if (strcmp(argv[arg], mode_names[opts->mode]) == 0) {
+                    break;
+                }
+            }
+            if (opts->mode == 4) {
+                return -1;
+            }
+        } else {
+            return -1;
+        }
+    }
+    if (opts->socket_path == NULL || opts->threads == 0 || opts->window == 0 ||
+        opts->window > MAX_WINDOW) {
+        return -1;
+    }
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    Options  opts;
+    Client  *clients;
+    uint64_t latency[HIST_BUCKETS] = { 0 };
+    uint64_t round_trips = 0, errors = 0, t0, elapsed;
+    size_t   i, j;
+
+    if (parse_options(&opts, argc, argv) != 0) {
+        return usage(argv[0]);
+    }
+    if ((clients = (Client *) calloc(opts.threads, sizeof *clients)) == NULL) {
+        return 1;
+    }
+    t0 = now_ns();
+    for (i = 0; i < opts.threads; i++) {
+        clients[i].opts = &opts;
+        clients[i].seed = (uint32_t) (i * 2654435761U + 1);
+        if (pthread_create(&clients[i].thread, NULL, client_run, &clients[i]) != 0) {
+            fprintf(stderr, "Unable to create a thread\n");
+            return 1;
+        }
+    }
+    for (i = 0; i < opts.threads; i++) {
+        pthread_join(clients[i].thread, NULL);
+        for (j = 0; j < HIST_BUCKETS; j++) {
+            latency[j] += clients[i].latency[j];
+        }
+        round_trips += clients[i].round_trips;
+        errors += clients[i].errors;
+    }
+    elapsed = now_ns() - t0;
+
+    printf("%s: %u clients, window %zu: %llu round trips (2 requests each) in %.2f s, "
+           "%.0f requests/s\n",
+           mode_names[opts.mode], opts.threads, opts.window, (unsigned long long) round_trips,
+           (double) elapsed / 1e9, 2.0 * (double) round_trips / ((double) elapsed / 1e9));
+    printf("Round trip latency: p50 %.1f us, p99 %.1f us, p99.9 %.1f us\n",
+           percentile_us(latency, round_trips, 0.5), percentile_us(latency, round_trips, 0.99),
+           percentile_us(latency, round_trips, 0.999));
+    print_server_stats(opts.socket_path);
+    free(clients);
+    if (errors != 0) {
+        fprintf(stderr, "%llu errors\n", (unsigned long long) errors);
+        return 1;
+    }
+    return 0;
+}
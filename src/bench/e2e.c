@@ -0,0 +1,754 @@
+/**
+ * End-to-end anonymization benchmark.
+ *
+ * Generates a synthetic corpus resembling real traffic: hosts are drawn from a Zipf distribution,
+ * IPv4 hosts are clustered in /24 networks, IPv6 hosts in /48 networks, and each address is
+ * embedded in an access log line.
+ *
+ * For every mode, the corpus is processed through two paths:
+ * - string: parse the address at the start of each log line, encrypt it, and format the output
+ *   line with the encrypted address;
+ * - binary: encrypt 16-byte addresses and write the result to an output buffer.
+ *
+ * Each combination is run with an increasing number of threads, and the harness reports the
+ * number of lines (or addresses) per second, bytes per second, and the median and 99th
+ * percentile latency of individual operations.
+ *
+ * Results can be saved as JSON lines with --save, and compared with a previously saved file with
+ * --baseline. The exit status is 2 if throughput dropped by more than the tolerance.
+ *
+ * Usage: bench-e2e [options]
+ *   --lines N          number of log lines (default: 200000)
+ *   --hosts N          number of distinct hosts (default: 50000)
+ *   --zipf S           exponent of the Zipf distribution (default: 1.1)
+ *   --ipv6-ratio R     fraction of IPv6 hosts (default: 0.3)
+ *   --threads N        maximum number of threads (default: number of CPUs)
+ *   --mode M           only run one mode (deterministic, pfx, nd, ndx)
+ *   --json             print results as JSON lines
+ *   --save FILE        save results to FILE
+ *   --baseline FILE    compare results with FILE
+ *   --tolerance T      maximum accepted throughput drop (default: 0.10)
+ */
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "ipcrypt2.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#    include <x86intrin.h>
+#    define HAVE_TSC 1
+#endif
+
+/** Every LATENCY_SAMPLE_RATE-th operation is timed individually. */
+#define LATENCY_SAMPLE_RATE 16
+
+/** Size of the per-thread output buffer. It is reused once full. */
+#define OUTPUT_BYTES 65536
+
+/** Longest log line generated by the corpus generator. */
+#define MAX_LINE_BYTES 256
+
+#define MODES 4
+
+enum { MODE_DETERMINISTIC, MODE_PFX, MODE_ND, MODE_NDX };
+
+enum { PATH_STRING, PATH_BINARY };
+
+static const char *const mode_names[MODES] = { "deterministic", "pfx", "nd", "ndx" };
+static const char *const path_names[2]     = { "string", "binary" };
+
+typedef struct Corpus {
+    char    *text;
+    size_t  *line_offsets;
+    size_t   lines_count;
+    size_t   text_len;
+    uint8_t (*ip16)[16];
+} Corpus;
+
+typedef struct Contexts {
+    IPCrypt    ipcrypt;
+    IPCryptPFX ipcrypt_pfx;
+    IPCryptNDX ipcrypt_ndx;
+} Contexts;
+
+typedef struct Worker {
+    const Corpus   *corpus;
+    const Contexts *contexts;
+    int             mode;
+    int             path;
+    size_t          begin;
+    size_t          end;
+    double         *latencies;
+    size_t          latencies_count;
+    uint64_t        rng;
+    size_t          output_len;
+    size_t          output_total;
+    pthread_t       thread;
+    char            output[OUTPUT_BYTES];
+} Worker;
+
+typedef struct Result {
+    char   mode[16];
+    char   path[8];
+    size_t threads;
+    double ops_per_sec;
+    double bytes_per_sec;
+    double p50_ns;
+    double p99_ns;
+} Result;
+
+typedef struct Options {
+    size_t      lines;
+    size_t      hosts;
+    double      zipf;
+    double      ipv6_ratio;
+    size_t      max_threads;
+    int         mode;
+    int         json;
+    const char *save;
+    const char *baseline;
+    double      tolerance;
+} Options;
+
+/** Overhead of a pair of tick readings, subtracted from the latency samples, in ticks. */
+static double timer_overhead;
+
+/** Duration of a tick, in seconds. */
+static double tick_seconds = 1e-9;
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    timespec_get(&ts, TIME_UTC);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+/**
+ * High-resolution timer for the latency samples.
+ * The system clock can have a coarse resolution on virtual machines, so the TSC is used on x86.
+ */
+static uint64_t
+ticks(void)
+{
+#ifdef HAVE_TSC
+    return (uint64_t) __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000U + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+static uint64_t
+rnd64(uint64_t *x)
+{
+    *x ^= *x >> 12;
+    *x ^= *x << 25;
+    *x ^= *x >> 27;
+    return *x * 0x2545f4914f6cdd1dULL;
+}
+
+static double
+rnd_unit(uint64_t *x)
+{
+    return (double) (rnd64(x) >> 11) / 9007199254740992.0;
+}
+
+static void
+calibrate_timer(void)
+{
+    double   t0;
+    uint64_t c0, c1;
+    int      i;
+
+#ifdef HAVE_TSC
+    t0 = now();
+    c0 = ticks();
+    while (now() - t0 < 0.05) {
+    }
+    tick_seconds = (now() - t0) / (double) (ticks() - c0);
+#endif
+    timer_overhead = 1e9;
+    for (i = 0; i < 1000; i++) {
+        c0 = ticks();
+        c1 = ticks();
+        if ((double) (c1 - c0) < timer_overhead) {
+            timer_overhead = (double) (c1 - c0);
+        }
+    }
+}
+
+/**
+ * Generate the hosts, clustered in networks, then the log lines, with hosts drawn from a Zipf
+ * distribution. Host ranks are independent from networks, so popular hosts are spread across
+ * networks, as in real traffic.
+ */
+static int
+corpus_generate(Corpus *corpus, const Options *opts)
+{
+    static const char *const methods[]  = { "GET", "GET", "GET", "POST", "HEAD" };
+    static const char *const paths[]    = { "/", "/index.html", "/api/v1/items", "/login",
+                                            "/static/app.js", "/favicon.ico" };
+    static const int         statuses[] = { 200, 200, 200, 304, 404, 500 };
+    const size_t             networks_count = opts->hosts / 64 + 1;
+    uint8_t (*hosts)[16];
+    uint8_t (*networks)[16];
+    double  *cdf;
+    double   sum = 0.0, u;
+    char     ip_str[IPCRYPT_MAX_IP_STR_BYTES];
+    size_t   i, lo, hi, mid;
+    size_t   pos = 0;
+    uint64_t x   = 0x9e3779b97f4a7c15ULL;
+    int      len;
+
+    hosts    = malloc(opts->hosts * sizeof *hosts);
+    networks = malloc(networks_count * sizeof *networks);
+    cdf      = malloc(opts->hosts * sizeof *cdf);
+    corpus->text         = malloc(opts->lines * MAX_LINE_BYTES);
+    corpus->line_offsets = malloc((opts->lines + 1) * sizeof *corpus->line_offsets);
+    corpus->ip16         = malloc(opts->lines * sizeof *corpus->ip16);
+    if (hosts == NULL || networks == NULL || cdf == NULL || corpus->text == NULL ||
+        corpus->line_offsets == NULL || corpus->ip16 == NULL) {
+        return -1;
+    }
+
+    for (i = 0; i < networks_count; i++) {
+        memset(networks[i], 0, 16);
+        if (rnd_unit(&x) < opts->ipv6_ratio) {
+            // Global unicast /48 prefixes, under 2001::/16 and 20a0::/16.
+            networks[i][0] = 0x20;
+            networks[i][1] = (uint8_t) (rnd64(&x) & 1 ? 0x01 : 0xa0);
+            networks[i][2] = (uint8_t) rnd64(&x);
+            networks[i][3] = (uint8_t) rnd64(&x);
+            networks[i][4] = (uint8_t) rnd64(&x);
+            networks[i][5] = (uint8_t) rnd64(&x);
+        } else {
+            networks[i][10] = 0xff;
+            networks[i][11] = 0xff;
+            networks[i][12] = (uint8_t) (1 + rnd64(&x) % 223);
+            networks[i][13] = (uint8_t) rnd64(&x);
+            networks[i][14] = (uint8_t) rnd64(&x);
+        }
+    }
+    for (i = 0; i < opts->hosts; i++) {
+        const uint8_t *network = networks[rnd64(&x) % networks_count];
+
+        memcpy(hosts[i], network, 16);
+        if (network[10] == 0xff) {
+            hosts[i][15] = (uint8_t) (1 + rnd64(&x) % 254);
+        } else {
+            // A few subnets per network, with mostly random interface identifiers.
+            hosts[i][7] = (uint8_t) (rnd64(&x) % 4);
+            for (mid = 8; mid < 16; mid++) {
+                hosts[i][mid] = (uint8_t) rnd64(&x);
+            }
+        }
+        sum += 1.0 / pow((double) (i + 1), opts->zipf);
+        cdf[i] = sum;
+    }
+
+    for (i = 0; i < opts->lines; i++) {
+        u  = rnd_unit(&x) * sum;
+        lo = 0;
+        hi = opts->hosts - 1;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (cdf[mid] < u) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        memcpy(corpus->ip16[i], hosts[lo], 16);
+        ipcrypt_ip16_to_str(ip_str, hosts[lo]);
+        corpus->line_offsets[i] = pos;
+        len = snprintf(&corpus->text[pos], MAX_LINE_BYTES,
+                       "%s - - [18/Oct/2026:12:%02u:%02u +0000] \"%s %s HTTP/1.1\" %d %u \"-\" "
+                       "\"Mozilla/5.0\"\n",
+                       ip_str, (unsigned int) (i / 60 % 60), (unsigned int) (i % 60),
+                       methods[rnd64(&x) % (sizeof methods / sizeof methods[0])],
+                       paths[rnd64(&x) % (sizeof paths / sizeof paths[0])],
+                       statuses[rnd64(&x) % (sizeof statuses / sizeof statuses[0])],
+                       (unsigned int) (rnd64(&x) % 100000));
+        if (len <= 0 || len >= MAX_LINE_BYTES) {
+            return -1;
+        }
+        pos += (size_t) len;
+    }
+    corpus->line_offsets[opts->lines] = pos;
+    corpus->lines_count               = opts->lines;
+    corpus->text_len                  = pos;
+
+    free(cdf);
+    free(networks);
+    free(hosts);
+
+    return 0;
+}
+
+static void
+corpus_free(Corpus *corpus)
+{
+    free(corpus->text);
+    free(corpus->line_offsets);
+    free(corpus->ip16);
+}
+
+static void
+output_append(Worker *w, const void *data, size_t len)
+{
+    if (w->output_len + len > sizeof w->output) {
+        w->output_len = 0;
+    }
+    memcpy(&w->output[w->output_len], data, len);
+    w->output_len += len;
+    w->output_total += len;
+}
+
+/**
+ * Fill a tweak for the non-deterministic modes. Applications must use a secure random number
+ * generator; a fast one is used here so that the benchmark measures ipcrypt itself.
+ */
+static void
+fill_tweak(Worker *w, uint8_t *tweak, size_t len)
+{
+    uint64_t r = 0;
+    size_t   i;
+
+    for (i = 0; i < len; i++) {
+        if (i % 8 == 0) {
+            r = rnd64(&w->rng);
+        }
+        tweak[i] = (uint8_t) (r >> (8 * (i % 8)));
+    }
+}
+
+/**
+ * Parse the address at the start of a log line, encrypt it, and write the output line.
+ */
+static void
+process_line(Worker *w, size_t i)
+{
+    const char *line = &w->corpus->text[w->corpus->line_offsets[i]];
+    const size_t line_len = w->corpus->line_offsets[i + 1] - w->corpus->line_offsets[i];
+    const char  *space    = memchr(line, ' ', line_len);
+    char         ip_str[IPCRYPT_MAX_IP_STR_BYTES];
+    char         encrypted[IPCRYPT_NDX_NDIP_STR_BYTES];
+    uint8_t      tweak[IPCRYPT_NDX_TWEAKBYTES];
+    size_t       ip_len, encrypted_len = 0;
+
+    if (space == NULL || (ip_len = (size_t) (space - line)) >= sizeof ip_str) {
+        output_append(w, line, line_len);
+        return;
+    }
+    memcpy(ip_str, line, ip_len);
+    ip_str[ip_len] = 0;
+    switch (w->mode) {
+    case MODE_DETERMINISTIC:
+        encrypted_len = ipcrypt_encrypt_ip_str(&w->contexts->ipcrypt, encrypted, ip_str);
+        break;
+    case MODE_PFX:
+        encrypted_len = ipcrypt_pfx_encrypt_ip_str(&w->contexts->ipcrypt_pfx, encrypted, ip_str);
+        break;
+    case MODE_ND:
+        fill_tweak(w, tweak, IPCRYPT_TWEAKBYTES);
+        encrypted_len = ipcrypt_nd_encrypt_ip_str(&w->contexts->ipcrypt, encrypted, ip_str, tweak);
+        break;
+    case MODE_NDX:
+        fill_tweak(w, tweak, IPCRYPT_NDX_TWEAKBYTES);
+        encrypted_len =
+            ipcrypt_ndx_encrypt_ip_str(&w->contexts->ipcrypt_ndx, encrypted, ip_str, tweak);
+        break;
+    }
+    output_append(w, encrypted, encrypted_len);
+    output_append(w, space, line_len - ip_len);
+}
+
+/**
+ * Encrypt a 16-byte address, and write the ciphertext.
+ */
+static void
+process_ip16(Worker *w, size_t i)
+{
+    uint8_t out[IPCRYPT_NDX_NDIP_BYTES];
+    uint8_t tweak[IPCRYPT_NDX_TWEAKBYTES];
+    size_t  out_len = 16;
+
+    switch (w->mode) {
+    case MODE_DETERMINISTIC:
+        memcpy(out, w->corpus->ip16[i], 16);
+        ipcrypt_encrypt_ip16(&w->contexts->ipcrypt, out);
+        break;
+    case MODE_PFX:
+        memcpy(out, w->corpus->ip16[i], 16);
+        ipcrypt_pfx_encrypt_ip16(&w->contexts->ipcrypt_pfx, out);
+        break;
+    case MODE_ND:
+        fill_tweak(w, tweak, IPCRYPT_TWEAKBYTES);
+        ipcrypt_nd_encrypt_ip16(&w->contexts->ipcrypt, out, w->corpus->ip16[i], tweak);
+        out_len = IPCRYPT_NDIP_BYTES;
+        break;
+    case MODE_NDX:
+        fill_tweak(w, tweak, IPCRYPT_NDX_TWEAKBYTES);
+        ipcrypt_ndx_encrypt_ip16(&w->contexts->ipcrypt_ndx, out, w->corpus->ip16[i], tweak);
+        out_len = IPCRYPT_NDX_NDIP_BYTES;
+        break;
+    }
+    output_append(w, out, out_len);
+}
+
+static void *
+worker_run(void *arg)
+{
+    Worker  *w = (Worker *) arg;
+    uint64_t c0;
+    double   latency;
+    size_t   i;
+
+    w->latencies_count = 0;
+    for (i = w->begin; i < w->end; i++) {
+        if (i % LATENCY_SAMPLE_RATE != 0) {
+            if (w->path == PATH_STRING) {
+                process_line(w, i);
+            } else {
+                process_ip16(w, i);
+            }
+            continue;
+        }
+        c0 = ticks();
+        if (w->path == PATH_STRING) {
+            process_line(w, i);
+        } else {
+            process_ip16(w, i);
+        }
+        latency = ((double) (ticks() - c0) - timer_overhead) * tick_seconds;
+        w->latencies[w->latencies_count++] = latency > 0.0 ? latency : 0.0;
+    }
+    return NULL;
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    const double x = *(const double *) a;
+    const double y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+static double
+percentile(const double *sorted, size_t count, double p)
+{
+    size_t i;
+
+    if (count == 0) {
+        return 0.0;
+    }
+    i = (size_t) (p * (double) (count - 1) + 0.5);
+    return sorted[i];
+}
+
+/**
+ * Process the whole corpus with `threads` threads, each one taking a contiguous share of lines.
+ */
+static int
+run(const Corpus *corpus, const Contexts *contexts, int mode, int path, size_t threads,
+    Result *result)
+{
+    Worker *workers;
+    double *latencies;
+    double  t0, elapsed;
+    size_t  share = (corpus->lines_count + threads - 1) / threads;
+    size_t  latencies_count = 0;
+    size_t  bytes = 0;
+    size_t  i;
+
+    workers   = calloc(threads, sizeof *workers);
+    latencies = malloc((corpus->lines_count / LATENCY_SAMPLE_RATE + threads) * sizeof *latencies);
+    if (workers == NULL || latencies == NULL) {
+        free(workers);
+        free(latencies);
+        return -1;
+    }
+    for (i = 0; i < threads; i++) {
+        workers[i].corpus   = corpus;
+        workers[i].contexts = contexts;
+        workers[i].mode     = mode;
+        workers[i].path     = path;
+        workers[i].begin    = i * share < corpus->lines_count ? i * share : corpus->lines_count;
+        workers[i].end      = workers[i].begin + share < corpus->lines_count
+                                  ? workers[i].begin + share
+                                  : corpus->lines_count;
+        workers[i].rng      = 0x243f6a8885a308d3ULL + i;
+        workers[i].latencies = &latencies[latencies_count];
+        latencies_count += (workers[i].end - workers[i].begin) / LATENCY_SAMPLE_RATE + 1;
+    }
+
+    t0 = now();
+    for (i = 1; i < threads; i++) {
+        if (pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]) != 0) {
+            return -1;
+        }
+    }
+    worker_run(&workers[0]);
+    for (i = 1; i < threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    elapsed = now() - t0;
+
+    // Gather the latency samples, which were written to disjoint ranges of the array.
+    latencies_count = 0;
+    for (i = 0; i < threads; i++) {
+        memmove(&latencies[latencies_count], workers[i].latencies,
+                workers[i].latencies_count * sizeof *latencies);
+        latencies_count += workers[i].latencies_count;
+    }
+    qsort(latencies, latencies_count, sizeof *latencies, cmp_double);
+
+    bytes = path == PATH_STRING ? corpus->text_len : corpus->lines_count * 16;
+    snprintf(result->mode, sizeof result->mode, "%s", mode_names[mode]);
+    snprintf(result->path, sizeof result->path, "%s", path_names[path]);
+    result->threads       = threads;
+    result->ops_per_sec   = (double) corpus->lines_count / elapsed;
+    result->bytes_per_sec = (double) bytes / elapsed;
+    result->p50_ns        = percentile(latencies, latencies_count, 0.50) * 1e9;
+    result->p99_ns        = percentile(latencies, latencies_count, 0.99) * 1e9;
+
+    free(latencies);
+    free(workers);
+
+    return 0;
+}
+
+static void
+result_print_json(FILE *fp, const Result *r)
+{
+    fprintf(fp,
+            "{\"mode\":\"%s\",\"path\":\"%s\",\"threads\":%zu,\"ops_per_sec\":%.0f,"
+            "\"bytes_per_sec\":%.0f,\"p50_ns\":%.1f,\"p99_ns\":%.1f}\n",
+            r->mode, r->path, r->threads, r->ops_per_sec, r->bytes_per_sec, r->p50_ns, r->p99_ns);
+}
+
+/**
+ * Parse a line written by result_print_json(). Returns 0 on success.
+ */
+static int
+result_parse_json(const char *line, Result *r)
+{
+    if (sscanf(line,
+               "{\"mode\":\"%15[^\"]\",\"path\":\"%7[^\"]\",\"threads\":%zu,\"ops_per_sec\":%lf,"
+               "\"bytes_per_sec\":%lf,\"p50_ns\":%lf,\"p99_ns\":%lf}",
+               r->mode, r->path, &r->threads, &r->ops_per_sec, &r->bytes_per_sec, &r->p50_ns,
+               &r->p99_ns) != 7) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Compare results with a baseline file. Returns the number of regressions.
+ */
+static size_t
+compare_baseline(const char *file, const Result *results, size_t results_count, double tolerance)
+{
+    FILE  *fp;
+    Result base;
+    char   line[512];
+    double change;
+    size_t regressions = 0;
+    size_t i;
+
+    if ((fp = fopen(file, "r")) == NULL) {
+        fprintf(stderr, "Unable to open the baseline file [%s]\n", file);
+        return 1;
+    }
+    printf("\n%-14s %-7s %7s %14s %14s %8s\n", "mode", "path", "threads", "ops/s", "baseline",
+           "change");
+    while (fgets(line, sizeof line, fp) != NULL) {
+        if (result_parse_json(line, &base) != 0) {
+            continue;
+        }
+        for (i = 0; i < results_count; i++) {
+            if (strcmp(results[i].mode, base.mode) != 0 ||
+                strcmp(results[i].path, base.path) != 0 || results[i].threads != base.threads) {
+                continue;
+            }
+            change = results[i].ops_per_sec / base.ops_per_sec - 1.0;
+            printf("%-14s %-7s %7zu %14.0f %14.0f %+7.1f%%%s\n", base.mode, base.path,
+                   base.threads, results[i].ops_per_sec, base.ops_per_sec, change * 100.0,
+                   change < -tolerance ? "  REGRESSION" : "");
+            regressions += change < -tolerance;
+        }
+    }
+    fclose(fp);
+
+    return regressions;
+}
+
+static int
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [--lines N] [--hosts N] [--zipf S] [--ipv6-ratio R] [--threads N]\n"
+            "       [--mode deterministic|pfx|nd|ndx] [--json] [--save FILE]\n"
+            "       [--baseline FILE] [--tolerance T]\n",
+            prog);
+    return 1;
+}
+
+static int
+parse_options(Options *opts, int argc, char *argv[])
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int  arg;
+    int  mode;
+
+    opts->lines       = 200000;
+    opts->hosts       = 50000;
+    opts->zipf        = 1.1;
+    opts->ipv6_ratio  = 0.3;
+    opts->max_threads = cpus > 0 ? (size_t) cpus : 1;
+    opts->mode        = -1;
+    opts->json        = 0;
+    opts->save        = NULL;
+    opts->baseline    = NULL;
+    opts->tolerance   = 0.10;
+    for (arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "--json") == 0) {
+            opts->json = 1;
+            continue;
+        }
+        if (arg + 1 >= argc) {
+            return -1;
+        }
+        if (strcmp(argv[arg], "--lines") == 0) {
+            opts->lines = (size_t) strtoul(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "--hosts") == 0) {
+            opts->hosts = (size_t) strtoul(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "--zipf") == 0) {
+            opts->zipf = strtod(argv[++arg], NULL);
+        } else if (strcmp(argv[arg], "--ipv6-ratio") == 0) {
+            opts->ipv6_ratio = strtod(argv[++arg], NULL);
+        } else if (strcmp(argv[arg], "--threads") == 0) {
+            opts->max_threads = (size_t) strtoul(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "--mode") == 0) {
+            arg++;
+            for (mode = 0; mode < MODES; mode++) {
+                if (strcmp(argv[arg], mode_names[mode]) == 0) {
+                    opts->mode = mode;
+                }
+            }
+            if (opts->mode < 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[arg], "--save") == 0) {
+            opts->save = argv[++arg];
+        } else if (strcmp(argv[arg], "--baseline") == 0) {
+            opts->baseline = argv[++arg];
+        } else if (strcmp(argv[arg], "--tolerance") == 0) {
+            opts->tolerance = strtod(argv[++arg], NULL);
+        } else {
+            return -1;
+        }
+    }
+    if (opts->lines == 0 || opts->hosts == 0 || opts->max_threads == 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static Contexts contexts;
+    const uint8_t   key[IPCRYPT_NDX_KEYBYTES] = { 0 };
+    Options         opts;
+    Corpus          corpus;
+    Result         *results;
+    FILE           *save_fp = NULL;
+    size_t          results_count = 0;
+    size_t          threads;
+    int             mode, path;
+
+    if (parse_options(&opts, argc, argv) != 0) {
+        return usage(argv[0]);
+    }
+    calibrate_timer();
+    memset(&corpus, 0, sizeof corpus);
+    if (corpus_generate(&corpus, &opts) != 0 ||
+        (results = malloc(MODES * 2 * 64 * sizeof *results)) == NULL) {
+        fprintf(stderr, "Unable to generate the corpus\n");
+        return 1;
+    }
+    ipcrypt_init(&contexts.ipcrypt, key);
+    ipcrypt_pfx_init(&contexts.ipcrypt_pfx, key);
+    ipcrypt_ndx_init(&contexts.ipcrypt_ndx, key);
+    if (opts.save != NULL && (save_fp = fopen(opts.save, "w")) == NULL) {
+        fprintf(stderr, "Unable to create [%s]\n", opts.save);
+        return 1;
+    }
+
+    if (!opts.json) {
+        printf("corpus: %zu lines, %zu bytes, %zu hosts, zipf %.2f, %.0f%% IPv6 networks\n\n",
+               corpus.lines_count, corpus.text_len, opts.hosts, opts.zipf,
+               opts.ipv6_ratio * 100.0);
+        printf("%-14s %-7s %7s %14s %14s %10s %10s\n", "mode", "path", "threads", "ops/s",
+               "bytes/s", "p50 (ns)", "p99 (ns)");
+    }
+    for (mode = 0; mode < MODES; mode++) {
+        if (opts.mode >= 0 && mode != opts.mode) {
+            continue;
+        }
+        for (path = PATH_STRING; path <= PATH_BINARY; path++) {
+            // 1, 2, 4, ... threads, and the maximum number of threads.
+            for (threads = 1; results_count < MODES * 2 * 64; threads *= 2) {
+                if (threads > opts.max_threads) {
+                    threads = opts.max_threads;
+                }
+                if (run(&corpus, &contexts, mode, path, threads, &results[results_count]) != 0) {
+                    fprintf(stderr, "Unable to start the benchmark threads\n");
+                    return 1;
+                }
+                if (opts.json) {
+                    result_print_json(stdout, &results[results_count]);
+                } else {
+                    const Result *r = &results[results_count];
+
+                    printf("%-14s %-7s %7zu %14.0f %14.0f %10.1f %10.1f\n", r->mode, r->path,
+                           r->threads, r->ops_per_sec, r->bytes_per_sec, r->p50_ns, r->p99_ns);
+                }
+                fflush(stdout);
+                if (save_fp != NULL) {
+                    result_print_json(save_fp, &results[results_count]);
+                }
+                results_count++;
+                if (threads == opts.max_threads) {
+                    break;
+                }
+            }
+        }
+    }
+    if (save_fp != NULL) {
+        fclose(save_fp);
+    }
+    if (opts.baseline != NULL &&
+        compare_baseline(opts.baseline, results, results_count, opts.tolerance) > 0) {
+        return 2;
+    }
+    free(results);
+    corpus_free(&corpus);
+
+    return 0;
+}
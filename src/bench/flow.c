@@ -0,0 +1,184 @@
+/**
+ * NetFlow v9 and IPFIX anonymizer benchmark.
+ *
+ * Generates synthetic IPFIX messages resembling the output of a flow exporter: an IPv4 template
+ * and an IPv6 template, both with the usual 5-tuple, counters, timestamps and next hop, followed
+ * by data messages filled with records of both templates. The messages are anonymized with the
+ * PFX mode, on a single thread, and the number of flow records per second is reported.
+ *
+ * Usage: bench-flow [packets]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ipcrypt2_flow.h"
+
+#define DEFAULT_PACKETS 200000U
+#define PACKET_BYTES    1400U
+#define ROUNDS          3
+
+typedef struct Field {
+    uint16_t id;
+    uint16_t len;
+} Field;
+
+static const Field ipv4_fields[] = { { 8, 4 },   { 12, 4 },  { 7, 2 }, { 11, 2 }, { 4, 1 },
+                                     { 1, 8 },   { 2, 8 },   { 152, 8 }, { 153, 8 }, { 15, 4 } };
+static const Field ipv6_fields[] = { { 27, 16 }, { 28, 16 }, { 7, 2 }, { 11, 2 }, { 4, 1 },
+                                     { 1, 8 },   { 2, 8 },   { 152, 8 }, { 153, 8 }, { 62, 16 } };
+
+#define FIELDS_COUNT (sizeof ipv4_fields / sizeof ipv4_fields[0])
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    timespec_get(&ts, TIME_UTC);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static size_t
+put16(uint8_t *p, size_t v)
+{
+    p[0] = (uint8_t) (v >> 8);
+    p[1] = (uint8_t) v;
+    return 2;
+}
+
+static size_t
+put32(uint8_t *p, uint32_t v)
+{
+    put16(p, v >> 16);
+    put16(p + 2, v & 0xffff);
+    return 4;
+}
+
+static size_t
+header(uint8_t *p, uint32_t seq)
+{
+    size_t n = 0;
+
+    n += put16(p + n, 10);
+    n += put16(p + n, 0);
+    n += put32(p + n, 1700000000U);
+    n += put32(p + n, seq);
+    n += put32(p + n, 1);
+    return n;
+}
+
+/**
+ * template_message writes a message with the templates 256 (IPv4) and 257 (IPv6).
+ */
+static size_t
+template_message(uint8_t *p)
+{
+    const Field *fields;
+    size_t       n = header(p, 0), set, i, t;
+
+    set = n;
+    n += put16(p + n, 2);
+    n += put16(p + n, 0);
+    for (t = 0; t < 2; t++) {
+        fields = t == 0 ? ipv4_fields : ipv6_fields;
+        n += put16(p + n, 256 + t);
+        n += put16(p + n, FIELDS_COUNT);
+        for (i = 0; i < FIELDS_COUNT; i++) {
+            n += put16(p + n, fields[i].id);
+            n += put16(p + n, fields[i].len);
+        }
+    }
+    put16(p + set + 2, n - set);
+    put16(p + 2, n);
+    return n;
+}
+
+/**
+ * data_message writes a message filled with records of the template `id`, and returns its
+ * length. `records` is set to the number of records.
+ */
+static size_t
+data_message(uint8_t *p, uint32_t seq, unsigned int id, uint32_t *x, size_t *records)
+{
+    const Field *fields = id == 256 ? ipv4_fields : ipv6_fields;
+    size_t       n      = header(p, seq), set, record_len = 0, i, j;
+
+    for (i = 0; i < FIELDS_COUNT; i++) {
+        record_len += fields[i].len;
+    }
+    set = n;
+    n += put16(p + n, id);
+    n += put16(p + n, 0);
+    for (*records = 0; n + record_len <= PACKET_BYTES; (*records)++) {
+        for (j = 0; j < record_len; j++) {
+            *x ^= *x << 13;
+            *x ^= *x >> 17;
+            *x ^= *x << 5;
+            p[n++] = (uint8_t) *x;
+        }
+    }
+    put16(p + set + 2, n - set);
+    put16(p + 2, n);
+    return n;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const uint8_t key[IPCRYPT_PFX_KEYBYTES] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+    IPCryptFlowStats     stats;
+    IPCryptFlow         *flow;
+    uint8_t              templates[PACKET_BYTES];
+    uint8_t             *packets;
+    size_t              *lengths;
+    size_t               count = DEFAULT_PACKETS, records = 0, n, i, templates_len;
+    uint32_t             x     = 0x9e3779b9;
+    double               t0, elapsed, best;
+    int                  round;
+
+    if (argc > 1) {
+        count = (size_t) strtoul(argv[1], NULL, 10);
+    }
+    packets = (uint8_t *) malloc(count * PACKET_BYTES);
+    lengths = (size_t *) malloc(count * sizeof *lengths);
+    if (count == 0 || packets == NULL || lengths == NULL) {
+        return 1;
+    }
+    templates_len = template_message(templates);
+    for (i = 0; i < count; i++) {
+        lengths[i] = data_message(packets + i * PACKET_BYTES, (uint32_t) i + 1,
+                                  i % 4 == 3 ? 257U : 256U, &x, &n);
+        records += n;
+    }
+    printf("%zu messages, %zu flow records (1 in 4 messages with IPv6 records)\n\n", count,
+           records);
+
+    flow = ipcrypt_flow_create(IPCRYPT_MODE_PFX, key, sizeof key, 0);
+    if (flow == NULL || ipcrypt_flow_encrypt(flow, templates, templates_len, NULL) == 0) {
+        return 1;
+    }
+    best = 0.0;
+    for (round = 0; round < ROUNDS; round++) {
+        t0 = now();
+        for (i = 0; i < count; i++) {
+            (void) ipcrypt_flow_encrypt(flow, packets + i * PACKET_BYTES, lengths[i], NULL);
+        }
+        elapsed = now() - t0;
+        if (best == 0.0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    ipcrypt_flow_stats(flow, &stats);
+    printf("%-14s %10.0f flows/s %10.0f addresses/s %8.0f messages/s\n", "pfx",
+           (double) records / best, (double) stats.addresses / (double) ROUNDS / best,
+           (double) count / best);
+    ipcrypt_flow_destroy(flow);
+    free(packets);
+    free(lengths);
+
+    return 0;
+}
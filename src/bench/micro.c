@@ -0,0 +1,1045 @@
+/**
+ * Microbenchmarks for IPCrypt2.
+ *
+ * Measures every public function, with IPv4-mapped and IPv6 inputs, as well as the strided and
+ * multi-tenant batch functions for several batch sizes. Results are reported in ns/op, cycles/op
+ * and ops/s, either as a table, or with --json, as one JSON object per line.
+ *
+ * Cycles are TSC ticks, and are only reported on x86 and x86_64.
+ *
+ * The library and this file must both be compiled with -DIPCRYPT_SOFTAES to measure the portable
+ * software AES implementation instead of the hardware-accelerated one.
+ *
+ * Usage: bench-micro [--json] [--filter substring] [--min-time milliseconds]
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ipcrypt2.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#    ifdef _MSC_VER
+#        include <intrin.h>
+#    else
+#        include <x86intrin.h>
+#    endif
+#    define HAVE_TSC 1
+#endif
+
+#if defined(IPCRYPT_SOFTAES)
+#    define BACKEND "softaes"
+#elif defined(__aarch64__)
+#    define BACKEND "armcrypto"
+#elif defined(HAVE_TSC)
+#    define BACKEND "aesni"
+#else
+#    define BACKEND "softaes"
+#endif
+
+/** Number of distinct inputs cycled through by the single-address benchmarks. */
+#define INPUTS 256
+
+/** Largest batch size of the strided benchmarks. */
+#define MAX_BATCH 4096
+
+/** Number of tenants of the multi-tenant benchmarks. Records are assigned to random tenants. */
+#define TENANTS 1024
+
+/** Prefix lengths kept in the clear by the anchored PFX benchmarks. */
+#define ANCHOR_IPV4 16
+#define ANCHOR_IPV6 32
+
+/** Number of timed samples per benchmark. The median is reported. */
+#define SAMPLES 5
+
+/** Default minimum duration of a sample, in milliseconds. */
+#define DEFAULT_MIN_TIME_MS 20
+
+/** The benchmark runs once for IPv4-mapped inputs, and once for IPv6 inputs. */
+#define BENCH_PER_FAMILY 1U
+/** The benchmark runs for every batch size; an operation is a single address. */
+#define BENCH_BATCH 2U
+
+/**
+ * Records used by the strided benchmarks: a 16-byte tweak, followed by an address.
+ * Deterministic and PFX modes only process the address, ND mode processes the last 8 bytes of
+ * the tweak and the address, and NDX mode processes the whole record.
+ */
+typedef struct Record {
+    uint8_t tweak[IPCRYPT_NDX_TWEAKBYTES];
+    uint8_t ip16[16];
+} Record;
+
+/**
+ * Records used by the multi-tenant benchmarks: a record, followed by a tenant index.
+ */
+typedef struct TenantRecord {
+    Record   rec;
+    uint32_t tenant;
+} TenantRecord;
+
+typedef struct Fixture {
+    IPCrypt                 ipcrypt;
+    IPCryptPFX              ipcrypt_pfx;
+    IPCryptNDX              ipcrypt_ndx;
+    IPCryptNDSession        nd_session;
+    IPCryptNDXSession       ndx_session;
+    uint8_t                 key[IPCRYPT_PFX_KEYBYTES];
+    char                    key_hex[2 * IPCRYPT_PFX_KEYBYTES + 1];
+    uint8_t                 ip16[INPUTS][16];
+    char                    ip_str[INPUTS][IPCRYPT_MAX_IP_STR_BYTES];
+    char                    encrypted_str[INPUTS][IPCRYPT_MAX_IP_STR_BYTES];
+    char                    pfx_encrypted_str[INPUTS][IPCRYPT_MAX_IP_STR_BYTES];
+    uint8_t                 tweaks[INPUTS][IPCRYPT_NDX_TWEAKBYTES];
+    uint8_t                 ndip[INPUTS][IPCRYPT_NDIP_BYTES];
+    uint8_t                 ndx_ndip[INPUTS][IPCRYPT_NDX_NDIP_BYTES];
+    char                    nd_str[INPUTS][IPCRYPT_NDIP_STR_BYTES];
+    char                    ndx_str[INPUTS][IPCRYPT_NDX_NDIP_STR_BYTES];
+    struct sockaddr_storage sa[INPUTS];
+    Record                  records[MAX_BATCH];
+    TenantRecord            tenant_records[MAX_BATCH];
+    uint8_t                 tenant_keys[MAX_BATCH][IPCRYPT_PFX_KEYBYTES];
+    IPCrypt                 tenant_ipcrypt[MAX_BATCH];
+    IPCryptPFX              tenant_ipcrypt_pfx[MAX_BATCH];
+    IPCryptNDX              tenant_ipcrypt_ndx[MAX_BATCH];
+    size_t                  batch;
+} Fixture;
+
+typedef struct Bench {
+    const char *name;
+    void (*run)(Fixture *f, size_t iterations);
+    unsigned int flags;
+} Bench;
+
+typedef struct Options {
+    const char *filter;
+    double      min_time;
+    int         json;
+} Options;
+
+/** Results are accumulated here, so that the compiler can't remove the benchmarked calls. */
+static volatile size_t sink;
+
+static const size_t ip_offset[1]  = { offsetof(Record, ip16) };
+static const size_t nd_offset[1]  = { offsetof(Record, ip16) - IPCRYPT_TWEAKBYTES };
+static const size_t ndx_offset[1] = { 0 };
+
+#define TENANT_ARGS(field)                                                           \
+    f->tenant_records, f->batch, sizeof(TenantRecord), offsetof(TenantRecord, tenant), \
+        offsetof(TenantRecord, rec.field)
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    timespec_get(&ts, TIME_UTC);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static uint64_t
+ticks(void)
+{
+#ifdef HAVE_TSC
+    return (uint64_t) __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static uint32_t
+rnd(uint32_t *x)
+{
+    *x ^= *x << 13;
+    *x ^= *x >> 17;
+    *x ^= *x << 5;
+    return *x;
+}
+
+static void
+bench_init(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_init(&f->ipcrypt, f->key);
+    }
+}
+
+static void
+bench_pfx_init(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_pfx_init(&f->ipcrypt_pfx, f->key);
+    }
+}
+
+static void
+bench_ndx_init(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_ndx_init(&f->ipcrypt_ndx, f->key);
+    }
+}
+
+static void
+bench_key_from_hex(Fixture *f, size_t iterations)
+{
+    size_t i;
+    int    acc = 0;
+
+    for (i = 0; i < iterations; i++) {
+        acc += ipcrypt_key_from_hex(f->key, sizeof f->key, f->key_hex, strlen(f->key_hex));
+    }
+    sink += (size_t) acc;
+}
+
+static void
+bench_ndip_from_hex(Fixture *f, size_t iterations)
+{
+    uint8_t ndip[IPCRYPT_NDIP_BYTES];
+    size_t  i;
+    int     acc = 0;
+
+    for (i = 0; i < iterations; i++) {
+        acc += ipcrypt_ndip_from_hex(ndip, f->nd_str[i % INPUTS], 2 * IPCRYPT_NDIP_BYTES);
+    }
+    sink += (size_t) acc + ndip[0];
+}
+
+static void
+bench_ndx_ndip_from_hex(Fixture *f, size_t iterations)
+{
+    uint8_t ndip[IPCRYPT_NDX_NDIP_BYTES];
+    size_t  i;
+    int     acc = 0;
+
+    for (i = 0; i < iterations; i++) {
+        acc += ipcrypt_ndx_ndip_from_hex(ndip, f->ndx_str[i % INPUTS], 2 * IPCRYPT_NDX_NDIP_BYTES);
+    }
+    sink += (size_t) acc + ndip[0];
+}
+
+static void
+bench_str_to_ip16(Fixture *f, size_t iterations)
+{
+    uint8_t ip16[16];
+    size_t  i;
+    int     acc = 0;
+
+    for (i = 0; i < iterations; i++) {
+        acc += ipcrypt_str_to_ip16(ip16, f->ip_str[i % INPUTS]);
+    }
+    sink += (size_t) acc + ip16[15];
+}
+
+static void
+bench_ip16_to_str(Fixture *f, size_t iterations)
+{
+    char   ip_str[IPCRYPT_MAX_IP_STR_BYTES];
+    size_t i;
+    size_t acc = 0;
+
+    for (i = 0; i < iterations; i++) {
+        acc += ipcrypt_ip16_to_str(ip_str, f->ip16[i % INPUTS]);
+    }
+    sink += acc;
+}
+
+static void
+bench_sockaddr_to_ip16(Fixture *f, size_t iterations)
+{
+    uint8_t ip16[16];
+    size_t  i;
+    int     acc = 0;
+
+    for (i = 0; i < iterations; i++) {
+        acc += ipcrypt_sockaddr_to_ip16(ip16, (const struct sockaddr *) &f->sa[i % INPUTS]);
+    }
+    sink += (size_t) acc + ip16[15];
+}
+
+static void
+bench_ip16_to_sockaddr(Fixture *f, size_t iterations)
+{
+    struct sockaddr_storage sa;
+    size_t                  i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_ip16_to_sockaddr(&sa, f->ip16[i % INPUTS]);
+    }
+    sink += (size_t) sa.ss_family;
+}
+
+static void
+bench_encrypt_ip16(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_encrypt_ip16(&f->ipcrypt, f->ip16[i % INPUTS]);
+    }
+}
+
+static void
+bench_decrypt_ip16(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_decrypt_ip16(&f->ipcrypt, f->ip16[i % INPUTS]);
+    }
+}
+
+static void
+bench_encrypt_ip_str(Fixture *f, size_t iterations)
+{
+    char   out[IPCRYPT_MAX_IP_STR_BYTES];
+    size_t i;
+    size_t acc = 0;
+
+    for (i = 0; i < iterations; i++) {
+        acc += ipcrypt_encrypt_ip_str(&f->ipcrypt, out, f->ip_str[i % INPUTS]);
+    }
+    sink += acc;
+}
+
+static void
+bench_decrypt_ip_str(Fixture *f, size_t iterations)
+{
+    char   out[IPCRYPT_MAX_IP_STR_BYTES];
+    size_t i;
+    size_t acc = 0;
+
+    for (i = 0; i < iterations; i++) {
+        acc += ipcrypt_decrypt_ip_str(&f->ipcrypt, out, f->encrypted_str[i % INPUTS]);
+    }
+    sink += acc;
+}
+
+static void
+bench_pfx_encrypt_ip16(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_pfx_encrypt_ip16(&f->ipcrypt_pfx, f->ip16[i % INPUTS]);
+    }
+}
+
+static void
+bench_pfx_decrypt_ip16(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_pfx_decrypt_ip16(&f->ipcrypt_pfx, f->ip16[i % INPUTS]);
+    }
+}
+
+static void
+bench_pfx_encrypt_ip16_anchored(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_pfx_encrypt_ip16_anchored(&f->ipcrypt_pfx, f->ip16[i % INPUTS], ANCHOR_IPV4,
+                                          ANCHOR_IPV6);
+    }
+}
+
+static void
+bench_pfx_decrypt_ip16_anchored(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_pfx_decrypt_ip16_anchored(&f->ipcrypt_pfx, f->ip16[i % INPUTS], ANCHOR_IPV4,
+                                          ANCHOR_IPV6);
+    }
+}
+
+static void
+bench_pfx_encrypt_ip_str(Fixture *f, size_t iterations)
+{
+    char   out[IPCRYPT_MAX_IP_STR_BYTES];
+    size_t i;
+    size_t acc = 0;
+
+    for (i = 0; i < iterations; i++) {
+        acc += ipcrypt_pfx_encrypt_ip_str(&f->ipcrypt_pfx, out, f->ip_str[i % INPUTS]);
+    }
+    sink += acc;
+}
+
+static void
+bench_pfx_decrypt_ip_str(Fixture *f, size_t iterations)
+{
+    char   out[IPCRYPT_MAX_IP_STR_BYTES];
+    size_t i;
+    size_t acc = 0;
+
+    for (i = 0; i < iterations; i++) {
+        acc += ipcrypt_pfx_decrypt_ip_str(&f->ipcrypt_pfx, out, f->pfx_encrypted_str[i % INPUTS]);
+    }
+    sink += acc;
+}
+
+static void
+bench_nd_encrypt_ip16(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_nd_encrypt_ip16(&f->ipcrypt, f->ndip[i % INPUTS], f->ip16[i % INPUTS],
+                                f->tweaks[i % INPUTS]);
+    }
+}
+
+static void
+bench_nd_decrypt_ip16(Fixture *f, size_t iterations)
+{
+    uint8_t ip16[16];
+    size_t  i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_nd_decrypt_ip16(&f->ipcrypt, ip16, f->ndip[i % INPUTS]);
+    }
+    sink += ip16[15];
+}
+
+static void
+bench_nd_encrypt_ip_str(Fixture *f, size_t iterations)
+{
+    char   out[IPCRYPT_NDIP_STR_BYTES];
+    size_t i;
+    size_t acc = 0;
+
+    for (i = 0; i < iterations; i++) {
+        acc += ipcrypt_nd_encrypt_ip_str(&f->ipcrypt, out, f->ip_str[i % INPUTS],
+                                         f->tweaks[i % INPUTS]);
+    }
+    sink += acc;
+}
+
+static void
+bench_nd_decrypt_ip_str(Fixture *f, size_t iterations)
+{
+    char   out[IPCRYPT_MAX_IP_STR_BYTES];
+    size_t i;
+    size_t acc = 0;
+
+    for (i = 0; i < iterations; i++) {
+        acc += ipcrypt_nd_decrypt_ip_str(&f->ipcrypt, out, f->nd_str[i % INPUTS]);
+    }
+    sink += acc;
+}
+
+static void
+bench_ndx_encrypt_ip16(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_ndx_encrypt_ip16(&f->ipcrypt_ndx, f->ndx_ndip[i % INPUTS], f->ip16[i % INPUTS],
+                                 f->tweaks[i % INPUTS]);
+    }
+}
+
+static void
+bench_ndx_decrypt_ip16(Fixture *f, size_t iterations)
+{
+    uint8_t ip16[16];
+    size_t  i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_ndx_decrypt_ip16(&f->ipcrypt_ndx, ip16, f->ndx_ndip[i % INPUTS]);
+    }
+    sink += ip16[15];
+}
+
+static void
+bench_ndx_encrypt_ip_str(Fixture *f, size_t iterations)
+{
+    char   out[IPCRYPT_NDX_NDIP_STR_BYTES];
+    size_t i;
+    size_t acc = 0;
+
+    for (i = 0; i < iterations; i++) {
+        acc += ipcrypt_ndx_encrypt_ip_str(&f->ipcrypt_ndx, out, f->ip_str[i % INPUTS],
+                                          f->tweaks[i % INPUTS]);
+    }
+    sink += acc;
+}
+
+static void
+bench_ndx_decrypt_ip_str(Fixture *f, size_t iterations)
+{
+    char   out[IPCRYPT_MAX_IP_STR_BYTES];
+    size_t i;
+    size_t acc = 0;
+
+    for (i = 0; i < iterations; i++) {
+        acc += ipcrypt_ndx_decrypt_ip_str(&f->ipcrypt_ndx, out, f->ndx_str[i % INPUTS]);
+    }
+    sink += acc;
+}
+
+static void
+bench_encrypt_ip16_strided(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_encrypt_ip16_strided(&f->ipcrypt, f->records, f->batch, sizeof(Record), ip_offset,
+                                     1, 16);
+    }
+}
+
+static void
+bench_decrypt_ip16_strided(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_decrypt_ip16_strided(&f->ipcrypt, f->records, f->batch, sizeof(Record), ip_offset,
+                                     1, 16);
+    }
+}
+
+static void
+bench_pfx_encrypt_ip16_strided(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_pfx_encrypt_ip16_strided(&f->ipcrypt_pfx, f->records, f->batch, sizeof(Record),
+                                         ip_offset, 1, 16);
+    }
+}
+
+static void
+bench_pfx_decrypt_ip16_strided(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_pfx_decrypt_ip16_strided(&f->ipcrypt_pfx, f->records, f->batch, sizeof(Record),
+                                         ip_offset, 1, 16);
+    }
+}
+
+static void
+bench_nd_encrypt_ip16_strided(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_nd_encrypt_ip16_strided(&f->ipcrypt, f->records, f->batch, sizeof(Record),
+                                        nd_offset, 1, IPCRYPT_NDIP_BYTES);
+    }
+}
+
+static void
+bench_nd_decrypt_ip16_strided(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_nd_decrypt_ip16_strided(&f->ipcrypt, f->records, f->batch, sizeof(Record),
+                                        nd_offset, 1, IPCRYPT_NDIP_BYTES);
+    }
+}
+
+static void
+bench_ndx_encrypt_ip16_strided(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_ndx_encrypt_ip16_strided(&f->ipcrypt_ndx, f->records, f->batch, sizeof(Record),
+                                         ndx_offset, 1, IPCRYPT_NDX_NDIP_BYTES);
+    }
+}
+
+static void
+bench_ndx_decrypt_ip16_strided(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_ndx_decrypt_ip16_strided(&f->ipcrypt_ndx, f->records, f->batch, sizeof(Record),
+                                         ndx_offset, 1, IPCRYPT_NDX_NDIP_BYTES);
+    }
+}
+
+static void
+bench_nd_session_encrypt_ip16(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_nd_session_encrypt_ip16(&f->nd_session, f->ndip[i % INPUTS], f->ip16[i % INPUTS]);
+    }
+}
+
+static void
+bench_ndx_session_encrypt_ip16(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_ndx_session_encrypt_ip16(&f->ndx_session, f->ndx_ndip[i % INPUTS],
+                                         f->ip16[i % INPUTS]);
+    }
+}
+
+static void
+bench_nd_session_encrypt_ip16_strided(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_nd_session_encrypt_ip16_strided(&f->nd_session, f->records, f->batch,
+                                                sizeof(Record), ip_offset, 1, 16);
+    }
+}
+
+static void
+bench_nd_session_decrypt_ip16_strided(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_nd_session_decrypt_ip16_strided(&f->nd_session, f->records, f->batch,
+                                                sizeof(Record), ip_offset, 1, 16);
+    }
+}
+
+static void
+bench_ndx_session_encrypt_ip16_strided(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_ndx_session_encrypt_ip16_strided(&f->ndx_session, f->records, f->batch,
+                                                 sizeof(Record), ip_offset, 1, 16);
+    }
+}
+
+static void
+bench_ndx_session_decrypt_ip16_strided(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_ndx_session_decrypt_ip16_strided(&f->ndx_session, f->records, f->batch,
+                                                 sizeof(Record), ip_offset, 1, 16);
+    }
+}
+
+static void
+bench_init_many(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_init_many(f->tenant_ipcrypt, &f->tenant_keys[0][0], f->batch);
+    }
+}
+
+static void
+bench_pfx_init_many(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_pfx_init_many(f->tenant_ipcrypt_pfx, &f->tenant_keys[0][0], f->batch);
+    }
+}
+
+static void
+bench_ndx_init_many(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_ndx_init_many(f->tenant_ipcrypt_ndx, &f->tenant_keys[0][0], f->batch);
+    }
+}
+
+static void
+bench_encrypt_ip16_tenants(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_encrypt_ip16_tenants(f->tenant_ipcrypt, TENANTS, TENANT_ARGS(ip16), 16);
+    }
+}
+
+static void
+bench_decrypt_ip16_tenants(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_decrypt_ip16_tenants(f->tenant_ipcrypt, TENANTS, TENANT_ARGS(ip16), 16);
+    }
+}
+
+static void
+bench_pfx_encrypt_ip16_tenants(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_pfx_encrypt_ip16_tenants(f->tenant_ipcrypt_pfx, TENANTS, TENANT_ARGS(ip16), 16);
+    }
+}
+
+static void
+bench_pfx_decrypt_ip16_tenants(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_pfx_decrypt_ip16_tenants(f->tenant_ipcrypt_pfx, TENANTS, TENANT_ARGS(ip16), 16);
+    }
+}
+
+static void
+bench_nd_encrypt_ip16_tenants(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_nd_encrypt_ip16_tenants(f->tenant_ipcrypt, TENANTS,
+                                        TENANT_ARGS(tweak[IPCRYPT_TWEAKBYTES]),
+                                        IPCRYPT_NDIP_BYTES);
+    }
+}
+
+static void
+bench_nd_decrypt_ip16_tenants(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_nd_decrypt_ip16_tenants(f->tenant_ipcrypt, TENANTS,
+                                        TENANT_ARGS(tweak[IPCRYPT_TWEAKBYTES]),
+                                        IPCRYPT_NDIP_BYTES);
+    }
+}
+
+static void
+bench_ndx_encrypt_ip16_tenants(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_ndx_encrypt_ip16_tenants(f->tenant_ipcrypt_ndx, TENANTS, TENANT_ARGS(tweak),
+                                         IPCRYPT_NDX_NDIP_BYTES);
+    }
+}
+
+static void
+bench_ndx_decrypt_ip16_tenants(Fixture *f, size_t iterations)
+{
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        ipcrypt_ndx_decrypt_ip16_tenants(f->tenant_ipcrypt_ndx, TENANTS, TENANT_ARGS(tweak),
+                                         IPCRYPT_NDX_NDIP_BYTES);
+    }
+}
+
+static const Bench benches[] = {
+    { "ipcrypt_init", bench_init, 0 },
+    { "ipcrypt_pfx_init", bench_pfx_init, 0 },
+    { "ipcrypt_ndx_init", bench_ndx_init, 0 },
+    { "ipcrypt_key_from_hex", bench_key_from_hex, 0 },
+    { "ipcrypt_ndip_from_hex", bench_ndip_from_hex, 0 },
+    { "ipcrypt_ndx_ndip_from_hex", bench_ndx_ndip_from_hex, 0 },
+    { "ipcrypt_str_to_ip16", bench_str_to_ip16, BENCH_PER_FAMILY },
+    { "ipcrypt_ip16_to_str", bench_ip16_to_str, BENCH_PER_FAMILY },
+    { "ipcrypt_sockaddr_to_ip16", bench_sockaddr_to_ip16, BENCH_PER_FAMILY },
+    { "ipcrypt_ip16_to_sockaddr", bench_ip16_to_sockaddr, BENCH_PER_FAMILY },
+    { "ipcrypt_encrypt_ip16", bench_encrypt_ip16, BENCH_PER_FAMILY },
+    { "ipcrypt_decrypt_ip16", bench_decrypt_ip16, BENCH_PER_FAMILY },
+    { "ipcrypt_encrypt_ip_str", bench_encrypt_ip_str, BENCH_PER_FAMILY },
+    { "ipcrypt_decrypt_ip_str", bench_decrypt_ip_str, BENCH_PER_FAMILY },
+    { "ipcrypt_pfx_encrypt_ip16", bench_pfx_encrypt_ip16, BENCH_PER_FAMILY },
+    { "ipcrypt_pfx_decrypt_ip16", bench_pfx_decrypt_ip16, BENCH_PER_FAMILY },
+    { "ipcrypt_pfx_encrypt_ip16_anchored", bench_pfx_encrypt_ip16_anchored, BENCH_PER_FAMILY },
+    { "ipcrypt_pfx_decrypt_ip16_anchored", bench_pfx_decrypt_ip16_anchored, BENCH_PER_FAMILY },
+    { "ipcrypt_pfx_encrypt_ip_str", bench_pfx_encrypt_ip_str, BENCH_PER_FAMILY },
+    { "ipcrypt_pfx_decrypt_ip_str", bench_pfx_decrypt_ip_str, BENCH_PER_FAMILY },
+    { "ipcrypt_nd_encrypt_ip16", bench_nd_encrypt_ip16, BENCH_PER_FAMILY },
+    { "ipcrypt_nd_decrypt_ip16", bench_nd_decrypt_ip16, BENCH_PER_FAMILY },
+    { "ipcrypt_nd_encrypt_ip_str", bench_nd_encrypt_ip_str, BENCH_PER_FAMILY },
+    { "ipcrypt_nd_decrypt_ip_str", bench_nd_decrypt_ip_str, BENCH_PER_FAMILY },
+    { "ipcrypt_ndx_encrypt_ip16", bench_ndx_encrypt_ip16, BENCH_PER_FAMILY },
+    { "ipcrypt_ndx_decrypt_ip16", bench_ndx_decrypt_ip16, BENCH_PER_FAMILY },
+    { "ipcrypt_ndx_encrypt_ip_str", bench_ndx_encrypt_ip_str, BENCH_PER_FAMILY },
+    { "ipcrypt_ndx_decrypt_ip_str", bench_ndx_decrypt_ip_str, BENCH_PER_FAMILY },
+    { "ipcrypt_encrypt_ip16_strided", bench_encrypt_ip16_strided, BENCH_PER_FAMILY | BENCH_BATCH },
+    { "ipcrypt_decrypt_ip16_strided", bench_decrypt_ip16_strided, BENCH_PER_FAMILY | BENCH_BATCH },
+    { "ipcrypt_pfx_encrypt_ip16_strided", bench_pfx_encrypt_ip16_strided,
+      BENCH_PER_FAMILY | BENCH_BATCH },
+    { "ipcrypt_pfx_decrypt_ip16_strided", bench_pfx_decrypt_ip16_strided,
+      BENCH_PER_FAMILY | BENCH_BATCH },
+    { "ipcrypt_nd_encrypt_ip16_strided", bench_nd_encrypt_ip16_strided,
+      BENCH_PER_FAMILY | BENCH_BATCH },
+    { "ipcrypt_nd_decrypt_ip16_strided", bench_nd_decrypt_ip16_strided,
+      BENCH_PER_FAMILY | BENCH_BATCH },
+    { "ipcrypt_ndx_encrypt_ip16_strided", bench_ndx_encrypt_ip16_strided,
+      BENCH_PER_FAMILY | BENCH_BATCH },
+    { "ipcrypt_ndx_decrypt_ip16_strided", bench_ndx_decrypt_ip16_strided,
+      BENCH_PER_FAMILY | BENCH_BATCH },
+    { "ipcrypt_nd_session_encrypt_ip16", bench_nd_session_encrypt_ip16, BENCH_PER_FAMILY },
+    { "ipcrypt_ndx_session_encrypt_ip16", bench_ndx_session_encrypt_ip16, BENCH_PER_FAMILY },
+    { "ipcrypt_nd_session_encrypt_ip16_strided", bench_nd_session_encrypt_ip16_strided,
+      BENCH_PER_FAMILY | BENCH_BATCH },
+    { "ipcrypt_nd_session_decrypt_ip16_strided", bench_nd_session_decrypt_ip16_strided,
+      BENCH_PER_FAMILY | BENCH_BATCH },
+    { "ipcrypt_ndx_session_encrypt_ip16_strided", bench_ndx_session_encrypt_ip16_strided,
+      BENCH_PER_FAMILY | BENCH_BATCH },
+    { "ipcrypt_ndx_session_decrypt_ip16_strided", bench_ndx_session_decrypt_ip16_strided,
+      BENCH_PER_FAMILY | BENCH_BATCH },
+    { "ipcrypt_init_many", bench_init_many, BENCH_BATCH },
+    { "ipcrypt_pfx_init_many", bench_pfx_init_many, BENCH_BATCH },
+    { "ipcrypt_ndx_init_many", bench_ndx_init_many, BENCH_BATCH },
+    { "ipcrypt_encrypt_ip16_tenants", bench_encrypt_ip16_tenants, BENCH_PER_FAMILY | BENCH_BATCH },
+    { "ipcrypt_decrypt_ip16_tenants", bench_decrypt_ip16_tenants, BENCH_PER_FAMILY | BENCH_BATCH },
+    { "ipcrypt_pfx_encrypt_ip16_tenants", bench_pfx_encrypt_ip16_tenants,
+      BENCH_PER_FAMILY | BENCH_BATCH },
+    { "ipcrypt_pfx_decrypt_ip16_tenants", bench_pfx_decrypt_ip16_tenants,
+      BENCH_PER_FAMILY | BENCH_BATCH },
+    { "ipcrypt_nd_encrypt_ip16_tenants", bench_nd_encrypt_ip16_tenants,
+      BENCH_PER_FAMILY | BENCH_BATCH },
+    { "ipcrypt_nd_decrypt_ip16_tenants", bench_nd_decrypt_ip16_tenants,
+      BENCH_PER_FAMILY | BENCH_BATCH },
+    { "ipcrypt_ndx_encrypt_ip16_tenants", bench_ndx_encrypt_ip16_tenants,
+      BENCH_PER_FAMILY | BENCH_BATCH },
+    { "ipcrypt_ndx_decrypt_ip16_tenants", bench_ndx_decrypt_ip16_tenants,
+      BENCH_PER_FAMILY | BENCH_BATCH },
+};
+
+static const size_t batch_sizes[] = { 1, 16, 256, MAX_BATCH };
+
+/**
+ * Fill the fixture with random inputs. Since the encryption functions preserve the kind of
+ * IPv4-mapped inputs in PFX mode, and since the cost of the other modes doesn't depend on the
+ * input, benchmarks can keep encrypting their inputs in-place.
+ */
+static void
+fixture_setup(Fixture *f, int ipv6)
+{
+    static const uint8_t ipv4_mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+    uint32_t             x               = 0x9e3779b9;
+    size_t               i, j;
+
+    for (i = 0; i < sizeof f->key; i++) {
+        f->key[i] = (uint8_t) rnd(&x);
+        snprintf(&f->key_hex[2 * i], 3, "%02x", f->key[i]);
+    }
+    ipcrypt_init(&f->ipcrypt, f->key);
+    ipcrypt_pfx_init(&f->ipcrypt_pfx, f->key);
+    ipcrypt_ndx_init(&f->ipcrypt_ndx, f->key);
+
+    for (i = 0; i < INPUTS; i++) {
+        for (j = 0; j < 16; j++) {
+            f->ip16[i][j] = (uint8_t) rnd(&x);
+        }
+        for (j = 0; j < sizeof f->tweaks[i]; j++) {
+            f->tweaks[i][j] = (uint8_t) rnd(&x);
+        }
+        if (ipv6) {
+            f->ip16[i][0] = 0x20;
+            f->ip16[i][1] = 0x01;
+        } else {
+            memcpy(f->ip16[i], ipv4_mapped, sizeof ipv4_mapped);
+        }
+        ipcrypt_ip16_to_str(f->ip_str[i], f->ip16[i]);
+        ipcrypt_encrypt_ip_str(&f->ipcrypt, f->encrypted_str[i], f->ip_str[i]);
+        ipcrypt_pfx_encrypt_ip_str(&f->ipcrypt_pfx, f->pfx_encrypted_str[i], f->ip_str[i]);
+        ipcrypt_nd_encrypt_ip_str(&f->ipcrypt, f->nd_str[i], f->ip_str[i], f->tweaks[i]);
+        ipcrypt_ndx_encrypt_ip_str(&f->ipcrypt_ndx, f->ndx_str[i], f->ip_str[i], f->tweaks[i]);
+        ipcrypt_nd_encrypt_ip16(&f->ipcrypt, f->ndip[i], f->ip16[i], f->tweaks[i]);
+        ipcrypt_ndx_encrypt_ip16(&f->ipcrypt_ndx, f->ndx_ndip[i], f->ip16[i], f->tweaks[i]);
+        ipcrypt_ip16_to_sockaddr(&f->sa[i], f->ip16[i]);
+    }
+    ipcrypt_nd_session_init(&f->nd_session, &f->ipcrypt, f->tweaks[0]);
+    ipcrypt_ndx_session_init(&f->ndx_session, &f->ipcrypt_ndx, f->tweaks[0]);
+    for (i = 0; i < MAX_BATCH; i++) {
+        memcpy(f->records[i].tweak, f->tweaks[i % INPUTS], sizeof f->records[i].tweak);
+        memcpy(f->records[i].ip16, f->ip16[i % INPUTS], sizeof f->records[i].ip16);
+        f->tenant_records[i].rec    = f->records[i];
+        f->tenant_records[i].tenant = rnd(&x) % TENANTS;
+        for (j = 0; j < sizeof f->tenant_keys[i]; j++) {
+            f->tenant_keys[i][j] = (uint8_t) rnd(&x);
+        }
+    }
+    ipcrypt_init_many(f->tenant_ipcrypt, &f->tenant_keys[0][0], TENANTS);
+    ipcrypt_pfx_init_many(f->tenant_ipcrypt_pfx, &f->tenant_keys[0][0], TENANTS);
+    ipcrypt_ndx_init_many(f->tenant_ipcrypt_ndx, &f->tenant_keys[0][0], TENANTS);
+    f->batch = 1;
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    const double x = *(const double *) a;
+    const double y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Run a benchmark, doubling the number of iterations until a sample lasts at least `min_time`
+ * seconds, then return the median time and number of ticks per iteration.
+ */
+static size_t
+measure(const Bench *bench, Fixture *f, double min_time, double *seconds, double *cycles)
+{
+    double   s[SAMPLES], c[SAMPLES];
+    double   t0;
+    uint64_t c0;
+    size_t   iterations = 1;
+    size_t   i;
+
+    bench->run(f, 1);
+    for (;;) {
+        t0 = now();
+        bench->run(f, iterations);
+        if (now() - t0 >= min_time) {
+            break;
+        }
+        iterations *= 2;
+    }
+    for (i = 0; i < SAMPLES; i++) {
+        t0 = now();
+        c0 = ticks();
+        bench->run(f, iterations);
+        c[i] = (double) (ticks() - c0) / (double) iterations;
+        s[i] = (now() - t0) / (double) iterations;
+    }
+    qsort(s, SAMPLES, sizeof s[0], cmp_double);
+    qsort(c, SAMPLES, sizeof c[0], cmp_double);
+    *seconds = s[SAMPLES / 2];
+    *cycles  = c[SAMPLES / 2];
+
+    return iterations;
+}
+
+static void
+report(const Options *opts, const char *name, const char *input, size_t batch, size_t iterations,
+       double ns, double cycles)
+{
+    const double ops_per_sec = ns > 0.0 ? 1e9 / ns : 0.0;
+
+    if (opts->json) {
+        printf("{\"backend\":\"%s\",\"benchmark\":\"%s\",\"input\":\"%s\",\"batch\":%zu,"
+               "\"iterations\":%zu,\"ns_per_op\":%.3f,",
+               BACKEND, name, input, batch, iterations, ns);
+#ifdef HAVE_TSC
+        printf("\"cycles_per_op\":%.2f,", cycles);
+#else
+        (void) cycles;
+        printf("\"cycles_per_op\":null,");
+#endif
+        printf("\"ops_per_sec\":%.0f}\n", ops_per_sec);
+    } else {
+#ifdef HAVE_TSC
+        printf("%-9s %-34s %-5s %6zu %11.2f %11.1f %14.0f\n", BACKEND, name, input, batch, ns,
+               cycles, ops_per_sec);
+#else
+        (void) cycles;
+        printf("%-9s %-34s %-5s %6zu %11.2f %11s %14.0f\n", BACKEND, name, input, batch, ns, "-",
+               ops_per_sec);
+#endif
+    }
+    fflush(stdout);
+}
+
+static void
+run_bench(const Options *opts, const Bench *bench, Fixture *f, const char *input)
+{
+    double seconds, cycles;
+    size_t iterations;
+    size_t i;
+
+    if (!(bench->flags & BENCH_BATCH)) {
+        iterations = measure(bench, f, opts->min_time, &seconds, &cycles);
+        report(opts, bench->name, input, 1, iterations, seconds * 1e9, cycles);
+        return;
+    }
+    for (i = 0; i < sizeof batch_sizes / sizeof batch_sizes[0]; i++) {
+        f->batch   = batch_sizes[i];
+        iterations = measure(bench, f, opts->min_time, &seconds, &cycles);
+        report(opts, bench->name, input, f->batch, iterations,
+               seconds * 1e9 / (double) f->batch, cycles / (double) f->batch);
+    }
+    f->batch = 1;
+}
+
+static int
+usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [--json] [--filter substring] [--min-time milliseconds]\n", prog);
+    return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static Fixture f;
+    Options        opts;
+    size_t         i;
+    int            arg;
+    int            ipv6;
+
+    opts.filter   = NULL;
+    opts.min_time = DEFAULT_MIN_TIME_MS / 1000.0;
+    opts.json     = 0;
+    for (arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "--json") == 0) {
+            opts.json = 1;
+        } else if (strcmp(argv[arg], "--filter") == 0 && arg + 1 < argc) {
+            opts.filter = argv[++arg];
+        } else if (strcmp(argv[arg], "--min-time") == 0 && arg + 1 < argc) {
+            opts.min_time = strtod(argv[++arg], NULL) / 1000.0;
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    if (!opts.json) {
+        printf("%-9s %-34s %-5s %6s %11s %11s %14s\n", "backend", "benchmark", "input", "batch",
+               "ns/op", "cycles/op", "ops/s");
+    }
+    for (i = 0; i < sizeof benches / sizeof benches[0]; i++) {
+        if (opts.filter != NULL && strstr(benches[i].name, opts.filter) == NULL) {
+            continue;
+        }
+        if (!(benches[i].flags & BENCH_PER_FAMILY)) {
+            fixture_setup(&f, 0);
+            run_bench(&opts, &benches[i], &f, "any");
+            continue;
+        }
+        for (ipv6 = 0; ipv6 <= 1; ipv6++) {
+            fixture_setup(&f, ipv6);
+            run_bench(&opts, &benches[i], &f, ipv6 ? "ipv6" : "ipv4");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,147 @@
+/**
+ * Thread pool scaling benchmark.
+ *
+ * Encrypts a large array of records with 1 to N threads, for every mode, and reports the
+ * throughput and the speedup relative to a single thread.
+ *
+ * Usage: bench-pool [max_threads [records]]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ipcrypt2_pool.h"
+
+#define DEFAULT_RECORDS 1000000U
+#define ROUNDS          3
+
+typedef struct Record {
+    uint8_t tweak[IPCRYPT_NDX_TWEAKBYTES];
+    uint8_t ip16[16];
+} Record;
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    timespec_get(&ts, TIME_UTC);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static void
+fill_records(Record *records, size_t count)
+{
+    uint32_t x = 0x9e3779b9;
+    size_t   i, j;
+
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < sizeof records[i]; j++) {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            ((uint8_t *) &records[i])[j] = (uint8_t) x;
+        }
+        // Mix IPv4 and IPv6 addresses, so that the cost of PFX records varies.
+        if (x % 2 == 0) {
+            memset(records[i].ip16, 0, 10);
+            records[i].ip16[10] = 0xff;
+            records[i].ip16[11] = 0xff;
+        }
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const char *const modes[] = { "deterministic", "pfx", "nd", "ndx" };
+    const uint8_t            key[IPCRYPT_PFX_KEYBYTES] = { 0 };
+    const size_t             ip_offset[1]              = { offsetof(Record, ip16) };
+    const size_t             nd_offset[1]              = {
+        offsetof(Record, ip16) - IPCRYPT_TWEAKBYTES
+    };
+    const size_t             ndx_offset[1]             = { 0 };
+    IPCrypt                  ipcrypt;
+    IPCryptPFX               ipcrypt_pfx;
+    IPCryptNDX               ipcrypt_ndx;
+    IPCryptPool             *pool;
+    Record                  *records;
+    double                   best, t0, elapsed;
+    double                   base_rate[4];
+    size_t                   count = DEFAULT_RECORDS;
+    unsigned int             max_threads;
+    unsigned int             threads;
+    unsigned int             mode;
+    unsigned int             round;
+
+    if ((pool = ipcrypt_pool_create(0)) == NULL) {
+        return 1;
+    }
+    max_threads = ipcrypt_pool_threads(pool);
+    ipcrypt_pool_destroy(pool);
+    if (argc > 1) {
+        max_threads = (unsigned int) strtoul(argv[1], NULL, 10);
+    }
+    if (argc > 2) {
+        count = (size_t) strtoul(argv[2], NULL, 10);
+    }
+    if (max_threads == 0 || count == 0 ||
+        (records = (Record *) malloc(count * sizeof *records)) == NULL) {
+        return 1;
+    }
+    ipcrypt_init(&ipcrypt, key);
+    ipcrypt_pfx_init(&ipcrypt_pfx, key);
+    ipcrypt_ndx_init(&ipcrypt_ndx, key);
+
+    printf("%-14s %8s %14s %8s\n", "mode", "threads", "records/s", "speedup");
+    for (mode = 0; mode < 4; mode++) {
+        for (threads = 1; threads <= max_threads; threads++) {
+            if ((pool = ipcrypt_pool_create(threads)) == NULL) {
+                return 1;
+            }
+            best = 0.0;
+            for (round = 0; round < ROUNDS; round++) {
+                fill_records(records, count);
+                t0 = now();
+                switch (mode) {
+                case 0:
+                    ipcrypt_pool_encrypt_ip16_strided(pool, &ipcrypt, records, count,
+                                                      sizeof *records, ip_offset, 1, 16);
+                    break;
+                case 1:
+                    ipcrypt_pool_pfx_encrypt_ip16_strided(pool, &ipcrypt_pfx, records, count,
+                                                          sizeof *records, ip_offset, 1, 16);
+                    break;
+                case 2:
+                    ipcrypt_pool_nd_encrypt_ip16_strided(pool, &ipcrypt, records, count,
+                                                         sizeof *records, nd_offset, 1,
+                                                         IPCRYPT_NDIP_BYTES);
+                    break;
+                default:
+                    ipcrypt_pool_ndx_encrypt_ip16_strided(pool, &ipcrypt_ndx, records, count,
+                                                          sizeof *records, ndx_offset, 1,
+                                                          IPCRYPT_NDX_NDIP_BYTES);
+                }
+                elapsed = now() - t0;
+                if (elapsed > 0.0 && (double) count / elapsed > best) {
+                    best = (double) count / elapsed;
+                }
+            }
+            ipcrypt_pool_destroy(pool);
+            if (threads == 1) {
+                base_rate[mode] = best;
+            }
+            printf("%-14s %8u %14.0f %7.2fx\n", modes[mode], threads, best,
+                   base_rate[mode] > 0.0 ? best / base_rate[mode] : 0.0);
+        }
+    }
+    ipcrypt_pfx_deinit(&ipcrypt_pfx);
+    ipcrypt_ndx_deinit(&ipcrypt_ndx);
+    ipcrypt_deinit(&ipcrypt);
+    free(records);
+
+    return 0;
+}
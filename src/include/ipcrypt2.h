@@ -32,6 +32,12 @@ extern "C" {
 /** Size of the hexadecimal output for non-deterministic encryption, including null terminator. */
 #define IPCRYPT_NDIP_STR_BYTES (48U + 1U)
 
+/** Size of the base64url output for non-deterministic encryption, including null terminator. */
+#define IPCRYPT_NDIP_B64_STR_BYTES (32U + 1U)
+
+/** Size of the base32 output for non-deterministic encryption, including null terminator. */
+#define IPCRYPT_NDIP_B32_STR_BYTES (39U + 1U)
+
 /** Size of the NDX encryption key, in bytes (256 bits). */
 #define IPCRYPT_NDX_KEYBYTES 32U
 
@@ -44,9 +50,25 @@ extern "C" {
 /** Size of the hexadecimal output for NDX encryption, including null terminator. */
 #define IPCRYPT_NDX_NDIP_STR_BYTES (64U + 1U)
 
+/** Size of the base64url output for NDX encryption, including null terminator. */
+#define IPCRYPT_NDX_NDIP_B64_STR_BYTES (43U + 1U)
+
+/** Size of the base32 output for NDX encryption, including null terminator. */
+#define IPCRYPT_NDX_NDIP_B32_STR_BYTES (52U + 1U)
+
 /** Size of the PFX encryption key, in bytes (256 bits). */
 #define IPCRYPT_PFX_KEYBYTES 32U
 
+/**
+ * Encryption modes, for APIs that are not specific to a mode.
+ */
+typedef enum IPCryptMode {
+    IPCRYPT_MODE_DETERMINISTIC, /**< IPCrypt, ipcrypt_encrypt_ip16(). 16-byte key. */
+    IPCRYPT_MODE_PFX,           /**< IPCryptPFX, ipcrypt_pfx_encrypt_ip16(). 32-byte key. */
+    IPCRYPT_MODE_ND,            /**< IPCrypt, ipcrypt_nd_encrypt_ip16(). 16-byte key. */
+    IPCRYPT_MODE_NDX            /**< IPCryptNDX, ipcrypt_ndx_encrypt_ip16(). 32-byte key. */
+} IPCryptMode;
+
 /* -------- Utility functions -------- */
 
 /**
@@ -83,6 +105,22 @@ int ipcrypt_sockaddr_to_ip16(uint8_t ip16[16], const struct sockaddr *sa);
  */
 void ipcrypt_ip16_to_sockaddr(struct sockaddr_storage *sa, const uint8_t ip16[16]);
 
+/**
+ * Convert an array of `count` socket addresses, such as the addresses filled by recvmmsg(), to
+ * `count` consecutive 16-byte binary IP addresses, in the same way as ipcrypt_sockaddr_to_ip16().
+ *
+ * Addresses of unsupported families are converted to the unspecified address (16 zero bytes).
+ * Returns the number of addresses that were successfully converted.
+ */
+size_t ipcrypt_sockaddrs_to_ip16s(uint8_t *ip16s, const struct sockaddr_storage *sas,
+                                  size_t count);
+
+/**
+ * Convert `count` consecutive 16-byte binary IP addresses to an array of socket addresses, in the
+ * same way as ipcrypt_ip16_to_sockaddr().
+ */
+void ipcrypt_ip16s_to_sockaddrs(struct sockaddr_storage *sas, const uint8_t *ip16s, size_t count);
+
 /**
  * Convert a hexadecimal string to a secret key.
  *
@@ -109,6 +147,43 @@ int ipcrypt_ndip_from_hex(uint8_t ndip[IPCRYPT_NDIP_BYTES], const char *hex, siz
 int ipcrypt_ndx_ndip_from_hex(uint8_t ndip[IPCRYPT_NDX_NDIP_BYTES], const char *hex,
                               size_t hex_len);
 
+/**
+ * Convert an unpadded base64url string (RFC 4648, section 5) to an ipcrypt-nd ciphertext.
+ *
+ * The input string must be exactly 32 characters long (IPCRYPT_NDIP_BYTES bytes in base64url).
+ * Returns 0 on success, or -1 if the input string is invalid or conversion fails.
+ */
+int ipcrypt_ndip_from_b64(uint8_t ndip[IPCRYPT_NDIP_BYTES], const char *b64, size_t b64_len);
+
+/**
+ * Convert an unpadded base64url string (RFC 4648, section 5) to an ipcrypt-ndx ciphertext.
+ *
+ * The input string must be exactly 43 characters long (IPCRYPT_NDX_NDIP_BYTES bytes in base64url),
+ * and its unused trailing bits must be zero. Returns 0 on success, or -1 if the input string is
+ * invalid or conversion fails.
+ */
+int ipcrypt_ndx_ndip_from_b64(uint8_t ndip[IPCRYPT_NDX_NDIP_BYTES], const char *b64,
+                              size_t b64_len);
+
+/**
+ * Convert an unpadded lowercase base32 string (RFC 4648, section 6) to an ipcrypt-nd ciphertext.
+ *
+ * The input string must be exactly 39 characters long (IPCRYPT_NDIP_BYTES bytes in base32), and
+ * its unused trailing bits must be zero. Returns 0 on success, or -1 if the input string is invalid
+ * or conversion fails.
+ */
+int ipcrypt_ndip_from_b32(uint8_t ndip[IPCRYPT_NDIP_BYTES], const char *b32, size_t b32_len);
+
+/**
+ * Convert an unpadded lowercase base32 string (RFC 4648, section 6) to an ipcrypt-ndx ciphertext.
+ *
+ * The input string must be exactly 52 characters long (IPCRYPT_NDX_NDIP_BYTES bytes in base32),
+ * and its unused trailing bits must be zero. Returns 0 on success, or -1 if the input string is
+ * invalid or conversion fails.
+ */
+int ipcrypt_ndx_ndip_from_b32(uint8_t ndip[IPCRYPT_NDX_NDIP_BYTES], const char *b32,
+                              size_t b32_len);
+
 /* -------- IP encryption -------- */
 
 /**
@@ -201,6 +276,46 @@ size_t ipcrypt_nd_decrypt_ip_str(const IPCrypt *ipcrypt,
                                  char           ip_str[IPCRYPT_MAX_IP_STR_BYTES],
                                  const char    *encrypted_ip_str);
 
+/**
+ * Encrypt an IP address string non-deterministically, like ipcrypt_nd_encrypt_ip_str(), with the
+ * output encoded as an unpadded base64url string: 32 characters instead of 48.
+ *
+ * Returns the output length, without the null terminator.
+ */
+size_t ipcrypt_nd_encrypt_ip_str_b64(const IPCrypt *ipcrypt,
+                                     char           encrypted_ip_str[IPCRYPT_NDIP_B64_STR_BYTES],
+                                     const char    *ip_str,
+                                     const uint8_t  random[IPCRYPT_TWEAKBYTES]);
+
+/**
+ * Decrypt a base64url-encoded IP address string from non-deterministic mode.
+ *
+ * Output is written to ip_str. Returns the output length on success, or 0 on error.
+ */
+size_t ipcrypt_nd_decrypt_ip_str_b64(const IPCrypt *ipcrypt,
+                                     char           ip_str[IPCRYPT_MAX_IP_STR_BYTES],
+                                     const char    *encrypted_ip_str);
+
+/**
+ * Encrypt an IP address string non-deterministically, like ipcrypt_nd_encrypt_ip_str(), with the
+ * output encoded as an unpadded lowercase base32 string: 39 characters instead of 48.
+ *
+ * Returns the output length, without the null terminator.
+ */
+size_t ipcrypt_nd_encrypt_ip_str_b32(const IPCrypt *ipcrypt,
+                                     char           encrypted_ip_str[IPCRYPT_NDIP_B32_STR_BYTES],
+                                     const char    *ip_str,
+                                     const uint8_t  random[IPCRYPT_TWEAKBYTES]);
+
+/**
+ * Decrypt a base32-encoded IP address string from non-deterministic mode.
+ *
+ * Output is written to ip_str. Returns the output length on success, or 0 on error.
+ */
+size_t ipcrypt_nd_decrypt_ip_str_b32(const IPCrypt *ipcrypt,
+                                     char           ip_str[IPCRYPT_MAX_IP_STR_BYTES],
+                                     const char    *encrypted_ip_str);
+
 /* -------- Prefix-preserving IP encryption -------- */
 
 /**
@@ -243,6 +358,31 @@ void ipcrypt_pfx_encrypt_ip16(const IPCryptPFX *ipcrypt, uint8_t ip16[16]);
  */
 void ipcrypt_pfx_decrypt_ip16(const IPCryptPFX *ipcrypt, uint8_t ip16[16]);
 
+/**
+ * Encrypt a 16-byte IP address in-place with prefix preservation, keeping its first bits in the
+ * clear.
+ *
+ * The first `ipv4_prefix_len` bits of IPv4 addresses (0 to 32), or the first `ipv6_prefix_len`
+ * bits of IPv6 addresses (0 to 128), are copied through, and the AES computations for these bits
+ * are skipped: keeping a /32 in the clear saves a quarter of the cost for IPv6. The remaining bits
+ * are exactly the ones produced by ipcrypt_pfx_encrypt_ip16(), and prefix lengths of 0 produce the
+ * same output. Outputs of both functions for the same key should therefore not be published
+ * together.
+ *
+ * Returns 0 on success, or -1 if a prefix length is out of range.
+ */
+int ipcrypt_pfx_encrypt_ip16_anchored(const IPCryptPFX *ipcrypt, uint8_t ip16[16],
+                                      unsigned int ipv4_prefix_len, unsigned int ipv6_prefix_len);
+
+/**
+ * Decrypt a 16-byte IP address in-place with prefix preservation.
+ *
+ * Reverses the encryption performed by ipcrypt_pfx_encrypt_ip16_anchored(), with the same prefix
+ * lengths. Returns 0 on success, or -1 if a prefix length is out of range.
+ */
+int ipcrypt_pfx_decrypt_ip16_anchored(const IPCryptPFX *ipcrypt, uint8_t ip16[16],
+                                      unsigned int ipv4_prefix_len, unsigned int ipv6_prefix_len);
+
 /**
  * Encrypt an IP address string (IPv4 or IPv6) with prefix preservation.
  *
@@ -327,6 +467,373 @@ size_t ipcrypt_ndx_encrypt_ip_str(const IPCryptNDX *ipcrypt,
 size_t ipcrypt_ndx_decrypt_ip_str(const IPCryptNDX *ipcrypt, char ip_str[IPCRYPT_MAX_IP_STR_BYTES],
                                   const char *encrypted_ip_str);
 
+/**
+ * Encrypt an IP address string in NDX mode, like ipcrypt_ndx_encrypt_ip_str(), with the output
+ * encoded as an unpadded base64url string: 43 characters instead of 64.
+ *
+ * Returns the output length, without the null terminator.
+ */
+size_t ipcrypt_ndx_encrypt_ip_str_b64(const IPCryptNDX *ipcrypt,
+                                      char encrypted_ip_str[IPCRYPT_NDX_NDIP_B64_STR_BYTES],
+                                      const char *ip_str,
+                                      const uint8_t random[IPCRYPT_NDX_TWEAKBYTES]);
+
+/**
+ * Decrypt a base64url-encoded IP address string from NDX mode.
+ *
+ * Output is written to ip_str. Returns the output length on success, or 0 on error.
+ */
+size_t ipcrypt_ndx_decrypt_ip_str_b64(const IPCryptNDX *ipcrypt,
+                                      char ip_str[IPCRYPT_MAX_IP_STR_BYTES],
+                                      const char *encrypted_ip_str);
+
+/**
+ * Encrypt an IP address string in NDX mode, like ipcrypt_ndx_encrypt_ip_str(), with the output
+ * encoded as an unpadded lowercase base32 string: 52 characters instead of 64.
+ *
+ * Returns the output length, without the null terminator.
+ */
+size_t ipcrypt_ndx_encrypt_ip_str_b32(const IPCryptNDX *ipcrypt,
+                                      char encrypted_ip_str[IPCRYPT_NDX_NDIP_B32_STR_BYTES],
+                                      const char *ip_str,
+                                      const uint8_t random[IPCRYPT_NDX_TWEAKBYTES]);
+
+/**
+ * Decrypt a base32-encoded IP address string from NDX mode.
+ *
+ * Output is written to ip_str. Returns the output length on success, or 0 on error.
+ */
+size_t ipcrypt_ndx_decrypt_ip_str_b32(const IPCryptNDX *ipcrypt,
+                                      char ip_str[IPCRYPT_MAX_IP_STR_BYTES],
+                                      const char *encrypted_ip_str);
+
+/* -------- Strided batch encryption -------- */
+
+/*
+ * The following functions process IP addresses stored in-place within an array of records, such as
+ * an array of flow structures, without gathering them into a temporary array first.
+ *
+ * `base` points to the first of `count` records, each `stride` bytes apart. Every record contains
+ * `offsets_count` fields, located at the byte offsets listed in `offsets`, and each field is
+ * `field_bytes` long. Fields must fit within a record and must not overlap.
+ *
+ * These functions return 0 on success, or -1 if the layout is invalid or if the field size is not
+ * supported by the mode.
+ */
+
+/**
+ * Encrypt 16-byte IP addresses stored within an array of records, in-place.
+ *
+ * `field_bytes` must be 16. The result is identical to calling ipcrypt_encrypt_ip16() on each field.
+ */
+int ipcrypt_encrypt_ip16_strided(const IPCrypt *ipcrypt, void *base, size_t count, size_t stride,
+                                 const size_t *offsets, size_t offsets_count, size_t field_bytes);
+
+/**
+ * Decrypt 16-byte IP addresses stored within an array of records, in-place.
+ *
+ * `field_bytes` must be 16. The result is identical to calling ipcrypt_decrypt_ip16() on each field.
+ */
+int ipcrypt_decrypt_ip16_strided(const IPCrypt *ipcrypt, void *base, size_t count, size_t stride,
+                                 const size_t *offsets, size_t offsets_count, size_t field_bytes);
+
+/**
+ * Encrypt IP addresses stored within an array of records, in-place, with prefix preservation.
+ *
+ * `field_bytes` can be 16 (IPv6 or IPv4-mapped addresses) or 4 (raw IPv4 addresses, in network
+ * byte order). The result is identical to calling ipcrypt_pfx_encrypt_ip16() on each address.
+ */
+int ipcrypt_pfx_encrypt_ip16_strided(const IPCryptPFX *ipcrypt, void *base, size_t count,
+                                     size_t stride, const size_t *offsets, size_t offsets_count,
+                                     size_t field_bytes);
+
+/**
+ * Decrypt IP addresses stored within an array of records, in-place, with prefix preservation.
+ *
+ * `field_bytes` can be 16 (IPv6 or IPv4-mapped addresses) or 4 (raw IPv4 addresses, in network
+ * byte order).
+ */
+int ipcrypt_pfx_decrypt_ip16_strided(const IPCryptPFX *ipcrypt, void *base, size_t count,
+                                     size_t stride, const size_t *offsets, size_t offsets_count,
+                                     size_t field_bytes);
+
+/**
+ * Non-deterministically encrypt IP addresses stored within an array of records, in-place.
+ *
+ * `field_bytes` must be IPCRYPT_NDIP_BYTES. Each field must contain a secure 8-byte random tweak,
+ * followed by a 16-byte IP address. The address is replaced with its encrypted value, so that the
+ * field ends up holding the same output as ipcrypt_nd_encrypt_ip16().
+ */
+int ipcrypt_nd_encrypt_ip16_strided(const IPCrypt *ipcrypt, void *base, size_t count,
+                                    size_t stride, const size_t *offsets, size_t offsets_count,
+                                    size_t field_bytes);
+
+/**
+ * Decrypt IPCRYPT_NDIP_BYTES ciphertexts stored within an array of records, in-place.
+ *
+ * The tweak is left untouched, and the encrypted address that follows it is replaced with the
+ * original 16-byte IP address.
+ */
+int ipcrypt_nd_decrypt_ip16_strided(const IPCrypt *ipcrypt, void *base, size_t count,
+                                    size_t stride, const size_t *offsets, size_t offsets_count,
+                                    size_t field_bytes);
+
+/**
+ * Non-deterministically encrypt IP addresses stored within an array of records, in-place, using
+ * NDX mode.
+ *
+ * `field_bytes` must be IPCRYPT_NDX_NDIP_BYTES. Each field must contain a secure 16-byte random
+ * tweak, followed by a 16-byte IP address. The address is replaced with its encrypted value, so
+ * that the field ends up holding the same output as ipcrypt_ndx_encrypt_ip16().
+ */
+int ipcrypt_ndx_encrypt_ip16_strided(const IPCryptNDX *ipcrypt, void *base, size_t count,
+                                     size_t stride, const size_t *offsets, size_t offsets_count,
+                                     size_t field_bytes);
+
+/**
+ * Decrypt IPCRYPT_NDX_NDIP_BYTES ciphertexts stored within an array of records, in-place.
+ *
+ * The tweak is left untouched, and the encrypted address that follows it is replaced with the
+ * original 16-byte IP address.
+ */
+int ipcrypt_ndx_decrypt_ip16_strided(const IPCryptNDX *ipcrypt, void *base, size_t count,
+                                     size_t stride, const size_t *offsets, size_t offsets_count,
+                                     size_t field_bytes);
+
+/* -------- Multi-tenant batch encryption -------- */
+
+/*
+ * The following functions initialize and use arrays of contexts, one per tenant.
+ *
+ * The *_init_many() functions are equivalent to calling the *_init() function of the mode on each
+ * context, with `keys` pointing to `count` consecutive keys. Independent keys are expanded in
+ * parallel, which is substantially faster than initializing contexts one by one.
+ *
+ * The *_tenants() functions process records stored in an array, like the strided functions, but
+ * every record also contains a 32-bit tenant index, in native byte order, at `tenant_offset`.
+ * Each record is processed with `ipcrypts[tenant index]`. Records don't have to be sorted by
+ * tenant: records of different tenants are processed in parallel, each with its own key schedule,
+ * and the contexts of upcoming records are prefetched.
+ *
+ * Every record has a single field, at `field_offset`, with the same format as the corresponding
+ * strided function. The tenant index and the field must fit within a record and must not overlap.
+ *
+ * These functions return 0 on success, or -1 if the layout is invalid, if the field size is not
+ * supported by the mode, or if a tenant index is not lower than `ipcrypts_count`. Records are only
+ * modified on success.
+ */
+
+/**
+ * Initialize `count` contexts from `count` consecutive IPCRYPT_KEYBYTES-byte keys.
+ */
+void ipcrypt_init_many(IPCrypt *ipcrypts, const uint8_t *keys, size_t count);
+
+/**
+ * Initialize `count` contexts from `count` consecutive IPCRYPT_PFX_KEYBYTES-byte keys.
+ */
+void ipcrypt_pfx_init_many(IPCryptPFX *ipcrypts, const uint8_t *keys, size_t count);
+
+/**
+ * Initialize `count` contexts from `count` consecutive IPCRYPT_NDX_KEYBYTES-byte keys.
+ */
+void ipcrypt_ndx_init_many(IPCryptNDX *ipcrypts, const uint8_t *keys, size_t count);
+
+/**
+ * Encrypt 16-byte IP addresses stored within an array of records, each with the key of its tenant.
+ *
+ * `field_bytes` must be 16.
+ */
+int ipcrypt_encrypt_ip16_tenants(const IPCrypt *ipcrypts, size_t ipcrypts_count, void *base,
+                                 size_t count, size_t stride, size_t tenant_offset,
+                                 size_t field_offset, size_t field_bytes);
+
+/**
+ * Decrypt 16-byte IP addresses stored within an array of records, each with the key of its tenant.
+ *
+ * `field_bytes` must be 16.
+ */
+int ipcrypt_decrypt_ip16_tenants(const IPCrypt *ipcrypts, size_t ipcrypts_count, void *base,
+                                 size_t count, size_t stride, size_t tenant_offset,
+                                 size_t field_offset, size_t field_bytes);
+
+/**
+ * Encrypt IP addresses stored within an array of records, with prefix preservation, each with the
+ * key of its tenant.
+ *
+ * `field_bytes` can be 16 (IPv6 or IPv4-mapped addresses) or 4 (raw IPv4 addresses).
+ */
+int ipcrypt_pfx_encrypt_ip16_tenants(const IPCryptPFX *ipcrypts, size_t ipcrypts_count, void *base,
+                                     size_t count, size_t stride, size_t tenant_offset,
+                                     size_t field_offset, size_t field_bytes);
+
+/**
+ * Decrypt IP addresses stored within an array of records, with prefix preservation, each with the
+ * key of its tenant.
+ *
+ * `field_bytes` can be 16 (IPv6 or IPv4-mapped addresses) or 4 (raw IPv4 addresses).
+ */
+int ipcrypt_pfx_decrypt_ip16_tenants(const IPCryptPFX *ipcrypts, size_t ipcrypts_count, void *base,
+                                     size_t count, size_t stride, size_t tenant_offset,
+                                     size_t field_offset, size_t field_bytes);
+
+/**
+ * Non-deterministically encrypt IP addresses stored within an array of records, each with the key
+ * of its tenant.
+ *
+ * `field_bytes` must be IPCRYPT_NDIP_BYTES, and each field must start with a secure random tweak.
+ */
+int ipcrypt_nd_encrypt_ip16_tenants(const IPCrypt *ipcrypts, size_t ipcrypts_count, void *base,
+                                    size_t count, size_t stride, size_t tenant_offset,
+                                    size_t field_offset, size_t field_bytes);
+
+/**
+ * Decrypt IPCRYPT_NDIP_BYTES ciphertexts stored within an array of records, each with the key of
+ * its tenant.
+ */
+int ipcrypt_nd_decrypt_ip16_tenants(const IPCrypt *ipcrypts, size_t ipcrypts_count, void *base,
+                                    size_t count, size_t stride, size_t tenant_offset,
+                                    size_t field_offset, size_t field_bytes);
+
+/**
+ * Non-deterministically encrypt IP addresses stored within an array of records using NDX mode,
+ * each with the key of its tenant.
+ *
+ * `field_bytes` must be IPCRYPT_NDX_NDIP_BYTES, and each field must start with a secure random
+ * tweak.
+ */
+int ipcrypt_ndx_encrypt_ip16_tenants(const IPCryptNDX *ipcrypts, size_t ipcrypts_count,
+                                     void *base, size_t count, size_t stride,
+                                     size_t tenant_offset, size_t field_offset,
+                                     size_t field_bytes);
+
+/**
+ * Decrypt IPCRYPT_NDX_NDIP_BYTES ciphertexts stored within an array of records, each with the key
+ * of its tenant.
+ */
+int ipcrypt_ndx_decrypt_ip16_tenants(const IPCryptNDX *ipcrypts, size_t ipcrypts_count,
+                                     void *base, size_t count, size_t stride,
+                                     size_t tenant_offset, size_t field_offset,
+                                     size_t field_bytes);
+
+/* -------- Shared-tweak sessions -------- */
+
+/*
+ * A session precomputes the state that depends on a tweak, so that many addresses can be encrypted
+ * with the same tweak, for example one random tweak per batch or per file. ND sessions fold the
+ * tweak into the round keys, and NDX sessions encrypt it once: both encrypt an address with a
+ * single AES operation.
+ *
+ * The output is identical to calling ipcrypt_nd_encrypt_ip16() or ipcrypt_ndx_encrypt_ip16() with
+ * the tweak of the session. Since the tweak is shared, identical addresses of a session have
+ * identical ciphertexts: sessions only make ciphertexts unlinkable across sessions.
+ *
+ * The strided functions accept 16-byte fields, holding addresses encrypted in-place, or fields in
+ * the format of the single-address functions (IPCRYPT_NDIP_BYTES or IPCRYPT_NDX_NDIP_BYTES), that
+ * start with the tweak. When encrypting such fields, the tweak of the session is written to every
+ * field. When decrypting them, every tweak must match the tweak of the session.
+ *
+ * These functions return 0 on success, or -1 if the layout is invalid, or if a tweak doesn't
+ * match. Records are only modified on success.
+ */
+
+/**
+ * Session of the ND mode, for a context and a tweak. Created with ipcrypt_nd_session_init().
+ */
+typedef struct IPCryptNDSession {
+    uint8_t opaque[16U * 21];
+} IPCryptNDSession;
+
+/**
+ * Session of the NDX mode, for a context and a tweak. Created with ipcrypt_ndx_session_init().
+ */
+typedef struct IPCryptNDXSession {
+    uint8_t opaque[16U * 21];
+} IPCryptNDXSession;
+
+/**
+ * Initialize an ND session, for the context `ipcrypt` and the 8-byte tweak `random`.
+ * The session doesn't reference the context, that can be deinitialized.
+ */
+void ipcrypt_nd_session_init(IPCryptNDSession *session, const IPCrypt *ipcrypt,
+                             const uint8_t random[IPCRYPT_TWEAKBYTES]);
+
+/**
+ * Securely clear an ND session.
+ */
+void ipcrypt_nd_session_deinit(IPCryptNDSession *session);
+
+/**
+ * Encrypt a 16-byte IP address with the tweak of the session, like ipcrypt_nd_encrypt_ip16().
+ */
+void ipcrypt_nd_session_encrypt_ip16(const IPCryptNDSession *session,
+                                     uint8_t ndip[IPCRYPT_NDIP_BYTES], const uint8_t ip16[16]);
+
+/**
+ * Decrypt the output of ipcrypt_nd_encrypt_ip16(), if its tweak is the tweak of the session.
+ */
+int ipcrypt_nd_session_decrypt_ip16(const IPCryptNDSession *session, uint8_t ip16[16],
+                                    const uint8_t ndip[IPCRYPT_NDIP_BYTES]);
+
+/**
+ * Encrypt IP addresses stored within an array of records, in-place, with the tweak of the session.
+ *
+ * `field_bytes` must be 16 or IPCRYPT_NDIP_BYTES.
+ */
+int ipcrypt_nd_session_encrypt_ip16_strided(const IPCryptNDSession *session, void *base,
+                                            size_t count, size_t stride, const size_t *offsets,
+                                            size_t offsets_count, size_t field_bytes);
+
+/**
+ * Decrypt IP addresses stored within an array of records, in-place, with the tweak of the session.
+ *
+ * `field_bytes` must be 16 or IPCRYPT_NDIP_BYTES.
+ */
+int ipcrypt_nd_session_decrypt_ip16_strided(const IPCryptNDSession *session, void *base,
+                                            size_t count, size_t stride, const size_t *offsets,
+                                            size_t offsets_count, size_t field_bytes);
+
+/**
+ * Initialize an NDX session, for the context `ipcrypt` and the 16-byte tweak `random`.
+ * The session doesn't reference the context, that can be deinitialized.
+ */
+void ipcrypt_ndx_session_init(IPCryptNDXSession *session, const IPCryptNDX *ipcrypt,
+                              const uint8_t random[IPCRYPT_NDX_TWEAKBYTES]);
+
+/**
+ * Securely clear an NDX session.
+ */
+void ipcrypt_ndx_session_deinit(IPCryptNDXSession *session);
+
+/**
+ * Encrypt a 16-byte IP address with the tweak of the session, like ipcrypt_ndx_encrypt_ip16().
+ */
+void ipcrypt_ndx_session_encrypt_ip16(const IPCryptNDXSession *session,
+                                      uint8_t ndip[IPCRYPT_NDX_NDIP_BYTES], const uint8_t ip16[16]);
+
+/**
+ * Decrypt the output of ipcrypt_ndx_encrypt_ip16(), if its tweak is the tweak of the session.
+ */
+int ipcrypt_ndx_session_decrypt_ip16(const IPCryptNDXSession *session, uint8_t ip16[16],
+                                     const uint8_t ndip[IPCRYPT_NDX_NDIP_BYTES]);
+
+/**
+ * Encrypt IP addresses stored within an array of records, in-place, with the tweak of the session.
+ *
+ * `field_bytes` must be 16 or IPCRYPT_NDX_NDIP_BYTES.
+ */
+int ipcrypt_ndx_session_encrypt_ip16_strided(const IPCryptNDXSession *session, void *base,
+                                             size_t count, size_t stride, const size_t *offsets,
+                                             size_t offsets_count, size_t field_bytes);
+
+/**
+ * Decrypt IP addresses stored within an array of records, in-place, with the tweak of the session.
+ *
+ * `field_bytes` must be 16 or IPCRYPT_NDX_NDIP_BYTES.
+ */
+int ipcrypt_ndx_session_decrypt_ip16_strided(const IPCryptNDXSession *session, void *base,
+                                             size_t count, size_t stride, const size_t *offsets,
+                                             size_t offsets_count, size_t field_bytes);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,404 @@
+#ifndef ipcrypt2_HPP
+#define ipcrypt2_HPP
+
+/*
+ * C++20 interface.
+ *
+ * Modes are policies: Cipher<mode::Deterministic>, Cipher<mode::Pfx>, Cipher<mode::Nd> and
+ * Cipher<mode::Ndx> call the functions of their mode directly, without virtual dispatch. A Cipher
+ * owns its context, and wipes it with the matching *_deinit() function when it is destroyed.
+ *
+ * Keys, addresses, tweaks and ciphertexts are fixed-size arrays, whose sizes come from the
+ * IPCRYPT_* constants, so that buffers are sized at compile time. Batch functions take spans of
+ * them, and use the strided batch functions of the library. Spans of different lengths are never
+ * overrun: batch functions process as many elements as the shortest span holds, and return their
+ * number.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+#include "ipcrypt2.h"
+
+namespace ipcrypt2 {
+
+/** A 16-byte IP address, as produced by ipcrypt_str_to_ip16(). */
+using Address = std::array<std::uint8_t, 16>;
+
+namespace mode {
+
+    /** Format-preserving deterministic encryption. */
+    struct Deterministic {
+        using Context = IPCrypt;
+
+        static constexpr IPCryptMode id               = IPCRYPT_MODE_DETERMINISTIC;
+        static constexpr std::size_t key_bytes        = IPCRYPT_KEYBYTES;
+        static constexpr std::size_t tweak_bytes      = 0;
+        static constexpr std::size_t ciphertext_bytes = 16;
+
+        static void init(Context *ctx, const std::uint8_t *key) noexcept
+        {
+            ipcrypt_init(ctx, key);
+        }
+        static void deinit(Context *ctx) noexcept
+        {
+            ipcrypt_deinit(ctx);
+        }
+        static void encrypt(const Context *ctx, std::uint8_t *ip16) noexcept
+        {
+            ipcrypt_encrypt_ip16(ctx, ip16);
+        }
+        static void decrypt(const Context *ctx, std::uint8_t *ip16) noexcept
+        {
+            ipcrypt_decrypt_ip16(ctx, ip16);
+        }
+        static int encrypt_strided(const Context *ctx, void *base, std::size_t count,
+                                   std::size_t stride, const std::size_t *offsets,
+                                   std::size_t offsets_count, std::size_t field_bytes) noexcept
+        {
+            return ipcrypt_encrypt_ip16_strided(ctx, base, count, stride, offsets, offsets_count,
+                                                field_bytes);
+        }
+        static int decrypt_strided(const Context *ctx, void *base, std::size_t count,
+                                   std::size_t stride, const std::size_t *offsets,
+                                   std::size_t offsets_count, std::size_t field_bytes) noexcept
+        {
+            return ipcrypt_decrypt_ip16_strided(ctx, base, count, stride, offsets, offsets_count,
+                                                field_bytes);
+        }
+    };
+
+    /** Prefix-preserving encryption. */
+    struct Pfx {
+        using Context = IPCryptPFX;
+
+        static constexpr IPCryptMode id               = IPCRYPT_MODE_PFX;
+        static constexpr std::size_t key_bytes        = IPCRYPT_PFX_KEYBYTES;
+        static constexpr std::size_t tweak_bytes      = 0;
+        static constexpr std::size_t ciphertext_bytes = 16;
+
+        static void init(Context *ctx, const std::uint8_t *key) noexcept
+        {
+            ipcrypt_pfx_init(ctx, key);
+        }
+        static void deinit(Context *ctx) noexcept
+        {
+            ipcrypt_pfx_deinit(ctx);
+        }
+        static void encrypt(const Context *ctx, std::uint8_t *ip16) noexcept
+        {
+            ipcrypt_pfx_encrypt_ip16(ctx, ip16);
+        }
+        static void decrypt(const Context *ctx, std::uint8_t *ip16) noexcept
+        {
+            ipcrypt_pfx_decrypt_ip16(ctx, ip16);
+        }
+        static int encrypt_strided(const Context *ctx, void *base, std::size_t count,
+                                   std::size_t stride, const std::size_t *offsets,
+                                   std::size_t offsets_count, std::size_t field_bytes) noexcept
+        {
+            return ipcrypt_pfx_encrypt_ip16_strided(ctx, base, count, stride, offsets,
+                                                    offsets_count, field_bytes);
+        }
+        static int decrypt_strided(const Context *ctx, void *base, std::size_t count,
+                                   std::size_t stride, const std::size_t *offsets,
+                                   std::size_t offsets_count, std::size_t field_bytes) noexcept
+        {
+            return ipcrypt_pfx_decrypt_ip16_strided(ctx, base, count, stride, offsets,
+                                                    offsets_count, field_bytes);
+        }
+    };
+
+    /** Non-deterministic encryption with an 8-byte tweak (KIASU-BC). */
+    struct Nd {
+        using Context = IPCrypt;
+
+        static constexpr IPCryptMode id               = IPCRYPT_MODE_ND;
+        static constexpr std::size_t key_bytes        = IPCRYPT_KEYBYTES;
+        static constexpr std::size_t tweak_bytes      = IPCRYPT_TWEAKBYTES;
+        static constexpr std::size_t ciphertext_bytes = IPCRYPT_NDIP_BYTES;
+
+        static void init(Context *ctx, const std::uint8_t *key) noexcept
+        {
+            ipcrypt_init(ctx, key);
+        }
+        static void deinit(Context *ctx) noexcept
+        {
+            ipcrypt_deinit(ctx);
+        }
+        static void encrypt(const Context *ctx, std::uint8_t *ndip, const std::uint8_t *ip16,
+                            const std::uint8_t *random) noexcept
+        {
+            ipcrypt_nd_encrypt_ip16(ctx, ndip, ip16, random);
+        }
+        static void decrypt(const Context *ctx, std::uint8_t *ip16,
+                            const std::uint8_t *ndip) noexcept
+        {
+            ipcrypt_nd_decrypt_ip16(ctx, ip16, ndip);
+        }
+        static int encrypt_strided(const Context *ctx, void *base, std::size_t count,
+                                   std::size_t stride, const std::size_t *offsets,
+                                   std::size_t offsets_count, std::size_t field_bytes) noexcept
+        {
+            return ipcrypt_nd_encrypt_ip16_strided(ctx, base, count, stride, offsets,
+                                                   offsets_count, field_bytes);
+        }
+        static int decrypt_strided(const Context *ctx, void *base, std::size_t count,
+                                   std::size_t stride, const std::size_t *offsets,
+                                   std::size_t offsets_count, std::size_t field_bytes) noexcept
+        {
+            return ipcrypt_nd_decrypt_ip16_strided(ctx, base, count, stride, offsets,
+                                                   offsets_count, field_bytes);
+        }
+    };
+
+    /** Non-deterministic encryption with a 16-byte tweak (AES-XTX). */
+    struct Ndx {
+        using Context = IPCryptNDX;
+
+        static constexpr IPCryptMode id               = IPCRYPT_MODE_NDX;
+        static constexpr std::size_t key_bytes        = IPCRYPT_NDX_KEYBYTES;
+        static constexpr std::size_t tweak_bytes      = IPCRYPT_NDX_TWEAKBYTES;
+        static constexpr std::size_t ciphertext_bytes = IPCRYPT_NDX_NDIP_BYTES;
+
+        static void init(Context *ctx, const std::uint8_t *key) noexcept
+        {
+            ipcrypt_ndx_init(ctx, key);
+        }
+        static void deinit(Context *ctx) noexcept
+        {
+            ipcrypt_ndx_deinit(ctx);
+        }
+        static void encrypt(const Context *ctx, std::uint8_t *ndip, const std::uint8_t *ip16,
+                            const std::uint8_t *random) noexcept
+        {
+            ipcrypt_ndx_encrypt_ip16(ctx, ndip, ip16, random);
+        }
+        static void decrypt(const Context *ctx, std::uint8_t *ip16,
+                            const std::uint8_t *ndip) noexcept
+        {
+            ipcrypt_ndx_decrypt_ip16(ctx, ip16, ndip);
+        }
+        static int encrypt_strided(const Context *ctx, void *base, std::size_t count,
+                                   std::size_t stride, const std::size_t *offsets,
+                                   std::size_t offsets_count, std::size_t field_bytes) noexcept
+        {
+            return ipcrypt_ndx_encrypt_ip16_strided(ctx, base, count, stride, offsets,
+                                                    offsets_count, field_bytes);
+        }
+        static int decrypt_strided(const Context *ctx, void *base, std::size_t count,
+                                   std::size_t stride, const std::size_t *offsets,
+                                   std::size_t offsets_count, std::size_t field_bytes) noexcept
+        {
+            return ipcrypt_ndx_decrypt_ip16_strided(ctx, base, count, stride, offsets,
+                                                    offsets_count, field_bytes);
+        }
+    };
+
+}
+
+/** Modes whose ciphertexts are addresses: deterministic and prefix-preserving. */
+template <typename Mode>
+concept FormatPreserving = Mode::tweak_bytes == 0 && Mode::ciphertext_bytes == 16;
+
+/** Modes whose ciphertexts are a random tweak followed by an encrypted address. */
+template <typename Mode>
+concept NonDeterministic = Mode::tweak_bytes > 0 && Mode::ciphertext_bytes ==
+                                                        Mode::tweak_bytes + 16;
+
+/**
+ * Cipher owns a context for `Mode`.
+ *
+ * Contexts are not copyable: copies of key material would have to be wiped as well. A Cipher can
+ * be shared between threads, as all its operations are const.
+ */
+template <typename Mode>
+class Cipher {
+public:
+    using Context    = typename Mode::Context;
+    using Key        = std::array<std::uint8_t, Mode::key_bytes>;
+    using Tweak      = std::array<std::uint8_t, Mode::tweak_bytes>;
+    using Ciphertext = std::array<std::uint8_t, Mode::ciphertext_bytes>;
+
+    static_assert(sizeof(Address) == 16 && sizeof(Ciphertext) == Mode::ciphertext_bytes,
+                  "arrays of addresses and ciphertexts must be contiguous");
+
+    explicit Cipher(std::span<const std::uint8_t, Mode::key_bytes> key) noexcept
+    {
+        Mode::init(&ctx_, key.data());
+    }
+
+    ~Cipher()
+    {
+        Mode::deinit(&ctx_);
+    }
+
+    Cipher(const Cipher &)            = delete;
+    Cipher &operator=(const Cipher &) = delete;
+
+    /** The underlying context, for the functions of the C API. */
+    const Context *context() const noexcept
+    {
+        return &ctx_;
+    }
+
+    /** Encrypt an address. */
+    Address encrypt(const Address &ip) const noexcept
+        requires FormatPreserving<Mode>
+    {
+        Address out = ip;
+
+        Mode::encrypt(&ctx_, out.data());
+        return out;
+    }
+
+    /** Decrypt an address. */
+    Address decrypt(const Address &ip) const noexcept
+        requires FormatPreserving<Mode>
+    {
+        Address out = ip;
+
+        Mode::decrypt(&ctx_, out.data());
+        return out;
+    }
+
+    /** Encrypt an address with a tweak, that must be random. */
+    Ciphertext encrypt(const Address &ip, const Tweak &random) const noexcept
+        requires NonDeterministic<Mode>
+    {
+        Ciphertext out;
+
+        Mode::encrypt(&ctx_, out.data(), ip.data(), random.data());
+        return out;
+    }
+
+    /** Decrypt a ciphertext. */
+    Address decrypt(const Ciphertext &ciphertext) const noexcept
+        requires NonDeterministic<Mode>
+    {
+        Address out;
+
+        Mode::decrypt(&ctx_, out.data(), ciphertext.data());
+        return out;
+    }
+
+    /** Encrypt addresses in-place. */
+    void encrypt(std::span<Address> ips) const noexcept
+        requires FormatPreserving<Mode>
+    {
+        static constexpr std::size_t offset = 0;
+
+        (void) Mode::encrypt_strided(&ctx_, ips.data(), ips.size(), sizeof(Address), &offset, 1,
+                                     sizeof(Address));
+    }
+
+    /** Decrypt addresses in-place. */
+    void decrypt(std::span<Address> ips) const noexcept
+        requires FormatPreserving<Mode>
+    {
+        static constexpr std::size_t offset = 0;
+
+        (void) Mode::decrypt_strided(&ctx_, ips.data(), ips.size(), sizeof(Address), &offset, 1,
+                                     sizeof(Address));
+    }
+
+    /**
+     * Encrypt `ips` into `out`. Only the first min(ips.size(), out.size()) addresses are
+     * encrypted; returns their number.
+     */
+    std::size_t encrypt(std::span<const Address> ips, std::span<Address> out) const noexcept
+        requires FormatPreserving<Mode>
+    {
+        const std::size_t count = std::min(ips.size(), out.size());
+
+        if (count > 0 && out.data() != ips.data()) {
+            std::memmove(out.data(), ips.data(), count * sizeof(Address));
+        }
+        encrypt(out.first(count));
+        return count;
+    }
+
+    /**
+     * Decrypt `ips` into `out`. Only the first min(ips.size(), out.size()) addresses are
+     * decrypted; returns their number.
+     */
+    std::size_t decrypt(std::span<const Address> ips, std::span<Address> out) const noexcept
+        requires FormatPreserving<Mode>
+    {
+        const std::size_t count = std::min(ips.size(), out.size());
+
+        if (count > 0 && out.data() != ips.data()) {
+            std::memmove(out.data(), ips.data(), count * sizeof(Address));
+        }
+        decrypt(out.first(count));
+        return count;
+    }
+
+    /**
+     * Encrypt `ips` into `out`, with one random tweak per address. Only the first
+     * min(ips.size(), random.size(), out.size()) addresses are encrypted; returns their number.
+     */
+    std::size_t encrypt(std::span<const Address> ips, std::span<const Tweak> random,
+                        std::span<Ciphertext> out) const noexcept
+        requires NonDeterministic<Mode>
+    {
+        static constexpr std::size_t offset = 0;
+        const std::size_t            count  = std::min({ ips.size(), random.size(), out.size() });
+
+        for (std::size_t i = 0; i < count; i++) {
+            std::memcpy(out[i].data(), random[i].data(), Mode::tweak_bytes);
+            std::memcpy(out[i].data() + Mode::tweak_bytes, ips[i].data(), sizeof(Address));
+        }
+        (void) Mode::encrypt_strided(&ctx_, out.data(), count, sizeof(Ciphertext), &offset, 1,
+                                     sizeof(Ciphertext));
+        return count;
+    }
+
+    /**
+     * Decrypt `ciphertexts` into `out`. Only the first min(ciphertexts.size(), out.size())
+     * ciphertexts are decrypted; returns their number.
+     *
+     * Ciphertexts are decrypted in batches, in a copy on the stack, as the strided functions
+     * decrypt in-place.
+     */
+    std::size_t decrypt(std::span<const Ciphertext> ciphertexts,
+                        std::span<Address> out) const noexcept
+        requires NonDeterministic<Mode>
+    {
+        static constexpr std::size_t       offset = 0;
+        std::array<Ciphertext, batch_size> batch;
+        const std::size_t                  count = std::min(ciphertexts.size(), out.size());
+        std::size_t                        n;
+
+        for (std::size_t i = 0; i < count; i += n) {
+            n = std::min(count - i, batch.size());
+            std::memcpy(batch.data(), ciphertexts.data() + i, n * sizeof(Ciphertext));
+            (void) Mode::decrypt_strided(&ctx_, batch.data(), n, sizeof(Ciphertext), &offset, 1,
+                                         sizeof(Ciphertext));
+            for (std::size_t j = 0; j < n; j++) {
+                std::memcpy(out[i + j].data(), batch[j].data() + Mode::tweak_bytes,
+                            sizeof(Address));
+            }
+        }
+        return count;
+    }
+
+private:
+    /** Number of ciphertexts decrypted together. */
+    static constexpr std::size_t batch_size = 64;
+
+    Context ctx_;
+};
+
+using DeterministicCipher = Cipher<mode::Deterministic>;
+using PfxCipher           = Cipher<mode::Pfx>;
+using NdCipher            = Cipher<mode::Nd>;
+using NdxCipher           = Cipher<mode::Ndx>;
+
+}
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef ipcrypt2_blob_H
+#define ipcrypt2_blob_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ipcrypt2.h"
+#include "ipcrypt2_keyring.h"
+
+/*
+ * Optional binary blobs of expanded contexts.
+ *
+ * A blob holds initialized IPCrypt, IPCryptPFX and IPCryptNDX contexts, each identified by a mode
+ * and a key ID. A process expands its keys once, and exports the contexts into a blob, typically
+ * in shared memory (a POSIX shared memory object or a memfd). Worker processes map the blob
+ * read-only, and use the contexts in place, without any key setup or copy.
+ *
+ * Contexts contain the whole expanded state that encryption and decryption need: decryption
+ * derives its round keys on the fly, and no tables are precomputed, so there is nothing else to
+ * share.
+ *
+ * A blob starts with a header, followed by a table of entries and by the contexts. All integers
+ * are little-endian, except the byte order mark.
+ *
+ *   offset  size  header field
+ *        0     8  magic, "IPC2CTX" followed by a zero byte
+ *        8     2  version, 1
+ *       10     2  header size, 64
+ *       12     4  byte order mark, 0x01020304 in the byte order of the writer
+ *       16     4  number of entries
+ *       20     4  reserved, 0
+ *       24     8  size of the blob, in bytes
+ *       32     8  checksum of the blob, computed with this field set to 0
+ *       40    24  reserved, 0
+ *
+ * Every entry of the table is 16 bytes long: the key ID (4 bytes), the mode (1 byte), 3 reserved
+ * bytes, the offset of the context (4 bytes) and its size (4 bytes). Contexts are aligned to
+ * IPCRYPT_BLOB_ALIGN bytes.
+ *
+ * Contexts are stored as they are in memory, so a blob can only be used by the same version of the
+ * library, on a system with the same byte order. The checksum (64-bit FNV-1a) detects truncated or
+ * corrupted blobs; it is not a MAC. Blobs contain expanded secret keys, and must be protected like
+ * the keys themselves.
+ */
+
+/** Size of the header. The table of entries starts at this offset. */
+#define IPCRYPT_BLOB_HEADER_BYTES 64U
+
+/** Size of an entry of the table. */
+#define IPCRYPT_BLOB_ENTRY_BYTES 16U
+
+/** Alignment of the contexts within a blob. */
+#define IPCRYPT_BLOB_ALIGN 64U
+
+/** Flag for ipcrypt_blob_map(): wipe the blob when it is closed. */
+#define IPCRYPT_BLOB_WIPE_ON_CLOSE 1U
+
+/**
+ * Context of a blob, with its mode and key ID.
+ *
+ * `ctx` points to an IPCrypt for the deterministic and ND modes, to an IPCryptPFX for the PFX mode,
+ * and to an IPCryptNDX for the NDX mode.
+ */
+typedef struct IPCryptBlobEntry {
+    uint32_t    key_id;
+    IPCryptMode mode;
+    const void *ctx;
+} IPCryptBlobEntry;
+
+/**
+ * Validated blob, in memory or mapped from a file. Created with ipcrypt_blob_open() or
+ * ipcrypt_blob_map().
+ */
+typedef struct IPCryptBlob IPCryptBlob;
+
+/**
+ * Return the size of a blob holding the `count` contexts of `entries`, or 0 if a mode is invalid.
+ */
+size_t ipcrypt_blob_size(const IPCryptBlobEntry *entries, size_t count);
+
+/**
+ * Export the `count` contexts of `entries` into the blob `blob`, of `blob_len` bytes.
+ *
+ * Returns the size of the blob, or 0 if a mode is invalid, or if `blob_len` is too small.
+ */
+size_t ipcrypt_blob_export(void *blob, size_t blob_len, const IPCryptBlobEntry *entries,
+                           size_t count);
+
+/**
+ * Validate the blob `blob`, of `blob_len` bytes.
+ *
+ * The blob is not copied, and must remain valid and unchanged until ipcrypt_blob_close() is called.
+ * Returns NULL if the blob is invalid, or if memory could not be allocated.
+ */
+IPCryptBlob *ipcrypt_blob_open(const void *blob, size_t blob_len);
+
+/**
+ * Free a blob. A blob mapped with IPCRYPT_BLOB_WIPE_ON_CLOSE is wiped, then unmapped.
+ * Contexts of the blob must not be used afterwards.
+ */
+void ipcrypt_blob_close(IPCryptBlob *blob);
+
+/**
+ * Return the number of contexts of a blob.
+ */
+size_t ipcrypt_blob_count(const IPCryptBlob *blob);
+
+/**
+ * Store the context `index` of a blob into `entry`.
+ *
+ * `entry->ctx` points into the blob. Returns 0 on success, or -1 if there is no such context.
+ */
+int ipcrypt_blob_entry(const IPCryptBlob *blob, size_t index, IPCryptBlobEntry *entry);
+
+/**
+ * Return a pointer to the context for `mode` and `key_id` in a blob, or NULL if there is none.
+ *
+ * The pointer can be cast to the context type of the mode, and used directly with the functions of
+ * that mode, by any number of threads.
+ */
+const void *ipcrypt_blob_find(const IPCryptBlob *blob, IPCryptMode mode, uint32_t key_id);
+
+/**
+ * Add the contexts of a blob that have the mode of `keyring` to the keyring, without expanding any
+ * key. The current key of the keyring is not changed.
+ *
+ * Returns the number of contexts added, or -1 if a context could not be added.
+ */
+int ipcrypt_blob_load_keyring(const IPCryptBlob *blob, IPCryptKeyring *keyring);
+
+/**
+ * Securely erase `len` bytes at `blob`, such as a blob exported into memory that is not needed
+ * anymore.
+ */
+void ipcrypt_blob_wipe(void *blob, size_t len);
+
+#ifndef _WIN32
+/**
+ * Export the `count` contexts of `entries` into the file `fd`, opened for reading and writing,
+ * such as a POSIX shared memory object. The file is resized to the size of the blob, and the blob
+ * is written through a shared mapping, without an intermediate copy.
+ *
+ * Returns 0 on success, or -1 with errno set on error.
+ */
+int ipcrypt_blob_write(int fd, const IPCryptBlobEntry *entries, size_t count);
+
+/**
+ * Map the blob stored in the file `fd`, and validate it. The file descriptor can be closed
+ * afterwards.
+ *
+ * The blob is mapped read-only and shared, so that processes mapping the same file share the same
+ * physical pages, and never hold private copies of the keys. On Linux, the mapping is excluded from
+ * core dumps.
+ *
+ * With the IPCRYPT_BLOB_WIPE_ON_CLOSE flag, `fd` must be opened for reading and writing, and the
+ * blob is erased by ipcrypt_blob_close(), for every process sharing it. This is meant for the last
+ * user of the blob, usually the process that exported it.
+ *
+ * Returns NULL with errno set if the blob is invalid, or on error.
+ */
+IPCryptBlob *ipcrypt_blob_map(int fd, unsigned int flags);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
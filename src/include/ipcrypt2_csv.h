@@ -0,0 +1,121 @@
+#ifndef ipcrypt2_csv_H
+#define ipcrypt2_csv_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ipcrypt2.h"
+#include "ipcrypt2_pool.h"
+
+/*
+ * Optional anonymizer for the address columns of large CSV and TSV files.
+ *
+ * The input is split into segments of about IPCRYPT_CSV_SEGMENT_BYTES, cut at record boundaries,
+ * that are processed in parallel by a thread pool. Every segment produces its own output, and the
+ * outputs are written in order, so that addresses can be replaced with text of any length, such
+ * as the hex strings of the ND and NDX modes, without a second pass.
+ *
+ * Records end with a newline that is not enclosed in double quotes. Fields are separated by a
+ * delimiter that is not enclosed in double quotes. A field of a selected column that holds an
+ * address, optionally enclosed in double quotes, is replaced with the same text as the
+ * ipcrypt_*_encrypt_ip_str() functions of the mode. Other fields, and fields of selected columns
+ * that don't hold an address, are copied verbatim.
+ *
+ * A decryptor restores the addresses, and copies fields that can't be decrypted verbatim.
+ */
+
+/** Approximate size of the input segments processed by a worker at a time, in bytes. */
+#define IPCRYPT_CSV_SEGMENT_BYTES (1U << 20)
+
+/** Maximum number of columns that can be selected. Columns are numbered from 0. */
+#define IPCRYPT_CSV_MAX_COLUMNS 1024U
+
+/** Copy the first record unchanged. */
+#define IPCRYPT_CSV_HEADER 0x1U
+
+/** Decrypt the selected columns, instead of encrypting them. */
+#define IPCRYPT_CSV_DECRYPT 0x2U
+
+/**
+ * CSV anonymizer. Created with ipcrypt_csv_create().
+ */
+typedef struct IPCryptCsv IPCryptCsv;
+
+/**
+ * Function filling `len` bytes at `buf` with secure random bytes. It is called concurrently by
+ * the workers of the thread pool, and must be thread-safe.
+ * Called with the `opaque` pointer given to ipcrypt_csv_create().
+ */
+typedef void (*IPCryptCsvRandomFn)(void *opaque, uint8_t *buf, size_t len);
+
+/**
+ * Function writing `len` bytes of output. Returns 0 on success, or -1 to abort processing.
+ * Called from the thread that called ipcrypt_csv_process(), with the output in order.
+ */
+typedef int (*IPCryptCsvWriteFn)(void *opaque, const char *buf, size_t len);
+
+/**
+ * Statistics about a processed file.
+ */
+typedef struct IPCryptCsvStats {
+    /** Number of records, including the header. */
+    uint64_t records;
+    /** Number of fields that were encrypted or decrypted. */
+    uint64_t fields;
+    /** Number of non-empty fields of the selected columns that were copied verbatim. */
+    uint64_t invalid_fields;
+} IPCryptCsvStats;
+
+/**
+ * Create a CSV anonymizer for the given mode.
+ *
+ * `key_len` must be the key size of the mode: IPCRYPT_KEYBYTES for the deterministic and ND modes,
+ * IPCRYPT_PFX_KEYBYTES or IPCRYPT_NDX_KEYBYTES for the PFX and NDX modes.
+ * `columns` lists the `columns_count` columns holding addresses, all below
+ * IPCRYPT_CSV_MAX_COLUMNS. `delimiter` is usually ',' or '\t', and can't be a double quote or a
+ * newline. `flags` is a combination of IPCRYPT_CSV_HEADER and IPCRYPT_CSV_DECRYPT.
+ * `random` is required to encrypt with the ND and NDX modes, and ignored otherwise.
+ *
+ * Returns NULL if the parameters are invalid or if memory could not be allocated.
+ */
+IPCryptCsv *ipcrypt_csv_create(IPCryptMode mode, const uint8_t *key, size_t key_len,
+                               char delimiter, const size_t *columns, size_t columns_count,
+                               unsigned int flags, IPCryptCsvRandomFn random, void *opaque);
+
+/**
+ * Free the CSV anonymizer, and securely erase the key.
+ */
+void ipcrypt_csv_destroy(IPCryptCsv *csv);
+
+/**
+ * Process the `in_len` bytes of the whole file at `in`, and pass the output to `write`, in order.
+ *
+ * Segments are processed by the workers of `pool`, or by the calling thread if `pool` is NULL.
+ * The anonymizer is only read, and can be used by multiple threads. Statistics are stored into
+ * `stats`, if not NULL.
+ *
+ * Returns 0 on success, or -1 if memory could not be allocated, or if `write` returned -1.
+ */
+int ipcrypt_csv_process(const IPCryptCsv *csv, IPCryptPool *pool, const char *in, size_t in_len,
+                        IPCryptCsvWriteFn write, void *opaque, IPCryptCsvStats *stats);
+
+#ifndef _WIN32
+/**
+ * Map the regular file `in_fd` into memory, process it with ipcrypt_csv_process(), and write the
+ * output to `out_fd`.
+ *
+ * Returns 0 on success, or -1 with errno set on error.
+ */
+int ipcrypt_csv_process_file(const IPCryptCsv *csv, IPCryptPool *pool, int in_fd, int out_fd,
+                             IPCryptCsvStats *stats);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
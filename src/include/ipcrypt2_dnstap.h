@@ -0,0 +1,104 @@
+#ifndef ipcrypt2_dnstap_H
+#define ipcrypt2_dnstap_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ipcrypt2.h"
+
+/*
+ * Optional dnstap anonymizer.
+ *
+ * Rewrites the `query_address` and `response_address` fields of the dnstap messages of a Frame
+ * Streams stream, in-place. Protobuf messages are walked without being decoded: the fields are
+ * located, and their 4 or 16 bytes are replaced with the encrypted address. Lengths don't change,
+ * so that nothing has to be re-encoded, and the output is exactly as long as the input.
+ *
+ * The stream is processed in buffers of any size. The complete frames at the beginning of a buffer
+ * are rewritten, and the caller keeps the bytes that follow them, to process them again at the
+ * beginning of the next buffer, followed by more data.
+ *
+ * Control frames are copied verbatim. Data frames longer than IPCRYPT_DNSTAP_MAX_FRAME_BYTES, and
+ * data frames that are not valid dnstap messages, are copied verbatim as well.
+ *
+ * Addresses are encrypted with the PFX mode, or with the deterministic mode, whose handling of
+ * IPv4 addresses is described in ipcrypt2_packet.h.
+ */
+
+/** Frames longer than this are copied without being parsed. */
+#define IPCRYPT_DNSTAP_MAX_FRAME_BYTES (256U * 1024U)
+
+/** Minimum buffer size for every frame of up to IPCRYPT_DNSTAP_MAX_FRAME_BYTES to be parsed. */
+#define IPCRYPT_DNSTAP_BUFFER_BYTES (IPCRYPT_DNSTAP_MAX_FRAME_BYTES + 8U)
+
+/**
+ * dnstap anonymizer. Created with ipcrypt_dnstap_create().
+ */
+typedef struct IPCryptDnstap IPCryptDnstap;
+
+/**
+ * Statistics about the stream processed so far.
+ */
+typedef struct IPCryptDnstapStats {
+    /** Number of data frames. */
+    uint64_t frames;
+    /** Number of control frames. */
+    uint64_t control_frames;
+    /** Number of data frames copied verbatim, because they were too long or invalid. */
+    uint64_t skipped_frames;
+    /** Number of addresses that were rewritten. */
+    uint64_t addresses;
+} IPCryptDnstapStats;
+
+/**
+ * Create a dnstap anonymizer for the PFX or the deterministic mode, to process a single stream.
+ *
+ * `key_len` must be IPCRYPT_PFX_KEYBYTES for the PFX mode, or IPCRYPT_KEYBYTES for the
+ * deterministic mode.
+ *
+ * Returns NULL if the parameters are invalid or if memory could not be allocated.
+ */
+IPCryptDnstap *ipcrypt_dnstap_create(IPCryptMode mode, const uint8_t *key, size_t key_len);
+
+/**
+ * Free the dnstap anonymizer, and securely erase the key.
+ */
+void ipcrypt_dnstap_destroy(IPCryptDnstap *dnstap);
+
+/**
+ * Encrypt the addresses of the complete frames at the beginning of `buf`, in-place.
+ *
+ * Returns the number of bytes that are done, and can be written out. The remaining `len - ret`
+ * bytes are the beginning of a frame, that must be passed again, at the beginning of the next
+ * buffer. With buffers of at least IPCRYPT_DNSTAP_BUFFER_BYTES, there is always room for a
+ * complete frame. At the end of the stream, the remaining bytes are a truncated frame, and can be
+ * written out unchanged.
+ */
+size_t ipcrypt_dnstap_encrypt(IPCryptDnstap *dnstap, uint8_t *buf, size_t len);
+
+/**
+ * Decrypt the addresses of the complete frames at the beginning of `buf`, in-place.
+ *
+ * Same as ipcrypt_dnstap_encrypt(). In the deterministic mode, IPv4 addresses are left untouched.
+ */
+size_t ipcrypt_dnstap_decrypt(IPCryptDnstap *dnstap, uint8_t *buf, size_t len);
+
+/**
+ * Store the statistics about the stream processed so far into `stats`.
+ */
+void ipcrypt_dnstap_stats(const IPCryptDnstap *dnstap, IPCryptDnstapStats *stats);
+
+/**
+ * Reset the state and the statistics, to process a new stream.
+ */
+void ipcrypt_dnstap_reset(IPCryptDnstap *dnstap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
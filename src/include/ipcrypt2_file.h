@@ -0,0 +1,77 @@
+#ifndef ipcrypt2_file_H
+#define ipcrypt2_file_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ipcrypt2.h"
+
+/*
+ * Optional asynchronous file pipeline, for transforming large files of fixed-size records, such as
+ * re-encrypting archives of binary addresses with a new key.
+ *
+ * The input file is read in blocks, every block is passed to a function that transforms it
+ * in-place, typically with the strided batch functions, and is then written to the output file at
+ * the same offset.
+ *
+ * On Linux, many reads and writes are kept in flight with io_uring, using buffers registered with
+ * the kernel: while a block is transformed, the next blocks are being read, and the previous ones
+ * written. Buffers go from a read to a write and back without being copied. Elsewhere, or when
+ * io_uring is not available, blocks are read and written with pread() and pwrite().
+ *
+ * Only regular files are supported. POSIX systems only.
+ */
+
+/** Size of the blocks, before rounding down to a multiple of the record size. */
+#define IPCRYPT_FILE_BLOCK_BYTES (1U << 20)
+
+/** Number of blocks in flight with io_uring. */
+#define IPCRYPT_FILE_QUEUE_DEPTH 16U
+
+/** Don't use io_uring, even if it is available. */
+#define IPCRYPT_FILE_NO_IO_URING 0x1U
+
+/**
+ * Function transforming a block of `len` bytes in-place. `offset` is the position of the block in
+ * the file. Called with the `ctx` pointer given to ipcrypt_file_process().
+ * Returns 0 on success, or -1 to abort processing.
+ */
+typedef int (*IPCryptFileFn)(void *ctx, uint8_t *block, size_t len, uint64_t offset);
+
+/**
+ * Statistics about a processed file.
+ */
+typedef struct IPCryptFileStats {
+    /** Number of bytes transformed. */
+    uint64_t bytes;
+    /** Number of blocks transformed. */
+    uint64_t blocks;
+    /** 1 if io_uring was used, 0 if pread() and pwrite() were used. */
+    int io_uring;
+} IPCryptFileStats;
+
+/**
+ * Transform the content of the regular file `in_fd`, and write the result to the regular file
+ * `out_fd`. Both descriptors can be the same file, to transform it in-place.
+ *
+ * Blocks are a multiple of `record_bytes` bytes long, so that records are never split, except for
+ * the last block, that holds the rest of the file. Blocks are passed to `fn` in an unspecified
+ * order, one at a time, from the calling thread. The output file is truncated to the size of the
+ * input file.
+ *
+ * `flags` is 0 or IPCRYPT_FILE_NO_IO_URING. Statistics are stored into `stats`, if not NULL.
+ *
+ * Returns 0 on success, or -1 with errno set on error, or if `fn` returned -1.
+ */
+int ipcrypt_file_process(int in_fd, int out_fd, size_t record_bytes, unsigned int flags,
+                         IPCryptFileFn fn, void *ctx, IPCryptFileStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef ipcrypt2_flow_H
+#define ipcrypt2_flow_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ipcrypt2.h"
+
+/*
+ * Optional NetFlow v9 and IPFIX anonymizer, for collectors that forward flow records.
+ *
+ * Rewrites the address information elements of the data records of NetFlow v9 and IPFIX packets,
+ * in-place. The positions of the fields depend on templates sent earlier by the exporter: the
+ * templates of every exporter are cached, and every template is compiled into a plan listing the
+ * offsets of its address fields. Data records are never decoded: the plan is applied to every
+ * record of a data set, and the addresses of a packet are encrypted together with the strided
+ * functions. The packet can then be sent as it is.
+ *
+ * The rewritten information elements are the source, destination, next hop, BGP next hop,
+ * post-NAT and exporter addresses, in their IPv4 (4 bytes) and IPv6 (16 bytes) forms. Fields of
+ * other sizes, enterprise-specific fields, and the scope fields of NetFlow v9 options are left
+ * untouched.
+ *
+ * Data sets whose template is not known yet are left untouched as well, unless the anonymizer is
+ * created with IPCRYPT_FLOW_STRIP_UNKNOWN, in which case they are removed from the packet. They
+ * can contain addresses that would otherwise be forwarded in clear.
+ *
+ * Addresses are encrypted with the PFX mode, which preserves the prefixes that flow analysis
+ * relies on, and is reversible for both address families. The deterministic mode is not
+ * supported, since it merges distinct IPv4 addresses (see ipcrypt2_packet.h).
+ */
+
+/** Maximum number of templates cached by an anonymizer. Templates beyond that are ignored. */
+#define IPCRYPT_FLOW_MAX_TEMPLATES 65536U
+
+/** Flag for ipcrypt_flow_create(): remove the data sets whose template is not known. */
+#define IPCRYPT_FLOW_STRIP_UNKNOWN 1U
+
+/**
+ * NetFlow v9 and IPFIX anonymizer. Created with ipcrypt_flow_create().
+ */
+typedef struct IPCryptFlow IPCryptFlow;
+
+/**
+ * Statistics about the packets processed so far.
+ */
+typedef struct IPCryptFlowStats {
+    /** Number of packets. */
+    uint64_t packets;
+    /** Number of packets left untouched, because they were not valid NetFlow v9 or IPFIX. */
+    uint64_t invalid_packets;
+    /** Number of templates and options templates received, including updates. */
+    uint64_t templates;
+    /** Number of data records. */
+    uint64_t records;
+    /** Number of data sets whose template was not known. */
+    uint64_t unknown_sets;
+    /** Number of addresses that were rewritten. */
+    uint64_t addresses;
+} IPCryptFlowStats;
+
+/**
+ * Create a NetFlow v9 and IPFIX anonymizer for the PFX mode.
+ *
+ * `mode` must be IPCRYPT_MODE_PFX, and `key_len` must be IPCRYPT_PFX_KEYBYTES. `flags` is 0 or
+ * IPCRYPT_FLOW_STRIP_UNKNOWN.
+ *
+ * Returns NULL if the parameters are invalid or if memory could not be allocated.
+ */
+IPCryptFlow *ipcrypt_flow_create(IPCryptMode mode, const uint8_t *key, size_t key_len,
+                                 unsigned int flags);
+
+/**
+ * Free the anonymizer, its templates, and securely erase the key.
+ */
+void ipcrypt_flow_destroy(IPCryptFlow *flow);
+
+/**
+ * Encrypt the addresses of a NetFlow v9 or IPFIX packet, in-place.
+ *
+ * `exporter` is the 16-byte address of the exporter that sent the packet, as returned by
+ * ipcrypt_sockaddr_to_ip16(). Templates are scoped by exporter, and by the source ID or the
+ * observation domain of the packet. `exporter` can be NULL if all the packets come from the same
+ * exporter.
+ *
+ * Templates found in the packet are cached, and apply to the data sets that follow them, in the
+ * same packet and in the next ones.
+ *
+ * Returns the length of the packet after processing. It is `len`, unless data sets were removed
+ * with IPCRYPT_FLOW_STRIP_UNKNOWN. The packet is left untouched, and 0 is returned, if it is not a
+ * valid NetFlow v9 or IPFIX packet. The record count of NetFlow v9 headers is not updated when
+ * data sets are removed.
+ */
+size_t ipcrypt_flow_encrypt(IPCryptFlow *flow, uint8_t *packet, size_t len,
+                            const uint8_t exporter[16]);
+
+/**
+ * Decrypt the addresses of a NetFlow v9 or IPFIX packet, in-place.
+ *
+ * Same as ipcrypt_flow_encrypt(). Templates are not encrypted, and are cached the same way. In
+ * the deterministic mode, IPv4 addresses are left untouched.
+ */
+size_t ipcrypt_flow_decrypt(IPCryptFlow *flow, uint8_t *packet, size_t len,
+                            const uint8_t exporter[16]);
+
+/**
+ * Store the statistics about the packets processed so far into `stats`.
+ */
+void ipcrypt_flow_stats(const IPCryptFlow *flow, IPCryptFlowStats *stats);
+
+/**
+ * Forget all the templates, and reset the statistics.
+ */
+void ipcrypt_flow_reset(IPCryptFlow *flow);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
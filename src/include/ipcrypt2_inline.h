@@ -0,0 +1,361 @@
+#ifndef ipcrypt2_inline_H
+#define ipcrypt2_inline_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ipcrypt2.h"
+
+/*
+ * Inlinable encryption kernels.
+ *
+ * The functions of this header produce exactly the same output as ipcrypt_encrypt_ip16(),
+ * ipcrypt_nd_encrypt_ip16(), ipcrypt_ndx_encrypt_ip16() and ipcrypt_pfx_encrypt_ip16(), but are
+ * defined as `static inline`, so that the compiler can inline them into the caller's loops and
+ * interleave independent blocks, without link-time optimization.
+ *
+ * They read the round keys straight from the context, which must have been initialized by the
+ * library. Contexts should be declared with IPCRYPT_INLINE_ALIGNED, so that round keys can be used
+ * as memory operands; a context that isn't 16-byte aligned is passed to the library instead.
+ *
+ * The kernels are only inlined when the including code is compiled with AES instructions enabled
+ * (`-maes -mssse3` on x86, `-march=armv8-a+crypto` on AArch64). Otherwise, and when
+ * IPCRYPT_SOFTAES is defined, every function calls its library counterpart.
+ */
+
+/** Alignment specifier for contexts used with the inline kernels. */
+#if defined(__cplusplus) && __cplusplus >= 201103L
+#    define IPCRYPT_INLINE_ALIGNED alignas(16)
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#    define IPCRYPT_INLINE_ALIGNED _Alignas(16)
+#elif defined(_MSC_VER)
+#    define IPCRYPT_INLINE_ALIGNED __declspec(align(16))
+#else
+#    define IPCRYPT_INLINE_ALIGNED __attribute__((aligned(16)))
+#endif
+
+#if !defined(IPCRYPT_SOFTAES) && (defined(__x86_64__) || defined(__i386__)) && \
+    defined(__AES__) && defined(__SSSE3__)
+#    define IPCRYPT_INLINE_AESNI 1
+#    include <tmmintrin.h>
+#    include <wmmintrin.h>
+#elif !defined(IPCRYPT_SOFTAES) && defined(__aarch64__) && \
+    (defined(__ARM_FEATURE_AES) || defined(__ARM_FEATURE_CRYPTO))
+#    define IPCRYPT_INLINE_ARMAES 1
+#    include <arm_neon.h>
+#endif
+
+#if defined(IPCRYPT_INLINE_AESNI) || defined(IPCRYPT_INLINE_ARMAES)
+
+/** Number of round keys of an expanded AES-128 key. */
+#    define IPCRYPT_INLINE_RKEYS 11
+
+/**
+ * Run a block for each of the four lanes of the PFX kernel, with `j` set to the lane index.
+ * Lanes are unrolled explicitly, so that their state stays in registers at -O2.
+ */
+#    define IPCRYPT_INLINE_EACH_LANE(j, S) \
+        do {                               \
+            {                              \
+                const size_t j = 0;        \
+                S                          \
+            }                              \
+            {                              \
+                const size_t j = 1;        \
+                S                          \
+            }                              \
+            {                              \
+                const size_t j = 2;        \
+                S                          \
+            }                              \
+            {                              \
+                const size_t j = 3;        \
+                S                          \
+            }                              \
+        } while (0)
+
+#    ifdef IPCRYPT_INLINE_AESNI
+typedef __m128i IPCryptInlineBlock;
+
+#        define IPCRYPT_INLINE_LOAD(p)     _mm_loadu_si128((const __m128i *) (const void *) (p))
+#        define IPCRYPT_INLINE_STORE(p, b) _mm_storeu_si128((__m128i *) (void *) (p), (b))
+#        define IPCRYPT_INLINE_XOR(a, b)   _mm_xor_si128((a), (b))
+#        define IPCRYPT_INLINE_RKEY(rkeys, i) \
+            _mm_load_si128((const __m128i *) (const void *) ((rkeys) + 16 * (i)))
+#    else
+typedef uint8x16_t IPCryptInlineBlock;
+
+#        define IPCRYPT_INLINE_LOAD(p)        vld1q_u8((const uint8_t *) (p))
+#        define IPCRYPT_INLINE_STORE(p, b)    vst1q_u8((uint8_t *) (p), (b))
+#        define IPCRYPT_INLINE_XOR(a, b)      veorq_u8((a), (b))
+#        define IPCRYPT_INLINE_RKEY(rkeys, i) vld1q_u8((rkeys) + 16 * (i))
+#    endif
+
+/**
+ * ipcrypt_inline_aes encrypts a block with the round keys at `rkeys`, each XORed with `tweak`.
+ * With a zero tweak, this is plain AES-128.
+ */
+static inline IPCryptInlineBlock
+ipcrypt_inline_aes(IPCryptInlineBlock t, const uint8_t *rkeys, IPCryptInlineBlock tweak)
+{
+    size_t i;
+
+#    ifdef IPCRYPT_INLINE_AESNI
+    t = IPCRYPT_INLINE_XOR(t, IPCRYPT_INLINE_XOR(tweak, IPCRYPT_INLINE_RKEY(rkeys, 0)));
+    for (i = 1; i < IPCRYPT_INLINE_RKEYS - 1; i++) {
+        t = _mm_aesenc_si128(t, IPCRYPT_INLINE_XOR(tweak, IPCRYPT_INLINE_RKEY(rkeys, i)));
+    }
+    return _mm_aesenclast_si128(t, IPCRYPT_INLINE_XOR(tweak, IPCRYPT_INLINE_RKEY(rkeys, i)));
+#    else
+    for (i = 0; i < IPCRYPT_INLINE_RKEYS - 2; i++) {
+        t = vaesmcq_u8(vaeseq_u8(t, IPCRYPT_INLINE_XOR(tweak, IPCRYPT_INLINE_RKEY(rkeys, i))));
+    }
+    t = vaeseq_u8(t, IPCRYPT_INLINE_XOR(tweak, IPCRYPT_INLINE_RKEY(rkeys, i)));
+    return IPCRYPT_INLINE_XOR(t, IPCRYPT_INLINE_XOR(tweak, IPCRYPT_INLINE_RKEY(rkeys, i + 1)));
+#    endif
+}
+
+/**
+ * ipcrypt_inline_zero returns an all-zero block.
+ */
+static inline IPCryptInlineBlock
+ipcrypt_inline_zero(void)
+{
+#    ifdef IPCRYPT_INLINE_AESNI
+    return _mm_setzero_si128();
+#    else
+    return vdupq_n_u8(0);
+#    endif
+}
+
+/**
+ * ipcrypt_inline_aligned returns 1 if the round keys of a context can be loaded directly.
+ */
+static inline int
+ipcrypt_inline_aligned(const void *ctx)
+{
+    return ((uintptr_t) ctx & 15) == 0;
+}
+
+/**
+ * ipcrypt_inline_encrypt_ip16 is an inline version of ipcrypt_encrypt_ip16().
+ */
+static inline void
+ipcrypt_inline_encrypt_ip16(const IPCrypt *ipcrypt, uint8_t ip16[16])
+{
+    if (!ipcrypt_inline_aligned(ipcrypt)) {
+        ipcrypt_encrypt_ip16(ipcrypt, ip16);
+        return;
+    }
+    IPCRYPT_INLINE_STORE(ip16, ipcrypt_inline_aes(IPCRYPT_INLINE_LOAD(ip16), ipcrypt->opaque,
+                                                  ipcrypt_inline_zero()));
+}
+
+/**
+ * ipcrypt_inline_nd_encrypt_ip16 is an inline version of ipcrypt_nd_encrypt_ip16().
+ */
+static inline void
+ipcrypt_inline_nd_encrypt_ip16(const IPCrypt *ipcrypt, uint8_t ndip[IPCRYPT_NDIP_BYTES],
+                               const uint8_t ip16[16], const uint8_t random[IPCRYPT_TWEAKBYTES])
+{
+    IPCryptInlineBlock tweak;
+
+    if (!ipcrypt_inline_aligned(ipcrypt)) {
+        ipcrypt_nd_encrypt_ip16(ipcrypt, ndip, ip16, random);
+        return;
+    }
+    /* Spread the 8-byte tweak over the block, two bytes out of every four. */
+#    ifdef IPCRYPT_INLINE_AESNI
+    tweak = _mm_shuffle_epi8(_mm_loadl_epi64((const __m128i *) (const void *) random),
+                             _mm_setr_epi8(0x00, 0x01, -1, -1, 0x02, 0x03, -1, -1, 0x04, 0x05, -1,
+                                           -1, 0x06, 0x07, -1, -1));
+#    else
+    tweak = vreinterpretq_u8_u32(vmovl_u16(vreinterpret_u16_u8(vld1_u8(random))));
+#    endif
+    IPCRYPT_INLINE_STORE(ndip + IPCRYPT_TWEAKBYTES,
+                         ipcrypt_inline_aes(IPCRYPT_INLINE_LOAD(ip16), ipcrypt->opaque, tweak));
+    memcpy(ndip, random, IPCRYPT_TWEAKBYTES);
+}
+
+/**
+ * ipcrypt_inline_ndx_encrypt_ip16 is an inline version of ipcrypt_ndx_encrypt_ip16().
+ */
+static inline void
+ipcrypt_inline_ndx_encrypt_ip16(const IPCryptNDX *ipcrypt, uint8_t ndip[IPCRYPT_NDX_NDIP_BYTES],
+                                const uint8_t ip16[16],
+                                const uint8_t random[IPCRYPT_NDX_TWEAKBYTES])
+{
+    const uint8_t     *tkeys = ipcrypt->opaque;
+    const uint8_t     *rkeys = ipcrypt->opaque + 16 * IPCRYPT_INLINE_RKEYS;
+    IPCryptInlineBlock tt;
+
+    if (!ipcrypt_inline_aligned(ipcrypt)) {
+        ipcrypt_ndx_encrypt_ip16(ipcrypt, ndip, ip16, random);
+        return;
+    }
+    tt = ipcrypt_inline_aes(IPCRYPT_INLINE_LOAD(random), tkeys, ipcrypt_inline_zero());
+    IPCRYPT_INLINE_STORE(ndip + IPCRYPT_NDX_TWEAKBYTES,
+                         IPCRYPT_INLINE_XOR(ipcrypt_inline_aes(IPCRYPT_INLINE_XOR(
+                                                                   IPCRYPT_INLINE_LOAD(ip16), tt),
+                                                               rkeys, ipcrypt_inline_zero()),
+                                            tt));
+    memcpy(ndip, random, IPCRYPT_NDX_TWEAKBYTES);
+}
+
+/**
+ * ipcrypt_inline_bswap64 reverses the byte order of a 64-bit integer.
+ */
+static inline uint64_t
+ipcrypt_inline_bswap64(uint64_t x)
+{
+    x = ((x & 0x00ff00ff00ff00ffULL) << 8) | ((x >> 8) & 0x00ff00ff00ff00ffULL);
+    x = ((x & 0x0000ffff0000ffffULL) << 16) | ((x >> 16) & 0x0000ffff0000ffffULL);
+    return (x << 32) | (x >> 32);
+}
+
+/**
+ * ipcrypt_inline_pfx_encrypt_ip16 is an inline version of ipcrypt_pfx_encrypt_ip16().
+ *
+ * Addresses and padded prefixes are kept as pairs of big-endian 64-bit halves. As in the library,
+ * the padded prefixes of four consecutive bit positions only depend on the original address, so
+ * their eight AES encryptions are interleaved.
+ */
+static inline void
+ipcrypt_inline_pfx_encrypt_ip16(const IPCryptPFX *ipcrypt, uint8_t ip16[16])
+{
+    static const uint8_t ipv4_mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+    const uint8_t       *k1keys          = ipcrypt->opaque;
+    const uint8_t       *k2keys          = ipcrypt->opaque + 16 * IPCRYPT_INLINE_RKEYS;
+    IPCryptInlineBlock   e1[4], e2[4];
+    uint64_t             ip[2], out[2], prefix[2];
+    unsigned int         pos;
+    size_t               i;
+    uint8_t              bits[4];
+
+    if (!ipcrypt_inline_aligned(ipcrypt)) {
+        ipcrypt_pfx_encrypt_ip16(ipcrypt, ip16);
+        return;
+    }
+    ip[0] = ip[1] = 0;
+    for (i = 0; i < 8; i++) {
+        ip[0] = (ip[0] << 8) | ip16[i];
+        ip[1] = (ip[1] << 8) | ip16[8 + i];
+    }
+    if (memcmp(ip16, ipv4_mapped, sizeof ipv4_mapped) == 0) {
+        prefix[0] = (uint64_t) 1 << 32;
+        prefix[1] = 0xffff;
+        out[0]    = 0;
+        out[1]    = (uint64_t) 0xffff << 32;
+        pos       = 96;
+    } else {
+        prefix[0] = 0;
+        prefix[1] = 1;
+        out[0] = out[1] = 0;
+        pos             = 0;
+    }
+    for (; pos < 128; pos += 4) {
+        IPCRYPT_INLINE_EACH_LANE(j, {
+            const unsigned int bit_index = 127 - pos - (unsigned int) j;
+
+            bits[j] = (uint8_t) (ip[bit_index < 64] >> (bit_index % 64)) & 1;
+#    ifdef IPCRYPT_INLINE_AESNI
+            e1[j] = _mm_set_epi64x((long long) ipcrypt_inline_bswap64(prefix[1]),
+                                   (long long) ipcrypt_inline_bswap64(prefix[0]));
+#    else
+            e1[j] = vcombine_u8(vcreate_u8(ipcrypt_inline_bswap64(prefix[0])),
+                                vcreate_u8(ipcrypt_inline_bswap64(prefix[1])));
+#    endif
+            e2[j]     = e1[j];
+            prefix[0] = (prefix[0] << 1) | (prefix[1] >> 63);
+            prefix[1] = (prefix[1] << 1) | bits[j];
+        });
+#    ifdef IPCRYPT_INLINE_AESNI
+        IPCRYPT_INLINE_EACH_LANE(j, {
+            e1[j] = IPCRYPT_INLINE_XOR(e1[j], IPCRYPT_INLINE_RKEY(k1keys, 0));
+            e2[j] = IPCRYPT_INLINE_XOR(e2[j], IPCRYPT_INLINE_RKEY(k2keys, 0));
+        });
+        for (i = 1; i < IPCRYPT_INLINE_RKEYS - 1; i++) {
+            IPCRYPT_INLINE_EACH_LANE(j, {
+                e1[j] = _mm_aesenc_si128(e1[j], IPCRYPT_INLINE_RKEY(k1keys, i));
+                e2[j] = _mm_aesenc_si128(e2[j], IPCRYPT_INLINE_RKEY(k2keys, i));
+            });
+        }
+        IPCRYPT_INLINE_EACH_LANE(j, {
+            e1[j] = _mm_aesenclast_si128(e1[j], IPCRYPT_INLINE_RKEY(k1keys, i));
+            e2[j] = _mm_aesenclast_si128(e2[j], IPCRYPT_INLINE_RKEY(k2keys, i));
+        });
+#    else
+        for (i = 0; i < IPCRYPT_INLINE_RKEYS - 2; i++) {
+            IPCRYPT_INLINE_EACH_LANE(j, {
+                e1[j] = vaesmcq_u8(vaeseq_u8(e1[j], IPCRYPT_INLINE_RKEY(k1keys, i)));
+                e2[j] = vaesmcq_u8(vaeseq_u8(e2[j], IPCRYPT_INLINE_RKEY(k2keys, i)));
+            });
+        }
+        IPCRYPT_INLINE_EACH_LANE(j, {
+            e1[j] = IPCRYPT_INLINE_XOR(vaeseq_u8(e1[j], IPCRYPT_INLINE_RKEY(k1keys, i)),
+                                       IPCRYPT_INLINE_RKEY(k1keys, i + 1));
+            e2[j] = IPCRYPT_INLINE_XOR(vaeseq_u8(e2[j], IPCRYPT_INLINE_RKEY(k2keys, i)),
+                                       IPCRYPT_INLINE_RKEY(k2keys, i + 1));
+        });
+#    endif
+        /* The cipher bit is the least significant bit of the last byte of e1 ^ e2. */
+        IPCRYPT_INLINE_EACH_LANE(j, {
+            const IPCryptInlineBlock e         = IPCRYPT_INLINE_XOR(e1[j], e2[j]);
+            const unsigned int       bit_index = 127 - pos - (unsigned int) j;
+            uint8_t                  cipher_bit;
+
+#    ifdef IPCRYPT_INLINE_AESNI
+            cipher_bit = (uint8_t) (_mm_extract_epi16(e, 7) >> 8) & 1;
+#    else
+            cipher_bit = vgetq_lane_u8(e, 15) & 1;
+#    endif
+            out[bit_index < 64] |= (uint64_t) (bits[j] ^ cipher_bit) << (bit_index % 64);
+        });
+    }
+    for (i = 0; i < 8; i++) {
+        ip16[7 - i]  = (uint8_t) (out[0] >> (8 * i));
+        ip16[15 - i] = (uint8_t) (out[1] >> (8 * i));
+    }
+}
+
+#else
+
+static inline void
+ipcrypt_inline_encrypt_ip16(const IPCrypt *ipcrypt, uint8_t ip16[16])
+{
+    ipcrypt_encrypt_ip16(ipcrypt, ip16);
+}
+
+static inline void
+ipcrypt_inline_nd_encrypt_ip16(const IPCrypt *ipcrypt, uint8_t ndip[IPCRYPT_NDIP_BYTES],
+                               const uint8_t ip16[16], const uint8_t random[IPCRYPT_TWEAKBYTES])
+{
+    ipcrypt_nd_encrypt_ip16(ipcrypt, ndip, ip16, random);
+}
+
+static inline void
+ipcrypt_inline_ndx_encrypt_ip16(const IPCryptNDX *ipcrypt, uint8_t ndip[IPCRYPT_NDX_NDIP_BYTES],
+                                const uint8_t ip16[16],
+                                const uint8_t random[IPCRYPT_NDX_TWEAKBYTES])
+{
+    ipcrypt_ndx_encrypt_ip16(ipcrypt, ndip, ip16, random);
+}
+
+static inline void
+ipcrypt_inline_pfx_encrypt_ip16(const IPCryptPFX *ipcrypt, uint8_t ip16[16])
+{
+    ipcrypt_pfx_encrypt_ip16(ipcrypt, ip16);
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
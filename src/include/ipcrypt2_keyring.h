@@ -0,0 +1,152 @@
+#ifndef ipcrypt2_keyring_H
+#define ipcrypt2_keyring_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ipcrypt2.h"
+
+/*
+ * Optional keyring, holding the contexts of multiple keys identified by a 32-bit key ID,
+ * such as an epoch or a day number.
+ *
+ * New data is encrypted with the current key, and the ID of the key is stored along with it, so
+ * that data encrypted with older keys can still be decrypted.
+ *
+ * Readers never take locks: they can encrypt and decrypt from any number of threads while keys are
+ * added, promoted or removed. Keys are expanded when they are added, by the writer, and the memory
+ * of removed keys is reclaimed once no reader can still use it.
+ * Writers are serialized by an internal lock.
+ *
+ * All the keys of a keyring use the same mode. Keys are stored in `capacity` slots, indexed by
+ * `key_id % capacity`, so consecutive key IDs never collide until `capacity` keys are in use.
+ */
+
+/**
+ * Keyring. Created with ipcrypt_keyring_create().
+ */
+typedef struct IPCryptKeyring IPCryptKeyring;
+
+/**
+ * Create a keyring for the given mode, with room for `capacity` keys.
+ *
+ * Returns NULL if memory could not be allocated or if the mode is invalid.
+ */
+IPCryptKeyring *ipcrypt_keyring_create(IPCryptMode mode, size_t capacity);
+
+/**
+ * Free the keyring, and securely erase the contexts.
+ * There must not be any concurrent readers or writers.
+ */
+void ipcrypt_keyring_destroy(IPCryptKeyring *keyring);
+
+/**
+ * Return the mode of the keyring.
+ */
+IPCryptMode ipcrypt_keyring_mode(const IPCryptKeyring *keyring);
+
+/**
+ * Add a key, or replace the key with the same ID.
+ *
+ * The key is expanded before being published, so readers never wait for key expansion.
+ * `key_len` must be the key size of the mode: IPCRYPT_KEYBYTES for the deterministic and ND modes,
+ * IPCRYPT_PFX_KEYBYTES or IPCRYPT_NDX_KEYBYTES for the PFX and NDX modes.
+ *
+ * Returns 0 on success, or -1 if the key size is invalid, if memory could not be allocated, or if
+ * the slot is used by a different key ID.
+ */
+int ipcrypt_keyring_add(IPCryptKeyring *keyring, uint32_t key_id, const uint8_t *key,
+                        size_t key_len);
+
+/**
+ * Add an already expanded key, or replace the key with the same ID.
+ *
+ * `ctx` must point to an initialized context of the mode of the keyring: an IPCrypt for the
+ * deterministic and ND modes, an IPCryptPFX or an IPCryptNDX for the PFX and NDX modes, such as a
+ * context loaded from a blob (see ipcrypt2_blob.h). It is copied, so it can be wiped afterwards.
+ *
+ * Returns 0 on success, or -1 if memory could not be allocated, or if the slot is used by a
+ * different key ID.
+ */
+int ipcrypt_keyring_add_context(IPCryptKeyring *keyring, uint32_t key_id, const void *ctx);
+
+/**
+ * Remove a key. The current key cannot be removed.
+ *
+ * Waits until no reader uses the key anymore, then securely erases it.
+ * Returns 0 on success, or -1 if the key is not in the keyring or is the current key.
+ */
+int ipcrypt_keyring_remove(IPCryptKeyring *keyring, uint32_t key_id);
+
+/**
+ * Atomically make `key_id` the key used for new encryptions.
+ *
+ * Returns 0 on success, or -1 if the key is not in the keyring.
+ */
+int ipcrypt_keyring_promote(IPCryptKeyring *keyring, uint32_t key_id);
+
+/**
+ * Get the ID of the current key.
+ *
+ * Returns 0 on success, or -1 if no key has been promoted yet.
+ */
+int ipcrypt_keyring_current(IPCryptKeyring *keyring, uint32_t *key_id);
+
+/**
+ * Encrypt an IP address string with the current key.
+ *
+ * The ID of the key is stored into `key_id`. For the ND and NDX modes, `random` must be
+ * IPCRYPT_TWEAKBYTES or IPCRYPT_NDX_TWEAKBYTES random bytes; it is ignored by the other modes.
+ *
+ * Returns the output length, or 0 on error or if there is no current key.
+ */
+size_t ipcrypt_keyring_encrypt_ip_str(IPCryptKeyring *keyring, uint32_t *key_id,
+                                      char encrypted_ip_str[IPCRYPT_NDX_NDIP_STR_BYTES],
+                                      const char *ip_str, const uint8_t *random);
+
+/**
+ * Decrypt an IP address string encrypted with the key `key_id`.
+ *
+ * Returns the output length, or 0 on error or if the key is not in the keyring.
+ */
+size_t ipcrypt_keyring_decrypt_ip_str(IPCryptKeyring *keyring, uint32_t key_id,
+                                      char        ip_str[IPCRYPT_MAX_IP_STR_BYTES],
+                                      const char *encrypted_ip_str);
+
+/*
+ * Batch operations over arrays of records. Each record, `stride` bytes long, contains a 32-bit key
+ * ID in native byte order at `key_id_offset`, and a field at `field_offset`, with the same format
+ * as the ipcrypt_*_ip16_strided() functions of the mode: a 16-byte address, or a 4-byte IPv4
+ * address for PFX, or a tweak followed by the address for ND and NDX.
+ */
+
+/**
+ * Encrypt the records with the current key, and store its ID into every record.
+ *
+ * Returns 0 on success, or -1 if the layout is invalid or if there is no current key.
+ */
+int ipcrypt_keyring_encrypt_ip16_strided(IPCryptKeyring *keyring, void *base, size_t count,
+                                         size_t stride, size_t key_id_offset, size_t field_offset,
+                                         size_t field_bytes);
+
+/**
+ * Decrypt the records, each with the key identified by its key ID.
+ *
+ * Consecutive records with the same key ID are decrypted together. Records whose key is not in
+ * the keyring are left untouched, and their number is stored into `skipped`, if not NULL.
+ *
+ * Returns 0 on success, or -1 if the layout is invalid.
+ */
+int ipcrypt_keyring_decrypt_ip16_strided(IPCryptKeyring *keyring, void *base, size_t count,
+                                         size_t stride, size_t key_id_offset, size_t field_offset,
+                                         size_t field_bytes, size_t *skipped);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
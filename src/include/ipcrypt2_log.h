@@ -0,0 +1,141 @@
+#ifndef ipcrypt2_log_H
+#define ipcrypt2_log_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ipcrypt2.h"
+
+/*
+ * Optional streaming anonymizer for text logs, such as web server access logs or syslog lines.
+ *
+ * Input is fed in chunks of any size. IPv4 and IPv6 addresses found in the text are encrypted, and
+ * everything else is copied verbatim to the output. Lines that are not complete at the end of a
+ * chunk are carried over to the next one, so that addresses are never split.
+ *
+ * An address is recognized when it is not part of a larger word: `10.0.0.1`, `[2001:db8::1]:443`
+ * and `client=10.0.0.1:5060` contain an address, `v1.2.3.4` and `1.2.3.4.5` don't.
+ *
+ * Addresses are replaced with the same text as the ipcrypt_*_encrypt_ip_str() functions of the
+ * mode: an address for the deterministic and PFX modes, or a hex string for the ND and NDX modes.
+ * The host of a "host:port" pair is written within brackets if and only if it contains colons, so
+ * `10.0.0.1:8080` may become `[2001:db8::1]:8080` in deterministic mode, and the reverse.
+ *
+ * The same interface reverses the process: a decryptor finds encrypted addresses, or the hex
+ * strings of the ND and NDX modes, and replaces them with the original addresses.
+ */
+
+/** Lines longer than this are split at a delimiter, and processed in multiple parts. */
+#define IPCRYPT_LOG_MAX_LINE_BYTES 65536U
+
+/**
+ * Log anonymizer. Created with ipcrypt_log_create().
+ */
+typedef struct IPCryptLog IPCryptLog;
+
+/**
+ * Function filling `len` bytes at `buf` with secure random bytes.
+ * Called with the `opaque` pointer given to ipcrypt_log_create().
+ */
+typedef void (*IPCryptLogRandomFn)(void *opaque, uint8_t *buf, size_t len);
+
+/**
+ * Function called with every run of hex digits that looks like a token but can't be decrypted.
+ * `token` is not NUL-terminated. Called with the `opaque` pointer given to
+ * ipcrypt_log_create_decryptor().
+ */
+typedef void (*IPCryptLogInvalidFn)(void *opaque, const char *token, size_t token_len);
+
+/**
+ * Create a log anonymizer for the given mode.
+ *
+ * `key_len` must be the key size of the mode: IPCRYPT_KEYBYTES for the deterministic and ND modes,
+ * IPCRYPT_PFX_KEYBYTES or IPCRYPT_NDX_KEYBYTES for the PFX and NDX modes.
+ * `random` is required by the ND and NDX modes, and ignored by the other modes.
+ *
+ * Returns NULL if the parameters are invalid or if memory could not be allocated.
+ */
+IPCryptLog *ipcrypt_log_create(IPCryptMode mode, const uint8_t *key, size_t key_len,
+                               IPCryptLogRandomFn random, void *opaque);
+
+/**
+ * Create a log decryptor for the given mode, that restores the text encrypted by a log anonymizer,
+ * or by the ipcrypt_*_encrypt_ip_str() functions, with the same key.
+ *
+ * In the ND and NDX modes, the tokens are the runs of exactly 48 or 64 hex digits, that are not
+ * part of a larger word. Other runs of 32 hex digits or more, such as truncated tokens or tokens of
+ * the other mode, are left untouched, counted, and passed to `invalid` if it is not NULL.
+ * Hex strings of the right size, such as SHA-256 digests in NDX mode, can't be told apart from
+ * tokens, and are decrypted as well.
+ *
+ * The ipcrypt_log_process() and ipcrypt_log_finish() functions are used in the same way as with an
+ * anonymizer. Returns NULL if the parameters are invalid or if memory could not be allocated.
+ */
+IPCryptLog *ipcrypt_log_create_decryptor(IPCryptMode mode, const uint8_t *key, size_t key_len,
+                                         IPCryptLogInvalidFn invalid, void *opaque);
+
+/**
+ * Free the log anonymizer, and securely erase the key.
+ */
+void ipcrypt_log_destroy(IPCryptLog *log);
+
+/**
+ * Return the size of the output buffer required to process `in_len` bytes, including the data
+ * carried over from the previous chunks.
+ *
+ * It must be called again before every call to ipcrypt_log_process().
+ */
+size_t ipcrypt_log_max_output(const IPCryptLog *log, size_t in_len);
+
+/**
+ * Process a chunk of input.
+ *
+ * The anonymized text of all the complete lines is written to `out`, which must be at least
+ * ipcrypt_log_max_output(log, in_len) bytes long. The last line, if not terminated with a newline,
+ * is kept for the next call.
+ *
+ * Returns the number of bytes written to `out`.
+ */
+size_t ipcrypt_log_process(IPCryptLog *log, char *out, const char *in, size_t in_len);
+
+/**
+ * Process the data carried over from the previous chunks, at the end of the stream.
+ *
+ * `out` must be at least ipcrypt_log_max_output(log, 0) bytes long.
+ * Returns the number of bytes written to `out`. The anonymizer can then be reused for a new stream.
+ */
+size_t ipcrypt_log_finish(IPCryptLog *log, char *out);
+
+/**
+ * Process `count` independent messages, such as datagrams, each of them being a complete stream.
+ *
+ * The addresses of all the messages are encrypted or decrypted together, and the text of
+ * `ins[i]`, `in_lens[i]` bytes long, is written to `outs[i]`, which must be at least
+ * ipcrypt_log_max_output(log, in_lens[i]) bytes long. The number of bytes written to `outs[i]` is
+ * stored into `out_lens[i]`.
+ *
+ * Messages are processed independently from the stream of ipcrypt_log_process(): data carried
+ * over from previous chunks is neither used nor modified.
+ */
+void ipcrypt_log_process_messages(IPCryptLog *log, char *const *outs, size_t *out_lens,
+                                  const char *const *ins, const size_t *in_lens, size_t count);
+
+/**
+ * Return the number of tokens encrypted or decrypted so far.
+ */
+uint64_t ipcrypt_log_tokens(const IPCryptLog *log);
+
+/**
+ * Return the number of invalid tokens found so far by a decryptor.
+ */
+uint64_t ipcrypt_log_invalid_tokens(const IPCryptLog *log);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef ipcrypt2_packet_H
+#define ipcrypt2_packet_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ipcrypt2.h"
+
+/*
+ * Optional packet encryption, for vectors of raw frames such as the bursts received by a packet
+ * processing framework.
+ *
+ * The source and destination addresses of IPv4 and IPv6 packets are rewritten in-place, and the
+ * IPv4 header checksums and the TCP, UDP and ICMPv6 checksums are updated incrementally, without
+ * reading the payload.
+ *
+ * Encapsulated packets are processed as well: the packets quoted by ICMP and ICMPv6 error
+ * messages, IPv4 and IPv6 packets tunneled in IPv4 or IPv6 (IP-in-IP), and IPv4, IPv6 and
+ * Ethernet frames tunneled in GRE. The checksums of the enclosing ICMP messages and GRE headers
+ * are updated as well.
+ *
+ * Addresses are encrypted with the PFX mode, or with the deterministic mode. The PFX mode is
+ * reversible for both address families.
+ *
+ * The deterministic mode encrypts IPv4 addresses into IPv6 addresses, that don't fit in an IPv4
+ * header: IPv4 addresses are then replaced with the last 4 bytes of their encrypted form. This
+ * can't be decrypted, and isn't one-to-one. The replacements of all the IPv4 addresses only cover
+ * about 63% of the IPv4 space, and among n distinct addresses, about n^2 / 2^33 pairs are merged
+ * into a single address: about 116 pairs for a million addresses. The deterministic mode must
+ * not be used when distinct IPv4 hosts have to remain distinct, as in traffic analysis.
+ */
+
+/**
+ * Packet encryption context. Created with ipcrypt_packet_create().
+ */
+typedef struct IPCryptPacket IPCryptPacket;
+
+/**
+ * Create a packet encryption context for the PFX or the deterministic mode.
+ *
+ * `key_len` must be IPCRYPT_PFX_KEYBYTES for the PFX mode, or IPCRYPT_KEYBYTES for the
+ * deterministic mode.
+ *
+ * Returns NULL if the parameters are invalid or if memory could not be allocated.
+ */
+IPCryptPacket *ipcrypt_packet_create(IPCryptMode mode, const uint8_t *key, size_t key_len);
+
+/**
+ * Free the packet encryption context, and securely erase the key.
+ */
+void ipcrypt_packet_destroy(IPCryptPacket *packet);
+
+/**
+ * Encrypt the addresses of a vector of `count` packets, in-place.
+ *
+ * The i-th packet is `lengths[i]` bytes long, starts at `packets[i]`, and its IPv4 or IPv6 header
+ * starts `l3_offsets[i]` bytes after that. If `l3_offsets` is NULL, all the packets start with
+ * their IP header. Packets that are not IPv4 or IPv6 packets are left untouched, and truncated
+ * headers are processed as far as they go.
+ *
+ * Upcoming packets are prefetched while the current ones are parsed, and the addresses of the
+ * whole vector are encrypted together. The context is only read, and can be shared by multiple
+ * threads.
+ *
+ * Returns the number of addresses that were rewritten.
+ */
+size_t ipcrypt_packet_encrypt(const IPCryptPacket *packet, uint8_t *const *packets,
+                              const size_t *lengths, const size_t *l3_offsets, size_t count);
+
+/**
+ * Decrypt the addresses of a vector of `count` packets, in-place.
+ *
+ * Same as ipcrypt_packet_encrypt(). In the deterministic mode, IPv4 addresses are left untouched.
+ */
+size_t ipcrypt_packet_decrypt(const IPCryptPacket *packet, uint8_t *const *packets,
+                              const size_t *lengths, const size_t *l3_offsets, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef ipcrypt2_pcap_H
+#define ipcrypt2_pcap_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ipcrypt2.h"
+#include "ipcrypt2_pool.h"
+
+/*
+ * Optional packet capture anonymizer.
+ *
+ * Rewrites the source and destination addresses of the IPv4 and IPv6 packets of a capture file in
+ * the classic pcap format, in-place, and updates the IPv4 header checksums and the TCP, UDP and
+ * ICMPv6 checksums incrementally, so that the packets remain valid.
+ *
+ * Ethernet (with any number of VLAN tags), Linux cooked (SLL and SLL2) and raw IP link types are
+ * supported. IPv6 extension headers are skipped to find the transport header, and encapsulated
+ * packets are processed as described in ipcrypt2_packet.h. Other packets are left untouched.
+ *
+ * Addresses are encrypted with the PFX mode, which is reversible for both address families. The
+ * deterministic mode is not supported, since it merges distinct IPv4 addresses (see
+ * ipcrypt2_packet.h), and captures are analyzed host by host.
+ */
+
+/**
+ * Packet capture anonymizer. Created with ipcrypt_pcap_create().
+ */
+typedef struct IPCryptPcap IPCryptPcap;
+
+/**
+ * Statistics about a processed capture.
+ */
+typedef struct IPCryptPcapStats {
+    /** Number of packets in the capture. */
+    uint64_t packets;
+    /** Number of IPv4 and IPv6 packets. */
+    uint64_t ip_packets;
+    /** Number of addresses that were rewritten. */
+    uint64_t addresses;
+} IPCryptPcapStats;
+
+/**
+ * Create a packet capture anonymizer for the PFX mode.
+ *
+ * `mode` must be IPCRYPT_MODE_PFX, and `key_len` must be IPCRYPT_PFX_KEYBYTES.
+ *
+ * Returns NULL if the parameters are invalid or if memory could not be allocated.
+ */
+IPCryptPcap *ipcrypt_pcap_create(IPCryptMode mode, const uint8_t *key, size_t key_len);
+
+/**
+ * Free the packet capture anonymizer, and securely erase the key.
+ */
+void ipcrypt_pcap_destroy(IPCryptPcap *pcap);
+
+/**
+ * Encrypt the addresses of a capture, in-place.
+ *
+ * `data` holds the whole content of a pcap file, `len` bytes long, such as a writable memory
+ * mapping. If `pool` is not NULL, packets are processed in parallel by the workers of the pool.
+ * Statistics are stored into `stats`, if not NULL.
+ *
+ * A truncated last packet is left untouched.
+ * Returns 0 on success, or -1 if the data is not a pcap file, or if memory could not be allocated.
+ */
+int ipcrypt_pcap_encrypt(const IPCryptPcap *pcap, IPCryptPool *pool, void *data, size_t len,
+                         IPCryptPcapStats *stats);
+
+/**
+ * Decrypt the addresses of a capture, in-place.
+ *
+ * Same as ipcrypt_pcap_encrypt().
+ */
+int ipcrypt_pcap_decrypt(const IPCryptPcap *pcap, IPCryptPool *pool, void *data, size_t len,
+                         IPCryptPcapStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef ipcrypt2_pool_H
+#define ipcrypt2_pool_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ipcrypt2.h"
+
+/*
+ * Optional thread pool to encrypt or decrypt large arrays of records in parallel.
+ *
+ * Jobs are split into chunks of records that fit in the L1 cache. Every worker starts with an
+ * equal share of the chunks, and idle workers steal chunks from busy ones. This keeps all the cores
+ * busy even when the cost per record varies, such as with PFX encryption, where IPv6 addresses
+ * require four times as much work as IPv4 addresses.
+ *
+ * Contexts are only read, and are shared by all the workers.
+ * The record layout is the same as for the ipcrypt_*_ip16_strided() functions.
+ */
+
+/** Size of the chunks of records processed by a worker at a time, in bytes. */
+#define IPCRYPT_POOL_CHUNK_BYTES 16384U
+
+/**
+ * Thread pool. Created with ipcrypt_pool_create().
+ */
+typedef struct IPCryptPool IPCryptPool;
+
+/**
+ * Create a thread pool with `threads` workers, including the calling thread.
+ *
+ * If `threads` is 0, the number of online CPUs is used.
+ * Returns NULL if memory could not be allocated or if threads could not be created.
+ */
+IPCryptPool *ipcrypt_pool_create(unsigned int threads);
+
+/**
+ * Stop the workers and free the thread pool.
+ */
+void ipcrypt_pool_destroy(IPCryptPool *pool);
+
+/**
+ * Return the number of workers of the thread pool, including the calling thread.
+ */
+unsigned int ipcrypt_pool_threads(const IPCryptPool *pool);
+
+/*
+ * The following functions are parallel versions of the ipcrypt_*_ip16_strided() functions.
+ *
+ * They block until all the records have been processed. The calling thread takes part in the job.
+ * A pool can be shared by multiple threads; concurrent jobs are then run one after the other.
+ *
+ * They return 0 on success, or -1 if the layout is invalid.
+ */
+
+int ipcrypt_pool_encrypt_ip16_strided(IPCryptPool *pool, const IPCrypt *ipcrypt, void *base,
+                                      size_t count, size_t stride, const size_t *offsets,
+                                      size_t offsets_count, size_t field_bytes);
+
+int ipcrypt_pool_decrypt_ip16_strided(IPCryptPool *pool, const IPCrypt *ipcrypt, void *base,
+                                      size_t count, size_t stride, const size_t *offsets,
+                                      size_t offsets_count, size_t field_bytes);
+
+int ipcrypt_pool_pfx_encrypt_ip16_strided(IPCryptPool *pool, const IPCryptPFX *ipcrypt, void *base,
+                                          size_t count, size_t stride, const size_t *offsets,
+                                          size_t offsets_count, size_t field_bytes);
+
+int ipcrypt_pool_pfx_decrypt_ip16_strided(IPCryptPool *pool, const IPCryptPFX *ipcrypt, void *base,
+                                          size_t count, size_t stride, const size_t *offsets,
+                                          size_t offsets_count, size_t field_bytes);
+
+int ipcrypt_pool_nd_encrypt_ip16_strided(IPCryptPool *pool, const IPCrypt *ipcrypt, void *base,
+                                         size_t count, size_t stride, const size_t *offsets,
+                                         size_t offsets_count, size_t field_bytes);
+
+int ipcrypt_pool_nd_decrypt_ip16_strided(IPCryptPool *pool, const IPCrypt *ipcrypt, void *base,
+                                         size_t count, size_t stride, const size_t *offsets,
+                                         size_t offsets_count, size_t field_bytes);
+
+int ipcrypt_pool_ndx_encrypt_ip16_strided(IPCryptPool *pool, const IPCryptNDX *ipcrypt, void *base,
+                                          size_t count, size_t stride, const size_t *offsets,
+                                          size_t offsets_count, size_t field_bytes);
+
+int ipcrypt_pool_ndx_decrypt_ip16_strided(IPCryptPool *pool, const IPCryptNDX *ipcrypt, void *base,
+                                          size_t count, size_t stride, const size_t *offsets,
+                                          size_t offsets_count, size_t field_bytes);
+
+/*
+ * Generic jobs, used by other components to parallelize work that is not a plain strided
+ * encryption.
+ */
+
+/**
+ * Function processing `count` items, `stride` bytes apart, starting at `base`.
+ */
+typedef void (*IPCryptPoolFn)(void *ctx, void *base, size_t count, size_t stride);
+
+/**
+ * Call `fn` on chunks of the `count` items, `stride` bytes apart, starting at `base`, in parallel.
+ *
+ * Chunks hold IPCRYPT_POOL_CHUNK_BYTES of items, and are balanced between the workers in the same
+ * way as records. `fn` must be thread-safe. Returns 0.
+ */
+int ipcrypt_pool_for_each(IPCryptPool *pool, IPCryptPoolFn fn, void *ctx, void *base, size_t count,
+                          size_t stride);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
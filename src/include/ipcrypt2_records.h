@@ -0,0 +1,171 @@
+#ifndef ipcrypt2_records_H
+#define ipcrypt2_records_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ipcrypt2.h"
+#include "ipcrypt2_pool.h"
+
+/*
+ * Optional binary file format for columns of encrypted addresses.
+ *
+ * Records are stored in binary, with the size of the ciphertexts of the mode: 16 bytes for the
+ * deterministic and PFX modes, IPCRYPT_NDIP_BYTES for the ND mode and IPCRYPT_NDX_NDIP_BYTES for
+ * the NDX mode, half the size of their hex encoding.
+ *
+ * A file starts with a header page, followed by blocks of IPCRYPT_RECORDS_BLOCK_RECORDS records,
+ * and ends with a block index. All integers are little-endian.
+ *
+ *   offset  size  header field
+ *        0     8  magic, "IPC2REC" followed by a zero byte
+ *        8     2  version, 1
+ *       10     1  mode, an IPCryptMode value
+ *       11     1  reserved, 0
+ *       12     4  key ID
+ *       16     4  record size, in bytes
+ *       20     4  records per block
+ *       24     8  number of records
+ *       32     8  number of blocks
+ *       40     8  offset of the block index
+ *       48    16  reserved, 0
+ *
+ * Blocks start at IPCRYPT_RECORDS_DATA_OFFSET and are page-aligned; only the last one can be
+ * partial. Every entry of the index is 16 bytes long: the offset of the block (8 bytes), its
+ * number of records (4 bytes), and 4 reserved bytes.
+ *
+ * Since records have a fixed size, the location of any record is computed in constant time, and
+ * blocks can be processed independently. Files are written and read through memory mappings, and
+ * whole blocks are encrypted or decrypted at once, optionally in parallel with a thread pool.
+ *
+ * POSIX systems only.
+ */
+
+/** Size of the header page. Blocks start at this offset. */
+#define IPCRYPT_RECORDS_DATA_OFFSET 4096U
+
+/** Size of the header, at the beginning of the header page. */
+#define IPCRYPT_RECORDS_HEADER_BYTES 64U
+
+/** Size of an entry of the block index. */
+#define IPCRYPT_RECORDS_INDEX_ENTRY_BYTES 16U
+
+/** Number of records per block. */
+#define IPCRYPT_RECORDS_BLOCK_RECORDS 4096U
+
+/**
+ * Function filling `len` bytes at `buf` with secure random bytes.
+ * Called with the `opaque` pointer given to ipcrypt_records_writer_create().
+ */
+typedef void (*IPCryptRecordsRandomFn)(void *opaque, uint8_t *buf, size_t len);
+
+/**
+ * Description of a file, read from its header.
+ */
+typedef struct IPCryptRecordsInfo {
+    IPCryptMode mode;
+    uint32_t    key_id;
+    /** Size of a record, in bytes. */
+    uint32_t    record_bytes;
+    /** Number of records per block. */
+    uint32_t    block_records;
+    /** Number of records. */
+    uint64_t    records;
+    /** Number of blocks. */
+    uint64_t    blocks;
+} IPCryptRecordsInfo;
+
+/**
+ * Writer, encrypting addresses into a new file. Created with ipcrypt_records_writer_create().
+ */
+typedef struct IPCryptRecordsWriter IPCryptRecordsWriter;
+
+/**
+ * Reader, decrypting addresses from a file. Created with ipcrypt_records_reader_open().
+ */
+typedef struct IPCryptRecordsReader IPCryptRecordsReader;
+
+/**
+ * Create a writer, that replaces the content of the regular file `fd`, opened for reading and
+ * writing.
+ *
+ * `key_len` must be the key size of the mode. `key_id` is stored in the header, to find the key
+ * when the file is read, such as the ID of the key in a keyring. `random` is required by the ND and
+ * NDX modes, and ignored by the other modes.
+ *
+ * Returns NULL with errno set on error.
+ */
+IPCryptRecordsWriter *ipcrypt_records_writer_create(int fd, IPCryptMode mode, const uint8_t *key,
+                                                    size_t key_len, uint32_t key_id,
+                                                    IPCryptRecordsRandomFn random, void *opaque);
+
+/**
+ * Encrypt `count` 16-byte addresses, and append them to the file.
+ *
+ * Records are encrypted one block at a time, when the block is full. If `pool` is not NULL, blocks
+ * are encrypted in parallel by the workers of the pool.
+ *
+ * Returns 0 on success, or -1 with errno set on error.
+ */
+int ipcrypt_records_writer_append(IPCryptRecordsWriter *writer, IPCryptPool *pool,
+                                  const uint8_t *ip16s, size_t count);
+
+/**
+ * Encrypt the last block, write the block index and the header, and free the writer.
+ * The file descriptor is not closed.
+ *
+ * Returns 0 on success, or -1 with errno set if an error occurred, now or in a previous call.
+ */
+int ipcrypt_records_writer_close(IPCryptRecordsWriter *writer, IPCryptPool *pool);
+
+/**
+ * Read the header of the file `fd`, without decrypting anything, such as to find its key ID.
+ *
+ * Returns 0 on success, or -1 with errno set if the file is not a valid records file.
+ */
+int ipcrypt_records_probe(int fd, IPCryptRecordsInfo *info);
+
+/**
+ * Open the file `fd` for reading, and map it into memory.
+ *
+ * `key_len` must be the key size of the mode of the file.
+ * Returns NULL with errno set if the file is not a valid records file, or on error.
+ */
+IPCryptRecordsReader *ipcrypt_records_reader_open(int fd, const uint8_t *key, size_t key_len);
+
+/**
+ * Unmap the file, and free the reader. The file descriptor is not closed.
+ */
+void ipcrypt_records_reader_close(IPCryptRecordsReader *reader);
+
+/**
+ * Store the description of the file into `info`.
+ */
+void ipcrypt_records_reader_info(const IPCryptRecordsReader *reader, IPCryptRecordsInfo *info);
+
+/**
+ * Return a pointer to the ciphertext of the record `index` in the mapping, or NULL if there is
+ * no such record.
+ */
+const uint8_t *ipcrypt_records_reader_record(const IPCryptRecordsReader *reader, uint64_t index);
+
+/**
+ * Decrypt the `count` records starting at `first`, into `count` 16-byte addresses at `ip16s`.
+ *
+ * If `pool` is not NULL, records are decrypted in parallel by the workers of the pool.
+ * The reader is only read, and can be used by multiple threads.
+ *
+ * Returns 0 on success, or -1 if the range is out of bounds, or if memory could not be allocated.
+ */
+int ipcrypt_records_reader_read(const IPCryptRecordsReader *reader, IPCryptPool *pool,
+                                uint64_t first, size_t count, uint8_t *ip16s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef ipcrypt2_relay_H
+#define ipcrypt2_relay_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ipcrypt2.h"
+#include "ipcrypt2_log.h"
+
+/*
+ * Optional datagram relay, for UDP syslog hops that anonymize addresses.
+ *
+ * A relay receives datagrams from a socket, encrypts the addresses found in their payload, and
+ * forwards them to a destination through another socket. Datagrams are received and sent in
+ * batches, with recvmmsg() and sendmmsg() where available, or one at a time otherwise.
+ *
+ * The addresses of the senders of a batch are converted with ipcrypt_sockaddrs_to_ip16s(), and
+ * encrypted at once with the strided function of the mode. Since forwarded datagrams are sent by
+ * the relay, the original senders can only be passed on in the payload: with the
+ * IPCRYPT_RELAY_PREPEND_PEER flag, every message is prefixed with the encrypted address of its
+ * sender, followed by a space.
+ *
+ * Addresses in the payloads are encrypted with a log anonymizer (see ipcrypt2_log.h). The payloads
+ * of a batch are passed to ipcrypt_log_process_messages() at once, so that their addresses are
+ * encrypted together as well. Addresses are formatted in the same way as the sender addresses: an
+ * address for the deterministic and PFX modes, or a hex string for the ND and NDX modes.
+ *
+ * Datagrams larger than IPCRYPT_RELAY_DATAGRAM_BYTES are dropped rather than truncated, so that
+ * a partial address at the end of a truncated message is never forwarded in clear.
+ *
+ * POSIX systems only.
+ */
+
+/** Maximum number of datagrams received and sent at once. */
+#define IPCRYPT_RELAY_BATCH 64U
+
+/** Size of the largest datagram that can be relayed. */
+#define IPCRYPT_RELAY_DATAGRAM_BYTES 8192U
+
+/** Flag for ipcrypt_relay_create(): prefix messages with the encrypted address of the sender. */
+#define IPCRYPT_RELAY_PREPEND_PEER 1U
+
+/**
+ * Relay. Created with ipcrypt_relay_create().
+ */
+typedef struct IPCryptRelay IPCryptRelay;
+
+/**
+ * Counters of a relay.
+ */
+typedef struct IPCryptRelayStats {
+    /** Number of datagrams received. */
+    uint64_t received;
+    /** Number of datagrams forwarded. */
+    uint64_t forwarded;
+    /** Number of datagrams dropped because they were too large, or could not be sent. */
+    uint64_t dropped;
+    /** Number of batches received. */
+    uint64_t batches;
+    /** Number of sender addresses encrypted. */
+    uint64_t peers;
+    /** Number of addresses encrypted in the payloads. */
+    uint64_t addresses;
+} IPCryptRelayStats;
+
+/**
+ * Create a relay, that receives datagrams from the socket `in_fd`, and sends them through the
+ * socket `out_fd` to `dest`. If `dest` is NULL, `out_fd` must be connected. Both sockets can be
+ * the same.
+ *
+ * `key_len` must be the key size of the mode. `random` is required by the ND and NDX modes, and
+ * ignored by the other modes. `flags` is 0 or IPCRYPT_RELAY_PREPEND_PEER.
+ *
+ * Returns NULL if the parameters are invalid, or if memory could not be allocated.
+ */
+IPCryptRelay *ipcrypt_relay_create(int in_fd, int out_fd, const struct sockaddr *dest,
+                                   socklen_t dest_len, IPCryptMode mode, const uint8_t *key,
+                                   size_t key_len, IPCryptLogRandomFn random, void *opaque,
+                                   unsigned int flags);
+
+/**
+ * Free a relay, and securely erase the key. The sockets are not closed.
+ */
+void ipcrypt_relay_destroy(IPCryptRelay *relay);
+
+/**
+ * Receive a batch of up to IPCRYPT_RELAY_BATCH datagrams, and forward them.
+ *
+ * If `in_fd` is blocking, waits for the first datagram, then takes the datagrams that are already
+ * queued, without waiting for more. Datagrams that can't be sent are dropped and counted.
+ *
+ * Returns the number of datagrams received, 0 if `in_fd` is non-blocking and no datagram is
+ * queued, or -1 with errno set if receiving failed.
+ */
+int ipcrypt_relay_step(IPCryptRelay *relay);
+
+/**
+ * Store the counters of a relay into `stats`.
+ */
+void ipcrypt_relay_stats(const IPCryptRelay *relay, IPCryptRelayStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
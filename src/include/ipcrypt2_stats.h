@@ -0,0 +1,70 @@
+#ifndef ipcrypt2_stats_H
+#define ipcrypt2_stats_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/*
+ * Optional instrumentation.
+ *
+ * When the library is compiled with IPCRYPT_STATS defined, every thread counts its operations in
+ * its own set of counters, on a separate cache line, without atomic read-modify-write operations.
+ * Counters are aggregated on demand by ipcrypt_stats_snapshot(). Counters of threads that have
+ * exited are kept, and their cache lines are reused by new threads.
+ *
+ * When the library is compiled with IPCRYPT_USDT defined, on systems with the SystemTap
+ * <sys/sdt.h>, the batch functions fire the `ipcrypt2:batch__start` and `ipcrypt2:batch__done`
+ * static tracepoints. Their arguments are the mode, 1 for decryption or 0 for encryption, the
+ * number of addresses, and, for `batch__done`, the duration of the call in nanoseconds. The clock
+ * is only read while a tracer is attached to `batch__done`.
+ *
+ * Without these definitions, nothing is counted, and the hooks compile to nothing.
+ */
+
+/** Number of modes, used to size the per-mode counters. Counters are indexed by IPCryptMode. */
+#define IPCRYPT_STATS_MODES 4
+
+/**
+ * Aggregated counters.
+ */
+typedef struct IPCryptStats {
+    /** Number of addresses encrypted or decrypted. */
+    uint64_t operations[IPCRYPT_STATS_MODES];
+    /** Number of bytes of addresses and ciphertexts processed. */
+    uint64_t bytes[IPCRYPT_STATS_MODES];
+    /** Number of calls to the strided and multi-tenant batch functions. */
+    uint64_t batches[IPCRYPT_STATS_MODES];
+    /** Number of calls to the batch functions rejected because of an invalid layout. */
+    uint64_t errors;
+    /** Number of strings that ipcrypt_str_to_ip16() could not parse. */
+    uint64_t parse_errors;
+    /** Number of keyring lookups that found the requested key. */
+    uint64_t keyring_hits;
+    /** Number of keyring lookups for a key that is not in the keyring. */
+    uint64_t keyring_misses;
+} IPCryptStats;
+
+/**
+ * Return 1 if the library was compiled with IPCRYPT_STATS, or 0 otherwise.
+ */
+int ipcrypt_stats_enabled(void);
+
+/**
+ * Store the sum of the counters of all the threads, since the last call to ipcrypt_stats_reset(),
+ * into `stats`. Counters updated concurrently may or may not be included.
+ */
+void ipcrypt_stats_snapshot(IPCryptStats *stats);
+
+/**
+ * Reset the aggregated counters to zero.
+ */
+void ipcrypt_stats_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
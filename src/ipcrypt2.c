@@ -26,6 +26,7 @@
  * Additional Features:
  * - Built-in string/binary IP conversion helpers.
  * - Optimized for x86_64 and ARM (aarch64) with AES hardware acceleration.
+ *   Define IPCRYPT_SOFTAES to use the portable software AES implementation instead.
  * - Minimal external dependencies; just compile and link.
  *
  * Limitations:
@@ -33,6 +34,11 @@
  * - Ensure keys are secret and tweak values are random or unique per encryption.
  */
 
+#if defined(IPCRYPT_USDT) && defined(__linux__) && !defined(_GNU_SOURCE)
+#    define _GNU_SOURCE // clock_gettime(), used by the instrumentation hooks.
+#endif
+
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 
@@ -46,17 +52,60 @@
 #endif
 
 #include "include/ipcrypt2.h"
+#include "ipcrypt2_stats_hooks.h"
 
 /** Number of AES rounds. For AES-128, this is 10. */
 #define ROUNDS 10
 
+/** Number of independent blocks interleaved by the batch kernels. */
+#define LANES 4
+
+/** Number of fields gathered before running the batch kernels on them. */
+#define BATCH_FIELDS 32
+
+/** Number of records to prefetch ahead when walking arrays of records. */
+#define PREFETCH_RECORDS 8
+
 #define COMPILER_ASSERT(X) (void) sizeof(char[(X) ? 1 : -1])
 
+/**
+ * Run a block once per lane, with `j` set to the lane index.
+ * Lanes are unrolled explicitly, so that the per-lane state stays in registers even when the
+ * compiler doesn't unroll loops. The number of expansions must match LANES.
+ */
+#define EACH_LANE(j, S)          \
+    do {                         \
+        {                        \
+            const size_t j = 0;  \
+            S                    \
+        }                        \
+        {                        \
+            const size_t j = 1;  \
+            S                    \
+        }                        \
+        {                        \
+            const size_t j = 2;  \
+            S                    \
+        }                        \
+        {                        \
+            const size_t j = 3;  \
+            S                    \
+        }                        \
+    } while (0)
+
+#if defined(__GNUC__) || defined(__clang__)
+#    define PREFETCH_RW(p) __builtin_prefetch((p), 1, 3)
+#    define PREFETCH_R(p)  __builtin_prefetch((p), 0, 3)
+#else
+#    define PREFETCH_RW(p) (void) (p)
+#    define PREFETCH_R(p)  (void) (p)
+#endif
+
 #if !defined(_MSC_VER) || _MSC_VER < 1800
 #    define __vectorcall
 #endif
 
-#ifdef __aarch64__
+#if defined(__aarch64__) && !defined(IPCRYPT_SOFTAES)
 #    ifndef __ARM_FEATURE_CRYPTO
 #        define __ARM_FEATURE_CRYPTO 1
 #    endif
@@ -184,7 +233,8 @@ AES_KEYGEN(BlockVec block_vec, const int rc)
 
 #else
 
-#    if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#    if (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)) && \
+        !defined(IPCRYPT_SOFTAES)
 
 #        ifdef __clang__
 /**
@@ -252,6 +302,16 @@ typedef __m128i BlockVec;
  * Generate an AES subkey for key expansion.
  */
 #    define AES_KEYGEN(block_vec, rc)        _mm_aeskeygenassist_si128((block_vec), (rc))
+/**
+ * Apply RotWord and SubWord to the last word of a round key, add the round constant, and broadcast
+ * the result to all words. Equivalent to shuffling the output of AES_KEYGEN, but AESKEYGENASSIST
+ * is microcoded on many CPUs, while AESENCLAST is pipelined.
+ */
+#    define AES_KEYGEN_BROADCAST(block_vec, rc)                                               \
+        _mm_aesenclast_si128(                                                                 \
+            _mm_shuffle_epi8((block_vec),                                                     \
+                             _mm_setr_epi32(0x0c0f0e0d, 0x0c0f0e0d, 0x0c0f0e0d, 0x0c0f0e0d)), \
+            _mm_setr_epi32((rc), (rc), (rc), (rc)))
 /**
  * XOR two 128-bit blocks.
  */
@@ -331,6 +391,15 @@ typedef struct PFXState {
     KeySchedule k2keys;
 } PFXState;
 
+/**
+ * Compute SubWord(RotWord(w3)) ^ rc of a round key, broadcast to all words.
+ */
+#ifdef AES_KEYGEN_BROADCAST
+#    define KEYGEN_WORD(t, RC) AES_KEYGEN_BROADCAST(t, RC)
+#else
+#    define KEYGEN_WORD(t, RC) SHUFFLE32x4(AES_KEYGEN(t, RC), 3, 3, 3, 3)
+#endif
+
 /**
  * expand_key expands a 16-byte AES key into a full set of round keys.
  * st: the AesState structure to be populated.
@@ -344,10 +413,10 @@ expand_key(KeySchedule rkeys, const unsigned char key[IPCRYPT_KEYBYTES])
 
 #define EXPAND_KEY(RC)                        \
     rkeys[i++] = t;                           \
-    s          = AES_KEYGEN(t, RC);           \
+    s          = KEYGEN_WORD(t, RC);          \
     t          = XOR128(t, BYTESHL128(t, 4)); \
     t          = XOR128(t, BYTESHL128(t, 8)); \
-    t          = XOR128(t, SHUFFLE32x4(s, 3, 3, 3, 3));
+    t          = XOR128(t, s);
 
     // Load the initial 128-bit key from memory.
     t = LOAD128(key);
@@ -366,6 +435,87 @@ expand_key(KeySchedule rkeys, const unsigned char key[IPCRYPT_KEYBYTES])
     rkeys[i++] = t;
 }
 
+/**
+ * expand_key_lanes expands LANES independent 16-byte AES keys at once.
+ * Each round key depends on the previous one, so a single key schedule is bound by the latency of
+ * the key generation step. Interleaving independent key schedules keeps the AES unit busy.
+ */
+static void __vectorcall
+expand_key_lanes(KeySchedule rkeys[LANES], const uint8_t *const keys[LANES])
+{
+    BlockVec t[LANES], s[LANES];
+    size_t   i = 0;
+
+#define EXPAND_KEY_LANES(RC)                       \
+    EACH_LANE(j, {                                 \
+        rkeys[j][i] = t[j];                        \
+        s[j]        = KEYGEN_WORD(t[j], RC);       \
+    });                                            \
+    EACH_LANE(j, {                                 \
+        t[j] = XOR128(t[j], BYTESHL128(t[j], 4));  \
+        t[j] = XOR128(t[j], BYTESHL128(t[j], 8));  \
+        t[j] = XOR128(t[j], s[j]);                 \
+    });                                            \
+    i++;
+
+    EACH_LANE(j, {
+        t[j] = LOAD128(keys[j]);
+    });
+    EXPAND_KEY_LANES(0x01);
+    EXPAND_KEY_LANES(0x02);
+    EXPAND_KEY_LANES(0x04);
+    EXPAND_KEY_LANES(0x08);
+    EXPAND_KEY_LANES(0x10);
+    EXPAND_KEY_LANES(0x20);
+    EXPAND_KEY_LANES(0x40);
+    EXPAND_KEY_LANES(0x80);
+    EXPAND_KEY_LANES(0x1b);
+    EXPAND_KEY_LANES(0x36);
+    EACH_LANE(j, {
+        rkeys[j][i] = t[j];
+    });
+}
+
+/**
+ * KeyExpansionQueue collects keys to expand, so that they can be expanded LANES at a time.
+ * Key schedules are copied to `outs`, that don't need to be aligned.
+ */
+typedef struct KeyExpansionQueue {
+    KeySchedule    rkeys[LANES];
+    const uint8_t *keys[LANES];
+    uint8_t       *outs[LANES];
+    size_t         n;
+} KeyExpansionQueue;
+
+static void
+key_queue_push(KeyExpansionQueue *q, uint8_t *out, const uint8_t key[IPCRYPT_KEYBYTES])
+{
+    size_t j;
+
+    q->keys[q->n] = key;
+    q->outs[q->n] = out;
+    if (++q->n < LANES) {
+        return;
+    }
+    expand_key_lanes(q->rkeys, q->keys);
+    for (j = 0; j < LANES; j++) {
+        memcpy(q->outs[j], q->rkeys[j], sizeof(KeySchedule));
+    }
+    q->n = 0;
+}
+
+static void
+key_queue_flush(KeyExpansionQueue *q)
+{
+    size_t j;
+
+    for (j = 0; j < q->n; j++) {
+        expand_key(q->rkeys[0], q->keys[j]);
+        memcpy(q->outs[j], q->rkeys[0], sizeof(KeySchedule));
+    }
+    q->n = 0;
+}
+
 /**
  * aes_encrypt encrypts a 16-byte block x in-place using the expanded keys in st.
  */
@@ -580,6 +730,635 @@ aes_ndx_decrypt(uint8_t x[16], const NDXState *st, const uint8_t tweak[IPCRYPT_N
     STORE128(x, t);
 }
 
+/**
+ * aes_invert_key_schedule computes the decryption round keys once, so that they can be shared by
+ * all the blocks of a batch.
+ */
+static void
+aes_invert_key_schedule(InvKeySchedule rkeys_inv, const KeySchedule rkeys)
+{
+    size_t i;
+
+    for (i = 0; i < ROUNDS - 1; i++) {
+        rkeys_inv[i] = RKINVERT(rkeys[ROUNDS - 1 - i]);
+    }
+}
+
+/**
+ * aes_encrypt_lanes encrypts LANES independent 16-byte blocks in-place.
+ * Interleaving the rounds of independent blocks hides the latency of the AES instructions.
+ */
+static void
+aes_encrypt_lanes(uint8_t *const xs[LANES], const KeySchedule rkeys)
+{
+    BlockVec t[LANES];
+    size_t   i;
+
+#ifdef AES_XENCRYPT
+    EACH_LANE(j, {
+        t[j] = AES_XENCRYPT(LOAD128(xs[j]), rkeys[0]);
+    });
+    for (i = 1; i < ROUNDS - 1; i++) {
+        EACH_LANE(j, {
+            t[j] = AES_XENCRYPT(t[j], rkeys[i]);
+        });
+    }
+    EACH_LANE(j, {
+        t[j] = XOR128(AES_XENCRYPTLAST(t[j], rkeys[i]), rkeys[ROUNDS]);
+    });
+#else
+    EACH_LANE(j, {
+        t[j] = XOR128(LOAD128(xs[j]), rkeys[0]);
+    });
+    for (i = 1; i < ROUNDS; i++) {
+        EACH_LANE(j, {
+            t[j] = AES_ENCRYPT(t[j], rkeys[i]);
+        });
+    }
+    EACH_LANE(j, {
+        t[j] = AES_ENCRYPTLAST(t[j], rkeys[ROUNDS]);
+    });
+#endif
+    EACH_LANE(j, {
+        STORE128(xs[j], t[j]);
+    });
+}
+
+/**
+ * aes_decrypt_lanes decrypts LANES independent 16-byte blocks in-place,
+ * using a precomputed inverse key schedule.
+ */
+static void
+aes_decrypt_lanes(uint8_t *const xs[LANES], const KeySchedule rkeys,
+                  const InvKeySchedule rkeys_inv)
+{
+    BlockVec t[LANES];
+    size_t   i;
+
+#ifdef AES_XENCRYPT
+    EACH_LANE(j, {
+        t[j] = AES_XDECRYPT(LOAD128(xs[j]), rkeys[ROUNDS]);
+    });
+    for (i = 0; i < ROUNDS - 2; i++) {
+        EACH_LANE(j, {
+            t[j] = AES_XDECRYPT(t[j], rkeys_inv[i]);
+        });
+    }
+    EACH_LANE(j, {
+        t[j] = XOR128(AES_XDECRYPTLAST(t[j], rkeys_inv[i]), rkeys[0]);
+    });
+#else
+    EACH_LANE(j, {
+        t[j] = XOR128(LOAD128(xs[j]), rkeys[ROUNDS]);
+    });
+    for (i = 0; i < ROUNDS - 1; i++) {
+        EACH_LANE(j, {
+            t[j] = AES_DECRYPT(t[j], rkeys_inv[i]);
+        });
+    }
+    EACH_LANE(j, {
+        t[j] = AES_DECRYPTLAST(t[j], rkeys[0]);
+    });
+#endif
+    EACH_LANE(j, {
+        STORE128(xs[j], t[j]);
+    });
+}
+
+/**
+ * aes_encrypt_with_tweak_lanes encrypts LANES ipcrypt-nd records in-place.
+ * Each record is an 8-byte tweak followed by the 16-byte block to encrypt.
+ */
+static void
+aes_encrypt_with_tweak_lanes(uint8_t *const xs[LANES], const KeySchedule rkeys)
+{
+    BlockVec tweak_block[LANES];
+    BlockVec t[LANES];
+    size_t   i;
+
+    EACH_LANE(j, {
+        tweak_block[j] = TWEAK_EXPAND(xs[j]);
+    });
+#ifdef AES_XENCRYPT
+    EACH_LANE(j, {
+        t[j] = AES_XENCRYPT(LOAD128(xs[j] + IPCRYPT_TWEAKBYTES), XOR128(tweak_block[j], rkeys[0]));
+    });
+    for (i = 1; i < ROUNDS - 1; i++) {
+        EACH_LANE(j, {
+            t[j] = AES_XENCRYPT(t[j], XOR128(tweak_block[j], rkeys[i]));
+        });
+    }
+    EACH_LANE(j, {
+        t[j] = AES_XENCRYPTLAST(t[j], XOR128(tweak_block[j], rkeys[i]));
+        t[j] = XOR128(t[j], XOR128(tweak_block[j], rkeys[ROUNDS]));
+    });
+#else
+    EACH_LANE(j, {
+        t[j] = XOR128_3(LOAD128(xs[j] + IPCRYPT_TWEAKBYTES), tweak_block[j], rkeys[0]);
+    });
+    for (i = 1; i < ROUNDS; i++) {
+        EACH_LANE(j, {
+            t[j] = AES_ENCRYPT(t[j], XOR128(tweak_block[j], rkeys[i]));
+        });
+    }
+    EACH_LANE(j, {
+        t[j] = AES_ENCRYPTLAST(t[j], XOR128(tweak_block[j], rkeys[ROUNDS]));
+    });
+#endif
+    EACH_LANE(j, {
+        STORE128(xs[j] + IPCRYPT_TWEAKBYTES, t[j]);
+    });
+}
+
+/**
+ * aes_decrypt_with_tweak_lanes decrypts LANES ipcrypt-nd records in-place,
+ * using a precomputed inverse key schedule. The tweaks are left untouched.
+ */
+static void
+aes_decrypt_with_tweak_lanes(uint8_t *const xs[LANES], const KeySchedule rkeys,
+                             const InvKeySchedule rkeys_inv)
+{
+    BlockVec tweak_block[LANES];
+    BlockVec tweak_block_inv[LANES];
+    BlockVec t[LANES];
+    size_t   i;
+
+    EACH_LANE(j, {
+        tweak_block[j]     = TWEAK_EXPAND(xs[j]);
+        tweak_block_inv[j] = RKINVERT(tweak_block[j]);
+    });
+#ifdef AES_XENCRYPT
+    EACH_LANE(j, {
+        t[j] = AES_XDECRYPT(LOAD128(xs[j] + IPCRYPT_TWEAKBYTES),
+                            XOR128(tweak_block[j], rkeys[ROUNDS]));
+    });
+    for (i = 0; i < ROUNDS - 2; i++) {
+        EACH_LANE(j, {
+            t[j] = AES_XDECRYPT(t[j], XOR128(tweak_block_inv[j], rkeys_inv[i]));
+        });
+    }
+    EACH_LANE(j, {
+        t[j] = AES_XDECRYPTLAST(t[j], XOR128(tweak_block_inv[j], rkeys_inv[i]));
+        t[j] = XOR128(t[j], XOR128(tweak_block[j], rkeys[0]));
+    });
+#else
+    EACH_LANE(j, {
+        t[j] = XOR128_3(LOAD128(xs[j] + IPCRYPT_TWEAKBYTES), tweak_block[j], rkeys[ROUNDS]);
+    });
+    for (i = 0; i < ROUNDS - 1; i++) {
+        EACH_LANE(j, {
+            t[j] = AES_DECRYPT(t[j], XOR128(tweak_block_inv[j], rkeys_inv[i]));
+        });
+    }
+    EACH_LANE(j, {
+        t[j] = AES_DECRYPTLAST(t[j], XOR128(tweak_block[j], rkeys[0]));
+    });
+#endif
+    EACH_LANE(j, {
+        STORE128(xs[j] + IPCRYPT_TWEAKBYTES, t[j]);
+    });
+}
+
+/**
+ * aes_xex_encrypt_lanes encrypts LANES ipcrypt-ndx records in-place.
+ * Each record is a 16-byte tweak followed by the 16-byte block to encrypt.
+ */
+static void
+aes_xex_encrypt_lanes(uint8_t *const xs[LANES], const NDXState *st)
+{
+    const BlockVec *tkeys = st->tkeys;
+    const BlockVec *rkeys = st->rkeys;
+    BlockVec        tt[LANES];
+    BlockVec        t[LANES];
+    size_t          i;
+
+#ifdef AES_XENCRYPT
+    EACH_LANE(j, {
+        tt[j] = AES_XENCRYPT(LOAD128(xs[j]), tkeys[0]);
+    });
+    for (i = 1; i < ROUNDS - 1; i++) {
+        EACH_LANE(j, {
+            tt[j] = AES_XENCRYPT(tt[j], tkeys[i]);
+        });
+    }
+    EACH_LANE(j, {
+        tt[j] = XOR128(AES_XENCRYPTLAST(tt[j], tkeys[i]), tkeys[ROUNDS]);
+        t[j]  = AES_XENCRYPT(XOR128(LOAD128(xs[j] + IPCRYPT_NDX_TWEAKBYTES), tt[j]), rkeys[0]);
+    });
+    for (i = 1; i < ROUNDS - 1; i++) {
+        EACH_LANE(j, {
+            t[j] = AES_XENCRYPT(t[j], rkeys[i]);
+        });
+    }
+    EACH_LANE(j, {
+        t[j] = XOR128_3(AES_XENCRYPTLAST(t[j], rkeys[i]), rkeys[ROUNDS], tt[j]);
+    });
+#else
+    EACH_LANE(j, {
+        tt[j] = XOR128(LOAD128(xs[j]), tkeys[0]);
+    });
+    for (i = 1; i < ROUNDS; i++) {
+        EACH_LANE(j, {
+            tt[j] = AES_ENCRYPT(tt[j], tkeys[i]);
+        });
+    }
+    EACH_LANE(j, {
+        tt[j] = AES_ENCRYPTLAST(tt[j], tkeys[ROUNDS]);
+        t[j]  = XOR128_3(LOAD128(xs[j] + IPCRYPT_NDX_TWEAKBYTES), tt[j], rkeys[0]);
+    });
+    for (i = 1; i < ROUNDS; i++) {
+        EACH_LANE(j, {
+            t[j] = AES_ENCRYPT(t[j], rkeys[i]);
+        });
+    }
+    EACH_LANE(j, {
+        t[j] = AES_ENCRYPTLAST(t[j], XOR128(rkeys[ROUNDS], tt[j]));
+    });
+#endif
+    EACH_LANE(j, {
+        STORE128(xs[j] + IPCRYPT_NDX_TWEAKBYTES, t[j]);
+    });
+}
+
+/**
+ * aes_ndx_decrypt_lanes decrypts LANES ipcrypt-ndx records in-place,
+ * using a precomputed inverse key schedule. The tweaks are left untouched.
+ */
+static void
+aes_ndx_decrypt_lanes(uint8_t *const xs[LANES], const NDXState *st,
+                      const InvKeySchedule rkeys_inv)
+{
+    const BlockVec *tkeys = st->tkeys;
+    const BlockVec *rkeys = st->rkeys;
+    BlockVec        tt[LANES];
+    BlockVec        t[LANES];
+    size_t          i;
+
+#ifdef AES_XENCRYPT
+    EACH_LANE(j, {
+        tt[j] = AES_XENCRYPT(LOAD128(xs[j]), tkeys[0]);
+    });
+    for (i = 1; i < ROUNDS - 1; i++) {
+        EACH_LANE(j, {
+            tt[j] = AES_XENCRYPT(tt[j], tkeys[i]);
+        });
+    }
+    EACH_LANE(j, {
+        tt[j] = XOR128(AES_XENCRYPTLAST(tt[j], tkeys[i]), tkeys[ROUNDS]);
+        t[j] =
+            AES_XDECRYPT(XOR128(LOAD128(xs[j] + IPCRYPT_NDX_TWEAKBYTES), tt[j]), rkeys[ROUNDS]);
+    });
+    for (i = 0; i < ROUNDS - 2; i++) {
+        EACH_LANE(j, {
+            t[j] = AES_XDECRYPT(t[j], rkeys_inv[i]);
+        });
+    }
+    EACH_LANE(j, {
+        t[j] = XOR128_3(AES_XDECRYPTLAST(t[j], rkeys_inv[i]), rkeys[0], tt[j]);
+    });
+#else
+    EACH_LANE(j, {
+        tt[j] = XOR128(LOAD128(xs[j]), tkeys[0]);
+    });
+    for (i = 1; i < ROUNDS; i++) {
+        EACH_LANE(j, {
+            tt[j] = AES_ENCRYPT(tt[j], tkeys[i]);
+        });
+    }
+    EACH_LANE(j, {
+        tt[j] = AES_ENCRYPTLAST(tt[j], tkeys[ROUNDS]);
+        t[j]  = XOR128_3(LOAD128(xs[j] + IPCRYPT_NDX_TWEAKBYTES), tt[j], rkeys[ROUNDS]);
+    });
+    for (i = 0; i < ROUNDS - 1; i++) {
+        EACH_LANE(j, {
+            t[j] = AES_DECRYPT(t[j], rkeys_inv[i]);
+        });
+    }
+    EACH_LANE(j, {
+        t[j] = AES_DECRYPTLAST(t[j], XOR128(rkeys[0], tt[j]));
+    });
+#endif
+    EACH_LANE(j, {
+        STORE128(xs[j] + IPCRYPT_NDX_TWEAKBYTES, t[j]);
+    });
+}
+
+/**
+ * Load round key i of lane j, from a key schedule stored at an unaligned address.
+ */
+#define GATHER_RKEY(ks, j, i) LOAD128((ks)[j] + 16 * (i))
+
+/**
+ * aes_encrypt_gather_lanes encrypts LANES independent 16-byte blocks in-place, each with its own
+ * key schedule. Key schedules are read from the contexts directly, and don't have to be aligned.
+ */
+static void
+aes_encrypt_gather_lanes(uint8_t *const xs[LANES], const uint8_t *const ks[LANES])
+{
+    BlockVec t[LANES];
+    size_t   i;
+
+#ifdef AES_XENCRYPT
+    EACH_LANE(j, {
+        t[j] = AES_XENCRYPT(LOAD128(xs[j]), GATHER_RKEY(ks, j, 0));
+    });
+    for (i = 1; i < ROUNDS - 1; i++) {
+        EACH_LANE(j, {
+            t[j] = AES_XENCRYPT(t[j], GATHER_RKEY(ks, j, i));
+        });
+    }
+    EACH_LANE(j, {
+        t[j] = XOR128(AES_XENCRYPTLAST(t[j], GATHER_RKEY(ks, j, i)), GATHER_RKEY(ks, j, ROUNDS));
+    });
+#else
+    EACH_LANE(j, {
+        t[j] = XOR128(LOAD128(xs[j]), GATHER_RKEY(ks, j, 0));
+    });
+    for (i = 1; i < ROUNDS; i++) {
+        EACH_LANE(j, {
+            t[j] = AES_ENCRYPT(t[j], GATHER_RKEY(ks, j, i));
+        });
+    }
+    EACH_LANE(j, {
+        t[j] = AES_ENCRYPTLAST(t[j], GATHER_RKEY(ks, j, ROUNDS));
+    });
+#endif
+    EACH_LANE(j, {
+        STORE128(xs[j], t[j]);
+    });
+}
+
+/**
+ * aes_decrypt_gather_lanes decrypts LANES independent 16-byte blocks in-place, each with its own
+ * key schedule. Decryption round keys are computed on the fly.
+ */
+static void
+aes_decrypt_gather_lanes(uint8_t *const xs[LANES], const uint8_t *const ks[LANES])
+{
+    BlockVec t[LANES];
+    size_t   i;
+
+#ifdef AES_XENCRYPT
+    EACH_LANE(j, {
+        t[j] = AES_XDECRYPT(LOAD128(xs[j]), GATHER_RKEY(ks, j, ROUNDS));
+    });
+    for (i = 0; i < ROUNDS - 2; i++) {
+        EACH_LANE(j, {
+            t[j] = AES_XDECRYPT(t[j], RKINVERT(GATHER_RKEY(ks, j, ROUNDS - 1 - i)));
+        });
+    }
+    EACH_LANE(j, {
+        t[j] = XOR128(AES_XDECRYPTLAST(t[j], RKINVERT(GATHER_RKEY(ks, j, ROUNDS - 1 - i))),
+                      GATHER_RKEY(ks, j, 0));
+    });
+#else
+    EACH_LANE(j, {
+        t[j] = XOR128(LOAD128(xs[j]), GATHER_RKEY(ks, j, ROUNDS));
+    });
+    for (i = 0; i < ROUNDS - 1; i++) {
+        EACH_LANE(j, {
+            t[j] = AES_DECRYPT(t[j], RKINVERT(GATHER_RKEY(ks, j, ROUNDS - 1 - i)));
+        });
+    }
+    EACH_LANE(j, {
+        t[j] = AES_DECRYPTLAST(t[j], GATHER_RKEY(ks, j, 0));
+    });
+#endif
+    EACH_LANE(j, {
+        STORE128(xs[j], t[j]);
+    });
+}
+
+/**
+ * aes_encrypt_with_tweak_gather_lanes encrypts LANES ipcrypt-nd records in-place, each with its
+ * own key schedule.
+ */
+static void
+aes_encrypt_with_tweak_gather_lanes(uint8_t *const xs[LANES], const uint8_t *const ks[LANES])
+{
+    BlockVec tweak_block[LANES];
+    BlockVec t[LANES];
+    size_t   i;
+
+    EACH_LANE(j, {
+        tweak_block[j] = TWEAK_EXPAND(xs[j]);
+    });
+#ifdef AES_XENCRYPT
+    EACH_LANE(j, {
+        t[j] = AES_XENCRYPT(LOAD128(xs[j] + IPCRYPT_TWEAKBYTES),
+                            XOR128(tweak_block[j], GATHER_RKEY(ks, j, 0)));
+    });
+    for (i = 1; i < ROUNDS - 1; i++) {
+        EACH_LANE(j, {
+            t[j] = AES_XENCRYPT(t[j], XOR128(tweak_block[j], GATHER_RKEY(ks, j, i)));
+        });
+    }
+    EACH_LANE(j, {
+        t[j] = AES_XENCRYPTLAST(t[j], XOR128(tweak_block[j], GATHER_RKEY(ks, j, i)));
+        t[j] = XOR128(t[j], XOR128(tweak_block[j], GATHER_RKEY(ks, j, ROUNDS)));
+    });
+#else
+    EACH_LANE(j, {
+        t[j] = XOR128_3(LOAD128(xs[j] + IPCRYPT_TWEAKBYTES), tweak_block[j],
+                        GATHER_RKEY(ks, j, 0));
+    });
+    for (i = 1; i < ROUNDS; i++) {
+        EACH_LANE(j, {
+            t[j] = AES_ENCRYPT(t[j], XOR128(tweak_block[j], GATHER_RKEY(ks, j, i)));
+        });
+    }
+    EACH_LANE(j, {
+        t[j] = AES_ENCRYPTLAST(t[j], XOR128(tweak_block[j], GATHER_RKEY(ks, j, ROUNDS)));
+    });
+#endif
+    EACH_LANE(j, {
+        STORE128(xs[j] + IPCRYPT_TWEAKBYTES, t[j]);
+    });
+}
+
+/**
+ * aes_decrypt_with_tweak_gather_lanes decrypts LANES ipcrypt-nd records in-place, each with its
+ * own key schedule. The tweaks are left untouched.
+ */
+static void
+aes_decrypt_with_tweak_gather_lanes(uint8_t *const xs[LANES], const uint8_t *const ks[LANES])
+{
+    BlockVec tweak_block[LANES];
+    BlockVec tweak_block_inv[LANES];
+    BlockVec t[LANES];
+    size_t   i;
+
+    EACH_LANE(j, {
+        tweak_block[j]     = TWEAK_EXPAND(xs[j]);
+        tweak_block_inv[j] = RKINVERT(tweak_block[j]);
+    });
+#ifdef AES_XENCRYPT
+    EACH_LANE(j, {
+        t[j] = AES_XDECRYPT(LOAD128(xs[j] + IPCRYPT_TWEAKBYTES),
+                            XOR128(tweak_block[j], GATHER_RKEY(ks, j, ROUNDS)));
+    });
+    for (i = 0; i < ROUNDS - 2; i++) {
+        EACH_LANE(j, {
+            t[j] = AES_XDECRYPT(
+                t[j], XOR128(tweak_block_inv[j], RKINVERT(GATHER_RKEY(ks, j, ROUNDS - 1 - i))));
+        });
+    }
+    EACH_LANE(j, {
+        t[j] = AES_XDECRYPTLAST(
+            t[j], XOR128(tweak_block_inv[j], RKINVERT(GATHER_RKEY(ks, j, ROUNDS - 1 - i))));
+        t[j] = XOR128(t[j], XOR128(tweak_block[j], GATHER_RKEY(ks, j, 0)));
+    });
+#else
+    EACH_LANE(j, {
+        t[j] = XOR128_3(LOAD128(xs[j] + IPCRYPT_TWEAKBYTES), tweak_block[j],
+                        GATHER_RKEY(ks, j, ROUNDS));
+    });
+    for (i = 0; i < ROUNDS - 1; i++) {
+        EACH_LANE(j, {
+            t[j] = AES_DECRYPT(
+                t[j], XOR128(tweak_block_inv[j], RKINVERT(GATHER_RKEY(ks, j, ROUNDS - 1 - i))));
+        });
+    }
+    EACH_LANE(j, {
+        t[j] = AES_DECRYPTLAST(t[j], XOR128(tweak_block[j], GATHER_RKEY(ks, j, 0)));
+    });
+#endif
+    EACH_LANE(j, {
+        STORE128(xs[j] + IPCRYPT_TWEAKBYTES, t[j]);
+    });
+}
+
+/**
+ * aes_xex_encrypt_gather_lanes encrypts LANES ipcrypt-ndx records in-place, each with its own
+ * NDX state. The tweak key schedule is followed by the encryption key schedule.
+ */
+static void
+aes_xex_encrypt_gather_lanes(uint8_t *const xs[LANES], const uint8_t *const ks[LANES])
+{
+    const uint8_t *rks[LANES];
+    BlockVec       tt[LANES];
+    BlockVec       t[LANES];
+    size_t         i;
+
+    EACH_LANE(j, {
+        rks[j] = ks[j] + sizeof(KeySchedule);
+    });
+#ifdef AES_XENCRYPT
+    EACH_LANE(j, {
+        tt[j] = AES_XENCRYPT(LOAD128(xs[j]), GATHER_RKEY(ks, j, 0));
+    });
+    for (i = 1; i < ROUNDS - 1; i++) {
+        EACH_LANE(j, {
+            tt[j] = AES_XENCRYPT(tt[j], GATHER_RKEY(ks, j, i));
+        });
+    }
+    EACH_LANE(j, {
+        tt[j] = XOR128(AES_XENCRYPTLAST(tt[j], GATHER_RKEY(ks, j, i)), GATHER_RKEY(ks, j, ROUNDS));
+        t[j]  = AES_XENCRYPT(XOR128(LOAD128(xs[j] + IPCRYPT_NDX_TWEAKBYTES), tt[j]),
+                             GATHER_RKEY(rks, j, 0));
+    });
+    for (i = 1; i < ROUNDS - 1; i++) {
+        EACH_LANE(j, {
+            t[j] = AES_XENCRYPT(t[j], GATHER_RKEY(rks, j, i));
+        });
+    }
+    EACH_LANE(j, {
+        t[j] = XOR128_3(AES_XENCRYPTLAST(t[j], GATHER_RKEY(rks, j, i)),
+                        GATHER_RKEY(rks, j, ROUNDS), tt[j]);
+    });
+#else
+    EACH_LANE(j, {
+        tt[j] = XOR128(LOAD128(xs[j]), GATHER_RKEY(ks, j, 0));
+    });
+    for (i = 1; i < ROUNDS; i++) {
+        EACH_LANE(j, {
+            tt[j] = AES_ENCRYPT(tt[j], GATHER_RKEY(ks, j, i));
+        });
+    }
+    EACH_LANE(j, {
+        tt[j] = AES_ENCRYPTLAST(tt[j], GATHER_RKEY(ks, j, ROUNDS));
+        t[j]  = XOR128_3(LOAD128(xs[j] + IPCRYPT_NDX_TWEAKBYTES), tt[j], GATHER_RKEY(rks, j, 0));
+    });
+    for (i = 1; i < ROUNDS; i++) {
+        EACH_LANE(j, {
+            t[j] = AES_ENCRYPT(t[j], GATHER_RKEY(rks, j, i));
+        });
+    }
+    EACH_LANE(j, {
+        t[j] = AES_ENCRYPTLAST(t[j], XOR128(GATHER_RKEY(rks, j, ROUNDS), tt[j]));
+    });
+#endif
+    EACH_LANE(j, {
+        STORE128(xs[j] + IPCRYPT_NDX_TWEAKBYTES, t[j]);
+    });
+}
+
+/**
+ * aes_ndx_decrypt_gather_lanes decrypts LANES ipcrypt-ndx records in-place, each with its own
+ * NDX state. The tweaks are left untouched.
+ */
+static void
+aes_ndx_decrypt_gather_lanes(uint8_t *const xs[LANES], const uint8_t *const ks[LANES])
+{
+    const uint8_t *rks[LANES];
+    BlockVec       tt[LANES];
+    BlockVec       t[LANES];
+    size_t         i;
+
+    EACH_LANE(j, {
+        rks[j] = ks[j] + sizeof(KeySchedule);
+    });
+#ifdef AES_XENCRYPT
+    EACH_LANE(j, {
+        tt[j] = AES_XENCRYPT(LOAD128(xs[j]), GATHER_RKEY(ks, j, 0));
+    });
+    for (i = 1; i < ROUNDS - 1; i++) {
+        EACH_LANE(j, {
+            tt[j] = AES_XENCRYPT(tt[j], GATHER_RKEY(ks, j, i));
+        });
+    }
+    EACH_LANE(j, {
+        tt[j] = XOR128(AES_XENCRYPTLAST(tt[j], GATHER_RKEY(ks, j, i)), GATHER_RKEY(ks, j, ROUNDS));
+        t[j]  = AES_XDECRYPT(XOR128(LOAD128(xs[j] + IPCRYPT_NDX_TWEAKBYTES), tt[j]),
+                             GATHER_RKEY(rks, j, ROUNDS));
+    });
+    for (i = 0; i < ROUNDS - 2; i++) {
+        EACH_LANE(j, {
+            t[j] = AES_XDECRYPT(t[j], RKINVERT(GATHER_RKEY(rks, j, ROUNDS - 1 - i)));
+        });
+    }
+    EACH_LANE(j, {
+        t[j] = XOR128_3(AES_XDECRYPTLAST(t[j], RKINVERT(GATHER_RKEY(rks, j, ROUNDS - 1 - i))),
+                        GATHER_RKEY(rks, j, 0), tt[j]);
+    });
+#else
+    EACH_LANE(j, {
+        tt[j] = XOR128(LOAD128(xs[j]), GATHER_RKEY(ks, j, 0));
+    });
+    for (i = 1; i < ROUNDS; i++) {
+        EACH_LANE(j, {
+            tt[j] = AES_ENCRYPT(tt[j], GATHER_RKEY(ks, j, i));
+        });
+    }
+    EACH_LANE(j, {
+        tt[j] = AES_ENCRYPTLAST(tt[j], GATHER_RKEY(ks, j, ROUNDS));
+        t[j]  = XOR128_3(LOAD128(xs[j] + IPCRYPT_NDX_TWEAKBYTES), tt[j],
+                         GATHER_RKEY(rks, j, ROUNDS));
+    });
+    for (i = 0; i < ROUNDS - 1; i++) {
+        EACH_LANE(j, {
+            t[j] = AES_DECRYPT(t[j], RKINVERT(GATHER_RKEY(rks, j, ROUNDS - 1 - i)));
+        });
+    }
+    EACH_LANE(j, {
+        t[j] = AES_DECRYPTLAST(t[j], XOR128(GATHER_RKEY(rks, j, 0), tt[j]));
+    });
+#endif
+    EACH_LANE(j, {
+        STORE128(xs[j] + IPCRYPT_NDX_TWEAKBYTES, t[j]);
+    });
+}
+
 /**
  * bin2hex converts a binary buffer into a lowercase hex string.
  * hex: the destination buffer.
@@ -658,15 +1437,211 @@ hex2bin(uint8_t *bin, size_t bin_maxlen, const char *hex, size_t hex_len)
     return bin_len;
 }
 
+/*
+ * Constant-time byte comparisons, returning 0xFF if the comparison is true, and 0 otherwise.
+ * Characters are mapped without branches or tables indexed by secret-dependent values, like
+ * bin2hex().
+ */
+#define CT_EQ(x, y) ((((0U - ((unsigned int) (x) ^ (unsigned int) (y))) >> 8) & 0xFF) ^ 0xFF)
+#define CT_GT(x, y) ((((unsigned int) (y) - (unsigned int) (x)) >> 8) & 0xFF)
+#define CT_GE(x, y) (CT_GT(y, x) ^ 0xFF)
+#define CT_LT(x, y) CT_GT(y, x)
+#define CT_LE(x, y) CT_GE(y, x)
+
 /**
- * Convert a hexadecimal string to a secret key.
- *
- * The input string must be exactly 32 or 64 characters long (IPCRYPT_KEYBYTES or
- * IPCRYPT_NDX_KEYBYTES bytes in hex). Returns 0 on success, or -1 if the input string is invalid or
- * conversion fails.
+ * b64_byte_to_char maps a 6-bit value to a character of the base64url alphabet (RFC 4648).
  */
-int
-ipcrypt_key_from_hex(uint8_t *key, size_t key_len, const char *hex, size_t hex_len)
+static char
+b64_byte_to_char(unsigned int x)
+{
+    return (char) ((CT_LT(x, 26) & (x + 'A')) | (CT_GE(x, 26) & CT_LT(x, 52) & (x + ('a' - 26))) |
+                   (CT_GE(x, 52) & CT_LT(x, 62) & (x - (52U - '0'))) | (CT_EQ(x, 62) & '-') |
+                   (CT_EQ(x, 63) & '_'));
+}
+
+/**
+ * b64_char_to_byte maps a character of the base64url alphabet to its 6-bit value.
+ * Returns 0xFF if the character is not part of the alphabet.
+ */
+static unsigned int
+b64_char_to_byte(unsigned int c)
+{
+    const unsigned int x = (CT_GE(c, 'A') & CT_LE(c, 'Z') & (c - 'A')) |
+                           (CT_GE(c, 'a') & CT_LE(c, 'z') & (c - ('a' - 26))) |
+                           (CT_GE(c, '0') & CT_LE(c, '9') & (c + (52U - '0'))) |
+                           (CT_EQ(c, '-') & 62) | (CT_EQ(c, '_') & 63);
+
+    return x | (CT_EQ(x, 0) & (CT_EQ(c, 'A') ^ 0xFF));
+}
+
+/**
+ * b32_byte_to_char maps a 5-bit value to a character of the lowercase base32 alphabet (RFC 4648).
+ */
+static char
+b32_byte_to_char(unsigned int x)
+{
+    return (char) ((CT_LT(x, 26) & (x + 'a')) | (CT_GE(x, 26) & (x + ('2' - 26))));
+}
+
+/**
+ * b32_char_to_byte maps a character of the lowercase base32 alphabet to its 5-bit value.
+ * Returns 0xFF if the character is not part of the alphabet.
+ */
+static unsigned int
+b32_char_to_byte(unsigned int c)
+{
+    const unsigned int x = (CT_GE(c, 'a') & CT_LE(c, 'z') & (c - 'a')) |
+                           (CT_GE(c, '2') & CT_LE(c, '7') & (c - ('2' - 26)));
+
+    return x | (CT_EQ(x, 0) & (CT_EQ(c, 'a') ^ 0xFF));
+}
+
+/**
+ * bin2b64 converts a binary buffer into an unpadded base64url string.
+ * Returns NULL on error, or b64 on success.
+ */
+static char *
+bin2b64(char *b64, size_t b64_maxlen, const uint8_t *bin, size_t bin_len)
+{
+    unsigned int acc     = 0U;
+    unsigned int acc_len = 0U;
+    size_t       i;
+    size_t       j = 0U;
+
+    // Check buffer limits.
+    if (bin_len >= SIZE_MAX / 4 || b64_maxlen <= (bin_len * 4U + 2U) / 3U) {
+        return NULL;
+    }
+    // Emit 6 bits at a time.
+    for (i = 0; i < bin_len; i++) {
+        acc = (acc << 8) | bin[i];
+        acc_len += 8;
+        while (acc_len >= 6) {
+            acc_len -= 6;
+            b64[j++] = b64_byte_to_char((acc >> acc_len) & 0x3F);
+        }
+    }
+    if (acc_len > 0) {
+        b64[j++] = b64_byte_to_char((acc << (6 - acc_len)) & 0x3F);
+    }
+    // Null-terminate the string.
+    b64[j] = 0;
+
+    return b64;
+}
+
+/**
+ * b642bin converts an unpadded base64url string into a binary buffer.
+ * Characters outside of the alphabet, impossible lengths and non-zero trailing bits are rejected,
+ * so that every buffer has a single valid encoding.
+ * Returns the number of bytes written on success, or 0 on error.
+ */
+static size_t
+b642bin(uint8_t *bin, size_t bin_maxlen, const char *b64, size_t b64_len)
+{
+    unsigned int acc     = 0U;
+    unsigned int acc_len = 0U;
+    unsigned int err     = 0U;
+    unsigned int d;
+    size_t       i;
+    size_t       j = 0U;
+
+    if (b64_len >= SIZE_MAX / 6 || b64_len * 6U / 8U > bin_maxlen) {
+        return 0U;
+    }
+    for (i = 0; i < b64_len; i++) {
+        d = b64_char_to_byte((unsigned char) b64[i]);
+        err |= d;
+        acc = (acc << 6) | (d & 0x3F);
+        acc_len += 6;
+        if (acc_len >= 8) {
+            acc_len -= 8;
+            bin[j++] = (uint8_t) (acc >> acc_len);
+        }
+    }
+    if ((err & 0xC0) != 0 || acc_len >= 6 || (acc & ((1U << acc_len) - 1U)) != 0) {
+        return 0U;
+    }
+    return j;
+}
+
+/**
+ * bin2b32 converts a binary buffer into an unpadded lowercase base32 string.
+ * Returns NULL on error, or b32 on success.
+ */
+static char *
+bin2b32(char *b32, size_t b32_maxlen, const uint8_t *bin, size_t bin_len)
+{
+    unsigned int acc     = 0U;
+    unsigned int acc_len = 0U;
+    size_t       i;
+    size_t       j = 0U;
+
+    // Check buffer limits.
+    if (bin_len >= SIZE_MAX / 8 || b32_maxlen <= (bin_len * 8U + 4U) / 5U) {
+        return NULL;
+    }
+    // Emit 5 bits at a time.
+    for (i = 0; i < bin_len; i++) {
+        acc = (acc << 8) | bin[i];
+        acc_len += 8;
+        while (acc_len >= 5) {
+            acc_len -= 5;
+            b32[j++] = b32_byte_to_char((acc >> acc_len) & 0x1F);
+        }
+    }
+    if (acc_len > 0) {
+        b32[j++] = b32_byte_to_char((acc << (5 - acc_len)) & 0x1F);
+    }
+    // Null-terminate the string.
+    b32[j] = 0;
+
+    return b32;
+}
+
+/**
+ * b322bin converts an unpadded lowercase base32 string into a binary buffer.
+ * Characters outside of the alphabet, impossible lengths and non-zero trailing bits are rejected.
+ * Returns the number of bytes written on success, or 0 on error.
+ */
+static size_t
+b322bin(uint8_t *bin, size_t bin_maxlen, const char *b32, size_t b32_len)
+{
+    unsigned int acc     = 0U;
+    unsigned int acc_len = 0U;
+    unsigned int err     = 0U;
+    unsigned int d;
+    size_t       i;
+    size_t       j = 0U;
+
+    if (b32_len >= SIZE_MAX / 5 || b32_len * 5U / 8U > bin_maxlen) {
+        return 0U;
+    }
+    for (i = 0; i < b32_len; i++) {
+        d = b32_char_to_byte((unsigned char) b32[i]);
+        err |= d;
+        acc = (acc << 5) | (d & 0x1F);
+        acc_len += 5;
+        if (acc_len >= 8) {
+            acc_len -= 8;
+            bin[j++] = (uint8_t) (acc >> acc_len);
+        }
+    }
+    if ((err & 0xE0) != 0 || acc_len >= 5 || (acc & ((1U << acc_len) - 1U)) != 0) {
+        return 0U;
+    }
+    return j;
+}
+
+/**
+ * Convert a hexadecimal string to a secret key.
+ *
+ * The input string must be exactly 32 or 64 characters long (IPCRYPT_KEYBYTES or
+ * IPCRYPT_NDX_KEYBYTES bytes in hex). Returns 0 on success, or -1 if the input string is invalid or
+ * conversion fails.
+ */
+int
+ipcrypt_key_from_hex(uint8_t *key, size_t key_len, const char *hex, size_t hex_len)
 {
     if (hex_len != 2 * IPCRYPT_KEYBYTES && hex_len != 2 * IPCRYPT_NDX_KEYBYTES) {
         return -1;
@@ -713,6 +1688,78 @@ ipcrypt_ndx_ndip_from_hex(uint8_t ndip[IPCRYPT_NDX_NDIP_BYTES], const char *hex,
     return 0;
 }
 
+/**
+ * Convert a base64url string to an ipcrypt-nd ciphertext.
+ *
+ * The input string must be exactly 32 characters long (IPCRYPT_NDIP_BYTES bytes in base64url).
+ * Returns 0 on success, or -1 if the input string is invalid or conversion fails.
+ */
+int
+ipcrypt_ndip_from_b64(uint8_t ndip[IPCRYPT_NDIP_BYTES], const char *b64, size_t b64_len)
+{
+    if (b64_len != IPCRYPT_NDIP_B64_STR_BYTES - 1) {
+        return -1;
+    }
+    if (b642bin(ndip, IPCRYPT_NDIP_BYTES, b64, b64_len) != IPCRYPT_NDIP_BYTES) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Convert a base64url string to an ipcrypt-ndx ciphertext.
+ *
+ * The input string must be exactly 43 characters long (IPCRYPT_NDX_NDIP_BYTES bytes in base64url).
+ * Returns 0 on success, or -1 if the input string is invalid or conversion fails.
+ */
+int
+ipcrypt_ndx_ndip_from_b64(uint8_t ndip[IPCRYPT_NDX_NDIP_BYTES], const char *b64, size_t b64_len)
+{
+    if (b64_len != IPCRYPT_NDX_NDIP_B64_STR_BYTES - 1) {
+        return -1;
+    }
+    if (b642bin(ndip, IPCRYPT_NDX_NDIP_BYTES, b64, b64_len) != IPCRYPT_NDX_NDIP_BYTES) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Convert a base32 string to an ipcrypt-nd ciphertext.
+ *
+ * The input string must be exactly 39 characters long (IPCRYPT_NDIP_BYTES bytes in base32).
+ * Returns 0 on success, or -1 if the input string is invalid or conversion fails.
+ */
+int
+ipcrypt_ndip_from_b32(uint8_t ndip[IPCRYPT_NDIP_BYTES], const char *b32, size_t b32_len)
+{
+    if (b32_len != IPCRYPT_NDIP_B32_STR_BYTES - 1) {
+        return -1;
+    }
+    if (b322bin(ndip, IPCRYPT_NDIP_BYTES, b32, b32_len) != IPCRYPT_NDIP_BYTES) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Convert a base32 string to an ipcrypt-ndx ciphertext.
+ *
+ * The input string must be exactly 52 characters long (IPCRYPT_NDX_NDIP_BYTES bytes in base32).
+ * Returns 0 on success, or -1 if the input string is invalid or conversion fails.
+ */
+int
+ipcrypt_ndx_ndip_from_b32(uint8_t ndip[IPCRYPT_NDX_NDIP_BYTES], const char *b32, size_t b32_len)
+{
+    if (b32_len != IPCRYPT_NDX_NDIP_B32_STR_BYTES - 1) {
+        return -1;
+    }
+    if (b322bin(ndip, IPCRYPT_NDX_NDIP_BYTES, b32, b32_len) != IPCRYPT_NDX_NDIP_BYTES) {
+        return -1;
+    }
+    return 0;
+}
+
 /**
  * ipcrypt_str_to_ip16 parses an IP address string (IPv4 or IPv6) into a 16-byte buffer ip16.
  * If it detects an IPv4 address, it is stored as an IPv4-mapped IPv6 address.
@@ -737,6 +1784,7 @@ ipcrypt_str_to_ip16(uint8_t ip16[16], const char *ip_str)
         memcpy(ip16 + 12, &addr4, 4);
         return 0;
     }
+    STATS_PARSE_ERROR();
     return -1; // Parsing failed.
 }
 
@@ -842,6 +1890,39 @@ ipcrypt_ip16_to_sockaddr(struct sockaddr_storage *sa, const uint8_t ip16[16])
     }
 }
 
+/**
+ * Convert an array of socket addresses to consecutive 16-byte binary IP addresses.
+ * Addresses of unsupported families are converted to the unspecified address.
+ */
+size_t
+ipcrypt_sockaddrs_to_ip16s(uint8_t *ip16s, const struct sockaddr_storage *sas, size_t count)
+{
+    size_t converted = 0;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if (ipcrypt_sockaddr_to_ip16(ip16s + i * 16, (const struct sockaddr *) &sas[i]) == 0) {
+            converted++;
+        } else {
+            memset(ip16s + i * 16, 0, 16);
+        }
+    }
+    return converted;
+}
+
+/**
+ * Convert consecutive 16-byte binary IP addresses to an array of socket addresses.
+ */
+void
+ipcrypt_ip16s_to_sockaddrs(struct sockaddr_storage *sas, const uint8_t *ip16s, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        ipcrypt_ip16_to_sockaddr(&sas[i], ip16s + i * 16);
+    }
+}
+
 /**
  * ipcrypt_init initializes an IPCrypt context with a 16-byte key.
  * Expands the key into round keys and stores them in ipcrypt->opaque.
@@ -964,146 +2045,482 @@ ipcrypt_pfx_shift_left(uint8_t ip16[16])
 }
 
 /**
- * ipcrypt_pfx_encrypt_ip16 encrypts a 16-byte IP address in-place with prefix preservation.
- * IP addresses with the same prefix produce encrypted IP addresses with the same prefix.
- * The prefix can be of any length. For IPv4 addresses (stored as IPv4-mapped IPv6),
- * this preserves the IPv4 prefix structure.
+ * PFXPrefix is a padded prefix, or an address, as a 128-bit big-endian integer.
+ * Shifting and setting bits is much cheaper on a pair of 64-bit integers than on byte arrays.
  */
-void
-ipcrypt_pfx_encrypt_ip16(const IPCryptPFX *ipcrypt, uint8_t ip16[16])
+typedef struct PFXPrefix {
+    uint64_t hi;
+    uint64_t lo;
+} PFXPrefix;
+
+static PFXPrefix
+pfx_prefix_load(const uint8_t ip16[16])
 {
-    PFXState     st;
-    BlockVec     e1_0, e2_0, e_0, e1_1, e2_1, e_1;
-    uint8_t      encrypted_ip[16];
-    uint8_t      padded_prefix_0[16], padded_prefix_1[16];
-    uint8_t      t_0[16], t_1[16];
-    size_t       i;
-    unsigned int bit_pos_0, bit_pos_1;
-    unsigned int prefix_start = 0;
-    unsigned int prefix_len_bits;
-    uint8_t      cipher_bit_0, cipher_bit_1;
-    uint8_t      original_bit_0, original_bit_1;
+    PFXPrefix p;
+    size_t    i;
 
-    memcpy(&st, ipcrypt->opaque, sizeof st);
-    if (ipcrypt_is_mapped_ipv4(ip16)) {
-        prefix_start = 96;
+    p.hi = p.lo = 0;
+    for (i = 0; i < 8; i++) {
+        p.hi = (p.hi << 8) | ip16[i];
+        p.lo = (p.lo << 8) | ip16[8 + i];
     }
+    return p;
+}
 
-    ipcrypt_pfx_pad_prefix(padded_prefix_0, prefix_start);
+static void
+pfx_prefix_store(uint8_t ip16[16], PFXPrefix p)
+{
+    size_t i;
 
-    memset(encrypted_ip, 0, 16);
-    if (prefix_start == 96) {
-        encrypted_ip[10] = 0xff;
-        encrypted_ip[11] = 0xff;
+    for (i = 0; i < 8; i++) {
+        ip16[7 - i]  = (uint8_t) (p.hi >> (8 * i));
+        ip16[15 - i] = (uint8_t) (p.lo >> (8 * i));
     }
+}
 
-    // Process two bits per iteration for better parallelism
-    for (prefix_len_bits = prefix_start; prefix_len_bits < 128; prefix_len_bits += 2) {
-        // Prepare padded_prefix_1 for the second iteration
-        memcpy(padded_prefix_1, padded_prefix_0, 16);
-        bit_pos_0      = 127 - prefix_len_bits;
-        original_bit_0 = ipcrypt_pfx_get_bit(ip16, bit_pos_0);
-        ipcrypt_pfx_shift_left(padded_prefix_1);
-        ipcrypt_pfx_set_bit(padded_prefix_1, 0, original_bit_0);
-
-#ifdef AES_XENCRYPT
-        // For AArch64 with AES_XENCRYPT macros - process two encryptions in parallel
-        e1_0 = AES_XENCRYPT(LOAD128(padded_prefix_0), st.k1keys[0]);
-        e2_0 = AES_XENCRYPT(LOAD128(padded_prefix_0), st.k2keys[0]);
-        e1_1 = AES_XENCRYPT(LOAD128(padded_prefix_1), st.k1keys[0]);
-        e2_1 = AES_XENCRYPT(LOAD128(padded_prefix_1), st.k2keys[0]);
-
-        for (i = 1; i < ROUNDS - 1; i++) {
-            e1_0 = AES_XENCRYPT(e1_0, st.k1keys[i]);
-            e2_0 = AES_XENCRYPT(e2_0, st.k2keys[i]);
-            e1_1 = AES_XENCRYPT(e1_1, st.k1keys[i]);
-            e2_1 = AES_XENCRYPT(e2_1, st.k2keys[i]);
-        }
+/**
+ * pfx_prefix_top returns an address with all but its `len` most significant bits cleared.
+ */
+static PFXPrefix
+pfx_prefix_top(PFXPrefix ip, const unsigned int len)
+{
+    const unsigned int low = 128 - len;
 
-        e1_0 = AES_XENCRYPTLAST(e1_0, st.k1keys[i]);
-        e2_0 = AES_XENCRYPTLAST(e2_0, st.k2keys[i]);
-        e1_1 = AES_XENCRYPTLAST(e1_1, st.k1keys[i]);
-        e2_1 = AES_XENCRYPTLAST(e2_1, st.k2keys[i]);
+    if (low >= 64) {
+        ip.hi = low == 128 ? 0 : ip.hi & ~(((uint64_t) 1 << (low - 64)) - 1);
+        ip.lo = 0;
+    } else {
+        ip.lo = ip.lo & ~(((uint64_t) 1 << low) - 1);
+    }
+    return ip;
+}
 
-        e1_0 = XOR128(e1_0, st.k1keys[ROUNDS]);
-        e2_0 = XOR128(e2_0, st.k2keys[ROUNDS]);
-        e1_1 = XOR128(e1_1, st.k1keys[ROUNDS]);
-        e2_1 = XOR128(e2_1, st.k2keys[ROUNDS]);
-#else
-        // For x86_64 or a fallback - process two encryptions in parallel
-        e1_0 = XOR128(LOAD128(padded_prefix_0), st.k1keys[0]);
-        e2_0 = XOR128(LOAD128(padded_prefix_0), st.k2keys[0]);
-        e1_1 = XOR128(LOAD128(padded_prefix_1), st.k1keys[0]);
-        e2_1 = XOR128(LOAD128(padded_prefix_1), st.k2keys[0]);
+/**
+ * pfx_prefix_padded returns the padded prefix made of the `len` most significant bits of an
+ * address: a 1 bit followed by these bits, as a (len + 1)-bit integer. `len` must be below 128.
+ */
+static PFXPrefix
+pfx_prefix_padded(PFXPrefix ip, const unsigned int len)
+{
+    const unsigned int shift = 128 - len;
+    PFXPrefix          p;
 
-        for (i = 1; i < ROUNDS; i++) {
-            e1_0 = AES_ENCRYPT(e1_0, st.k1keys[i]);
-            e2_0 = AES_ENCRYPT(e2_0, st.k2keys[i]);
-            e1_1 = AES_ENCRYPT(e1_1, st.k1keys[i]);
-            e2_1 = AES_ENCRYPT(e2_1, st.k2keys[i]);
-        }
+    if (len == 0) {
+        p.hi = 0;
+        p.lo = 0;
+    } else if (shift >= 64) {
+        p.hi = 0;
+        p.lo = ip.hi >> (shift - 64);
+    } else {
+        p.hi = ip.hi >> shift;
+        p.lo = (ip.lo >> shift) | (ip.hi << (64 - shift));
+    }
+    if (len >= 64) {
+        p.hi |= (uint64_t) 1 << (len - 64);
+    } else {
+        p.lo |= (uint64_t) 1 << len;
+    }
+    return p;
+}
 
-        e1_0 = AES_ENCRYPTLAST(e1_0, st.k1keys[ROUNDS]);
-        e2_0 = AES_ENCRYPTLAST(e2_0, st.k2keys[ROUNDS]);
-        e1_1 = AES_ENCRYPTLAST(e1_1, st.k1keys[ROUNDS]);
-        e2_1 = AES_ENCRYPTLAST(e2_1, st.k2keys[ROUNDS]);
-#endif
+/**
+ * pfx_prefix_init returns the padded prefix for the first encrypted bit, and sets `out` to the
+ * fixed part of the output: nothing for IPv6, and the ::ffff:0:0/96 prefix for IPv4.
+ */
+static unsigned int
+pfx_prefix_init(PFXPrefix *padded_prefix, PFXPrefix *out, const uint8_t ip16[16])
+{
+    if (ipcrypt_is_mapped_ipv4(ip16)) {
+        padded_prefix->hi = (uint64_t) 1 << 32;
+        padded_prefix->lo = 0xffff;
+        out->hi           = 0;
+        out->lo           = (uint64_t) 0xffff << 32;
+        return 96;
+    }
+    padded_prefix->hi = 0;
+    padded_prefix->lo = 1;
+    out->hi = out->lo = 0;
+    return 0;
+}
 
-        // Process results for first bit
-        e_0 = XOR128(e1_0, e2_0);
-        STORE128(t_0, e_0);
-        cipher_bit_0 = t_0[15] & 1;
+/**
+ * pfx_prefix_anchor sets `out` to the first `len` bits of an address, and `padded_prefix` to the
+ * padded prefix they make, for the bit that follows them. It is the state pfx_prefix_init()
+ * leads to after `len` bits have been processed, and `len` is returned.
+ */
+static unsigned int
+pfx_prefix_anchor(PFXPrefix *padded_prefix, PFXPrefix *out, const uint8_t ip16[16],
+                  const unsigned int len)
+{
+    const PFXPrefix ip = pfx_prefix_load(ip16);
 
-        // Process results for second bit
-        e_1 = XOR128(e1_1, e2_1);
-        STORE128(t_1, e_1);
-        cipher_bit_1   = t_1[15] & 1;
-        bit_pos_1      = bit_pos_0 - 1;
-        original_bit_1 = ipcrypt_pfx_get_bit(ip16, bit_pos_1);
+    *out = pfx_prefix_top(ip, len);
+    if (len < 128) {
+        *padded_prefix = pfx_prefix_padded(ip, len);
+    }
+    return len;
+}
 
-        ipcrypt_pfx_set_bit(encrypted_ip, bit_pos_0, original_bit_0 ^ cipher_bit_0);
-        ipcrypt_pfx_set_bit(encrypted_ip, bit_pos_1, original_bit_1 ^ cipher_bit_1);
+static uint8_t
+pfx_prefix_get_bit(PFXPrefix p, const unsigned int bit_index)
+{
+    if (bit_index >= 64) {
+        return (uint8_t) (p.hi >> (bit_index - 64)) & 1;
+    }
+    return (uint8_t) (p.lo >> bit_index) & 1;
+}
 
-        // Update padded_prefix_0 for next iteration
-        ipcrypt_pfx_shift_left(padded_prefix_1);
-        ipcrypt_pfx_set_bit(padded_prefix_1, 0, original_bit_1);
-        memcpy(padded_prefix_0, padded_prefix_1, 16);
+static void
+pfx_prefix_set_bit(PFXPrefix *p, const unsigned int bit_index, const uint8_t bit_value)
+{
+    if (bit_index >= 64) {
+        p->hi |= (uint64_t) bit_value << (bit_index - 64);
+    } else {
+        p->lo |= (uint64_t) bit_value << bit_index;
     }
-    memcpy(ip16, encrypted_ip, 16);
 }
 
 /**
- * ipcrypt_pfx_decrypt_ip16 decrypts a 16-byte IP address in-place with prefix preservation.
- * This reverses the encryption performed by ipcrypt_pfx_encrypt_ip16, recovering the original IP
- * address.
+ * pfx_prefix_push appends a bit to a padded prefix.
  */
-void
-ipcrypt_pfx_decrypt_ip16(const IPCryptPFX *ipcrypt, uint8_t ip16[16])
+static PFXPrefix
+pfx_prefix_push(PFXPrefix p, const uint8_t bit_value)
 {
-    PFXState     st;
-    BlockVec     e1, e2, e;
-    uint8_t      original_ip[16];
-    uint8_t      padded_prefix[16];
-    uint8_t      t[16];
-    size_t       i;
-    unsigned int bit_pos;
-    unsigned int prefix_start = 0;
-    unsigned int prefix_len_bits;
-    uint8_t      cipher_bit;
-    uint8_t      encrypted_bit;
-    uint8_t      original_bit;
+    PFXPrefix q;
 
-    memcpy(&st, ipcrypt->opaque, sizeof st);
-    if (ipcrypt_is_mapped_ipv4(ip16)) {
-        prefix_start = 96;
-    }
+    q.hi = (p.hi << 1) | (p.lo >> 63);
+    q.lo = (p.lo << 1) | bit_value;
+    return q;
+}
 
-    ipcrypt_pfx_pad_prefix(padded_prefix, prefix_start);
+static uint64_t
+pfx_bswap64(uint64_t x)
+{
+    x = ((x & 0x00ff00ff00ff00ffULL) << 8) | ((x >> 8) & 0x00ff00ff00ff00ffULL);
+    x = ((x & 0x0000ffff0000ffffULL) << 16) | ((x >> 16) & 0x0000ffff0000ffffULL);
+    return (x << 32) | (x >> 32);
+}
 
-    memset(original_ip, 0, 16);
-    if (prefix_start == 96) {
-        original_ip[10] = 0xff;
-        original_ip[11] = 0xff;
+/**
+ * pfx_prefix_block converts a padded prefix into a block, without going through memory.
+ */
+static BlockVec
+pfx_prefix_block(PFXPrefix p)
+{
+    return SET64x2(pfx_bswap64(p.lo), pfx_bswap64(p.hi));
+}
+
+/**
+ * pfx_encrypt encrypts a 16-byte IP address in-place with prefix preservation.
+ *
+ * When encrypting, every padded prefix only depends on the original address, so the AES
+ * computations for different bit positions are independent. Four bit positions (eight AES
+ * encryptions) are processed per iteration to keep the AES units busy.
+ *
+ * The first `ipv4_prefix_len` (IPv4) or `ipv6_prefix_len` (IPv6) bits after the fixed part of the
+ * address can be skipped: the padded prefix chain then starts after them, exactly where it would
+ * be if these bits had been processed, so that the remaining bits are the same as without them.
+ * The skipped bits that follow the last multiple of LANES are encrypted anyway.
+ */
+static void
+pfx_encrypt(const PFXState *st, uint8_t ip16[16], const unsigned int ipv4_prefix_len,
+            const unsigned int ipv6_prefix_len)
+{
+    BlockVec     e1[LANES], e2[LANES];
+    PFXPrefix    ip, encrypted_ip;
+    PFXPrefix    padded_prefix[LANES];
+    uint8_t      t[16];
+    size_t       i;
+    unsigned int prefix_len_bits, preserved_bits;
+    uint8_t      original_bit[LANES];
+
+    ip              = pfx_prefix_load(ip16);
+    prefix_len_bits = pfx_prefix_init(&padded_prefix[0], &encrypted_ip, ip16);
+    preserved_bits  = prefix_len_bits + (prefix_len_bits == 96 ? ipv4_prefix_len : ipv6_prefix_len);
+    if (preserved_bits != prefix_len_bits) {
+        // Start at a multiple of LANES. The preserved bits encrypted by the first iteration are
+        // restored by the caller.
+        prefix_len_bits = pfx_prefix_anchor(&padded_prefix[0], &encrypted_ip, ip16,
+                                            preserved_bits - preserved_bits % LANES);
+    }
+
+    for (; prefix_len_bits < 128; prefix_len_bits += LANES) {
+        // Derive the padded prefixes for the next three bit positions from the original bits.
+        EACH_LANE(j, {
+            original_bit[j] = pfx_prefix_get_bit(ip, 127 - prefix_len_bits - (unsigned int) j);
+        });
+        for (i = 1; i < LANES; i++) {
+            padded_prefix[i] = pfx_prefix_push(padded_prefix[i - 1], original_bit[i - 1]);
+        }
+
+#ifdef AES_XENCRYPT
+        // For AArch64 with AES_XENCRYPT macros - process eight encryptions in parallel
+        EACH_LANE(j, {
+            const BlockVec p = pfx_prefix_block(padded_prefix[j]);
+
+            e1[j] = AES_XENCRYPT(p, st->k1keys[0]);
+            e2[j] = AES_XENCRYPT(p, st->k2keys[0]);
+        });
+        for (i = 1; i < ROUNDS - 1; i++) {
+            EACH_LANE(j, {
+                e1[j] = AES_XENCRYPT(e1[j], st->k1keys[i]);
+                e2[j] = AES_XENCRYPT(e2[j], st->k2keys[i]);
+            });
+        }
+        EACH_LANE(j, {
+            e1[j] = XOR128(AES_XENCRYPTLAST(e1[j], st->k1keys[i]), st->k1keys[ROUNDS]);
+            e2[j] = XOR128(AES_XENCRYPTLAST(e2[j], st->k2keys[i]), st->k2keys[ROUNDS]);
+        });
+#else
+        // For x86_64 or a fallback - process eight encryptions in parallel
+        EACH_LANE(j, {
+            const BlockVec p = pfx_prefix_block(padded_prefix[j]);
+
+            e1[j] = XOR128(p, st->k1keys[0]);
+            e2[j] = XOR128(p, st->k2keys[0]);
+        });
+        for (i = 1; i < ROUNDS; i++) {
+            EACH_LANE(j, {
+                e1[j] = AES_ENCRYPT(e1[j], st->k1keys[i]);
+                e2[j] = AES_ENCRYPT(e2[j], st->k2keys[i]);
+            });
+        }
+        EACH_LANE(j, {
+            e1[j] = AES_ENCRYPTLAST(e1[j], st->k1keys[ROUNDS]);
+            e2[j] = AES_ENCRYPTLAST(e2[j], st->k2keys[ROUNDS]);
+        });
+#endif
+
+        EACH_LANE(j, {
+            STORE128(t, XOR128(e1[j], e2[j]));
+            pfx_prefix_set_bit(&encrypted_ip, 127 - prefix_len_bits - (unsigned int) j,
+                               original_bit[j] ^ (t[15] & 1));
+        });
+
+        // Update padded_prefix[0] for next iteration
+        padded_prefix[0] = pfx_prefix_push(padded_prefix[LANES - 1], original_bit[LANES - 1]);
+    }
+    pfx_prefix_store(ip16, encrypted_ip);
+}
+
+/**
+ * PFXLane is the state of an address being decrypted by pfx_decrypt_lanes.
+ */
+typedef struct PFXLane {
+    uint8_t     *ip16;
+    PFXPrefix    encrypted_ip;
+    PFXPrefix    original_ip;
+    PFXPrefix    padded_prefix;
+    unsigned int prefix_len_bits;
+} PFXLane;
+
+/**
+ * pfx_lane_step recovers the next bit of an address from the cipher bit of its padded prefix.
+ * When all the bits have been recovered, the address is written back and the lane becomes idle.
+ */
+static void
+pfx_lane_step(PFXLane *lane, const uint8_t cipher_bit)
+{
+    const unsigned int bit_pos = 127 - lane->prefix_len_bits;
+    const uint8_t original_bit = pfx_prefix_get_bit(lane->encrypted_ip, bit_pos) ^ cipher_bit;
+
+    pfx_prefix_set_bit(&lane->original_ip, bit_pos, original_bit);
+    lane->padded_prefix = pfx_prefix_push(lane->padded_prefix, original_bit);
+    if (++lane->prefix_len_bits == 128) {
+        pfx_prefix_store(lane->ip16, lane->original_ip);
+        lane->ip16 = NULL;
+    }
+}
+
+/**
+ * pfx_lane_anchor copies the first `prefix_len` bits after the fixed part of an address through,
+ * and moves the lane to the next bit. Lanes with nothing left to decrypt become idle.
+ */
+static void
+pfx_lane_anchor(PFXLane *lane, const unsigned int prefix_len)
+{
+    lane->prefix_len_bits = pfx_prefix_anchor(&lane->padded_prefix, &lane->original_ip,
+                                              lane->ip16, lane->prefix_len_bits + prefix_len);
+    if (lane->prefix_len_bits == 128) {
+        lane->ip16 = NULL;
+    }
+}
+
+/**
+ * pfx_cipher_bit returns the least significant bit of AES(K1, prefix) ^ AES(K2, prefix).
+ */
+static uint8_t
+pfx_cipher_bit(const PFXState *st, PFXPrefix padded_prefix)
+{
+    BlockVec e1, e2;
+    uint8_t  t[16];
+    size_t   i;
+
+#ifdef AES_XENCRYPT
+    e1 = AES_XENCRYPT(pfx_prefix_block(padded_prefix), st->k1keys[0]);
+    e2 = AES_XENCRYPT(pfx_prefix_block(padded_prefix), st->k2keys[0]);
+    for (i = 1; i < ROUNDS - 1; i++) {
+        e1 = AES_XENCRYPT(e1, st->k1keys[i]);
+        e2 = AES_XENCRYPT(e2, st->k2keys[i]);
+    }
+    e1 = XOR128(AES_XENCRYPTLAST(e1, st->k1keys[i]), st->k1keys[ROUNDS]);
+    e2 = XOR128(AES_XENCRYPTLAST(e2, st->k2keys[i]), st->k2keys[ROUNDS]);
+#else
+    e1 = XOR128(pfx_prefix_block(padded_prefix), st->k1keys[0]);
+    e2 = XOR128(pfx_prefix_block(padded_prefix), st->k2keys[0]);
+    for (i = 1; i < ROUNDS; i++) {
+        e1 = AES_ENCRYPT(e1, st->k1keys[i]);
+        e2 = AES_ENCRYPT(e2, st->k2keys[i]);
+    }
+    e1 = AES_ENCRYPTLAST(e1, st->k1keys[ROUNDS]);
+    e2 = AES_ENCRYPTLAST(e2, st->k2keys[ROUNDS]);
+#endif
+    STORE128(t, XOR128(e1, e2));
+    return t[15] & 1;
+}
+
+/**
+ * pfx_decrypt_lanes decrypts a set of 16-byte IP addresses in-place with prefix preservation.
+ *
+ * Decryption of a single address is sequential, since every padded prefix depends on the
+ * previously recovered bit. Independent addresses are interleaved instead: each of the LANES
+ * lanes processes one address, and picks the next pending address as soon as it is done, so that
+ * mixed IPv4 (32 steps) and IPv6 (128 steps) inputs keep all lanes busy.
+ * Once a single address is left, it is finished without the other lanes.
+ */
+static void
+pfx_decrypt_lanes(const PFXState *st, uint8_t *const ips[], size_t n,
+                  const unsigned int ipv4_prefix_len, const unsigned int ipv6_prefix_len)
+{
+    BlockVec e1[LANES], e2[LANES];
+    PFXLane  lanes[LANES];
+    uint8_t  t[16];
+    size_t   next = 0;
+    size_t   active;
+    size_t   i;
+
+    memset(lanes, 0, sizeof lanes);
+    for (;;) {
+        active = 0;
+        EACH_LANE(j, {
+            PFXLane *lane = &lanes[j];
+
+            // Addresses that are entirely preserved are left as they are.
+            while (lane->ip16 == NULL && next < n) {
+                lane->ip16            = ips[next++];
+                lane->encrypted_ip    = pfx_prefix_load(lane->ip16);
+                lane->prefix_len_bits = pfx_prefix_init(&lane->padded_prefix,
+                                                        &lane->original_ip, lane->ip16);
+                if (ipv4_prefix_len != 0 || ipv6_prefix_len != 0) {
+                    pfx_lane_anchor(lane, lane->prefix_len_bits == 96 ? ipv4_prefix_len
+                                                                      : ipv6_prefix_len);
+                }
+            }
+            active += lane->ip16 != NULL;
+        });
+        if (active <= 1) {
+            break;
+        }
+
+        // Idle lanes encrypt a stale prefix; this is cheaper than branching on every round.
+#ifdef AES_XENCRYPT
+        EACH_LANE(j, {
+            const BlockVec p = pfx_prefix_block(lanes[j].padded_prefix);
+
+            e1[j] = AES_XENCRYPT(p, st->k1keys[0]);
+            e2[j] = AES_XENCRYPT(p, st->k2keys[0]);
+        });
+        for (i = 1; i < ROUNDS - 1; i++) {
+            EACH_LANE(j, {
+                e1[j] = AES_XENCRYPT(e1[j], st->k1keys[i]);
+                e2[j] = AES_XENCRYPT(e2[j], st->k2keys[i]);
+            });
+        }
+        EACH_LANE(j, {
+            e1[j] = XOR128(AES_XENCRYPTLAST(e1[j], st->k1keys[i]), st->k1keys[ROUNDS]);
+            e2[j] = XOR128(AES_XENCRYPTLAST(e2[j], st->k2keys[i]), st->k2keys[ROUNDS]);
+        });
+#else
+        EACH_LANE(j, {
+            const BlockVec p = pfx_prefix_block(lanes[j].padded_prefix);
+
+            e1[j] = XOR128(p, st->k1keys[0]);
+            e2[j] = XOR128(p, st->k2keys[0]);
+        });
+        for (i = 1; i < ROUNDS; i++) {
+            EACH_LANE(j, {
+                e1[j] = AES_ENCRYPT(e1[j], st->k1keys[i]);
+                e2[j] = AES_ENCRYPT(e2[j], st->k2keys[i]);
+            });
+        }
+        EACH_LANE(j, {
+            e1[j] = AES_ENCRYPTLAST(e1[j], st->k1keys[ROUNDS]);
+            e2[j] = AES_ENCRYPTLAST(e2[j], st->k2keys[ROUNDS]);
+        });
+#endif
+
+        EACH_LANE(j, {
+            if (lanes[j].ip16 != NULL) {
+                STORE128(t, XOR128(e1[j], e2[j]));
+                pfx_lane_step(&lanes[j], t[15] & 1);
+            }
+        });
+    }
+    EACH_LANE(j, {
+        while (lanes[j].ip16 != NULL) {
+            pfx_lane_step(&lanes[j], pfx_cipher_bit(st, lanes[j].padded_prefix));
+        }
+    });
+}
+
+/**
+ * ipcrypt_pfx_encrypt_ip16 encrypts a 16-byte IP address in-place with prefix preservation.
+ * IP addresses with the same prefix produce encrypted IP addresses with the same prefix.
+ * The prefix can be of any length. For IPv4 addresses (stored as IPv4-mapped IPv6),
+ * this preserves the IPv4 prefix structure.
+ */
+void
+ipcrypt_pfx_encrypt_ip16(const IPCryptPFX *ipcrypt, uint8_t ip16[16])
+{
+    PFXState st;
+
+    memcpy(&st, ipcrypt->opaque, sizeof st);
+    pfx_encrypt(&st, ip16, 0, 0);
+    STATS_OP(IPCRYPT_MODE_PFX, 16);
+}
+
+/**
+ * ipcrypt_pfx_decrypt_ip16 decrypts a 16-byte IP address in-place with prefix preservation.
+ * This reverses the encryption performed by ipcrypt_pfx_encrypt_ip16, recovering the original IP
+ * address.
+ */
+void
+ipcrypt_pfx_decrypt_ip16(const IPCryptPFX *ipcrypt, uint8_t ip16[16])
+{
+    PFXState     st;
+    BlockVec     e1, e2, e;
+    uint8_t      original_ip[16];
+    uint8_t      padded_prefix[16];
+    uint8_t      t[16];
+    size_t       i;
+    unsigned int bit_pos;
+    unsigned int prefix_start = 0;
+    unsigned int prefix_len_bits;
+    uint8_t      cipher_bit;
+    uint8_t      encrypted_bit;
+    uint8_t      original_bit;
+
+    memcpy(&st, ipcrypt->opaque, sizeof st);
+    if (ipcrypt_is_mapped_ipv4(ip16)) {
+        prefix_start = 96;
+    }
+
+    ipcrypt_pfx_pad_prefix(padded_prefix, prefix_start);
+
+    memset(original_ip, 0, 16);
+    if (prefix_start == 96) {
+        original_ip[10] = 0xff;
+        original_ip[11] = 0xff;
     }
 
     for (prefix_len_bits = prefix_start; prefix_len_bits < 128; prefix_len_bits++) {
@@ -1141,6 +2558,63 @@ ipcrypt_pfx_decrypt_ip16(const IPCryptPFX *ipcrypt, uint8_t ip16[16])
         ipcrypt_pfx_set_bit(padded_prefix, 0, original_bit);
     }
     memcpy(ip16, original_ip, 16);
+    STATS_OP(IPCRYPT_MODE_PFX, 16);
+}
+
+/**
+ * ipcrypt_pfx_encrypt_ip16_anchored encrypts a 16-byte IP address in-place with prefix
+ * preservation, copying its first `ipv4_prefix_len` (IPv4) or `ipv6_prefix_len` (IPv6) bits
+ * through. The AES computations for these bits are skipped.
+ * Returns 0 on success, or -1 if a prefix length is out of range.
+ */
+int
+ipcrypt_pfx_encrypt_ip16_anchored(const IPCryptPFX *ipcrypt, uint8_t ip16[16],
+                                  unsigned int ipv4_prefix_len, unsigned int ipv6_prefix_len)
+{
+    PFXState     st;
+    uint8_t      original_ip[16];
+    unsigned int preserved_bits;
+    uint8_t      mask;
+
+    if (ipv4_prefix_len > 32 || ipv6_prefix_len > 128) {
+        STATS_ERROR();
+        return -1;
+    }
+    memcpy(&st, ipcrypt->opaque, sizeof st);
+    memcpy(original_ip, ip16, 16);
+    preserved_bits = ipcrypt_is_mapped_ipv4(ip16) ? 96 + ipv4_prefix_len : ipv6_prefix_len;
+    pfx_encrypt(&st, ip16, ipv4_prefix_len, ipv6_prefix_len);
+    // Restore the preserved bits that were encrypted, for lengths that are not multiples of LANES.
+    memcpy(ip16, original_ip, preserved_bits / 8);
+    if (preserved_bits % 8 != 0) {
+        mask                     = (uint8_t) (0xff << (8 - preserved_bits % 8));
+        ip16[preserved_bits / 8] = (uint8_t) ((original_ip[preserved_bits / 8] & mask) |
+                                              (ip16[preserved_bits / 8] & ~mask));
+    }
+    STATS_OP(IPCRYPT_MODE_PFX, 16);
+    return 0;
+}
+
+/**
+ * ipcrypt_pfx_decrypt_ip16_anchored decrypts a 16-byte IP address in-place, reversing
+ * ipcrypt_pfx_encrypt_ip16_anchored() with the same prefix lengths.
+ * Returns 0 on success, or -1 if a prefix length is out of range.
+ */
+int
+ipcrypt_pfx_decrypt_ip16_anchored(const IPCryptPFX *ipcrypt, uint8_t ip16[16],
+                                  unsigned int ipv4_prefix_len, unsigned int ipv6_prefix_len)
+{
+    PFXState       st;
+    uint8_t *const ips[1] = { ip16 };
+
+    if (ipv4_prefix_len > 32 || ipv6_prefix_len > 128) {
+        STATS_ERROR();
+        return -1;
+    }
+    memcpy(&st, ipcrypt->opaque, sizeof st);
+    pfx_decrypt_lanes(&st, ips, 1, ipv4_prefix_len, ipv6_prefix_len);
+    STATS_OP(IPCRYPT_MODE_PFX, 16);
+    return 0;
 }
 
 /**
@@ -1225,6 +2699,7 @@ ipcrypt_encrypt_ip16(const IPCrypt *ipcrypt, uint8_t ip16[16])
     AesState st;
     memcpy(&st, ipcrypt->opaque, sizeof st);
     aes_encrypt(ip16, &st);
+    STATS_OP(IPCRYPT_MODE_DETERMINISTIC, 16);
 }
 
 /**
@@ -1237,6 +2712,7 @@ ipcrypt_decrypt_ip16(const IPCrypt *ipcrypt, uint8_t ip16[16])
     AesState st;
     memcpy(&st, ipcrypt->opaque, sizeof st);
     aes_decrypt(ip16, &st);
+    STATS_OP(IPCRYPT_MODE_DETERMINISTIC, 16);
 }
 
 /**
@@ -1294,6 +2770,7 @@ ipcrypt_nd_encrypt_ip16(const IPCrypt *ipcrypt, uint8_t ndip[IPCRYPT_NDIP_BYTES]
     memcpy(ndip + IPCRYPT_TWEAKBYTES, ip16, 16);
     // Encrypt the IP portion with the tweak.
     aes_encrypt_with_tweak(ndip + IPCRYPT_TWEAKBYTES, &st, random);
+    STATS_OP(IPCRYPT_MODE_ND, IPCRYPT_NDIP_BYTES);
 }
 
 /**
@@ -1312,6 +2789,7 @@ ipcrypt_nd_decrypt_ip16(const IPCrypt *ipcrypt, uint8_t ip16[16],
     memcpy(ip16, ndip + IPCRYPT_TWEAKBYTES, 16);
     // Decrypt using the tweak from the first 8 bytes.
     aes_decrypt_with_tweak(ip16, &st, ndip);
+    STATS_OP(IPCRYPT_MODE_ND, IPCRYPT_NDIP_BYTES);
 }
 
 /**
@@ -1359,6 +2837,87 @@ ipcrypt_nd_decrypt_ip_str(const IPCrypt *ipcrypt, char ip_str[IPCRYPT_MAX_IP_STR
     return ipcrypt_ip16_to_str(ip_str, ip16);
 }
 
+/**
+ * ipcrypt_nd_encrypt_ip_str_b64 encrypts an IP address string in non-deterministic mode, like
+ * ipcrypt_nd_encrypt_ip_str(), but encodes the 24-byte ciphertext as an unpadded base64url string.
+ */
+size_t
+ipcrypt_nd_encrypt_ip_str_b64(const IPCrypt *ipcrypt,
+                              char encrypted_ip_str[IPCRYPT_NDIP_B64_STR_BYTES], const char *ip_str,
+                              const uint8_t random[IPCRYPT_TWEAKBYTES])
+{
+    uint8_t ip16[16];
+    uint8_t ndip[IPCRYPT_NDIP_BYTES];
+
+    ipcrypt_str_to_ip16(ip16, ip_str);
+    ipcrypt_nd_encrypt_ip16(ipcrypt, ndip, ip16, random);
+    bin2b64(encrypted_ip_str, IPCRYPT_NDIP_B64_STR_BYTES, ndip, IPCRYPT_NDIP_BYTES);
+
+    return IPCRYPT_NDIP_B64_STR_BYTES - 1;
+}
+
+/**
+ * ipcrypt_nd_decrypt_ip_str_b64 decrypts a base64url string produced by
+ * ipcrypt_nd_encrypt_ip_str_b64.
+ * Returns the length of the resulting IP string on success, or 0 on error.
+ */
+size_t
+ipcrypt_nd_decrypt_ip_str_b64(const IPCrypt *ipcrypt, char ip_str[IPCRYPT_MAX_IP_STR_BYTES],
+                              const char *encrypted_ip_str)
+{
+    uint8_t ip16[16];
+    uint8_t ndip[IPCRYPT_NDIP_BYTES];
+
+    memset(ip_str, 0, IPCRYPT_MAX_IP_STR_BYTES);
+    if (ipcrypt_ndip_from_b64(ndip, encrypted_ip_str, strlen(encrypted_ip_str)) != 0) {
+        return 0;
+    }
+    ipcrypt_nd_decrypt_ip16(ipcrypt, ip16, ndip);
+
+    return ipcrypt_ip16_to_str(ip_str, ip16);
+}
+
+/**
+ * ipcrypt_nd_encrypt_ip_str_b32 encrypts an IP address string in non-deterministic mode, like
+ * ipcrypt_nd_encrypt_ip_str(), but encodes the 24-byte ciphertext as an unpadded lowercase base32
+ * string.
+ */
+size_t
+ipcrypt_nd_encrypt_ip_str_b32(const IPCrypt *ipcrypt,
+                              char encrypted_ip_str[IPCRYPT_NDIP_B32_STR_BYTES], const char *ip_str,
+                              const uint8_t random[IPCRYPT_TWEAKBYTES])
+{
+    uint8_t ip16[16];
+    uint8_t ndip[IPCRYPT_NDIP_BYTES];
+
+    ipcrypt_str_to_ip16(ip16, ip_str);
+    ipcrypt_nd_encrypt_ip16(ipcrypt, ndip, ip16, random);
+    bin2b32(encrypted_ip_str, IPCRYPT_NDIP_B32_STR_BYTES, ndip, IPCRYPT_NDIP_BYTES);
+
+    return IPCRYPT_NDIP_B32_STR_BYTES - 1;
+}
+
+/**
+ * ipcrypt_nd_decrypt_ip_str_b32 decrypts a base32 string produced by
+ * ipcrypt_nd_encrypt_ip_str_b32.
+ * Returns the length of the resulting IP string on success, or 0 on error.
+ */
+size_t
+ipcrypt_nd_decrypt_ip_str_b32(const IPCrypt *ipcrypt, char ip_str[IPCRYPT_MAX_IP_STR_BYTES],
+                              const char *encrypted_ip_str)
+{
+    uint8_t ip16[16];
+    uint8_t ndip[IPCRYPT_NDIP_BYTES];
+
+    memset(ip_str, 0, IPCRYPT_MAX_IP_STR_BYTES);
+    if (ipcrypt_ndip_from_b32(ndip, encrypted_ip_str, strlen(encrypted_ip_str)) != 0) {
+        return 0;
+    }
+    ipcrypt_nd_decrypt_ip16(ipcrypt, ip16, ndip);
+
+    return ipcrypt_ip16_to_str(ip_str, ip16);
+}
+
 /**
  * ipcrypt_ndx_encrypt_ip16 performs non-deterministic encryption of a 16-byte IP.
  * A random 16-byte tweak (random) must be provided.
@@ -1378,6 +2937,7 @@ ipcrypt_ndx_encrypt_ip16(const IPCryptNDX *ipcrypt, uint8_t ndip[IPCRYPT_NDX_NDI
     memcpy(ndip + IPCRYPT_NDX_TWEAKBYTES, ip16, 16);
     // Encrypt the IP portion with the tweak.
     aes_xex_encrypt(ndip + IPCRYPT_NDX_TWEAKBYTES, &st, random);
+    STATS_OP(IPCRYPT_MODE_NDX, IPCRYPT_NDX_NDIP_BYTES);
 }
 
 /**
@@ -1396,6 +2956,7 @@ ipcrypt_ndx_decrypt_ip16(const IPCryptNDX *ipcrypt, uint8_t ip16[16],
     memcpy(ip16, ndip + IPCRYPT_NDX_TWEAKBYTES, 16);
     // Decrypt using the tweak from the first 16 bytes.
     aes_ndx_decrypt(ip16, &st, ndip);
+    STATS_OP(IPCRYPT_MODE_NDX, IPCRYPT_NDX_NDIP_BYTES);
 }
 
 /**
@@ -1444,6 +3005,1169 @@ ipcrypt_ndx_decrypt_ip_str(const IPCryptNDX *ipcrypt, char ip_str[IPCRYPT_MAX_IP
     return ipcrypt_ip16_to_str(ip_str, ip16);
 }
 
+/**
+ * ipcrypt_ndx_encrypt_ip_str_b64 encrypts an IP address string in NDX mode, like
+ * ipcrypt_ndx_encrypt_ip_str(), but encodes the 32-byte ciphertext as an unpadded base64url string.
+ */
+size_t
+ipcrypt_ndx_encrypt_ip_str_b64(const IPCryptNDX *ipcrypt,
+                               char encrypted_ip_str[IPCRYPT_NDX_NDIP_B64_STR_BYTES],
+                               const char *ip_str, const uint8_t random[IPCRYPT_NDX_TWEAKBYTES])
+{
+    uint8_t ip16[16];
+    uint8_t ndip[IPCRYPT_NDX_NDIP_BYTES];
+
+    ipcrypt_str_to_ip16(ip16, ip_str);
+    ipcrypt_ndx_encrypt_ip16(ipcrypt, ndip, ip16, random);
+    bin2b64(encrypted_ip_str, IPCRYPT_NDX_NDIP_B64_STR_BYTES, ndip, IPCRYPT_NDX_NDIP_BYTES);
+
+    return IPCRYPT_NDX_NDIP_B64_STR_BYTES - 1;
+}
+
+/**
+ * ipcrypt_ndx_decrypt_ip_str_b64 decrypts a base64url string produced by
+ * ipcrypt_ndx_encrypt_ip_str_b64.
+ * Returns the length of the resulting IP string on success, or 0 on error.
+ */
+size_t
+ipcrypt_ndx_decrypt_ip_str_b64(const IPCryptNDX *ipcrypt, char ip_str[IPCRYPT_MAX_IP_STR_BYTES],
+                               const char *encrypted_ip_str)
+{
+    uint8_t ip16[16];
+    uint8_t ndip[IPCRYPT_NDX_NDIP_BYTES];
+
+    memset(ip_str, 0, IPCRYPT_MAX_IP_STR_BYTES);
+    if (ipcrypt_ndx_ndip_from_b64(ndip, encrypted_ip_str, strlen(encrypted_ip_str)) != 0) {
+        return 0;
+    }
+    ipcrypt_ndx_decrypt_ip16(ipcrypt, ip16, ndip);
+
+    return ipcrypt_ip16_to_str(ip_str, ip16);
+}
+
+/**
+ * ipcrypt_ndx_encrypt_ip_str_b32 encrypts an IP address string in NDX mode, like
+ * ipcrypt_ndx_encrypt_ip_str(), but encodes the 32-byte ciphertext as an unpadded lowercase base32
+ * string.
+ */
+size_t
+ipcrypt_ndx_encrypt_ip_str_b32(const IPCryptNDX *ipcrypt,
+                               char encrypted_ip_str[IPCRYPT_NDX_NDIP_B32_STR_BYTES],
+                               const char *ip_str, const uint8_t random[IPCRYPT_NDX_TWEAKBYTES])
+{
+    uint8_t ip16[16];
+    uint8_t ndip[IPCRYPT_NDX_NDIP_BYTES];
+
+    ipcrypt_str_to_ip16(ip16, ip_str);
+    ipcrypt_ndx_encrypt_ip16(ipcrypt, ndip, ip16, random);
+    bin2b32(encrypted_ip_str, IPCRYPT_NDX_NDIP_B32_STR_BYTES, ndip, IPCRYPT_NDX_NDIP_BYTES);
+
+    return IPCRYPT_NDX_NDIP_B32_STR_BYTES - 1;
+}
+
+/**
+ * ipcrypt_ndx_decrypt_ip_str_b32 decrypts a base32 string produced by
+ * ipcrypt_ndx_encrypt_ip_str_b32.
+ * Returns the length of the resulting IP string on success, or 0 on error.
+ */
+size_t
+ipcrypt_ndx_decrypt_ip_str_b32(const IPCryptNDX *ipcrypt, char ip_str[IPCRYPT_MAX_IP_STR_BYTES],
+                               const char *encrypted_ip_str)
+{
+    uint8_t ip16[16];
+    uint8_t ndip[IPCRYPT_NDX_NDIP_BYTES];
+
+    memset(ip_str, 0, IPCRYPT_MAX_IP_STR_BYTES);
+    if (ipcrypt_ndx_ndip_from_b32(ndip, encrypted_ip_str, strlen(encrypted_ip_str)) != 0) {
+        return 0;
+    }
+    ipcrypt_ndx_decrypt_ip16(ipcrypt, ip16, ndip);
+
+    return ipcrypt_ip16_to_str(ip_str, ip16);
+}
+
+/**
+ * A batch kernel transforms n fields in-place, using the expanded keys in ctx.
+ */
+typedef void (*BatchKernel)(const void *ctx, uint8_t *const xs[], size_t n);
+
+/**
+ * AesBatchDecState holds the round keys and the inverse round keys used to decrypt a batch.
+ */
+typedef struct AesBatchDecState {
+    AesState       st;
+    InvKeySchedule rkeys_inv;
+} AesBatchDecState;
+
+/**
+ * NDXBatchDecState holds the NDX state and the inverse round keys used to decrypt a batch.
+ */
+typedef struct NDXBatchDecState {
+    NDXState       st;
+    InvKeySchedule rkeys_inv;
+} NDXBatchDecState;
+
+static void
+aes_encrypt_batch(const void *ctx, uint8_t *const xs[], size_t n)
+{
+    const AesState *st = (const AesState *) ctx;
+    size_t          i;
+
+    for (i = 0; i < n; i += LANES) {
+        aes_encrypt_lanes(xs + i, st->rkeys);
+    }
+}
+
+static void
+aes_decrypt_batch(const void *ctx, uint8_t *const xs[], size_t n)
+{
+    const AesBatchDecState *st = (const AesBatchDecState *) ctx;
+    size_t                  i;
+
+    for (i = 0; i < n; i += LANES) {
+        aes_decrypt_lanes(xs + i, st->st.rkeys, st->rkeys_inv);
+    }
+}
+
+static void
+aes_encrypt_with_tweak_batch(const void *ctx, uint8_t *const xs[], size_t n)
+{
+    const AesState *st = (const AesState *) ctx;
+    size_t          i;
+
+    for (i = 0; i < n; i += LANES) {
+        aes_encrypt_with_tweak_lanes(xs + i, st->rkeys);
+    }
+}
+
+static void
+aes_decrypt_with_tweak_batch(const void *ctx, uint8_t *const xs[], size_t n)
+{
+    const AesBatchDecState *st = (const AesBatchDecState *) ctx;
+    size_t                  i;
+
+    for (i = 0; i < n; i += LANES) {
+        aes_decrypt_with_tweak_lanes(xs + i, st->st.rkeys, st->rkeys_inv);
+    }
+}
+
+static void
+aes_xex_encrypt_batch(const void *ctx, uint8_t *const xs[], size_t n)
+{
+    const NDXState *st = (const NDXState *) ctx;
+    size_t          i;
+
+    for (i = 0; i < n; i += LANES) {
+        aes_xex_encrypt_lanes(xs + i, st);
+    }
+}
+
+static void
+aes_ndx_decrypt_batch(const void *ctx, uint8_t *const xs[], size_t n)
+{
+    const NDXBatchDecState *st = (const NDXBatchDecState *) ctx;
+    size_t                  i;
+
+    for (i = 0; i < n; i += LANES) {
+        aes_ndx_decrypt_lanes(xs + i, &st->st, st->rkeys_inv);
+    }
+}
+
+static void
+pfx_encrypt_batch(const void *ctx, uint8_t *const xs[], size_t n)
+{
+    const PFXState *st = (const PFXState *) ctx;
+    size_t          i;
+
+    for (i = 0; i < n; i++) {
+        pfx_encrypt(st, xs[i], 0, 0);
+    }
+}
+
+static void
+pfx_decrypt_batch(const void *ctx, uint8_t *const xs[], size_t n)
+{
+    pfx_decrypt_lanes((const PFXState *) ctx, xs, n, 0, 0);
+}
+
+/**
+ * strided_check verifies that every field fits within a record, and that fields don't overlap.
+ * Returns 0 on success, or -1 if the layout is invalid.
+ */
+static int
+strided_check(size_t stride, const size_t *offsets, size_t offsets_count, size_t field_bytes)
+{
+    size_t i, j;
+
+    for (i = 0; i < offsets_count; i++) {
+        if (offsets[i] > stride || field_bytes > stride - offsets[i]) {
+            return -1;
+        }
+        for (j = 0; j < i; j++) {
+            if (offsets[i] < offsets[j] + field_bytes && offsets[j] < offsets[i] + field_bytes) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * strided_apply runs a batch kernel over fields stored at fixed offsets within an array of records.
+ *
+ * Fields are gathered BATCH_FIELDS at a time, while upcoming records are prefetched.
+ * 4-byte fields hold raw IPv4 addresses, that are temporarily converted to IPv4-mapped addresses.
+ * If pad_lanes is set, the kernel only processes multiples of LANES fields, and incomplete groups
+ * are padded with scratch blocks.
+ */
+static void
+strided_apply(BatchKernel kernel, const void *ctx, uint8_t *base, size_t count, size_t stride,
+              const size_t *offsets, size_t offsets_count, size_t field_bytes, int pad_lanes)
+{
+    uint8_t  ipv4_mapped[BATCH_FIELDS][16];
+    uint8_t  scratch[LANES][IPCRYPT_NDX_NDIP_BYTES];
+    uint8_t *fields[BATCH_FIELDS];
+    uint8_t *xs[BATCH_FIELDS + LANES];
+    uint8_t *record;
+    size_t   n = 0;
+    size_t   i, j, k;
+
+    COMPILER_ASSERT(BATCH_FIELDS % LANES == 0);
+    memset(scratch, 0, sizeof scratch);
+    for (i = 0; i < count; i++) {
+        record = base + i * stride;
+        if (i + PREFETCH_RECORDS < count) {
+            for (k = 0; k < offsets_count; k++) {
+                PREFETCH_RW(record + PREFETCH_RECORDS * stride + offsets[k]);
+            }
+        }
+        for (k = 0; k < offsets_count; k++) {
+            fields[n] = record + offsets[k];
+            if (field_bytes == 4) {
+                memset(ipv4_mapped[n], 0, 10);
+                ipv4_mapped[n][10] = 0xff;
+                ipv4_mapped[n][11] = 0xff;
+                memcpy(ipv4_mapped[n] + 12, fields[n], 4);
+                xs[n] = ipv4_mapped[n];
+            } else {
+                xs[n] = fields[n];
+            }
+            if (++n < BATCH_FIELDS && (i + 1 < count || k + 1 < offsets_count)) {
+                continue;
+            }
+            for (j = n; pad_lanes && j % LANES != 0; j++) {
+                xs[j] = scratch[j % LANES];
+            }
+            kernel(ctx, xs, n);
+            if (field_bytes == 4) {
+                for (j = 0; j < n; j++) {
+                    memcpy(fields[j], ipv4_mapped[j] + 12, 4);
+                }
+            }
+            n = 0;
+        }
+    }
+}
+
+/**
+ * ipcrypt_encrypt_ip16_strided encrypts 16-byte IP addresses stored within an array of records.
+ * Returns 0 on success, or -1 if the layout is invalid.
+ */
+int
+ipcrypt_encrypt_ip16_strided(const IPCrypt *ipcrypt, void *base, size_t count, size_t stride,
+                             const size_t *offsets, size_t offsets_count, size_t field_bytes)
+{
+    AesState st;
+
+    if (field_bytes != 16 || strided_check(stride, offsets, offsets_count, field_bytes) != 0) {
+        STATS_ERROR();
+        return -1;
+    }
+    memcpy(&st, ipcrypt->opaque, sizeof st);
+    STATS_BATCH_BEGIN(IPCRYPT_MODE_DETERMINISTIC, 0, count * offsets_count);
+    strided_apply(aes_encrypt_batch, &st, (uint8_t *) base, count, stride, offsets, offsets_count,
+                  field_bytes, 1);
+    STATS_BATCH_END(IPCRYPT_MODE_DETERMINISTIC, 0, count * offsets_count, field_bytes);
+    return 0;
+}
+
+/**
+ * ipcrypt_decrypt_ip16_strided decrypts 16-byte IP addresses stored within an array of records.
+ * Returns 0 on success, or -1 if the layout is invalid.
+ */
+int
+ipcrypt_decrypt_ip16_strided(const IPCrypt *ipcrypt, void *base, size_t count, size_t stride,
+                             const size_t *offsets, size_t offsets_count, size_t field_bytes)
+{
+    AesBatchDecState st;
+
+    if (field_bytes != 16 || strided_check(stride, offsets, offsets_count, field_bytes) != 0) {
+        STATS_ERROR();
+        return -1;
+    }
+    memcpy(&st.st, ipcrypt->opaque, sizeof st.st);
+    aes_invert_key_schedule(st.rkeys_inv, st.st.rkeys);
+    STATS_BATCH_BEGIN(IPCRYPT_MODE_DETERMINISTIC, 1, count * offsets_count);
+    strided_apply(aes_decrypt_batch, &st, (uint8_t *) base, count, stride, offsets, offsets_count,
+                  field_bytes, 1);
+    STATS_BATCH_END(IPCRYPT_MODE_DETERMINISTIC, 1, count * offsets_count, field_bytes);
+    return 0;
+}
+
+/**
+ * ipcrypt_pfx_encrypt_ip16_strided encrypts IP addresses stored within an array of records with
+ * prefix preservation. Fields can be 16-byte addresses, or 4-byte IPv4 addresses.
+ * Returns 0 on success, or -1 if the layout is invalid.
+ */
+int
+ipcrypt_pfx_encrypt_ip16_strided(const IPCryptPFX *ipcrypt, void *base, size_t count,
+                                 size_t stride, const size_t *offsets, size_t offsets_count,
+                                 size_t field_bytes)
+{
+    PFXState st;
+
+    if ((field_bytes != 16 && field_bytes != 4) ||
+        strided_check(stride, offsets, offsets_count, field_bytes) != 0) {
+        STATS_ERROR();
+        return -1;
+    }
+    memcpy(&st, ipcrypt->opaque, sizeof st);
+    STATS_BATCH_BEGIN(IPCRYPT_MODE_PFX, 0, count * offsets_count);
+    strided_apply(pfx_encrypt_batch, &st, (uint8_t *) base, count, stride, offsets, offsets_count,
+                  field_bytes, 0);
+    STATS_BATCH_END(IPCRYPT_MODE_PFX, 0, count * offsets_count, field_bytes);
+    return 0;
+}
+
+/**
+ * ipcrypt_pfx_decrypt_ip16_strided decrypts IP addresses stored within an array of records with
+ * prefix preservation. Fields can be 16-byte addresses, or 4-byte IPv4 addresses.
+ * Returns 0 on success, or -1 if the layout is invalid.
+ */
+int
+ipcrypt_pfx_decrypt_ip16_strided(const IPCryptPFX *ipcrypt, void *base, size_t count,
+                                 size_t stride, const size_t *offsets, size_t offsets_count,
+                                 size_t field_bytes)
+{
+    PFXState st;
+
+    if ((field_bytes != 16 && field_bytes != 4) ||
+        strided_check(stride, offsets, offsets_count, field_bytes) != 0) {
+        STATS_ERROR();
+        return -1;
+    }
+    memcpy(&st, ipcrypt->opaque, sizeof st);
+    STATS_BATCH_BEGIN(IPCRYPT_MODE_PFX, 1, count * offsets_count);
+    strided_apply(pfx_decrypt_batch, &st, (uint8_t *) base, count, stride, offsets, offsets_count,
+                  field_bytes, 0);
+    STATS_BATCH_END(IPCRYPT_MODE_PFX, 1, count * offsets_count, field_bytes);
+    return 0;
+}
+
+/**
+ * ipcrypt_nd_encrypt_ip16_strided encrypts ipcrypt-nd records stored within an array of records.
+ * Each field holds the tweak followed by the IP address, and the IP address is replaced with its
+ * encrypted value, so that the field ends up holding the output of ipcrypt_nd_encrypt_ip16().
+ * Returns 0 on success, or -1 if the layout is invalid.
+ */
+int
+ipcrypt_nd_encrypt_ip16_strided(const IPCrypt *ipcrypt, void *base, size_t count, size_t stride,
+                                const size_t *offsets, size_t offsets_count, size_t field_bytes)
+{
+    AesState st;
+
+    if (field_bytes != IPCRYPT_NDIP_BYTES ||
+        strided_check(stride, offsets, offsets_count, field_bytes) != 0) {
+        STATS_ERROR();
+        return -1;
+    }
+    memcpy(&st, ipcrypt->opaque, sizeof st);
+    STATS_BATCH_BEGIN(IPCRYPT_MODE_ND, 0, count * offsets_count);
+    strided_apply(aes_encrypt_with_tweak_batch, &st, (uint8_t *) base, count, stride, offsets,
+                  offsets_count, field_bytes, 1);
+    STATS_BATCH_END(IPCRYPT_MODE_ND, 0, count * offsets_count, field_bytes);
+    return 0;
+}
+
+/**
+ * ipcrypt_nd_decrypt_ip16_strided decrypts ipcrypt-nd records stored within an array of records.
+ * The tweak is kept, and the ciphertext is replaced with the original IP address.
+ * Returns 0 on success, or -1 if the layout is invalid.
+ */
+int
+ipcrypt_nd_decrypt_ip16_strided(const IPCrypt *ipcrypt, void *base, size_t count, size_t stride,
+                                const size_t *offsets, size_t offsets_count, size_t field_bytes)
+{
+    AesBatchDecState st;
+
+    if (field_bytes != IPCRYPT_NDIP_BYTES ||
+        strided_check(stride, offsets, offsets_count, field_bytes) != 0) {
+        STATS_ERROR();
+        return -1;
+    }
+    memcpy(&st.st, ipcrypt->opaque, sizeof st.st);
+    aes_invert_key_schedule(st.rkeys_inv, st.st.rkeys);
+    STATS_BATCH_BEGIN(IPCRYPT_MODE_ND, 1, count * offsets_count);
+    strided_apply(aes_decrypt_with_tweak_batch, &st, (uint8_t *) base, count, stride, offsets,
+                  offsets_count, field_bytes, 1);
+    STATS_BATCH_END(IPCRYPT_MODE_ND, 1, count * offsets_count, field_bytes);
+    return 0;
+}
+
+/**
+ * ipcrypt_ndx_encrypt_ip16_strided encrypts ipcrypt-ndx records stored within an array of records.
+ * Each field holds the tweak followed by the IP address, and the IP address is replaced with its
+ * encrypted value, so that the field ends up holding the output of ipcrypt_ndx_encrypt_ip16().
+ * Returns 0 on success, or -1 if the layout is invalid.
+ */
+int
+ipcrypt_ndx_encrypt_ip16_strided(const IPCryptNDX *ipcrypt, void *base, size_t count,
+                                 size_t stride, const size_t *offsets, size_t offsets_count,
+                                 size_t field_bytes)
+{
+    NDXState st;
+
+    if (field_bytes != IPCRYPT_NDX_NDIP_BYTES ||
+        strided_check(stride, offsets, offsets_count, field_bytes) != 0) {
+        STATS_ERROR();
+        return -1;
+    }
+    memcpy(&st, ipcrypt->opaque, sizeof st);
+    STATS_BATCH_BEGIN(IPCRYPT_MODE_NDX, 0, count * offsets_count);
+    strided_apply(aes_xex_encrypt_batch, &st, (uint8_t *) base, count, stride, offsets,
+                  offsets_count, field_bytes, 1);
+    STATS_BATCH_END(IPCRYPT_MODE_NDX, 0, count * offsets_count, field_bytes);
+    return 0;
+}
+
+/**
+ * ipcrypt_ndx_decrypt_ip16_strided decrypts ipcrypt-ndx records stored within an array of records.
+ * The tweak is kept, and the ciphertext is replaced with the original IP address.
+ * Returns 0 on success, or -1 if the layout is invalid.
+ */
+int
+ipcrypt_ndx_decrypt_ip16_strided(const IPCryptNDX *ipcrypt, void *base, size_t count,
+                                 size_t stride, const size_t *offsets, size_t offsets_count,
+                                 size_t field_bytes)
+{
+    NDXBatchDecState st;
+
+    if (field_bytes != IPCRYPT_NDX_NDIP_BYTES ||
+        strided_check(stride, offsets, offsets_count, field_bytes) != 0) {
+        STATS_ERROR();
+        return -1;
+    }
+    memcpy(&st.st, ipcrypt->opaque, sizeof st.st);
+    aes_invert_key_schedule(st.rkeys_inv, st.st.rkeys);
+    STATS_BATCH_BEGIN(IPCRYPT_MODE_NDX, 1, count * offsets_count);
+    strided_apply(aes_ndx_decrypt_batch, &st, (uint8_t *) base, count, stride, offsets,
+                  offsets_count, field_bytes, 1);
+    STATS_BATCH_END(IPCRYPT_MODE_NDX, 1, count * offsets_count, field_bytes);
+    return 0;
+}
+
+/**
+ * ipcrypt_init_many initializes `count` IPCrypt contexts from consecutive 16-byte keys.
+ */
+void
+ipcrypt_init_many(IPCrypt *ipcrypts, const uint8_t *keys, size_t count)
+{
+    KeyExpansionQueue q;
+    size_t            i;
+
+    COMPILER_ASSERT(sizeof ipcrypts->opaque >= sizeof(AesState));
+    q.n = 0;
+    for (i = 0; i < count; i++) {
+        key_queue_push(&q, ipcrypts[i].opaque + offsetof(AesState, rkeys),
+                       keys + i * IPCRYPT_KEYBYTES);
+    }
+    key_queue_flush(&q);
+}
+
+/**
+ * ipcrypt_pfx_init_many initializes `count` IPCryptPFX contexts from consecutive 32-byte keys.
+ */
+void
+ipcrypt_pfx_init_many(IPCryptPFX *ipcrypts, const uint8_t *keys, size_t count)
+{
+    KeyExpansionQueue q;
+    size_t            i;
+
+    COMPILER_ASSERT(sizeof ipcrypts->opaque >= sizeof(PFXState));
+    q.n = 0;
+    for (i = 0; i < count; i++) {
+        key_queue_push(&q, ipcrypts[i].opaque + offsetof(PFXState, k1keys),
+                       keys + i * IPCRYPT_PFX_KEYBYTES);
+        key_queue_push(&q, ipcrypts[i].opaque + offsetof(PFXState, k2keys),
+                       keys + i * IPCRYPT_PFX_KEYBYTES + 16);
+    }
+    key_queue_flush(&q);
+}
+
+/**
+ * ipcrypt_ndx_init_many initializes `count` IPCryptNDX contexts from consecutive 32-byte keys.
+ */
+void
+ipcrypt_ndx_init_many(IPCryptNDX *ipcrypts, const uint8_t *keys, size_t count)
+{
+    KeyExpansionQueue q;
+    size_t            i;
+
+    COMPILER_ASSERT(sizeof ipcrypts->opaque >= sizeof(NDXState));
+    q.n = 0;
+    for (i = 0; i < count; i++) {
+        key_queue_push(&q, ipcrypts[i].opaque + offsetof(NDXState, tkeys),
+                       keys + i * IPCRYPT_NDX_KEYBYTES + 16);
+        key_queue_push(&q, ipcrypts[i].opaque + offsetof(NDXState, rkeys),
+                       keys + i * IPCRYPT_NDX_KEYBYTES);
+    }
+    key_queue_flush(&q);
+}
+
+/**
+ * A gather kernel transforms n fields in-place, each with the context of its own tenant.
+ * ks[j] points to the context of the tenant of xs[j]. Kernels of AES-based modes require n to be
+ * LANES.
+ */
+typedef void (*GatherKernel)(uint8_t *const xs[], const uint8_t *const ks[], size_t n);
+
+static void
+aes_encrypt_gather(uint8_t *const xs[], const uint8_t *const ks[], size_t n)
+{
+    (void) n;
+    aes_encrypt_gather_lanes(xs, ks);
+}
+
+static void
+aes_decrypt_gather(uint8_t *const xs[], const uint8_t *const ks[], size_t n)
+{
+    (void) n;
+    aes_decrypt_gather_lanes(xs, ks);
+}
+
+static void
+aes_encrypt_with_tweak_gather(uint8_t *const xs[], const uint8_t *const ks[], size_t n)
+{
+    (void) n;
+    aes_encrypt_with_tweak_gather_lanes(xs, ks);
+}
+
+static void
+aes_decrypt_with_tweak_gather(uint8_t *const xs[], const uint8_t *const ks[], size_t n)
+{
+    (void) n;
+    aes_decrypt_with_tweak_gather_lanes(xs, ks);
+}
+
+static void
+aes_xex_encrypt_gather(uint8_t *const xs[], const uint8_t *const ks[], size_t n)
+{
+    (void) n;
+    aes_xex_encrypt_gather_lanes(xs, ks);
+}
+
+static void
+aes_ndx_decrypt_gather(uint8_t *const xs[], const uint8_t *const ks[], size_t n)
+{
+    (void) n;
+    aes_ndx_decrypt_gather_lanes(xs, ks);
+}
+
+/**
+ * PFX encryption is a long chain of AES operations with the same key, so the cost of loading the
+ * state of a tenant is negligible, and each address is encrypted on its own.
+ */
+static void
+pfx_encrypt_gather(uint8_t *const xs[], const uint8_t *const ks[], size_t n)
+{
+    PFXState st;
+    size_t   j;
+
+    for (j = 0; j < n; j++) {
+        if (j == 0 || ks[j] != ks[j - 1]) {
+            memcpy(&st, ks[j], sizeof st);
+        }
+        pfx_encrypt(&st, xs[j], 0, 0);
+    }
+}
+
+/**
+ * PFX decryption interleaves addresses, so consecutive addresses of the same tenant are decrypted
+ * together.
+ */
+static void
+pfx_decrypt_gather(uint8_t *const xs[], const uint8_t *const ks[], size_t n)
+{
+    PFXState st;
+    size_t   j, k;
+
+    for (j = 0; j < n; j = k) {
+        for (k = j + 1; k < n && ks[k] == ks[j]; k++) {
+        }
+        memcpy(&st, ks[j], sizeof st);
+        pfx_decrypt_lanes(&st, xs + j, k - j, 0, 0);
+    }
+}
+
+/**
+ * tenants_apply runs a gather kernel over a single field of the records of an array, each with the
+ * context of its tenant. `ctxs` points to `ctxs_count` contexts, each `ctx_bytes` long.
+ *
+ * Records are processed in order, LANES at a time, without sorting them: every lane reads the key
+ * schedule of its own tenant, so that records of different tenants still run in parallel. The
+ * contexts of upcoming records are prefetched, so that they are in the cache when needed even if
+ * there are many tenants. If pad_lanes is set, incomplete groups are padded with scratch blocks.
+ * Returns 0 on success, or -1 if the layout is invalid or if a tenant index is out of range.
+ */
+static int
+tenants_apply(GatherKernel kernel, int pad_lanes, const void *ctxs, size_t ctx_bytes,
+              size_t ctxs_count, uint8_t *base, size_t count, size_t stride, size_t tenant_offset,
+              size_t field_offset, size_t field_bytes)
+{
+    uint8_t        ipv4_mapped[LANES][16];
+    uint8_t        scratch[LANES][IPCRYPT_NDX_NDIP_BYTES];
+    uint8_t       *fields[LANES];
+    uint8_t       *xs[LANES];
+    const uint8_t *ks[LANES];
+    const uint8_t *ctx;
+    uint8_t       *record;
+    size_t         n = 0;
+    size_t         i, j, k;
+    uint32_t       tenant;
+
+    if (strided_check(stride, &field_offset, 1, field_bytes) != 0 || tenant_offset > stride ||
+        stride - tenant_offset < sizeof tenant ||
+        (tenant_offset < field_offset + field_bytes &&
+         field_offset < tenant_offset + sizeof tenant)) {
+        STATS_ERROR();
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        memcpy(&tenant, base + i * stride + tenant_offset, sizeof tenant);
+        if (tenant >= ctxs_count) {
+            STATS_ERROR();
+            return -1;
+        }
+    }
+    memset(scratch, 0, sizeof scratch);
+    for (i = 0; i < count; i++) {
+        record = base + i * stride;
+        if (i + PREFETCH_RECORDS < count) {
+            PREFETCH_RW(record + PREFETCH_RECORDS * stride + field_offset);
+            // The tenant index of that record was already loaded by the validation pass.
+            memcpy(&tenant, record + PREFETCH_RECORDS * stride + tenant_offset, sizeof tenant);
+            ctx = (const uint8_t *) ctxs + tenant * ctx_bytes;
+            for (k = 0; k < ctx_bytes; k += 64) {
+                PREFETCH_R(ctx + k);
+            }
+        }
+        memcpy(&tenant, record + tenant_offset, sizeof tenant);
+        ks[n]     = (const uint8_t *) ctxs + tenant * ctx_bytes;
+        fields[n] = record + field_offset;
+        if (field_bytes == 4) {
+            memset(ipv4_mapped[n], 0, 10);
+            ipv4_mapped[n][10] = 0xff;
+            ipv4_mapped[n][11] = 0xff;
+            memcpy(ipv4_mapped[n] + 12, fields[n], 4);
+            xs[n] = ipv4_mapped[n];
+        } else {
+            xs[n] = fields[n];
+        }
+        if (++n < LANES && i + 1 < count) {
+            continue;
+        }
+        for (j = n; pad_lanes && j < LANES; j++) {
+            xs[j] = scratch[j];
+            ks[j] = ks[0];
+        }
+        kernel(xs, ks, n);
+        if (field_bytes == 4) {
+            for (j = 0; j < n; j++) {
+                memcpy(fields[j], ipv4_mapped[j] + 12, 4);
+            }
+        }
+        n = 0;
+    }
+    return 0;
+}
+
+/**
+ * ipcrypt_encrypt_ip16_tenants encrypts 16-byte IP addresses stored within an array of records,
+ * each with the context of its tenant.
+ */
+int
+ipcrypt_encrypt_ip16_tenants(const IPCrypt *ipcrypts, size_t ipcrypts_count, void *base,
+                             size_t count, size_t stride, size_t tenant_offset, size_t field_offset,
+                             size_t field_bytes)
+{
+    int ret;
+
+    if (field_bytes != 16) {
+        STATS_ERROR();
+        return -1;
+    }
+    STATS_BATCH_BEGIN(IPCRYPT_MODE_DETERMINISTIC, 0, count);
+    ret = tenants_apply(aes_encrypt_gather, 1, ipcrypts, sizeof *ipcrypts, ipcrypts_count,
+                       (uint8_t *) base, count, stride, tenant_offset, field_offset, field_bytes);
+    STATS_BATCH_END(IPCRYPT_MODE_DETERMINISTIC, 0, ret == 0 ? count : 0, field_bytes);
+    return ret;
+}
+
+/**
+ * ipcrypt_decrypt_ip16_tenants decrypts 16-byte IP addresses stored within an array of records,
+ * each with the context of its tenant.
+ */
+int
+ipcrypt_decrypt_ip16_tenants(const IPCrypt *ipcrypts, size_t ipcrypts_count, void *base,
+                             size_t count, size_t stride, size_t tenant_offset, size_t field_offset,
+                             size_t field_bytes)
+{
+    int ret;
+
+    if (field_bytes != 16) {
+        STATS_ERROR();
+        return -1;
+    }
+    STATS_BATCH_BEGIN(IPCRYPT_MODE_DETERMINISTIC, 1, count);
+    ret = tenants_apply(aes_decrypt_gather, 1, ipcrypts, sizeof *ipcrypts, ipcrypts_count,
+                       (uint8_t *) base, count, stride, tenant_offset, field_offset, field_bytes);
+    STATS_BATCH_END(IPCRYPT_MODE_DETERMINISTIC, 1, ret == 0 ? count : 0, field_bytes);
+    return ret;
+}
+
+/**
+ * ipcrypt_pfx_encrypt_ip16_tenants encrypts IP addresses stored within an array of records with
+ * prefix preservation, each with the context of its tenant.
+ */
+int
+ipcrypt_pfx_encrypt_ip16_tenants(const IPCryptPFX *ipcrypts, size_t ipcrypts_count, void *base,
+                                 size_t count, size_t stride, size_t tenant_offset,
+                                 size_t field_offset, size_t field_bytes)
+{
+    int ret;
+
+    if (field_bytes != 16 && field_bytes != 4) {
+        STATS_ERROR();
+        return -1;
+    }
+    STATS_BATCH_BEGIN(IPCRYPT_MODE_PFX, 0, count);
+    ret = tenants_apply(pfx_encrypt_gather, 0, ipcrypts, sizeof *ipcrypts, ipcrypts_count,
+                       (uint8_t *) base, count, stride, tenant_offset, field_offset, field_bytes);
+    STATS_BATCH_END(IPCRYPT_MODE_PFX, 0, ret == 0 ? count : 0, field_bytes);
+    return ret;
+}
+
+/**
+ * ipcrypt_pfx_decrypt_ip16_tenants decrypts IP addresses stored within an array of records with
+ * prefix preservation, each with the context of its tenant.
+ */
+int
+ipcrypt_pfx_decrypt_ip16_tenants(const IPCryptPFX *ipcrypts, size_t ipcrypts_count, void *base,
+                                 size_t count, size_t stride, size_t tenant_offset,
+                                 size_t field_offset, size_t field_bytes)
+{
+    int ret;
+
+    if (field_bytes != 16 && field_bytes != 4) {
+        STATS_ERROR();
+        return -1;
+    }
+    STATS_BATCH_BEGIN(IPCRYPT_MODE_PFX, 1, count);
+    ret = tenants_apply(pfx_decrypt_gather, 0, ipcrypts, sizeof *ipcrypts, ipcrypts_count,
+                       (uint8_t *) base, count, stride, tenant_offset, field_offset, field_bytes);
+    STATS_BATCH_END(IPCRYPT_MODE_PFX, 1, ret == 0 ? count : 0, field_bytes);
+    return ret;
+}
+
+/**
+ * ipcrypt_nd_encrypt_ip16_tenants encrypts ipcrypt-nd records stored within an array of records,
+ * each with the context of its tenant.
+ */
+int
+ipcrypt_nd_encrypt_ip16_tenants(const IPCrypt *ipcrypts, size_t ipcrypts_count, void *base,
+                                size_t count, size_t stride, size_t tenant_offset,
+                                size_t field_offset, size_t field_bytes)
+{
+    int ret;
+
+    if (field_bytes != IPCRYPT_NDIP_BYTES) {
+        STATS_ERROR();
+        return -1;
+    }
+    STATS_BATCH_BEGIN(IPCRYPT_MODE_ND, 0, count);
+    ret = tenants_apply(aes_encrypt_with_tweak_gather, 1, ipcrypts, sizeof *ipcrypts,
+                       ipcrypts_count, (uint8_t *) base, count, stride, tenant_offset,
+                       field_offset, field_bytes);
+    STATS_BATCH_END(IPCRYPT_MODE_ND, 0, ret == 0 ? count : 0, field_bytes);
+    return ret;
+}
+
+/**
+ * ipcrypt_nd_decrypt_ip16_tenants decrypts ipcrypt-nd records stored within an array of records,
+ * each with the context of its tenant.
+ */
+int
+ipcrypt_nd_decrypt_ip16_tenants(const IPCrypt *ipcrypts, size_t ipcrypts_count, void *base,
+                                size_t count, size_t stride, size_t tenant_offset,
+                                size_t field_offset, size_t field_bytes)
+{
+    int ret;
+
+    if (field_bytes != IPCRYPT_NDIP_BYTES) {
+        STATS_ERROR();
+        return -1;
+    }
+    STATS_BATCH_BEGIN(IPCRYPT_MODE_ND, 1, count);
+    ret = tenants_apply(aes_decrypt_with_tweak_gather, 1, ipcrypts, sizeof *ipcrypts,
+                       ipcrypts_count, (uint8_t *) base, count, stride, tenant_offset,
+                       field_offset, field_bytes);
+    STATS_BATCH_END(IPCRYPT_MODE_ND, 1, ret == 0 ? count : 0, field_bytes);
+    return ret;
+}
+
+/**
+ * ipcrypt_ndx_encrypt_ip16_tenants encrypts ipcrypt-ndx records stored within an array of
+ * records, each with the context of its tenant.
+ */
+int
+ipcrypt_ndx_encrypt_ip16_tenants(const IPCryptNDX *ipcrypts, size_t ipcrypts_count, void *base,
+                                 size_t count, size_t stride, size_t tenant_offset,
+                                 size_t field_offset, size_t field_bytes)
+{
+    int ret;
+
+    if (field_bytes != IPCRYPT_NDX_NDIP_BYTES) {
+        STATS_ERROR();
+        return -1;
+    }
+    STATS_BATCH_BEGIN(IPCRYPT_MODE_NDX, 0, count);
+    ret = tenants_apply(aes_xex_encrypt_gather, 1, ipcrypts, sizeof *ipcrypts, ipcrypts_count,
+                       (uint8_t *) base, count, stride, tenant_offset, field_offset, field_bytes);
+    STATS_BATCH_END(IPCRYPT_MODE_NDX, 0, ret == 0 ? count : 0, field_bytes);
+    return ret;
+}
+
+/**
+ * ipcrypt_ndx_decrypt_ip16_tenants decrypts ipcrypt-ndx records stored within an array of
+ * records, each with the context of its tenant.
+ */
+int
+ipcrypt_ndx_decrypt_ip16_tenants(const IPCryptNDX *ipcrypts, size_t ipcrypts_count, void *base,
+                                 size_t count, size_t stride, size_t tenant_offset,
+                                 size_t field_offset, size_t field_bytes)
+{
+    int ret;
+
+    if (field_bytes != IPCRYPT_NDX_NDIP_BYTES) {
+        STATS_ERROR();
+        return -1;
+    }
+    STATS_BATCH_BEGIN(IPCRYPT_MODE_NDX, 1, count);
+    ret = tenants_apply(aes_ndx_decrypt_gather, 1, ipcrypts, sizeof *ipcrypts, ipcrypts_count,
+                       (uint8_t *) base, count, stride, tenant_offset, field_offset, field_bytes);
+    STATS_BATCH_END(IPCRYPT_MODE_NDX, 1, ret == 0 ? count : 0, field_bytes);
+    return ret;
+}
+
+/**
+ * SessionState holds the round keys of a shared-tweak session, with the tweak folded in, and the
+ * tweak itself, zero-padded.
+ * ND sessions XOR the expanded tweak into every round key. NDX sessions XOR the encrypted tweak
+ * into the first and last round keys, which turns the XEX construction into a plain AES
+ * encryption. The inverse round keys of both are the inverse round keys of the folded schedule.
+ */
+typedef struct SessionState {
+    AesBatchDecState dec;
+    uint8_t          tweak[IPCRYPT_NDX_TWEAKBYTES];
+} SessionState;
+
+/**
+ * session_apply runs an AES batch kernel over the fields of an array of records, for a session.
+ * Fields are either 16-byte addresses, or a tweak of `tweak_bytes` bytes followed by an address.
+ * Returns 0 on success, or -1 if the layout is invalid or if a tweak doesn't match.
+ */
+static int
+session_apply(const SessionState *st, int decrypt, uint8_t *base, size_t count, size_t stride,
+              const size_t *offsets, size_t offsets_count, size_t field_bytes, size_t tweak_bytes)
+{
+    const BatchKernel kernel = decrypt ? aes_decrypt_batch : aes_encrypt_batch;
+    const void       *ctx    = decrypt ? (const void *) &st->dec : (const void *) &st->dec.st;
+    size_t            i, k, offset;
+
+    if ((field_bytes != 16 && field_bytes != tweak_bytes + 16) ||
+        strided_check(stride, offsets, offsets_count, field_bytes) != 0) {
+        return -1;
+    }
+    if (field_bytes == 16) {
+        strided_apply(kernel, ctx, base, count, stride, offsets, offsets_count, 16, 1);
+        return 0;
+    }
+    for (i = 0; i < count; i++) {
+        for (k = 0; k < offsets_count; k++) {
+            if (decrypt && memcmp(base + i * stride + offsets[k], st->tweak, tweak_bytes) != 0) {
+                return -1;
+            }
+        }
+    }
+    for (k = 0; k < offsets_count; k++) {
+        for (i = 0; decrypt == 0 && i < count; i++) {
+            memcpy(base + i * stride + offsets[k], st->tweak, tweak_bytes);
+        }
+        offset = offsets[k] + tweak_bytes;
+        strided_apply(kernel, ctx, base, count, stride, &offset, 1, 16, 1);
+    }
+    return 0;
+}
+
+static void
+session_deinit(void *session, size_t session_len)
+{
+#ifdef _MSC_VER
+    SecureZeroMemory(session, session_len);
+#elif defined(__STDC_LIB_EXT1__)
+    memset_s(session, session_len, 0, session_len);
+#else
+    memset(session, 0, session_len);
+// Compiler barrier to prevent optimizations from removing memset.
+#    if defined(__GNUC__) || defined(__clang__)
+    __asm__ __volatile__("" : : "r"(session) : "memory");
+#    endif
+#endif
+}
+
+/**
+ * ipcrypt_nd_session_init folds an 8-byte tweak into the round keys of an IPCrypt context.
+ */
+void
+ipcrypt_nd_session_init(IPCryptNDSession *session, const IPCrypt *ipcrypt,
+                        const uint8_t random[IPCRYPT_TWEAKBYTES])
+{
+    const BlockVec tweak_block = TWEAK_EXPAND(random);
+    SessionState   st;
+    size_t         i;
+
+    COMPILER_ASSERT(sizeof session->opaque >= sizeof st);
+    memcpy(&st.dec.st, ipcrypt->opaque, sizeof st.dec.st);
+    for (i = 0; i <= ROUNDS; i++) {
+        st.dec.st.rkeys[i] = XOR128(st.dec.st.rkeys[i], tweak_block);
+    }
+    aes_invert_key_schedule(st.dec.rkeys_inv, st.dec.st.rkeys);
+    memcpy(session->opaque, &st, offsetof(SessionState, tweak));
+    // GCC 12 at -O2 drops the store of the tweak into `st`, so it is written to the session.
+    memset(session->opaque + offsetof(SessionState, tweak), 0, sizeof st.tweak);
+    memcpy(session->opaque + offsetof(SessionState, tweak), random, IPCRYPT_TWEAKBYTES);
+}
+
+/**
+ * ipcrypt_nd_session_deinit clears an ND session to wipe sensitive data from memory.
+ */
+void
+ipcrypt_nd_session_deinit(IPCryptNDSession *session)
+{
+    session_deinit(session, sizeof *session);
+}
+
+/**
+ * ipcrypt_nd_session_encrypt_ip16 encrypts a 16-byte IP with the tweak of the session.
+ * Output is 24 bytes: the tweak + the encrypted IP, as with ipcrypt_nd_encrypt_ip16().
+ */
+void
+ipcrypt_nd_session_encrypt_ip16(const IPCryptNDSession *session,
+                                uint8_t ndip[IPCRYPT_NDIP_BYTES], const uint8_t ip16[16])
+{
+    AesState st;
+
+    // Only the round keys and the tweak are needed.
+    memcpy(&st, session->opaque + offsetof(SessionState, dec.st), sizeof st);
+    memcpy(ndip, session->opaque + offsetof(SessionState, tweak), IPCRYPT_TWEAKBYTES);
+    memcpy(ndip + IPCRYPT_TWEAKBYTES, ip16, 16);
+    aes_encrypt(ndip + IPCRYPT_TWEAKBYTES, &st);
+    STATS_OP(IPCRYPT_MODE_ND, IPCRYPT_NDIP_BYTES);
+}
+
+/**
+ * ipcrypt_nd_session_decrypt_ip16 decrypts a 24-byte (tweak + IP) buffer whose tweak is the tweak
+ * of the session. Returns 0 on success, or -1 if the tweak doesn't match.
+ */
+int
+ipcrypt_nd_session_decrypt_ip16(const IPCryptNDSession *session, uint8_t ip16[16],
+                                const uint8_t ndip[IPCRYPT_NDIP_BYTES])
+{
+    AesState st;
+
+    if (memcmp(ndip, session->opaque + offsetof(SessionState, tweak), IPCRYPT_TWEAKBYTES) != 0) {
+        STATS_ERROR();
+        return -1;
+    }
+    memcpy(&st, session->opaque + offsetof(SessionState, dec.st), sizeof st);
+    memcpy(ip16, ndip + IPCRYPT_TWEAKBYTES, 16);
+    aes_decrypt(ip16, &st);
+    STATS_OP(IPCRYPT_MODE_ND, IPCRYPT_NDIP_BYTES);
+    return 0;
+}
+
+/**
+ * ipcrypt_nd_session_encrypt_ip16_strided encrypts IP addresses stored within an array of records
+ * with the tweak of the session. Returns 0 on success, or -1 if the layout is invalid.
+ */
+int
+ipcrypt_nd_session_encrypt_ip16_strided(const IPCryptNDSession *session, void *base,
+                                        size_t count, size_t stride, const size_t *offsets,
+                                        size_t offsets_count, size_t field_bytes)
+{
+    SessionState st;
+
+    memcpy(&st, session->opaque, sizeof st);
+    STATS_BATCH_BEGIN(IPCRYPT_MODE_ND, 0, count * offsets_count);
+    if (session_apply(&st, 0, (uint8_t *) base, count, stride, offsets, offsets_count,
+                      field_bytes, IPCRYPT_TWEAKBYTES) != 0) {
+        STATS_ERROR();
+        return -1;
+    }
+    STATS_BATCH_END(IPCRYPT_MODE_ND, 0, count * offsets_count, field_bytes);
+    return 0;
+}
+
+/**
+ * ipcrypt_nd_session_decrypt_ip16_strided decrypts IP addresses stored within an array of records
+ * with the tweak of the session. Returns 0 on success, or -1 if the layout is invalid or if a
+ * tweak doesn't match.
+ */
+int
+ipcrypt_nd_session_decrypt_ip16_strided(const IPCryptNDSession *session, void *base,
+                                        size_t count, size_t stride, const size_t *offsets,
+                                        size_t offsets_count, size_t field_bytes)
+{
+    SessionState st;
+
+    memcpy(&st, session->opaque, sizeof st);
+    STATS_BATCH_BEGIN(IPCRYPT_MODE_ND, 1, count * offsets_count);
+    if (session_apply(&st, 1, (uint8_t *) base, count, stride, offsets, offsets_count,
+                      field_bytes, IPCRYPT_TWEAKBYTES) != 0) {
+        STATS_ERROR();
+        return -1;
+    }
+    STATS_BATCH_END(IPCRYPT_MODE_ND, 1, count * offsets_count, field_bytes);
+    return 0;
+}
+
+/**
+ * ipcrypt_ndx_session_init encrypts a 16-byte tweak once, and folds it into the first and last
+ * round keys of an IPCryptNDX context.
+ */
+void
+ipcrypt_ndx_session_init(IPCryptNDXSession *session, const IPCryptNDX *ipcrypt,
+                         const uint8_t random[IPCRYPT_NDX_TWEAKBYTES])
+{
+    NDXState     ndx;
+    SessionState st;
+    BlockVec     tt;
+
+    COMPILER_ASSERT(sizeof session->opaque >= sizeof st);
+    memcpy(&ndx, ipcrypt->opaque, sizeof ndx);
+    tt = aes_xex_tweak(&ndx, random);
+    memcpy(st.dec.st.rkeys, ndx.rkeys, sizeof st.dec.st.rkeys);
+    st.dec.st.rkeys[0]      = XOR128(st.dec.st.rkeys[0], tt);
+    st.dec.st.rkeys[ROUNDS] = XOR128(st.dec.st.rkeys[ROUNDS], tt);
+    aes_invert_key_schedule(st.dec.rkeys_inv, st.dec.st.rkeys);
+    memcpy(session->opaque, &st, offsetof(SessionState, tweak));
+    memcpy(session->opaque + offsetof(SessionState, tweak), random, IPCRYPT_NDX_TWEAKBYTES);
+}
+
+/**
+ * ipcrypt_ndx_session_deinit clears an NDX session to wipe sensitive data from memory.
+ */
+void
+ipcrypt_ndx_session_deinit(IPCryptNDXSession *session)
+{
+    session_deinit(session, sizeof *session);
+}
+
+/**
+ * ipcrypt_ndx_session_encrypt_ip16 encrypts a 16-byte IP with the tweak of the session.
+ * Output is 32 bytes: the tweak + the encrypted IP, as with ipcrypt_ndx_encrypt_ip16().
+ */
+void
+ipcrypt_ndx_session_encrypt_ip16(const IPCryptNDXSession *session,
+                                 uint8_t ndip[IPCRYPT_NDX_NDIP_BYTES], const uint8_t ip16[16])
+{
+    AesState st;
+
+    // Only the round keys and the tweak are needed.
+    memcpy(&st, session->opaque + offsetof(SessionState, dec.st), sizeof st);
+    memcpy(ndip, session->opaque + offsetof(SessionState, tweak), IPCRYPT_NDX_TWEAKBYTES);
+    memcpy(ndip + IPCRYPT_NDX_TWEAKBYTES, ip16, 16);
+    aes_encrypt(ndip + IPCRYPT_NDX_TWEAKBYTES, &st);
+    STATS_OP(IPCRYPT_MODE_NDX, IPCRYPT_NDX_NDIP_BYTES);
+}
+
+/**
+ * ipcrypt_ndx_session_decrypt_ip16 decrypts a 32-byte (tweak + IP) buffer whose tweak is the
+ * tweak of the session. Returns 0 on success, or -1 if the tweak doesn't match.
+ */
+int
+ipcrypt_ndx_session_decrypt_ip16(const IPCryptNDXSession *session, uint8_t ip16[16],
+                                 const uint8_t ndip[IPCRYPT_NDX_NDIP_BYTES])
+{
+    const uint8_t *tweak = session->opaque + offsetof(SessionState, tweak);
+    AesState       st;
+
+    if (memcmp(ndip, tweak, IPCRYPT_NDX_TWEAKBYTES) != 0) {
+        STATS_ERROR();
+        return -1;
+    }
+    memcpy(&st, session->opaque + offsetof(SessionState, dec.st), sizeof st);
+    memcpy(ip16, ndip + IPCRYPT_NDX_TWEAKBYTES, 16);
+    aes_decrypt(ip16, &st);
+    STATS_OP(IPCRYPT_MODE_NDX, IPCRYPT_NDX_NDIP_BYTES);
+    return 0;
+}
+
+/**
+ * ipcrypt_ndx_session_encrypt_ip16_strided encrypts IP addresses stored within an array of
+ * records with the tweak of the session. Returns 0 on success, or -1 if the layout is invalid.
+ */
+int
+ipcrypt_ndx_session_encrypt_ip16_strided(const IPCryptNDXSession *session, void *base,
+                                         size_t count, size_t stride, const size_t *offsets,
+                                         size_t offsets_count, size_t field_bytes)
+{
+    SessionState st;
+
+    memcpy(&st, session->opaque, sizeof st);
+    STATS_BATCH_BEGIN(IPCRYPT_MODE_NDX, 0, count * offsets_count);
+    if (session_apply(&st, 0, (uint8_t *) base, count, stride, offsets, offsets_count,
+                      field_bytes, IPCRYPT_NDX_TWEAKBYTES) != 0) {
+        STATS_ERROR();
+        return -1;
+    }
+    STATS_BATCH_END(IPCRYPT_MODE_NDX, 0, count * offsets_count, field_bytes);
+    return 0;
+}
+
+/**
+ * ipcrypt_ndx_session_decrypt_ip16_strided decrypts IP addresses stored within an array of
+ * records with the tweak of the session. Returns 0 on success, or -1 if the layout is invalid or
+ * if a tweak doesn't match.
+ */
+int
+ipcrypt_ndx_session_decrypt_ip16_strided(const IPCryptNDXSession *session, void *base,
+                                         size_t count, size_t stride, const size_t *offsets,
+                                         size_t offsets_count, size_t field_bytes)
+{
+    SessionState st;
+
+    memcpy(&st, session->opaque, sizeof st);
+    STATS_BATCH_BEGIN(IPCRYPT_MODE_NDX, 1, count * offsets_count);
+    if (session_apply(&st, 1, (uint8_t *) base, count, stride, offsets, offsets_count,
+                      field_bytes, IPCRYPT_NDX_TWEAKBYTES) != 0) {
+        STATS_ERROR();
+        return -1;
+    }
+    STATS_BATCH_END(IPCRYPT_MODE_NDX, 1, count * offsets_count, field_bytes);
+    return 0;
+}
+
 #ifdef __clang__
 #    pragma clang attribute pop
 #endif
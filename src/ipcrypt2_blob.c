@@ -0,0 +1,442 @@
+/**
+ * Blobs of expanded contexts for IPCrypt2.
+ *
+ * Contexts are copied into a blob as they are in memory. Once a blob has been validated, contexts
+ * are used in place: the pointers returned by ipcrypt_blob_entry() and ipcrypt_blob_find() point
+ * into the blob, so workers mapping a blob from shared memory need neither key expansion nor any
+ * private copy of the keys.
+ *
+ * The whole blob is validated when it is opened, so lookups never have to check anything again.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#    define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#    include <windows.h>
+#else
+#    include <errno.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <sys/types.h>
+#    include <unistd.h>
+#endif
+
+#include "include/ipcrypt2_blob.h"
+
+#define BLOB_VERSION 1U
+
+/** Value of the byte order mark, stored in the byte order of the writer. */
+#define BLOB_BYTE_ORDER_MARK 0x01020304U
+
+/** Offset of the checksum in the header. */
+#define BLOB_CHECKSUM_OFFSET 32U
+
+static const uint8_t blob_magic[8] = { 'I', 'P', 'C', '2', 'C', 'T', 'X', 0 };
+
+struct IPCryptBlob {
+    const uint8_t *data;
+    size_t         len;
+    size_t         count;
+    void          *map;
+    unsigned int   flags;
+};
+
+static inline uint16_t
+blob_load16(const uint8_t *p)
+{
+    return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+static inline uint32_t
+blob_load32(const uint8_t *p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) |
+           ((uint32_t) p[3] << 24);
+}
+
+static inline uint64_t
+blob_load64(const uint8_t *p)
+{
+    return (uint64_t) blob_load32(p) | ((uint64_t) blob_load32(p + 4) << 32);
+}
+
+static inline void
+blob_store16(uint8_t *p, uint16_t x)
+{
+    p[0] = (uint8_t) x;
+    p[1] = (uint8_t) (x >> 8);
+}
+
+static inline void
+blob_store32(uint8_t *p, uint32_t x)
+{
+    p[0] = (uint8_t) x;
+    p[1] = (uint8_t) (x >> 8);
+    p[2] = (uint8_t) (x >> 16);
+    p[3] = (uint8_t) (x >> 24);
+}
+
+static inline void
+blob_store64(uint8_t *p, uint64_t x)
+{
+    blob_store32(p, (uint32_t) x);
+    blob_store32(p + 4, (uint32_t) (x >> 32));
+}
+
+static size_t
+blob_align(size_t x)
+{
+    return (x + IPCRYPT_BLOB_ALIGN - 1) & ~(size_t) (IPCRYPT_BLOB_ALIGN - 1);
+}
+
+/**
+ * blob_context_bytes returns the size of the context of a mode, or 0 if the mode is invalid.
+ */
+static size_t
+blob_context_bytes(unsigned int mode)
+{
+    switch (mode) {
+    case IPCRYPT_MODE_DETERMINISTIC:
+    case IPCRYPT_MODE_ND:
+        return sizeof(IPCrypt);
+    case IPCRYPT_MODE_PFX:
+        return sizeof(IPCryptPFX);
+    case IPCRYPT_MODE_NDX:
+        return sizeof(IPCryptNDX);
+    }
+    return 0;
+}
+
+static uint64_t
+blob_fnv1a(uint64_t h, const uint8_t *p, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/**
+ * blob_checksum computes the checksum of a blob of at least IPCRYPT_BLOB_HEADER_BYTES bytes,
+ * as if its checksum field was set to 0.
+ */
+static uint64_t
+blob_checksum(const uint8_t *blob, size_t len)
+{
+    static const uint8_t zero[8];
+    uint64_t             h = 0xcbf29ce484222325ULL;
+
+    h = blob_fnv1a(h, blob, BLOB_CHECKSUM_OFFSET);
+    h = blob_fnv1a(h, zero, sizeof zero);
+    return blob_fnv1a(h, blob + BLOB_CHECKSUM_OFFSET + 8, len - BLOB_CHECKSUM_OFFSET - 8);
+}
+
+/**
+ * blob_is_zero returns 1 if the `len` bytes at `p` are all zero, or 0 otherwise.
+ */
+static int
+blob_is_zero(const uint8_t *p, size_t len)
+{
+    uint8_t acc = 0;
+    size_t  i;
+
+    for (i = 0; i < len; i++) {
+        acc |= p[i];
+    }
+    return acc == 0;
+}
+
+/**
+ * blob_validate checks the header, the table of entries and the checksum of a blob.
+ * Returns 0 and stores the number of entries into `count` if the blob is valid, or -1 otherwise.
+ */
+static int
+blob_validate(const uint8_t *blob, size_t len, size_t *count)
+{
+    const uint32_t bom = BLOB_BYTE_ORDER_MARK;
+    const uint8_t *entry;
+    size_t         table_end;
+    size_t         offset;
+    size_t         size;
+    size_t         n;
+    size_t         i;
+
+    if (len < IPCRYPT_BLOB_HEADER_BYTES || memcmp(blob, blob_magic, sizeof blob_magic) != 0 ||
+        blob_load16(blob + 8) != BLOB_VERSION ||
+        blob_load16(blob + 10) != IPCRYPT_BLOB_HEADER_BYTES || memcmp(blob + 12, &bom, 4) != 0 ||
+        !blob_is_zero(blob + 20, 4) || !blob_is_zero(blob + 40, 24) ||
+        blob_load64(blob + 24) != (uint64_t) len) {
+        return -1;
+    }
+    n = blob_load32(blob + 16);
+    if (n > (len - IPCRYPT_BLOB_HEADER_BYTES) / IPCRYPT_BLOB_ENTRY_BYTES) {
+        return -1;
+    }
+    table_end = IPCRYPT_BLOB_HEADER_BYTES + n * IPCRYPT_BLOB_ENTRY_BYTES;
+    for (i = 0; i < n; i++) {
+        entry  = blob + IPCRYPT_BLOB_HEADER_BYTES + i * IPCRYPT_BLOB_ENTRY_BYTES;
+        offset = blob_load32(entry + 8);
+        size   = blob_load32(entry + 12);
+        if (size == 0 || size != blob_context_bytes(entry[4]) || !blob_is_zero(entry + 5, 3) ||
+            offset % IPCRYPT_BLOB_ALIGN != 0 || offset < table_end || offset > len ||
+            len - offset < size) {
+            return -1;
+        }
+    }
+    if (blob_checksum(blob, len) != blob_load64(blob + BLOB_CHECKSUM_OFFSET)) {
+        return -1;
+    }
+    *count = n;
+
+    return 0;
+}
+
+size_t
+ipcrypt_blob_size(const IPCryptBlobEntry *entries, size_t count)
+{
+    size_t size;
+    size_t ctx_bytes;
+    size_t i;
+
+    if (count > (UINT32_MAX - IPCRYPT_BLOB_HEADER_BYTES) / IPCRYPT_BLOB_ENTRY_BYTES) {
+        return 0;
+    }
+    size = blob_align(IPCRYPT_BLOB_HEADER_BYTES + count * IPCRYPT_BLOB_ENTRY_BYTES);
+    for (i = 0; i < count; i++) {
+        if ((ctx_bytes = blob_context_bytes((unsigned int) entries[i].mode)) == 0 ||
+            size > UINT32_MAX - blob_align(ctx_bytes)) {
+            return 0;
+        }
+        size += blob_align(ctx_bytes);
+    }
+    return size;
+}
+
+size_t
+ipcrypt_blob_export(void *blob, size_t blob_len, const IPCryptBlobEntry *entries, size_t count)
+{
+    const uint32_t bom  = BLOB_BYTE_ORDER_MARK;
+    uint8_t *const out  = (uint8_t *) blob;
+    const size_t   size = ipcrypt_blob_size(entries, count);
+    size_t         offset;
+    size_t         ctx_bytes;
+    size_t         i;
+
+    if (size == 0 || blob_len < size) {
+        return 0;
+    }
+    memset(out, 0, size);
+    memcpy(out, blob_magic, sizeof blob_magic);
+    blob_store16(out + 8, BLOB_VERSION);
+    blob_store16(out + 10, IPCRYPT_BLOB_HEADER_BYTES);
+    memcpy(out + 12, &bom, 4);
+    blob_store32(out + 16, (uint32_t) count);
+    blob_store64(out + 24, (uint64_t) size);
+
+    offset = blob_align(IPCRYPT_BLOB_HEADER_BYTES + count * IPCRYPT_BLOB_ENTRY_BYTES);
+    for (i = 0; i < count; i++) {
+        uint8_t *const entry = out + IPCRYPT_BLOB_HEADER_BYTES + i * IPCRYPT_BLOB_ENTRY_BYTES;
+
+        ctx_bytes = blob_context_bytes((unsigned int) entries[i].mode);
+        blob_store32(entry, entries[i].key_id);
+        entry[4] = (uint8_t) entries[i].mode;
+        blob_store32(entry + 8, (uint32_t) offset);
+        blob_store32(entry + 12, (uint32_t) ctx_bytes);
+        memcpy(out + offset, entries[i].ctx, ctx_bytes);
+        offset += blob_align(ctx_bytes);
+    }
+    // The checksum is computed last, over the complete blob.
+    blob_store64(out + BLOB_CHECKSUM_OFFSET, blob_checksum(out, size));
+
+    return size;
+}
+
+IPCryptBlob *
+ipcrypt_blob_open(const void *blob, size_t blob_len)
+{
+    IPCryptBlob *b;
+    size_t       count;
+
+    if (blob_validate((const uint8_t *) blob, blob_len, &count) != 0) {
+        return NULL;
+    }
+    if ((b = (IPCryptBlob *) calloc(1, sizeof *b)) == NULL) {
+        return NULL;
+    }
+    b->data  = (const uint8_t *) blob;
+    b->len   = blob_len;
+    b->count = count;
+
+    return b;
+}
+
+void
+ipcrypt_blob_close(IPCryptBlob *blob)
+{
+    if (blob == NULL) {
+        return;
+    }
+#ifndef _WIN32
+    if (blob->map != NULL) {
+        if (blob->flags & IPCRYPT_BLOB_WIPE_ON_CLOSE) {
+            ipcrypt_blob_wipe(blob->map, blob->len);
+        }
+        munmap(blob->map, blob->len);
+    }
+#endif
+    free(blob);
+}
+
+size_t
+ipcrypt_blob_count(const IPCryptBlob *blob)
+{
+    return blob->count;
+}
+
+int
+ipcrypt_blob_entry(const IPCryptBlob *blob, size_t index, IPCryptBlobEntry *entry)
+{
+    const uint8_t *e;
+
+    if (index >= blob->count) {
+        return -1;
+    }
+    e             = blob->data + IPCRYPT_BLOB_HEADER_BYTES + index * IPCRYPT_BLOB_ENTRY_BYTES;
+    entry->key_id = blob_load32(e);
+    entry->mode   = (IPCryptMode) e[4];
+    entry->ctx    = blob->data + blob_load32(e + 8);
+
+    return 0;
+}
+
+const void *
+ipcrypt_blob_find(const IPCryptBlob *blob, IPCryptMode mode, uint32_t key_id)
+{
+    IPCryptBlobEntry entry;
+    size_t           i;
+
+    for (i = 0; i < blob->count; i++) {
+        ipcrypt_blob_entry(blob, i, &entry);
+        if (entry.mode == mode && entry.key_id == key_id) {
+            return entry.ctx;
+        }
+    }
+    return NULL;
+}
+
+int
+ipcrypt_blob_load_keyring(const IPCryptBlob *blob, IPCryptKeyring *keyring)
+{
+    const IPCryptMode mode = ipcrypt_keyring_mode(keyring);
+    IPCryptBlobEntry  entry;
+    int               added = 0;
+    size_t            i;
+
+    for (i = 0; i < blob->count; i++) {
+        ipcrypt_blob_entry(blob, i, &entry);
+        if (entry.mode != mode) {
+            continue;
+        }
+        if (ipcrypt_keyring_add_context(keyring, entry.key_id, entry.ctx) != 0) {
+            return -1;
+        }
+        added++;
+    }
+    return added;
+}
+
+void
+ipcrypt_blob_wipe(void *blob, size_t len)
+{
+#ifdef _MSC_VER
+    SecureZeroMemory(blob, len);
+#elif defined(__STDC_LIB_EXT1__)
+    memset_s(blob, len, 0, len);
+#else
+    memset(blob, 0, len);
+// Compiler barrier to prevent optimizations from removing memset.
+#    if defined(__GNUC__) || defined(__clang__)
+    __asm__ __volatile__("" : : "r"(blob) : "memory");
+#    endif
+#endif
+}
+
+#ifndef _WIN32
+
+int
+ipcrypt_blob_write(int fd, const IPCryptBlobEntry *entries, size_t count)
+{
+    const size_t size = ipcrypt_blob_size(entries, count);
+    void        *map;
+
+    if (size == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (ftruncate(fd, (off_t) size) != 0) {
+        return -1;
+    }
+    if ((map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        return -1;
+    }
+    ipcrypt_blob_export(map, size, entries, count);
+    if (munmap(map, size) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+IPCryptBlob *
+ipcrypt_blob_map(int fd, unsigned int flags)
+{
+    IPCryptBlob *blob;
+    struct stat  st;
+    size_t       count;
+    int          prot = PROT_READ;
+    void        *map;
+
+    if (fstat(fd, &st) != 0) {
+        return NULL;
+    }
+    if (!S_ISREG(st.st_mode) || (uint64_t) st.st_size < IPCRYPT_BLOB_HEADER_BYTES ||
+        (uint64_t) st.st_size > SIZE_MAX) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if ((blob = (IPCryptBlob *) calloc(1, sizeof *blob)) == NULL) {
+        return NULL;
+    }
+    if (flags & IPCRYPT_BLOB_WIPE_ON_CLOSE) {
+        prot |= PROT_WRITE;
+    }
+    blob->len = (size_t) st.st_size;
+    if ((map = mmap(NULL, blob->len, prot, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        free(blob);
+        return NULL;
+    }
+    if (blob_validate((const uint8_t *) map, blob->len, &count) != 0) {
+        munmap(map, blob->len);
+        free(blob);
+        errno = EINVAL;
+        return NULL;
+    }
+#    ifdef MADV_DONTDUMP
+    (void) madvise(map, blob->len, MADV_DONTDUMP);
+#    endif
+    blob->data  = (const uint8_t *) map;
+    blob->count = count;
+    blob->map   = map;
+    blob->flags = flags;
+
+    return blob;
+}
+
+#endif
@@ -0,0 +1,762 @@
+/**
+ * Parallel CSV and TSV column anonymizer for IPCrypt2.
+ *
+ * The calling thread cuts the input into segments: from the end of the previous segment, it skips
+ * IPCRYPT_CSV_SEGMENT_BYTES, computes whether that position is enclosed in double quotes from the
+ * parity of the number of quotes skipped, and moves to the next record boundary. Quotes are counted
+ * 16 bytes at a time with SIMD comparisons.
+ *
+ * Workers then parse their segments, jumping from one delimiter, quote or newline to the next with
+ * SIMD comparisons as well. Fields of the selected columns are collected into a batch, encrypted
+ * together with the strided functions, and the output of the segment is assembled in a single
+ * pass, copying the text between the fields and their replacements.
+ *
+ * Segments are processed in rounds of a few segments per worker, and the output of every round is
+ * written in order before the next round starts, so that memory usage doesn't grow with the size
+ * of the input.
+ */
+
+#if !defined(_WIN32) && defined(__linux__) && !defined(_GNU_SOURCE)
+#    define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#    include <emmintrin.h>
+#    define CSV_SSE2
+#elif defined(__ARM_NEON) || defined(__aarch64__) || defined(_M_ARM64)
+#    include <arm_neon.h>
+#    define CSV_NEON
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#    include <intrin.h>
+#endif
+
+#include "include/ipcrypt2_csv.h"
+
+/** Number of fields encrypted together. */
+#define CSV_BATCH_FIELDS 256
+
+/** Number of segments per worker processed in a round. */
+#define CSV_SEGMENTS_PER_THREAD 4
+
+/** Maximum length of a replacement: a hex-encoded NDX ciphertext. */
+#define CSV_MAX_REPLACEMENT_CHARS (IPCRYPT_NDX_NDIP_STR_BYTES - 1)
+
+/** Offset of the address within the field of a token. */
+#define CSV_IP16_OFFSET IPCRYPT_NDX_TWEAKBYTES
+
+/**
+ * CsvToken is a field to encrypt or decrypt, in the same layout as the tokens of the log
+ * anonymizer: the tweak followed by the address.
+ */
+typedef struct CsvToken {
+    uint8_t field[IPCRYPT_NDX_NDIP_BYTES];
+    size_t  start;
+    size_t  len;
+} CsvToken;
+
+struct IPCryptCsv {
+    IPCryptMode mode;
+    union {
+        IPCrypt    ipcrypt;
+        IPCryptPFX ipcrypt_pfx;
+        IPCryptNDX ipcrypt_ndx;
+    } ctx;
+    int                decrypt;
+    int                header;
+    char               delimiter;
+    size_t             last_column;
+    IPCryptCsvRandomFn random;
+    void              *opaque;
+    uint8_t            columns[IPCRYPT_CSV_MAX_COLUMNS];
+};
+
+/**
+ * CsvSegment is a range of complete records, and its output.
+ *
+ * With the batch buffers, a segment is larger than IPCRYPT_POOL_CHUNK_BYTES, so that the thread
+ * pool hands out segments one at a time.
+ */
+typedef struct CsvSegment {
+    const IPCryptCsv *csv;
+    const char       *in;
+    size_t            start;
+    size_t            end;
+    char             *out;
+    size_t            out_len;
+    size_t            out_size;
+    uint64_t          records;
+    uint64_t          fields;
+    uint64_t          invalid_fields;
+    int               failed;
+    uint8_t           tweaks[CSV_BATCH_FIELDS * IPCRYPT_NDX_TWEAKBYTES];
+    CsvToken          tokens[CSV_BATCH_FIELDS];
+} CsvSegment;
+
+static inline unsigned int
+csv_ctz32(uint32_t x)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long i;
+
+    _BitScanForward(&i, x);
+    return (unsigned int) i;
+#else
+    return (unsigned int) __builtin_ctz(x);
+#endif
+}
+
+static inline unsigned int
+csv_ctz64(uint64_t x)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long i;
+
+    _BitScanForward64(&i, x);
+    return (unsigned int) i;
+#else
+    return (unsigned int) __builtin_ctzll(x);
+#endif
+}
+
+/**
+ * csv_parity64 returns the parity of the number of bits set in `x`.
+ */
+static inline unsigned int
+csv_parity64(uint64_t x)
+{
+    x ^= x >> 32;
+    x ^= x >> 16;
+    x ^= x >> 8;
+    x ^= x >> 4;
+    x ^= x >> 2;
+    x ^= x >> 1;
+    return (unsigned int) (x & 1);
+}
+
+/**
+ * csv_quote_parity returns 1 if `in` contains an odd number of double quotes, 0 otherwise.
+ */
+static unsigned int
+csv_quote_parity(const char *in, size_t len)
+{
+    unsigned int parity = 0;
+    size_t       pos    = 0;
+
+#if defined(CSV_SSE2)
+    const __m128i quote = _mm_set1_epi8('"');
+    __m128i       acc   = _mm_setzero_si128();
+
+    // Every byte of the accumulator holds the parity of the quotes seen at that position.
+    for (; len - pos >= 16; pos += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i *) (const void *) (in + pos));
+
+        acc = _mm_xor_si128(acc, _mm_cmpeq_epi8(v, quote));
+    }
+    parity = csv_parity64((uint64_t) _mm_movemask_epi8(acc));
+#elif defined(CSV_NEON)
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t one   = vdupq_n_u8(1);
+    uint8x16_t       acc   = vdupq_n_u8(0);
+
+    for (; len - pos >= 16; pos += 16) {
+        acc = veorq_u8(acc, vandq_u8(vceqq_u8(vld1q_u8((const uint8_t *) in + pos), quote), one));
+    }
+    parity = csv_parity64(vgetq_lane_u64(vreinterpretq_u64_u8(acc), 0) ^
+                          vgetq_lane_u64(vreinterpretq_u64_u8(acc), 1));
+#endif
+    for (; pos < len; pos++) {
+        parity ^= in[pos] == '"';
+    }
+    return parity;
+}
+
+/**
+ * csv_next_special returns the position of the first delimiter, double quote or newline of `in`
+ * at or after `pos`, or `len` if there is none.
+ */
+static size_t
+csv_next_special(const char *in, size_t pos, size_t len, char delimiter)
+{
+#if defined(CSV_SSE2)
+    const __m128i delim = _mm_set1_epi8(delimiter);
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i nl    = _mm_set1_epi8('\n');
+
+    while (len - pos >= 16) {
+        const __m128i  v    = _mm_loadu_si128((const __m128i *) (const void *) (in + pos));
+        const __m128i  m    = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, delim),
+                                                        _mm_cmpeq_epi8(v, quote)),
+                                           _mm_cmpeq_epi8(v, nl));
+        const uint32_t mask = (uint32_t) _mm_movemask_epi8(m);
+
+        if (mask != 0) {
+            return pos + csv_ctz32(mask);
+        }
+        pos += 16;
+    }
+#elif defined(CSV_NEON)
+    const uint8x16_t delim = vdupq_n_u8((uint8_t) delimiter);
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t nl    = vdupq_n_u8('\n');
+
+    while (len - pos >= 16) {
+        const uint8x16_t v = vld1q_u8((const uint8_t *) in + pos);
+        const uint8x16_t m =
+            vorrq_u8(vorrq_u8(vceqq_u8(v, delim), vceqq_u8(v, quote)), vceqq_u8(v, nl));
+        // Narrow the comparison result to 4 bits per byte.
+        const uint64_t mask =
+            vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+
+        if (mask != 0) {
+            return pos + (csv_ctz64(mask) >> 2);
+        }
+        pos += 16;
+    }
+#endif
+    while (pos < len && in[pos] != delimiter && in[pos] != '"' && in[pos] != '\n') {
+        pos++;
+    }
+    return pos;
+}
+
+/**
+ * csv_record_end returns the position following the first newline of `in` at or after `pos` that
+ * is not enclosed in double quotes, or `len` if there is none. `quoted` tells whether `pos` is
+ * enclosed in double quotes.
+ */
+static size_t
+csv_record_end(const char *in, size_t pos, size_t len, unsigned int quoted)
+{
+    const char *p;
+
+    while (pos < len) {
+        if (quoted) {
+            if ((p = (const char *) memchr(in + pos, '"', len - pos)) == NULL) {
+                return len;
+            }
+            quoted = 0;
+        } else {
+            // The delimiter is irrelevant here, and a newline is searched for twice.
+            pos = csv_next_special(in, pos, len, '\n');
+            if (pos >= len || in[pos] == '\n') {
+                return pos < len ? pos + 1 : len;
+            }
+            p      = in + pos;
+            quoted = 1;
+        }
+        pos = (size_t) (p - in) + 1;
+    }
+    return len;
+}
+
+static int
+csv_reserve(CsvSegment *seg, size_t len)
+{
+    char  *out;
+    size_t size;
+
+    if (seg->out_size - seg->out_len >= len) {
+        return 0;
+    }
+    size = seg->out_size + seg->out_size / 2;
+    if (size < seg->out_len + len) {
+        size = seg->out_len + len;
+    }
+    if ((out = (char *) realloc(seg->out, size)) == NULL) {
+        return -1;
+    }
+    seg->out      = out;
+    seg->out_size = size;
+    return 0;
+}
+
+static void
+csv_encrypt_tokens(CsvSegment *seg, size_t count)
+{
+    const IPCryptCsv *csv    = seg->csv;
+    const size_t      stride = sizeof(CsvToken);
+    size_t            offset;
+    size_t            i;
+
+    switch (csv->mode) {
+    case IPCRYPT_MODE_DETERMINISTIC:
+        offset = CSV_IP16_OFFSET;
+        (void) ipcrypt_encrypt_ip16_strided(&csv->ctx.ipcrypt, seg->tokens, count, stride, &offset,
+                                            1, 16);
+        break;
+    case IPCRYPT_MODE_PFX:
+        offset = CSV_IP16_OFFSET;
+        (void) ipcrypt_pfx_encrypt_ip16_strided(&csv->ctx.ipcrypt_pfx, seg->tokens, count, stride,
+                                                &offset, 1, 16);
+        break;
+    case IPCRYPT_MODE_ND:
+        csv->random(csv->opaque, seg->tweaks, count * IPCRYPT_TWEAKBYTES);
+        for (i = 0; i < count; i++) {
+            memcpy(seg->tokens[i].field + CSV_IP16_OFFSET - IPCRYPT_TWEAKBYTES,
+                   seg->tweaks + i * IPCRYPT_TWEAKBYTES, IPCRYPT_TWEAKBYTES);
+        }
+        offset = CSV_IP16_OFFSET - IPCRYPT_TWEAKBYTES;
+        (void) ipcrypt_nd_encrypt_ip16_strided(&csv->ctx.ipcrypt, seg->tokens, count, stride,
+                                               &offset, 1, IPCRYPT_NDIP_BYTES);
+        break;
+    case IPCRYPT_MODE_NDX:
+        csv->random(csv->opaque, seg->tweaks, count * IPCRYPT_NDX_TWEAKBYTES);
+        for (i = 0; i < count; i++) {
+            memcpy(seg->tokens[i].field, seg->tweaks + i * IPCRYPT_NDX_TWEAKBYTES,
+                   IPCRYPT_NDX_TWEAKBYTES);
+        }
+        offset = 0;
+        (void) ipcrypt_ndx_encrypt_ip16_strided(&csv->ctx.ipcrypt_ndx, seg->tokens, count, stride,
+                                                &offset, 1, IPCRYPT_NDX_NDIP_BYTES);
+        break;
+    }
+}
+
+static void
+csv_decrypt_tokens(CsvSegment *seg, size_t count)
+{
+    const IPCryptCsv *csv    = seg->csv;
+    const size_t      stride = sizeof(CsvToken);
+    size_t            offset;
+
+    switch (csv->mode) {
+    case IPCRYPT_MODE_DETERMINISTIC:
+        offset = CSV_IP16_OFFSET;
+        (void) ipcrypt_decrypt_ip16_strided(&csv->ctx.ipcrypt, seg->tokens, count, stride, &offset,
+                                            1, 16);
+        break;
+    case IPCRYPT_MODE_PFX:
+        offset = CSV_IP16_OFFSET;
+        (void) ipcrypt_pfx_decrypt_ip16_strided(&csv->ctx.ipcrypt_pfx, seg->tokens, count, stride,
+                                                &offset, 1, 16);
+        break;
+    case IPCRYPT_MODE_ND:
+        offset = CSV_IP16_OFFSET - IPCRYPT_TWEAKBYTES;
+        (void) ipcrypt_nd_decrypt_ip16_strided(&csv->ctx.ipcrypt, seg->tokens, count, stride,
+                                               &offset, 1, IPCRYPT_NDIP_BYTES);
+        break;
+    case IPCRYPT_MODE_NDX:
+        offset = 0;
+        (void) ipcrypt_ndx_decrypt_ip16_strided(&csv->ctx.ipcrypt_ndx, seg->tokens, count, stride,
+                                                &offset, 1, IPCRYPT_NDX_NDIP_BYTES);
+        break;
+    }
+}
+
+static const char csv_hex_digits[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
+                                         '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
+
+static size_t
+csv_format_hex(char *out, const uint8_t *bin, size_t bin_len)
+{
+    size_t i;
+
+    for (i = 0; i < bin_len; i++) {
+        out[2 * i]     = csv_hex_digits[bin[i] >> 4];
+        out[2 * i + 1] = csv_hex_digits[bin[i] & 0xf];
+    }
+    return 2 * bin_len;
+}
+
+static size_t
+csv_format_token(const IPCryptCsv *csv, char *out, const CsvToken *token)
+{
+    char   str[IPCRYPT_MAX_IP_STR_BYTES];
+    size_t len;
+
+    if (!csv->decrypt) {
+        switch (csv->mode) {
+        case IPCRYPT_MODE_ND:
+            return csv_format_hex(out, token->field + CSV_IP16_OFFSET - IPCRYPT_TWEAKBYTES,
+                                  IPCRYPT_NDIP_BYTES);
+        case IPCRYPT_MODE_NDX:
+            return csv_format_hex(out, token->field, IPCRYPT_NDX_NDIP_BYTES);
+        default:
+            break;
+        }
+    }
+    len = ipcrypt_ip16_to_str(str, token->field + CSV_IP16_OFFSET);
+    memcpy(out, str, len);
+    return len;
+}
+
+/**
+ * csv_parse_field stores the content of a field into a token. Returns 1 if the field holds an
+ * address, or a ciphertext when decrypting, 0 otherwise.
+ */
+static int
+csv_parse_field(const IPCryptCsv *csv, CsvToken *token, const char *field, size_t len)
+{
+    char str[IPCRYPT_MAX_IP_STR_BYTES];
+
+    if (csv->decrypt && csv->mode == IPCRYPT_MODE_ND) {
+        return len == IPCRYPT_NDIP_STR_BYTES - 1 &&
+               ipcrypt_ndip_from_hex(token->field + CSV_IP16_OFFSET - IPCRYPT_TWEAKBYTES, field,
+                                     len) == 0;
+    }
+    if (csv->decrypt && csv->mode == IPCRYPT_MODE_NDX) {
+        return len == IPCRYPT_NDX_NDIP_STR_BYTES - 1 &&
+               ipcrypt_ndx_ndip_from_hex(token->field, field, len) == 0;
+    }
+    if (len >= sizeof str) {
+        return 0;
+    }
+    memcpy(str, field, len);
+    str[len] = 0;
+    return ipcrypt_str_to_ip16(token->field + CSV_IP16_OFFSET, str) == 0;
+}
+
+/**
+ * csv_flush transforms a batch of tokens, and appends the input up to the end of the last token to
+ * the output, with the tokens replaced. `*copied` is the position of the input copied so far.
+ */
+static int
+csv_flush(CsvSegment *seg, size_t count, size_t *copied)
+{
+    const char *in = seg->in;
+    size_t      i;
+
+    if (count == 0) {
+        return 0;
+    }
+    if (csv_reserve(seg, seg->tokens[count - 1].start - *copied +
+                             count * CSV_MAX_REPLACEMENT_CHARS) != 0) {
+        return -1;
+    }
+    if (seg->csv->decrypt) {
+        csv_decrypt_tokens(seg, count);
+    } else {
+        csv_encrypt_tokens(seg, count);
+    }
+    for (i = 0; i < count; i++) {
+        const CsvToken *token = &seg->tokens[i];
+
+        memcpy(seg->out + seg->out_len, in + *copied, token->start - *copied);
+        seg->out_len += token->start - *copied;
+        seg->out_len += csv_format_token(seg->csv, seg->out + seg->out_len, token);
+        *copied = token->start + token->len;
+    }
+    seg->fields += count;
+    return 0;
+}
+
+/**
+ * csv_segment parses the records of a segment, and writes its output.
+ */
+static void
+csv_segment(CsvSegment *seg)
+{
+    const IPCryptCsv *csv       = seg->csv;
+    const char       *in        = seg->in;
+    const size_t      end       = seg->end;
+    const char        delimiter = csv->delimiter;
+    size_t            pos       = seg->start;
+    size_t            copied    = seg->start;
+    size_t            count     = 0;
+    size_t            column    = 0;
+    size_t            field     = seg->start;
+    size_t            p, start, len;
+    int               quoted    = 0;
+    int               c;
+
+    for (;;) {
+        if (quoted) {
+            const char *q = (const char *) memchr(in + pos, '"', end - pos);
+
+            pos    = q != NULL ? (size_t) (q - in) + 1 : end;
+            quoted = 0;
+        }
+        p = csv_next_special(in, pos, end, delimiter);
+        if (p >= end && field >= end && column == 0) {
+            break;
+        }
+        c = p < end ? in[p] : '\n';
+        if (c == '"') {
+            pos    = p + 1;
+            quoted = 1;
+            continue;
+        }
+        if (column <= csv->last_column && csv->columns[column]) {
+            start = field;
+            len   = p - field;
+            if (c == '\n' && len > 0 && in[start + len - 1] == '\r') {
+                len--;
+            }
+            if (len >= 2 && in[start] == '"' && in[start + len - 1] == '"') {
+                start++;
+                len -= 2;
+            }
+            if (csv_parse_field(csv, &seg->tokens[count], in + start, len)) {
+                seg->tokens[count].start = start;
+                seg->tokens[count].len   = len;
+                if (++count == CSV_BATCH_FIELDS) {
+                    if (csv_flush(seg, count, &copied) != 0) {
+                        seg->failed = 1;
+                        return;
+                    }
+                    count = 0;
+                }
+            } else if (len > 0) {
+                seg->invalid_fields++;
+            }
+        }
+        pos   = p + 1;
+        field = pos;
+        if (c == delimiter) {
+            column++;
+            continue;
+        }
+        seg->records++;
+        if (p >= end) {
+            break;
+        }
+        column = 0;
+    }
+    if (csv_flush(seg, count, &copied) != 0 || csv_reserve(seg, end - copied) != 0) {
+        seg->failed = 1;
+        return;
+    }
+    memcpy(seg->out + seg->out_len, in + copied, end - copied);
+    seg->out_len += end - copied;
+}
+
+/**
+ * csv_chunk processes a chunk of segments. Called by the workers of the pool.
+ */
+static void
+csv_chunk(void *ctx, void *base, size_t count, size_t stride)
+{
+    CsvSegment *const segments = (CsvSegment *) base;
+    size_t            i;
+
+    (void) ctx;
+    (void) stride;
+    for (i = 0; i < count; i++) {
+        csv_segment(&segments[i]);
+    }
+}
+
+static size_t
+csv_key_bytes(IPCryptMode mode)
+{
+    switch (mode) {
+    case IPCRYPT_MODE_DETERMINISTIC:
+    case IPCRYPT_MODE_ND:
+        return IPCRYPT_KEYBYTES;
+    case IPCRYPT_MODE_PFX:
+        return IPCRYPT_PFX_KEYBYTES;
+    case IPCRYPT_MODE_NDX:
+        return IPCRYPT_NDX_KEYBYTES;
+    }
+    return 0;
+}
+
+IPCryptCsv *
+ipcrypt_csv_create(IPCryptMode mode, const uint8_t *key, size_t key_len, char delimiter,
+                   const size_t *columns, size_t columns_count, unsigned int flags,
+                   IPCryptCsvRandomFn random, void *opaque)
+{
+    IPCryptCsv *csv;
+    size_t      i;
+
+    if (key_len == 0 || key_len != csv_key_bytes(mode) || columns_count == 0 ||
+        delimiter == '"' || delimiter == '\n') {
+        return NULL;
+    }
+    if (!(flags & IPCRYPT_CSV_DECRYPT) && (mode == IPCRYPT_MODE_ND || mode == IPCRYPT_MODE_NDX) &&
+        random == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < columns_count; i++) {
+        if (columns[i] >= IPCRYPT_CSV_MAX_COLUMNS) {
+            return NULL;
+        }
+    }
+    if ((csv = (IPCryptCsv *) calloc(1, sizeof *csv)) == NULL) {
+        return NULL;
+    }
+    switch (mode) {
+    case IPCRYPT_MODE_DETERMINISTIC:
+    case IPCRYPT_MODE_ND:
+        ipcrypt_init(&csv->ctx.ipcrypt, key);
+        break;
+    case IPCRYPT_MODE_PFX:
+        ipcrypt_pfx_init(&csv->ctx.ipcrypt_pfx, key);
+        break;
+    case IPCRYPT_MODE_NDX:
+        ipcrypt_ndx_init(&csv->ctx.ipcrypt_ndx, key);
+        break;
+    }
+    for (i = 0; i < columns_count; i++) {
+        csv->columns[columns[i]] = 1;
+        if (columns[i] > csv->last_column) {
+            csv->last_column = columns[i];
+        }
+    }
+    csv->mode      = mode;
+    csv->decrypt   = (flags & IPCRYPT_CSV_DECRYPT) != 0;
+    csv->header    = (flags & IPCRYPT_CSV_HEADER) != 0;
+    csv->delimiter = delimiter;
+    csv->random    = random;
+    csv->opaque    = opaque;
+
+    return csv;
+}
+
+void
+ipcrypt_csv_destroy(IPCryptCsv *csv)
+{
+    if (csv == NULL) {
+        return;
+    }
+    switch (csv->mode) {
+    case IPCRYPT_MODE_DETERMINISTIC:
+    case IPCRYPT_MODE_ND:
+        ipcrypt_deinit(&csv->ctx.ipcrypt);
+        break;
+    case IPCRYPT_MODE_PFX:
+        ipcrypt_pfx_deinit(&csv->ctx.ipcrypt_pfx);
+        break;
+    case IPCRYPT_MODE_NDX:
+        ipcrypt_ndx_deinit(&csv->ctx.ipcrypt_ndx);
+        break;
+    }
+    free(csv);
+}
+
+int
+ipcrypt_csv_process(const IPCryptCsv *csv, IPCryptPool *pool, const char *in, size_t in_len,
+                    IPCryptCsvWriteFn write, void *opaque, IPCryptCsvStats *stats)
+{
+    IPCryptCsvStats st;
+    CsvSegment     *segments;
+    size_t          max_segments, count, nominal, pos = 0;
+    size_t          i;
+    unsigned int    quoted;
+    int             ret = 0;
+
+    memset(&st, 0, sizeof st);
+    max_segments = (pool != NULL ? ipcrypt_pool_threads(pool) : 1) * CSV_SEGMENTS_PER_THREAD;
+    if ((segments = (CsvSegment *) calloc(max_segments, sizeof *segments)) == NULL) {
+        return -1;
+    }
+    if (csv->header && in_len > 0) {
+        pos = csv_record_end(in, 0, in_len, 0);
+        st.records++;
+        ret = write(opaque, in, pos);
+    }
+    while (ret == 0 && pos < in_len) {
+        for (count = 0; count < max_segments && pos < in_len; count++) {
+            CsvSegment *seg = &segments[count];
+
+            nominal = in_len - pos > IPCRYPT_CSV_SEGMENT_BYTES ? pos + IPCRYPT_CSV_SEGMENT_BYTES
+                                                               : in_len;
+            quoted  = csv_quote_parity(in + pos, nominal - pos);
+            seg->csv            = csv;
+            seg->in             = in;
+            seg->start          = pos;
+            seg->end            = csv_record_end(in, nominal, in_len, quoted);
+            seg->out_len        = 0;
+            seg->records        = 0;
+            seg->fields         = 0;
+            seg->invalid_fields = 0;
+            pos                 = seg->end;
+        }
+        if (pool != NULL) {
+            (void) ipcrypt_pool_for_each(pool, csv_chunk, NULL, segments, count, sizeof *segments);
+        } else {
+            csv_chunk(NULL, segments, count, sizeof *segments);
+        }
+        for (i = 0; i < count && ret == 0; i++) {
+            if (segments[i].failed) {
+                ret = -1;
+                break;
+            }
+            st.records += segments[i].records;
+            st.fields += segments[i].fields;
+            st.invalid_fields += segments[i].invalid_fields;
+            ret = write(opaque, segments[i].out, segments[i].out_len);
+        }
+    }
+    for (i = 0; i < max_segments; i++) {
+        free(segments[i].out);
+    }
+    free(segments);
+    if (stats != NULL) {
+        *stats = st;
+    }
+    return ret;
+}
+
+#ifndef _WIN32
+
+static int
+csv_write_fd(void *opaque, const char *buf, size_t len)
+{
+    const int fd = *(const int *) opaque;
+    ssize_t   n;
+
+    while (len > 0) {
+        if ((n = write(fd, buf, len)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+int
+ipcrypt_csv_process_file(const IPCryptCsv *csv, IPCryptPool *pool, int in_fd, int out_fd,
+                         IPCryptCsvStats *stats)
+{
+    struct stat st;
+    void       *data = NULL;
+    size_t      len;
+    int         ret;
+
+    if (fstat(in_fd, &st) != 0) {
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        errno = EINVAL;
+        return -1;
+    }
+    len = (size_t) st.st_size;
+    if (len > 0) {
+        data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, in_fd, 0);
+        if (data == MAP_FAILED) {
+            return -1;
+        }
+#    ifdef MADV_SEQUENTIAL
+        (void) madvise(data, len, MADV_SEQUENTIAL);
+#    endif
+    }
+    errno = 0;
+    ret   = ipcrypt_csv_process(csv, pool, (const char *) data, len, csv_write_fd, &out_fd, stats);
+    if (ret != 0 && errno == 0) {
+        errno = ENOMEM;
+    }
+    if (data != NULL) {
+        munmap(data, len);
+    }
+    return ret;
+}
+
+#endif
@@ -0,0 +1,362 @@
+/**
+ * dnstap anonymizer for IPCrypt2.
+ *
+ * Frame Streams frames start with a 32-bit big-endian length. A zero length is an escape, followed
+ * by the length and the content of a control frame.
+ *
+ * Data frames hold a protobuf-encoded Dnstap message, whose field 14 is a Message. The fields of
+ * both messages are walked using only their tags and lengths. The fields 4 and 5 of a Message are
+ * the query and response addresses, stored as 4 or 16 bytes. A frame is only rewritten if it is
+ * well-formed all the way to its end.
+ *
+ * Addresses are collected across frames, and encrypted together with the strided functions.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/ipcrypt2_dnstap.h"
+
+/** Number of addresses encrypted together. */
+#define DNSTAP_BATCH_ADDRESSES 256
+
+/** Maximum number of addresses in a frame. Frames with more are copied verbatim. */
+#define DNSTAP_MAX_FRAME_ADDRESSES 4
+
+/** Dnstap.message */
+#define DNSTAP_FIELD_MESSAGE 14
+
+/** Message.query_address */
+#define DNSTAP_FIELD_QUERY_ADDRESS 4
+
+/** Message.response_address */
+#define DNSTAP_FIELD_RESPONSE_ADDRESS 5
+
+#define PROTOBUF_VARINT 0
+#define PROTOBUF_FIXED64 1
+#define PROTOBUF_BYTES 2
+#define PROTOBUF_FIXED32 5
+
+/**
+ * DnstapAddress is an address found in a frame.
+ * The copy of the address comes first, in the layout expected by the strided functions.
+ */
+typedef struct DnstapAddress {
+    uint8_t  ip16[16];
+    uint8_t *addr;
+    size_t   addr_len;
+} DnstapAddress;
+
+struct IPCryptDnstap {
+    IPCryptMode mode;
+    union {
+        IPCrypt    ipcrypt;
+        IPCryptPFX ipcrypt_pfx;
+    } ctx;
+    int                decrypt;
+    uint64_t           skip;
+    IPCryptDnstapStats stats;
+    size_t             count;
+    DnstapAddress      items[DNSTAP_BATCH_ADDRESSES];
+};
+
+static inline uint32_t
+load32_be(const uint8_t *p)
+{
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | (uint32_t) p[3];
+}
+
+/**
+ * protobuf_varint decodes a varint. Returns a pointer to the next byte, or NULL if the varint is
+ * truncated or longer than 10 bytes.
+ */
+static const uint8_t *
+protobuf_varint(const uint8_t *p, const uint8_t *end, uint64_t *value)
+{
+    uint64_t v = 0;
+    int      shift;
+
+    for (shift = 0; shift < 64 && p < end; shift += 7) {
+        v |= (uint64_t) (*p & 0x7f) << shift;
+        if ((*p++ & 0x80) == 0) {
+            *value = v;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * protobuf_field decodes the tag of a field, and locates its content. For length-delimited
+ * fields, `*content` and `*content_len` are the bytes of the field. Returns a pointer to the next
+ * field, or NULL if the field is invalid.
+ */
+static const uint8_t *
+protobuf_field(const uint8_t *p, const uint8_t *end, uint64_t *number, unsigned int *wire_type,
+               const uint8_t **content, size_t *content_len)
+{
+    uint64_t tag, len;
+
+    if ((p = protobuf_varint(p, end, &tag)) == NULL || (tag >> 3) == 0) {
+        return NULL;
+    }
+    *number    = tag >> 3;
+    *wire_type = (unsigned int) (tag & 7);
+    switch (*wire_type) {
+    case PROTOBUF_VARINT:
+        return protobuf_varint(p, end, &len);
+    case PROTOBUF_FIXED64:
+        return end - p >= 8 ? p + 8 : NULL;
+    case PROTOBUF_FIXED32:
+        return end - p >= 4 ? p + 4 : NULL;
+    case PROTOBUF_BYTES:
+        if ((p = protobuf_varint(p, end, &len)) == NULL || len > (uint64_t) (end - p)) {
+            return NULL;
+        }
+        *content     = p;
+        *content_len = (size_t) len;
+        return p + len;
+    default:
+        // Groups are deprecated, and not used by dnstap.
+        return NULL;
+    }
+}
+
+/**
+ * dnstap_message finds the addresses of a Message. Returns the number of addresses, or -1 if the
+ * message is invalid.
+ */
+static int
+dnstap_message(const uint8_t *p, const uint8_t *end, const uint8_t **addrs, size_t *addr_lens,
+               int count)
+{
+    const uint8_t *content     = NULL;
+    size_t         content_len = 0;
+    uint64_t       number;
+    unsigned int   wire_type;
+
+    while (p < end) {
+        if ((p = protobuf_field(p, end, &number, &wire_type, &content, &content_len)) == NULL) {
+            return -1;
+        }
+        if (wire_type != PROTOBUF_BYTES ||
+            (number != DNSTAP_FIELD_QUERY_ADDRESS && number != DNSTAP_FIELD_RESPONSE_ADDRESS) ||
+            (content_len != 4 && content_len != 16)) {
+            continue;
+        }
+        if (count == DNSTAP_MAX_FRAME_ADDRESSES) {
+            return -1;
+        }
+        addrs[count]     = content;
+        addr_lens[count] = content_len;
+        count++;
+    }
+    return count;
+}
+
+/**
+ * dnstap_frame finds the addresses of a data frame. Returns the number of addresses, or -1 if the
+ * frame is not a valid Dnstap message.
+ */
+static int
+dnstap_frame(const uint8_t *p, const uint8_t *end, const uint8_t **addrs, size_t *addr_lens)
+{
+    const uint8_t *content     = NULL;
+    size_t         content_len = 0;
+    uint64_t       number;
+    unsigned int   wire_type;
+    int            count = 0;
+
+    while (p < end) {
+        if ((p = protobuf_field(p, end, &number, &wire_type, &content, &content_len)) == NULL) {
+            return -1;
+        }
+        if (number == DNSTAP_FIELD_MESSAGE && wire_type == PROTOBUF_BYTES &&
+            (count = dnstap_message(content, content + content_len, addrs, addr_lens, count)) < 0) {
+            return -1;
+        }
+    }
+    return count;
+}
+
+/**
+ * dnstap_flush encrypts or decrypts the collected addresses, and writes them back.
+ */
+static void
+dnstap_flush(IPCryptDnstap *dnstap)
+{
+    const size_t   offset = 0;
+    DnstapAddress *a;
+    size_t         i;
+
+    if (dnstap->count == 0) {
+        return;
+    }
+    if (dnstap->mode == IPCRYPT_MODE_PFX) {
+        if (dnstap->decrypt) {
+            (void) ipcrypt_pfx_decrypt_ip16_strided(&dnstap->ctx.ipcrypt_pfx, dnstap->items,
+                                                    dnstap->count, sizeof(DnstapAddress), &offset,
+                                                    1, 16);
+        } else {
+            (void) ipcrypt_pfx_encrypt_ip16_strided(&dnstap->ctx.ipcrypt_pfx, dnstap->items,
+                                                    dnstap->count, sizeof(DnstapAddress), &offset,
+                                                    1, 16);
+        }
+    } else if (dnstap->decrypt) {
+        (void) ipcrypt_decrypt_ip16_strided(&dnstap->ctx.ipcrypt, dnstap->items, dnstap->count,
+                                            sizeof(DnstapAddress), &offset, 1, 16);
+    } else {
+        (void) ipcrypt_encrypt_ip16_strided(&dnstap->ctx.ipcrypt, dnstap->items, dnstap->count,
+                                            sizeof(DnstapAddress), &offset, 1, 16);
+    }
+    for (i = 0; i < dnstap->count; i++) {
+        a = &dnstap->items[i];
+        memcpy(a->addr, a->ip16 + 16 - a->addr_len, a->addr_len);
+    }
+    dnstap->stats.addresses += dnstap->count;
+    dnstap->count = 0;
+}
+
+static void
+dnstap_add(IPCryptDnstap *dnstap, uint8_t *addr, size_t addr_len)
+{
+    DnstapAddress *a;
+
+    // In the deterministic mode, IPv4 addresses are not reversible.
+    if (addr_len == 4 && dnstap->decrypt && dnstap->mode != IPCRYPT_MODE_PFX) {
+        return;
+    }
+    a = &dnstap->items[dnstap->count];
+    if (addr_len == 4) {
+        memset(a->ip16, 0, 10);
+        a->ip16[10] = 0xff;
+        a->ip16[11] = 0xff;
+    }
+    memcpy(a->ip16 + 16 - addr_len, addr, addr_len);
+    a->addr     = addr;
+    a->addr_len = addr_len;
+    if (++dnstap->count == DNSTAP_BATCH_ADDRESSES) {
+        dnstap_flush(dnstap);
+    }
+}
+
+static size_t
+dnstap_process(IPCryptDnstap *dnstap, uint8_t *buf, size_t len, int decrypt)
+{
+    const uint8_t *addrs[DNSTAP_MAX_FRAME_ADDRESSES];
+    size_t         addr_lens[DNSTAP_MAX_FRAME_ADDRESSES];
+    size_t         pos = 0;
+    uint32_t       frame_len;
+    int            count, i;
+
+    dnstap->decrypt = decrypt;
+    while (pos < len) {
+        if (dnstap->skip > 0) {
+            const size_t n = dnstap->skip < len - pos ? (size_t) dnstap->skip : len - pos;
+
+            dnstap->skip -= n;
+            pos += n;
+            continue;
+        }
+        if (len - pos < 4) {
+            break;
+        }
+        if ((frame_len = load32_be(buf + pos)) == 0) {
+            if (len - pos < 8) {
+                break;
+            }
+            frame_len = load32_be(buf + pos + 4);
+            if (frame_len > IPCRYPT_DNSTAP_MAX_FRAME_BYTES) {
+                dnstap->skip = frame_len;
+            } else if (len - pos - 8 < frame_len) {
+                break;
+            }
+            dnstap->stats.control_frames++;
+            pos += 8 + (dnstap->skip > 0 ? 0 : frame_len);
+            continue;
+        }
+        if (frame_len > IPCRYPT_DNSTAP_MAX_FRAME_BYTES) {
+            dnstap->stats.frames++;
+            dnstap->stats.skipped_frames++;
+            dnstap->skip = frame_len;
+            pos += 4;
+            continue;
+        }
+        if (len - pos - 4 < frame_len) {
+            break;
+        }
+        dnstap->stats.frames++;
+        count = dnstap_frame(buf + pos + 4, buf + pos + 4 + frame_len, addrs, addr_lens);
+        if (count < 0) {
+            dnstap->stats.skipped_frames++;
+        }
+        for (i = 0; i < count; i++) {
+            dnstap_add(dnstap, (uint8_t *) addrs[i], addr_lens[i]);
+        }
+        pos += 4 + frame_len;
+    }
+    dnstap_flush(dnstap);
+
+    return pos;
+}
+
+IPCryptDnstap *
+ipcrypt_dnstap_create(IPCryptMode mode, const uint8_t *key, size_t key_len)
+{
+    IPCryptDnstap *dnstap;
+
+    if (!(mode == IPCRYPT_MODE_PFX && key_len == IPCRYPT_PFX_KEYBYTES) &&
+        !(mode == IPCRYPT_MODE_DETERMINISTIC && key_len == IPCRYPT_KEYBYTES)) {
+        return NULL;
+    }
+    if ((dnstap = (IPCryptDnstap *) calloc(1, sizeof *dnstap)) == NULL) {
+        return NULL;
+    }
+    dnstap->mode = mode;
+    if (mode == IPCRYPT_MODE_PFX) {
+        ipcrypt_pfx_init(&dnstap->ctx.ipcrypt_pfx, key);
+    } else {
+        ipcrypt_init(&dnstap->ctx.ipcrypt, key);
+    }
+    return dnstap;
+}
+
+void
+ipcrypt_dnstap_destroy(IPCryptDnstap *dnstap)
+{
+    if (dnstap == NULL) {
+        return;
+    }
+    if (dnstap->mode == IPCRYPT_MODE_PFX) {
+        ipcrypt_pfx_deinit(&dnstap->ctx.ipcrypt_pfx);
+    } else {
+        ipcrypt_deinit(&dnstap->ctx.ipcrypt);
+    }
+    free(dnstap);
+}
+
+size_t
+ipcrypt_dnstap_encrypt(IPCryptDnstap *dnstap, uint8_t *buf, size_t len)
+{
+    return dnstap_process(dnstap, buf, len, 0);
+}
+
+size_t
+ipcrypt_dnstap_decrypt(IPCryptDnstap *dnstap, uint8_t *buf, size_t len)
+{
+    return dnstap_process(dnstap, buf, len, 1);
+}
+
+void
+ipcrypt_dnstap_stats(const IPCryptDnstap *dnstap, IPCryptDnstapStats *stats)
+{
+    *stats = dnstap->stats;
+}
+
+void
+ipcrypt_dnstap_reset(IPCryptDnstap *dnstap)
+{
+    dnstap->skip = 0;
+    memset(&dnstap->stats, 0, sizeof dnstap->stats);
+}
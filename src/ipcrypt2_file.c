@@ -0,0 +1,462 @@
+/**
+ * Asynchronous file pipeline for IPCrypt2.
+ *
+ * Every buffer goes through the same cycle: it is filled by a read, transformed in-place, written
+ * back at the same offset, and reused for the next unread block. Reads and writes of different
+ * buffers complete in any order, so up to IPCRYPT_FILE_QUEUE_DEPTH of them are kept in flight
+ * while blocks are transformed.
+ *
+ * The io_uring rings are set up with the raw system calls, so that no library is required. The
+ * pread()/pwrite() fallback processes one block at a time.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#    define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#    include <linux/io_uring.h>
+#    include <sys/syscall.h>
+#    if defined(__NR_io_uring_setup) && defined(IORING_FEAT_SINGLE_MMAP)
+#        define HAVE_IO_URING 1
+#    endif
+#endif
+
+#include "include/ipcrypt2_file.h"
+
+/**
+ * FileBlock is a buffer, and the block of the file it currently holds.
+ */
+typedef struct FileBlock {
+    uint8_t *data;
+    uint64_t offset;
+    size_t   len;
+    size_t   done;
+    int      writing;
+} FileBlock;
+
+/**
+ * FileJob holds the state shared by both implementations.
+ */
+typedef struct FileJob {
+    int              in_fd;
+    int              out_fd;
+    uint64_t         size;
+    uint64_t         next_offset;
+    size_t           block_bytes;
+    IPCryptFileFn    fn;
+    void            *ctx;
+    IPCryptFileStats stats;
+} FileJob;
+
+/**
+ * file_next assigns the next unread block of the file to `b`. Returns 0 if the whole file has
+ * already been assigned.
+ */
+static int
+file_next(FileJob *job, FileBlock *b)
+{
+    const uint64_t left = job->size - job->next_offset;
+
+    if (left == 0) {
+        return 0;
+    }
+    b->offset  = job->next_offset;
+    b->len     = left < job->block_bytes ? (size_t) left : job->block_bytes;
+    b->done    = 0;
+    b->writing = 0;
+    job->next_offset += b->len;
+    return 1;
+}
+
+static int
+file_process_sync(FileJob *job)
+{
+    FileBlock b;
+    ssize_t   n;
+    int       ret = 0;
+
+    if ((b.data = (uint8_t *) malloc(job->block_bytes)) == NULL) {
+        return -1;
+    }
+    while (ret == 0 && file_next(job, &b)) {
+        for (; b.done < b.len; b.done += (size_t) n) {
+            n = pread(job->in_fd, b.data + b.done, b.len - b.done, (off_t) (b.offset + b.done));
+            if (n < 0 && errno == EINTR) {
+                n = 0;
+            } else if (n <= 0) {
+                if (n == 0) {
+                    errno = EIO;
+                }
+                ret = -1;
+                break;
+            }
+        }
+        if (ret != 0) {
+            break;
+        }
+        if (job->fn(job->ctx, b.data, b.len, b.offset) != 0) {
+            errno = ECANCELED;
+            ret   = -1;
+            break;
+        }
+        for (b.done = 0; b.done < b.len; b.done += (size_t) n) {
+            n = pwrite(job->out_fd, b.data + b.done, b.len - b.done, (off_t) (b.offset + b.done));
+            if (n < 0 && errno == EINTR) {
+                n = 0;
+            } else if (n <= 0) {
+                ret = -1;
+                break;
+            }
+        }
+        job->stats.bytes += b.len;
+        job->stats.blocks++;
+    }
+    free(b.data);
+    return ret;
+}
+
+#ifdef HAVE_IO_URING
+
+/**
+ * FileRing is an io_uring instance, with its submission and completion rings mapped.
+ */
+typedef struct FileRing {
+    int                  fd;
+    unsigned int        *sq_tail;
+    unsigned int        *sq_mask;
+    unsigned int        *sq_array;
+    unsigned int        *cq_head;
+    unsigned int        *cq_tail;
+    unsigned int        *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void                *rings;
+    size_t               rings_size;
+    size_t               sqes_size;
+    unsigned int         pending;
+    int                  fixed;
+    int                  busy;
+} FileRing;
+
+static int
+ring_init(FileRing *ring, unsigned int entries)
+{
+    struct io_uring_params p;
+    size_t                 sq_size, cq_size;
+    uint8_t               *rings;
+
+    memset(&p, 0, sizeof p);
+    memset(ring, 0, sizeof *ring);
+    if ((ring->fd = (int) syscall(__NR_io_uring_setup, entries, &p)) < 0) {
+        return -1;
+    }
+    // Kernels without a single mapping for both rings are too old to be worth supporting.
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        close(ring->fd);
+        return -1;
+    }
+    sq_size          = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    cq_size          = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->rings_size = sq_size > cq_size ? sq_size : cq_size;
+    ring->sqes_size  = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->rings      = mmap(NULL, ring->rings_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->rings == MAP_FAILED) {
+        close(ring->fd);
+        return -1;
+    }
+    ring->sqes = (struct io_uring_sqe *) mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                                              MAP_SHARED | MAP_POPULATE, ring->fd,
+                                              IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        munmap(ring->rings, ring->rings_size);
+        close(ring->fd);
+        return -1;
+    }
+    rings          = (uint8_t *) ring->rings;
+    ring->sq_tail  = (unsigned int *) (rings + p.sq_off.tail);
+    ring->sq_mask  = (unsigned int *) (rings + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *) (rings + p.sq_off.array);
+    ring->cq_head  = (unsigned int *) (rings + p.cq_off.head);
+    ring->cq_tail  = (unsigned int *) (rings + p.cq_off.tail);
+    ring->cq_mask  = (unsigned int *) (rings + p.cq_off.ring_mask);
+    ring->cqes     = (struct io_uring_cqe *) (rings + p.cq_off.cqes);
+    return 0;
+}
+
+static void
+ring_destroy(FileRing *ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->rings, ring->rings_size);
+    close(ring->fd);
+}
+
+/**
+ * ring_enter submits the pending requests, and waits for at least `wait` completions.
+ */
+static int
+ring_enter(FileRing *ring, unsigned int wait)
+{
+    long ret;
+
+    do {
+        ret = syscall(__NR_io_uring_enter, ring->fd, ring->pending, wait,
+                      wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+        return -1;
+    }
+    ring->pending -= (unsigned int) ret;
+    return 0;
+}
+
+/**
+ * ring_drain waits for the completions of the requests that were submitted, out of the
+ * `in_flight` queued requests, so that the kernel no longer accesses their buffers. Requests that
+ * were queued but not submitted are dropped. Closing the ring doesn't wait for the requests.
+ *
+ * If the completions can't be waited for, `busy` is set, and the buffers must not be freed.
+ */
+static void
+ring_drain(FileRing *ring, unsigned int in_flight)
+{
+    unsigned int head;
+    long         ret;
+
+    in_flight -= ring->pending;
+    ring->pending = 0;
+    head          = *ring->cq_head;
+    while (in_flight > 0) {
+        if (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            __atomic_store_n(ring->cq_head, ++head, __ATOMIC_RELEASE);
+            in_flight--;
+            continue;
+        }
+        do {
+            ret = syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        } while (ret < 0 && errno == EINTR);
+        if (ret < 0) {
+            ring->busy = 1;
+            return;
+        }
+    }
+}
+
+/**
+ * ring_queue queues a read or a write of the remaining part of a block. `index` is the index of
+ * the buffer, both in the array of blocks and in the registered buffers.
+ */
+static void
+ring_queue(FileRing *ring, const FileJob *job, FileBlock *b, unsigned int index)
+{
+    const unsigned int   tail = *ring->sq_tail;
+    const unsigned int   slot = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe  = &ring->sqes[slot];
+
+    memset(sqe, 0, sizeof *sqe);
+    if (b->writing) {
+        sqe->opcode = ring->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd     = job->out_fd;
+    } else {
+        sqe->opcode = ring->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->fd     = job->in_fd;
+    }
+    sqe->addr      = (uint64_t) (uintptr_t) (b->data + b->done);
+    sqe->len       = (uint32_t) (b->len - b->done);
+    sqe->off       = b->offset + b->done;
+    sqe->buf_index = (uint16_t) (ring->fixed ? index : 0);
+    sqe->user_data = index;
+    ring->sq_array[slot] = slot;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->pending++;
+}
+
+static int
+file_process_uring(FileJob *job, FileRing *ring, FileBlock *blocks, unsigned int depth)
+{
+    struct io_uring_cqe *cqe;
+    FileBlock           *b;
+    unsigned int         head, index, in_flight = 0;
+    int                  error = 0;
+
+    for (index = 0; index < depth && file_next(job, &blocks[index]); index++) {
+        ring_queue(ring, job, &blocks[index], index);
+        in_flight++;
+    }
+    while (in_flight > 0) {
+        if (ring_enter(ring, 1) != 0) {
+            error = errno;
+            ring_drain(ring, in_flight);
+            errno = error;
+            return -1;
+        }
+        head = *ring->cq_head;
+        while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            cqe   = &ring->cqes[head & *ring->cq_mask];
+            index = (unsigned int) cqe->user_data;
+            b     = &blocks[index];
+            if (cqe->res < 0 && cqe->res != -EINTR && cqe->res != -EAGAIN) {
+                error = error != 0 ? error : -cqe->res;
+            } else if (cqe->res == 0 && !b->writing) {
+                // The file was truncated while being read.
+                error = error != 0 ? error : EIO;
+            } else if (cqe->res > 0) {
+                b->done += (size_t) cqe->res;
+            }
+            __atomic_store_n(ring->cq_head, ++head, __ATOMIC_RELEASE);
+            in_flight--;
+            if (error != 0) {
+                continue;
+            }
+            if (b->done < b->len) {
+                ring_queue(ring, job, b, index);
+                in_flight++;
+                continue;
+            }
+            if (!b->writing) {
+                // Let the kernel work on the queued requests while this block is transformed.
+                if (ring->pending > 0 && ring_enter(ring, 0) != 0) {
+                    error = errno;
+                    continue;
+                }
+                if (job->fn(job->ctx, b->data, b->len, b->offset) != 0) {
+                    error = ECANCELED;
+                    continue;
+                }
+                b->writing = 1;
+                b->done    = 0;
+            } else {
+                job->stats.bytes += b->len;
+                job->stats.blocks++;
+                if (!file_next(job, b)) {
+                    continue;
+                }
+            }
+            ring_queue(ring, job, b, index);
+            in_flight++;
+        }
+    }
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * file_try_uring processes the file with io_uring. Returns 1 if io_uring is not available, and
+ * nothing was done.
+ */
+static int
+file_try_uring(FileJob *job)
+{
+    FileRing     ring;
+    FileBlock    blocks[IPCRYPT_FILE_QUEUE_DEPTH];
+    struct iovec iov[IPCRYPT_FILE_QUEUE_DEPTH];
+    uint64_t     count;
+    uint8_t     *buffers;
+    size_t       buffers_size;
+    unsigned int depth, i;
+    int          ret;
+
+    count = (job->size + job->block_bytes - 1) / job->block_bytes;
+    depth = count < IPCRYPT_FILE_QUEUE_DEPTH ? (unsigned int) count : IPCRYPT_FILE_QUEUE_DEPTH;
+    if (depth == 0 || ring_init(&ring, depth) != 0) {
+        return 1;
+    }
+    buffers_size = (size_t) depth * job->block_bytes;
+    buffers      = (uint8_t *) mmap(NULL, buffers_size, PROT_READ | PROT_WRITE,
+                                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers == MAP_FAILED) {
+        ring_destroy(&ring);
+        return 1;
+    }
+    for (i = 0; i < depth; i++) {
+        blocks[i].data   = buffers + (size_t) i * job->block_bytes;
+        iov[i].iov_base = blocks[i].data;
+        iov[i].iov_len  = job->block_bytes;
+    }
+    // Registered buffers count against the locked memory limit; plain requests work without them.
+    ring.fixed =
+        syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, iov, depth) == 0;
+
+    ret = file_process_uring(job, &ring, blocks, depth);
+
+    ring_destroy(&ring);
+    // Buffers that the kernel may still write into are leaked rather than unmapped.
+    if (!ring.busy) {
+        munmap(buffers, buffers_size);
+    }
+    job->stats.io_uring = 1;
+    return ret;
+}
+
+#endif
+
+int
+ipcrypt_file_process(int in_fd, int out_fd, size_t record_bytes, unsigned int flags,
+                     IPCryptFileFn fn, void *ctx, IPCryptFileStats *stats)
+{
+    FileJob     job;
+    struct stat st;
+    int         ret = 1;
+
+    if (record_bytes == 0 || fn == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (fstat(in_fd, &st) != 0) {
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(&job, 0, sizeof job);
+    job.size = (uint64_t) st.st_size;
+    if (fstat(out_fd, &st) != 0) {
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        errno = EINVAL;
+        return -1;
+    }
+    job.in_fd       = in_fd;
+    job.out_fd      = out_fd;
+    job.fn          = fn;
+    job.ctx         = ctx;
+    job.block_bytes = IPCRYPT_FILE_BLOCK_BYTES / record_bytes * record_bytes;
+    if (job.block_bytes == 0) {
+        job.block_bytes = record_bytes;
+    }
+
+#ifdef HAVE_IO_URING
+    if (!(flags & IPCRYPT_FILE_NO_IO_URING)) {
+        ret = file_try_uring(&job);
+    }
+#else
+    (void) flags;
+#endif
+    if (ret == 1) {
+        ret = file_process_sync(&job);
+    }
+    if (ret == 0 && ftruncate(out_fd, (off_t) job.size) != 0) {
+        ret = -1;
+    }
+    if (stats != NULL) {
+        *stats = job.stats;
+    }
+    return ret;
+}
@@ -0,0 +1,603 @@
+/**
+ * NetFlow v9 and IPFIX anonymizer for IPCrypt2.
+ *
+ * A NetFlow v9 packet is a 20-byte header followed by flowsets; an IPFIX message is a 16-byte
+ * header followed by sets. Both are made of a 16-bit set ID and a 16-bit length, followed by
+ * records. Set IDs 0 and 1 (NetFlow v9), or 2 and 3 (IPFIX), hold templates and options
+ * templates. Set IDs from 256 up hold the data records of the template with the same ID.
+ *
+ * A template is compiled into a plan, cached in a hash table keyed by the exporter, the source ID
+ * or observation domain, the version and the template ID. Most templates only have fixed-length
+ * fields: their plan is the record length, and the offsets of the address fields. IPFIX templates
+ * with variable-length fields keep the list of all their fields, and records are walked field by
+ * field.
+ *
+ * The set headers of a packet are checked before anything is rewritten. Addresses are then
+ * collected across the data sets of the packet, and encrypted together with the strided
+ * functions.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/ipcrypt2_flow.h"
+
+/** Number of addresses encrypted together. */
+#define FLOW_BATCH_ADDRESSES 256
+
+/** Number of buckets of the template table. */
+#define FLOW_BUCKETS 4096
+
+#define NETFLOW_V9_VERSION      9
+#define NETFLOW_V9_HEADER_BYTES 20
+#define IPFIX_VERSION           10
+#define IPFIX_HEADER_BYTES      16
+#define SET_HEADER_BYTES        4
+#define MIN_DATA_SET_ID         256
+
+#define NETFLOW_V9_TEMPLATE_SET         0
+#define NETFLOW_V9_OPTIONS_TEMPLATE_SET 1
+#define IPFIX_TEMPLATE_SET              2
+#define IPFIX_OPTIONS_TEMPLATE_SET      3
+
+/** Length of the variable-length fields of IPFIX templates. */
+#define IPFIX_VARIABLE_LENGTH 0xffff
+
+/** Bit of the IPFIX information element IDs that are followed by an enterprise number. */
+#define IPFIX_ENTERPRISE_BIT 0x8000
+
+/**
+ * FlowField is a field of a plan.
+ * For fixed-length templates, only address fields are listed, with their offset in the record.
+ * For variable-length templates, all the fields are listed, in order, and `offset` is unused.
+ */
+typedef struct FlowField {
+    uint16_t offset;
+    uint16_t len;
+    uint8_t  is_address;
+} FlowField;
+
+/**
+ * FlowTemplate is the compiled plan of a template.
+ */
+typedef struct FlowTemplate {
+    struct FlowTemplate *next;
+    uint8_t              exporter[16];
+    uint32_t             domain;
+    uint16_t             id;
+    uint8_t              version;
+    uint8_t              variable;
+    size_t               record_len;
+    size_t               fields_count;
+    FlowField            fields[];
+} FlowTemplate;
+
+/**
+ * FlowAddress is an address found in a data record.
+ * The copy of the address comes first, in the layout expected by the strided functions.
+ */
+typedef struct FlowAddress {
+    uint8_t  ip16[16];
+    uint8_t *addr;
+    size_t   addr_len;
+} FlowAddress;
+
+/**
+ * FlowPacket holds the scope of the packet being processed.
+ */
+typedef struct FlowPacket {
+    const uint8_t *exporter;
+    uint32_t       domain;
+    uint8_t        version;
+} FlowPacket;
+
+struct IPCryptFlow {
+    IPCryptPFX       ipcrypt_pfx;
+    unsigned int     flags;
+    int              decrypt;
+    size_t           templates_count;
+    IPCryptFlowStats stats;
+    size_t           count;
+    FlowAddress      items[FLOW_BATCH_ADDRESSES];
+    FlowTemplate    *buckets[FLOW_BUCKETS];
+};
+
+static inline uint16_t
+load16_be(const uint8_t *p)
+{
+    return (uint16_t) ((unsigned int) p[0] << 8 | (unsigned int) p[1]);
+}
+
+static inline uint32_t
+load32_be(const uint8_t *p)
+{
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | (uint32_t) p[3];
+}
+
+static inline void
+store16_be(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t) (v >> 8);
+    p[1] = (uint8_t) v;
+}
+
+/**
+ * flow_address_len returns the size of the information element `id` if it is an address, or 0.
+ * NetFlow v9 field types and IPFIX information elements share these numbers.
+ */
+static size_t
+flow_address_len(uint16_t id)
+{
+    switch (id) {
+    case 8:   // sourceIPv4Address
+    case 12:  // destinationIPv4Address
+    case 15:  // ipNextHopIPv4Address
+    case 18:  // bgpNextHopIPv4Address
+    case 130: // exporterIPv4Address
+    case 225: // postNATSourceIPv4Address
+    case 226: // postNATDestinationIPv4Address
+        return 4;
+    case 27:  // sourceIPv6Address
+    case 28:  // destinationIPv6Address
+    case 62:  // ipNextHopIPv6Address
+    case 63:  // bgpNextHopIPv6Address
+    case 131: // exporterIPv6Address
+    case 281: // postNATSourceIPv6Address
+    case 282: // postNATDestinationIPv6Address
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+static size_t
+flow_bucket(const FlowPacket *packet, uint16_t id)
+{
+    uint32_t h = 2166136261U;
+    size_t   i;
+
+    for (i = 0; i < 16; i++) {
+        h = (h ^ packet->exporter[i]) * 16777619U;
+    }
+    h = (h ^ packet->domain) * 16777619U;
+    h = (h ^ ((uint32_t) packet->version << 16 | id)) * 16777619U;
+
+    return (size_t) (h ^ (h >> 16)) & (FLOW_BUCKETS - 1);
+}
+
+static int
+flow_template_matches(const FlowTemplate *t, const FlowPacket *packet, uint16_t id)
+{
+    return t->id == id && t->domain == packet->domain && t->version == packet->version &&
+           memcmp(t->exporter, packet->exporter, 16) == 0;
+}
+
+static const FlowTemplate *
+flow_find(const IPCryptFlow *flow, const FlowPacket *packet, uint16_t id)
+{
+    const FlowTemplate *t;
+
+    for (t = flow->buckets[flow_bucket(packet, id)]; t != NULL; t = t->next) {
+        if (flow_template_matches(t, packet, id)) {
+            return t;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * flow_remove removes the template `id`, or all the templates of the scope of the packet if
+ * `all` is set.
+ */
+static void
+flow_remove(IPCryptFlow *flow, const FlowPacket *packet, uint16_t id, int all)
+{
+    FlowTemplate **prev, *t;
+    size_t         bucket, first, last;
+
+    first = all ? 0 : flow_bucket(packet, id);
+    last  = all ? FLOW_BUCKETS - 1 : first;
+    for (bucket = first; bucket <= last; bucket++) {
+        prev = &flow->buckets[bucket];
+        while ((t = *prev) != NULL) {
+            if ((all && t->domain == packet->domain && t->version == packet->version &&
+                 memcmp(t->exporter, packet->exporter, 16) == 0) ||
+                (!all && flow_template_matches(t, packet, id))) {
+                *prev = t->next;
+                free(t);
+                flow->templates_count--;
+                continue;
+            }
+            prev = &t->next;
+        }
+    }
+}
+
+/**
+ * flow_insert replaces the template with the same ID, or adds a new one if there is room left.
+ */
+static void
+flow_insert(IPCryptFlow *flow, const FlowPacket *packet, FlowTemplate *t)
+{
+    const size_t bucket = flow_bucket(packet, t->id);
+
+    flow_remove(flow, packet, t->id, 0);
+    if (flow->templates_count >= IPCRYPT_FLOW_MAX_TEMPLATES) {
+        free(t);
+        return;
+    }
+    t->next                = flow->buckets[bucket];
+    flow->buckets[bucket]  = t;
+    flow->templates_count += 1;
+}
+
+/**
+ * flow_compile compiles the `count` field specifiers at `p` into a plan. The first `scope_count`
+ * fields are NetFlow v9 scope fields, that are never addresses.
+ * Returns a pointer to the end of the template, or NULL if the template is invalid.
+ */
+static const uint8_t *
+flow_compile(IPCryptFlow *flow, const FlowPacket *packet, uint16_t id, const uint8_t *p,
+             const uint8_t *end, size_t count, size_t scope_count)
+{
+    FlowTemplate *t;
+    FlowField    *f;
+    uint16_t      ie, len;
+    size_t        i, record_len = 0;
+    int           variable = 0;
+
+    if ((t = (FlowTemplate *) malloc(sizeof *t + count * sizeof t->fields[0])) == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < count; i++) {
+        if (end - p < 4) {
+            free(t);
+            return NULL;
+        }
+        ie  = load16_be(p);
+        len = load16_be(p + 2);
+        p += 4;
+        if (packet->version == IPFIX_VERSION && (ie & IPFIX_ENTERPRISE_BIT)) {
+            if (end - p < 4) {
+                free(t);
+                return NULL;
+            }
+            p += 4;
+            ie = 0;
+        }
+        f             = &t->fields[i];
+        f->offset     = (uint16_t) record_len;
+        f->len        = len;
+        f->is_address = (uint8_t) (i >= scope_count && flow_address_len(ie) != 0 &&
+                                    flow_address_len(ie) == len);
+        if (packet->version == IPFIX_VERSION && len == IPFIX_VARIABLE_LENGTH) {
+            variable = 1;
+            len      = 1;
+        }
+        record_len += len;
+    }
+    if (record_len == 0 || record_len > 0xffff) {
+        free(t);
+        return NULL;
+    }
+    memcpy(t->exporter, packet->exporter, 16);
+    t->domain     = packet->domain;
+    t->version    = packet->version;
+    t->id         = id;
+    t->variable   = (uint8_t) variable;
+    t->record_len = record_len;
+    // Fixed-length plans only keep the address fields.
+    t->fields_count = 0;
+    for (i = 0; i < count; i++) {
+        if (variable || t->fields[i].is_address) {
+            t->fields[t->fields_count++] = t->fields[i];
+        }
+    }
+    flow->stats.templates++;
+    flow_insert(flow, packet, t);
+
+    return p;
+}
+
+/**
+ * flow_templates compiles the templates of a template or options template set.
+ */
+static void
+flow_templates(IPCryptFlow *flow, const FlowPacket *packet, uint16_t set_id, const uint8_t *p,
+               const uint8_t *end)
+{
+    size_t   count, scope_count;
+    uint16_t id;
+
+    while (end - p >= 4 && (id = load16_be(p)) >= MIN_DATA_SET_ID) {
+        count       = load16_be(p + 2);
+        scope_count = 0;
+        p += 4;
+        if (set_id == NETFLOW_V9_OPTIONS_TEMPLATE_SET) {
+            // Scope and option lengths are in bytes, 4 per field specifier.
+            if (end - p < 2) {
+                return;
+            }
+            scope_count = count / 4;
+            count       = scope_count + load16_be(p) / 4;
+            p += 2;
+        } else if (set_id == IPFIX_OPTIONS_TEMPLATE_SET && count > 0) {
+            if (end - p < 2) {
+                return;
+            }
+            p += 2;
+        }
+        if (count == 0) {
+            // IPFIX template withdrawal.
+            flow_remove(flow, packet, id, 0);
+            continue;
+        }
+        if ((p = flow_compile(flow, packet, id, p, end, count, scope_count)) == NULL) {
+            return;
+        }
+    }
+    // IPFIX withdrawal of all the templates.
+    if (end - p >= 4 && packet->version == IPFIX_VERSION && load16_be(p) == set_id &&
+        load16_be(p + 2) == 0) {
+        flow_remove(flow, packet, 0, 1);
+    }
+}
+
+/**
+ * flow_flush encrypts or decrypts the collected addresses, and writes them back.
+ */
+static void
+flow_flush(IPCryptFlow *flow)
+{
+    const size_t offset = 0;
+    FlowAddress *a;
+    size_t       i;
+
+    if (flow->count == 0) {
+        return;
+    }
+    if (flow->decrypt) {
+        (void) ipcrypt_pfx_decrypt_ip16_strided(&flow->ipcrypt_pfx, flow->items, flow->count,
+                                                sizeof(FlowAddress), &offset, 1, 16);
+    } else {
+        (void) ipcrypt_pfx_encrypt_ip16_strided(&flow->ipcrypt_pfx, flow->items, flow->count,
+                                                sizeof(FlowAddress), &offset, 1, 16);
+    }
+    for (i = 0; i < flow->count; i++) {
+        a = &flow->items[i];
+        memcpy(a->addr, a->ip16 + 16 - a->addr_len, a->addr_len);
+    }
+    flow->stats.addresses += flow->count;
+    flow->count = 0;
+}
+
+static void
+flow_add(IPCryptFlow *flow, uint8_t *addr, size_t addr_len)
+{
+    FlowAddress *a;
+
+    a = &flow->items[flow->count];
+    if (addr_len == 4) {
+        memset(a->ip16, 0, 10);
+        a->ip16[10] = 0xff;
+        a->ip16[11] = 0xff;
+    }
+    memcpy(a->ip16 + 16 - addr_len, addr, addr_len);
+    a->addr     = addr;
+    a->addr_len = addr_len;
+    if (++flow->count == FLOW_BATCH_ADDRESSES) {
+        flow_flush(flow);
+    }
+}
+
+/**
+ * flow_field_len returns the length of the content of a field of a variable-length template, and
+ * skips its length prefix. Returns SIZE_MAX if the field is truncated.
+ */
+static size_t
+flow_field_len(const FlowField *f, uint8_t **p, const uint8_t *end)
+{
+    size_t len = f->len;
+
+    if (len == IPFIX_VARIABLE_LENGTH) {
+        if (*p >= end) {
+            return SIZE_MAX;
+        }
+        len = *(*p)++;
+        if (len == 0xff) {
+            if (end - *p < 2) {
+                return SIZE_MAX;
+            }
+            len = load16_be(*p);
+            *p += 2;
+        }
+    }
+    return (size_t) (end - *p) >= len ? len : SIZE_MAX;
+}
+
+/**
+ * flow_variable_record returns 1 if the record at `p` of a variable-length template is complete,
+ * or 0 if it is truncated.
+ */
+static int
+flow_variable_record(const FlowTemplate *t, uint8_t *p, const uint8_t *end)
+{
+    size_t i, len;
+
+    for (i = 0; i < t->fields_count; i++) {
+        if ((len = flow_field_len(&t->fields[i], &p, end)) == SIZE_MAX) {
+            return 0;
+        }
+        p += len;
+    }
+    return 1;
+}
+
+/**
+ * flow_data applies the plan of a template to the records of a data set.
+ */
+static void
+flow_data(IPCryptFlow *flow, const FlowTemplate *t, uint8_t *p, const uint8_t *end)
+{
+    const FlowField *f;
+    size_t           i, len;
+
+    if (!t->variable) {
+        for (; (size_t) (end - p) >= t->record_len; p += t->record_len) {
+            flow->stats.records++;
+            for (i = 0; i < t->fields_count; i++) {
+                f = &t->fields[i];
+                flow_add(flow, p + f->offset, f->len);
+            }
+        }
+        return;
+    }
+    // Records are checked before their addresses are collected, so that padding is never touched.
+    while ((size_t) (end - p) >= t->record_len && flow_variable_record(t, p, end)) {
+        flow->stats.records++;
+        for (i = 0; i < t->fields_count; i++) {
+            f   = &t->fields[i];
+            len = flow_field_len(f, &p, end);
+            if (f->is_address) {
+                flow_add(flow, p, len);
+            }
+            p += len;
+        }
+    }
+}
+
+static size_t
+flow_process(IPCryptFlow *flow, uint8_t *packet, size_t len, const uint8_t exporter[16],
+             int decrypt)
+{
+    static const uint8_t no_exporter[16] = { 0 };
+    const FlowTemplate  *t;
+    FlowPacket           scope;
+    size_t               header_len, pos, set_len;
+    uint16_t             set_id, template_set, options_template_set;
+
+    flow->stats.packets++;
+    flow->decrypt  = decrypt;
+    scope.exporter = exporter != NULL ? exporter : no_exporter;
+    if (len >= NETFLOW_V9_HEADER_BYTES && load16_be(packet) == NETFLOW_V9_VERSION) {
+        header_len           = NETFLOW_V9_HEADER_BYTES;
+        scope.domain         = load32_be(packet + 16);
+        template_set         = NETFLOW_V9_TEMPLATE_SET;
+        options_template_set = NETFLOW_V9_OPTIONS_TEMPLATE_SET;
+    } else if (len >= IPFIX_HEADER_BYTES && load16_be(packet) == IPFIX_VERSION &&
+               load16_be(packet + 2) == len) {
+        header_len           = IPFIX_HEADER_BYTES;
+        scope.domain         = load32_be(packet + 12);
+        template_set         = IPFIX_TEMPLATE_SET;
+        options_template_set = IPFIX_OPTIONS_TEMPLATE_SET;
+    } else {
+        flow->stats.invalid_packets++;
+        return 0;
+    }
+    scope.version = (uint8_t) load16_be(packet);
+
+    // Check the set headers first, so that invalid packets are left untouched.
+    for (pos = header_len; len - pos >= SET_HEADER_BYTES; pos += set_len) {
+        set_len = load16_be(packet + pos + 2);
+        if (set_len < SET_HEADER_BYTES || set_len > len - pos) {
+            flow->stats.invalid_packets++;
+            return 0;
+        }
+    }
+    if (pos != len && scope.version == IPFIX_VERSION) {
+        flow->stats.invalid_packets++;
+        return 0;
+    }
+
+    for (pos = header_len; len - pos >= SET_HEADER_BYTES;) {
+        set_id  = load16_be(packet + pos);
+        set_len = load16_be(packet + pos + 2);
+        if (set_id == template_set || set_id == options_template_set) {
+            flow_templates(flow, &scope, set_id, packet + pos + SET_HEADER_BYTES,
+                           packet + pos + set_len);
+        } else if (set_id >= MIN_DATA_SET_ID) {
+            if ((t = flow_find(flow, &scope, set_id)) != NULL) {
+                flow_data(flow, t, packet + pos + SET_HEADER_BYTES, packet + pos + set_len);
+            } else {
+                flow->stats.unknown_sets++;
+                if (flow->flags & IPCRYPT_FLOW_STRIP_UNKNOWN) {
+                    // Addresses collected so far are before this set, and don't move.
+                    memmove(packet + pos, packet + pos + set_len, len - pos - set_len);
+                    len -= set_len;
+                    continue;
+                }
+            }
+        }
+        pos += set_len;
+    }
+    flow_flush(flow);
+    if (scope.version == IPFIX_VERSION) {
+        store16_be(packet + 2, (uint16_t) len);
+    }
+    return len;
+}
+
+IPCryptFlow *
+ipcrypt_flow_create(IPCryptMode mode, const uint8_t *key, size_t key_len, unsigned int flags)
+{
+    IPCryptFlow *flow;
+
+    // The deterministic mode would merge distinct IPv4 addresses, see ipcrypt2_packet.h.
+    if (mode != IPCRYPT_MODE_PFX || key_len != IPCRYPT_PFX_KEYBYTES ||
+        (flags & ~IPCRYPT_FLOW_STRIP_UNKNOWN) != 0) {
+        return NULL;
+    }
+    if ((flow = (IPCryptFlow *) calloc(1, sizeof *flow)) == NULL) {
+        return NULL;
+    }
+    flow->flags = flags;
+    ipcrypt_pfx_init(&flow->ipcrypt_pfx, key);
+    return flow;
+}
+
+void
+ipcrypt_flow_destroy(IPCryptFlow *flow)
+{
+    if (flow == NULL) {
+        return;
+    }
+    ipcrypt_flow_reset(flow);
+    ipcrypt_pfx_deinit(&flow->ipcrypt_pfx);
+    free(flow);
+}
+
+size_t
+ipcrypt_flow_encrypt(IPCryptFlow *flow, uint8_t *packet, size_t len, const uint8_t exporter[16])
+{
+    return flow_process(flow, packet, len, exporter, 0);
+}
+
+size_t
+ipcrypt_flow_decrypt(IPCryptFlow *flow, uint8_t *packet, size_t len, const uint8_t exporter[16])
+{
+    return flow_process(flow, packet, len, exporter, 1);
+}
+
+void
+ipcrypt_flow_stats(const IPCryptFlow *flow, IPCryptFlowStats *stats)
+{
+    *stats = flow->stats;
+}
+
+void
+ipcrypt_flow_reset(IPCryptFlow *flow)
+{
+    FlowTemplate *t, *next;
+    size_t        i;
+
+    for (i = 0; i < FLOW_BUCKETS; i++) {
+        for (t = flow->buckets[i]; t != NULL; t = next) {
+            next = t->next;
+            free(t);
+        }
+        flow->buckets[i] = NULL;
+    }
+    flow->templates_count = 0;
+    memset(&flow->stats, 0, sizeof flow->stats);
+}
@@ -0,0 +1,570 @@
+/**
+ * Keyring for IPCrypt2.
+ *
+ * Keys are stored as pointers to immutable entries, in slots indexed by key ID.
+ * Readers never block: they announce themselves by incrementing one of two counters, selected by
+ * the parity of a global epoch, and load the slots with acquire semantics.
+ *
+ * A writer publishes a new entry by swapping a slot pointer. To reclaim an old entry, it flips the
+ * epoch, and waits for the counter of the previous parity to drop to zero. Readers that entered
+ * after the flip can only see the new pointer, so the old entry can then be erased and freed.
+ */
+
+#if defined(IPCRYPT_USDT) && defined(__linux__) && !defined(_GNU_SOURCE)
+#    define _GNU_SOURCE // clock_gettime(), used by the instrumentation hooks.
+#endif
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#    include <windows.h>
+#else
+#    include <pthread.h>
+#    include <sched.h>
+#endif
+
+#include "include/ipcrypt2_keyring.h"
+#include "ipcrypt2_stats_hooks.h"
+
+/** Cache line size, used to keep the reader counters on separate cache lines. */
+#define CACHE_LINE_BYTES 64
+
+/** Bit set in the `current` word when a key has been promoted. */
+#define CURRENT_VALID ((uint64_t) 1 << 32)
+
+#ifdef _WIN32
+typedef SRWLOCK KeyringMutex;
+
+#    define keyring_mutex_init(m)    InitializeSRWLock(m)
+#    define keyring_mutex_destroy(m) (void) (m)
+#    define keyring_mutex_lock(m)    AcquireSRWLockExclusive(m)
+#    define keyring_mutex_unlock(m)  ReleaseSRWLockExclusive(m)
+#    define keyring_yield()          SwitchToThread()
+#else
+typedef pthread_mutex_t KeyringMutex;
+
+#    define keyring_mutex_init(m)    pthread_mutex_init((m), NULL)
+#    define keyring_mutex_destroy(m) pthread_mutex_destroy(m)
+#    define keyring_mutex_lock(m)    pthread_mutex_lock(m)
+#    define keyring_mutex_unlock(m)  pthread_mutex_unlock(m)
+#    define keyring_yield()          sched_yield()
+#endif
+
+/**
+ * KeyringEntry is an expanded key. Entries are never modified once published.
+ */
+typedef struct KeyringEntry {
+    uint32_t key_id;
+    union {
+        IPCrypt    ipcrypt;
+        IPCryptPFX ipcrypt_pfx;
+        IPCryptNDX ipcrypt_ndx;
+    } ctx;
+} KeyringEntry;
+
+typedef struct KeyringReaders {
+    atomic_size_t count;
+    unsigned char padding[CACHE_LINE_BYTES - sizeof(atomic_size_t)];
+} KeyringReaders;
+
+struct IPCryptKeyring {
+    KeyringReaders           readers[2];
+    atomic_uint              epoch;
+    atomic_uint_least64_t    current;
+    _Atomic(KeyringEntry *) *slots;
+    size_t                   capacity;
+    IPCryptMode              mode;
+    KeyringMutex             write_lock;
+};
+
+/**
+ * keyring_read_lock enters a read-side critical section, and returns the epoch to pass to
+ * keyring_read_unlock(). Entries loaded from the slots remain valid until then.
+ */
+static unsigned int
+keyring_read_lock(IPCryptKeyring *keyring)
+{
+    unsigned int epoch;
+
+    for (;;) {
+        epoch = atomic_load(&keyring->epoch);
+        atomic_fetch_add(&keyring->readers[epoch & 1].count, 1);
+        // If the epoch was flipped in the meantime, the writer may not have seen our counter.
+        if (atomic_load(&keyring->epoch) == epoch) {
+            return epoch;
+        }
+        atomic_fetch_sub(&keyring->readers[epoch & 1].count, 1);
+    }
+}
+
+static void
+keyring_read_unlock(IPCryptKeyring *keyring, unsigned int epoch)
+{
+    atomic_fetch_sub_explicit(&keyring->readers[epoch & 1].count, 1, memory_order_release);
+}
+
+/**
+ * keyring_synchronize waits until all the readers that could have seen a previous value of the
+ * slots have left their critical section. Must be called with the write lock held.
+ */
+static void
+keyring_synchronize(IPCryptKeyring *keyring)
+{
+    const unsigned int epoch = atomic_fetch_add(&keyring->epoch, 1);
+
+    while (atomic_load(&keyring->readers[epoch & 1].count) != 0) {
+        keyring_yield();
+    }
+}
+
+static size_t
+keyring_key_bytes(IPCryptMode mode)
+{
+    switch (mode) {
+    case IPCRYPT_MODE_DETERMINISTIC:
+    case IPCRYPT_MODE_ND:
+        return IPCRYPT_KEYBYTES;
+    case IPCRYPT_MODE_PFX:
+        return IPCRYPT_PFX_KEYBYTES;
+    case IPCRYPT_MODE_NDX:
+        return IPCRYPT_NDX_KEYBYTES;
+    }
+    return 0;
+}
+
+static void
+keyring_entry_free(IPCryptMode mode, KeyringEntry *entry)
+{
+    if (entry == NULL) {
+        return;
+    }
+    switch (mode) {
+    case IPCRYPT_MODE_DETERMINISTIC:
+    case IPCRYPT_MODE_ND:
+        ipcrypt_deinit(&entry->ctx.ipcrypt);
+        break;
+    case IPCRYPT_MODE_PFX:
+        ipcrypt_pfx_deinit(&entry->ctx.ipcrypt_pfx);
+        break;
+    case IPCRYPT_MODE_NDX:
+        ipcrypt_ndx_deinit(&entry->ctx.ipcrypt_ndx);
+        break;
+    }
+    free(entry);
+}
+
+/**
+ * keyring_lookup returns the entry for `key_id`, or NULL if there is none.
+ * Must be called within a read-side critical section, or with the write lock held.
+ */
+static KeyringEntry *
+keyring_lookup(IPCryptKeyring *keyring, uint32_t key_id)
+{
+    KeyringEntry *entry = atomic_load_explicit(&keyring->slots[key_id % keyring->capacity],
+                                               memory_order_acquire);
+
+    if (entry == NULL || entry->key_id != key_id) {
+        return NULL;
+    }
+    return entry;
+}
+
+/**
+ * keyring_lookup_current returns the entry of the current key, or NULL if there is none.
+ * Must be called within a read-side critical section.
+ */
+static KeyringEntry *
+keyring_lookup_current(IPCryptKeyring *keyring)
+{
+    const uint64_t current = atomic_load(&keyring->current);
+
+    if (!(current & CURRENT_VALID)) {
+        return NULL;
+    }
+    return keyring_lookup(keyring, (uint32_t) current);
+}
+
+/**
+ * keyring_strided runs the ipcrypt_*_ip16_strided() function of the mode on a single field.
+ */
+static int
+keyring_strided(IPCryptMode mode, const KeyringEntry *entry, int decrypt, uint8_t *base,
+                size_t count, size_t stride, size_t field_offset, size_t field_bytes)
+{
+    const size_t offsets[1] = { field_offset };
+
+    switch (mode) {
+    case IPCRYPT_MODE_DETERMINISTIC:
+        return decrypt ? ipcrypt_decrypt_ip16_strided(&entry->ctx.ipcrypt, base, count, stride,
+                                                      offsets, 1, field_bytes)
+                       : ipcrypt_encrypt_ip16_strided(&entry->ctx.ipcrypt, base, count, stride,
+                                                      offsets, 1, field_bytes);
+    case IPCRYPT_MODE_PFX:
+        return decrypt ? ipcrypt_pfx_decrypt_ip16_strided(&entry->ctx.ipcrypt_pfx, base, count,
+                                                          stride, offsets, 1, field_bytes)
+                       : ipcrypt_pfx_encrypt_ip16_strided(&entry->ctx.ipcrypt_pfx, base, count,
+                                                          stride, offsets, 1, field_bytes);
+    case IPCRYPT_MODE_ND:
+        return decrypt ? ipcrypt_nd_decrypt_ip16_strided(&entry->ctx.ipcrypt, base, count, stride,
+                                                         offsets, 1, field_bytes)
+                       : ipcrypt_nd_encrypt_ip16_strided(&entry->ctx.ipcrypt, base, count, stride,
+                                                         offsets, 1, field_bytes);
+    case IPCRYPT_MODE_NDX:
+        return decrypt ? ipcrypt_ndx_decrypt_ip16_strided(&entry->ctx.ipcrypt_ndx, base, count,
+                                                          stride, offsets, 1, field_bytes)
+                       : ipcrypt_ndx_encrypt_ip16_strided(&entry->ctx.ipcrypt_ndx, base, count,
+                                                          stride, offsets, 1, field_bytes);
+    }
+    return -1;
+}
+
+/**
+ * keyring_check_layout checks that the key ID and the field fit within a record without
+ * overlapping, and that the field size is supported by the mode.
+ * Returns 0 if the layout is valid, or -1 otherwise.
+ */
+static int
+keyring_check_layout(IPCryptMode mode, size_t stride, size_t key_id_offset, size_t field_offset,
+                     size_t field_bytes)
+{
+    static const KeyringEntry empty_entry;
+    uint8_t                   empty_record[1];
+
+    if (key_id_offset > stride || stride - key_id_offset < sizeof(uint32_t)) {
+        return -1;
+    }
+    if (key_id_offset < field_offset + field_bytes &&
+        field_offset < key_id_offset + sizeof(uint32_t)) {
+        return -1;
+    }
+    // An empty batch only validates the field.
+    return keyring_strided(mode, &empty_entry, 0, empty_record, 0, stride, field_offset,
+                           field_bytes);
+}
+
+IPCryptKeyring *
+ipcrypt_keyring_create(IPCryptMode mode, size_t capacity)
+{
+    IPCryptKeyring *keyring;
+    size_t          i;
+
+    if (keyring_key_bytes(mode) == 0 || capacity == 0) {
+        return NULL;
+    }
+    if ((keyring = (IPCryptKeyring *) calloc(1, sizeof *keyring)) == NULL) {
+        return NULL;
+    }
+    if ((keyring->slots = calloc(capacity, sizeof *keyring->slots)) == NULL) {
+        free(keyring);
+        return NULL;
+    }
+    for (i = 0; i < capacity; i++) {
+        atomic_init(&keyring->slots[i], NULL);
+    }
+    atomic_init(&keyring->readers[0].count, 0);
+    atomic_init(&keyring->readers[1].count, 0);
+    atomic_init(&keyring->epoch, 0);
+    atomic_init(&keyring->current, 0);
+    keyring->capacity = capacity;
+    keyring->mode     = mode;
+    keyring_mutex_init(&keyring->write_lock);
+
+    return keyring;
+}
+
+void
+ipcrypt_keyring_destroy(IPCryptKeyring *keyring)
+{
+    size_t i;
+
+    if (keyring == NULL) {
+        return;
+    }
+    for (i = 0; i < keyring->capacity; i++) {
+        keyring_entry_free(keyring->mode, atomic_load(&keyring->slots[i]));
+    }
+    keyring_mutex_destroy(&keyring->write_lock);
+    free(keyring->slots);
+    free(keyring);
+}
+
+IPCryptMode
+ipcrypt_keyring_mode(const IPCryptKeyring *keyring)
+{
+    return keyring->mode;
+}
+
+/**
+ * keyring_publish stores a new entry in its slot, replacing the entry with the same key ID.
+ * The entry is freed on error.
+ * Returns 0 on success, or -1 if the slot is used by a different key ID.
+ */
+static int
+keyring_publish(IPCryptKeyring *keyring, KeyringEntry *entry)
+{
+    const uint32_t key_id = entry->key_id;
+    KeyringEntry  *old;
+
+    keyring_mutex_lock(&keyring->write_lock);
+    old = atomic_load(&keyring->slots[key_id % keyring->capacity]);
+    if (old != NULL && old->key_id != key_id) {
+        keyring_mutex_unlock(&keyring->write_lock);
+        keyring_entry_free(keyring->mode, entry);
+        return -1;
+    }
+    atomic_store_explicit(&keyring->slots[key_id % keyring->capacity], entry,
+                          memory_order_release);
+    if (old != NULL) {
+        keyring_synchronize(keyring);
+        keyring_entry_free(keyring->mode, old);
+    }
+    keyring_mutex_unlock(&keyring->write_lock);
+
+    return 0;
+}
+
+int
+ipcrypt_keyring_add(IPCryptKeyring *keyring, uint32_t key_id, const uint8_t *key, size_t key_len)
+{
+    KeyringEntry *entry;
+
+    if (key_len != keyring_key_bytes(keyring->mode)) {
+        return -1;
+    }
+    // Expand the key before taking the lock; readers never see a partially initialized entry.
+    if ((entry = (KeyringEntry *) calloc(1, sizeof *entry)) == NULL) {
+        return -1;
+    }
+    entry->key_id = key_id;
+    switch (keyring->mode) {
+    case IPCRYPT_MODE_DETERMINISTIC:
+    case IPCRYPT_MODE_ND:
+        ipcrypt_init(&entry->ctx.ipcrypt, key);
+        break;
+    case IPCRYPT_MODE_PFX:
+        ipcrypt_pfx_init(&entry->ctx.ipcrypt_pfx, key);
+        break;
+    case IPCRYPT_MODE_NDX:
+        ipcrypt_ndx_init(&entry->ctx.ipcrypt_ndx, key);
+        break;
+    }
+    return keyring_publish(keyring, entry);
+}
+
+int
+ipcrypt_keyring_add_context(IPCryptKeyring *keyring, uint32_t key_id, const void *ctx)
+{
+    KeyringEntry *entry;
+
+    if ((entry = (KeyringEntry *) calloc(1, sizeof *entry)) == NULL) {
+        return -1;
+    }
+    entry->key_id = key_id;
+    switch (keyring->mode) {
+    case IPCRYPT_MODE_DETERMINISTIC:
+    case IPCRYPT_MODE_ND:
+        memcpy(&entry->ctx.ipcrypt, ctx, sizeof entry->ctx.ipcrypt);
+        break;
+    case IPCRYPT_MODE_PFX:
+        memcpy(&entry->ctx.ipcrypt_pfx, ctx, sizeof entry->ctx.ipcrypt_pfx);
+        break;
+    case IPCRYPT_MODE_NDX:
+        memcpy(&entry->ctx.ipcrypt_ndx, ctx, sizeof entry->ctx.ipcrypt_ndx);
+        break;
+    }
+    return keyring_publish(keyring, entry);
+}
+
+int
+ipcrypt_keyring_remove(IPCryptKeyring *keyring, uint32_t key_id)
+{
+    KeyringEntry *old;
+
+    keyring_mutex_lock(&keyring->write_lock);
+    if ((old = keyring_lookup(keyring, key_id)) == NULL ||
+        atomic_load(&keyring->current) == (CURRENT_VALID | key_id)) {
+        keyring_mutex_unlock(&keyring->write_lock);
+        return -1;
+    }
+    atomic_store(&keyring->slots[key_id % keyring->capacity], NULL);
+    keyring_synchronize(keyring);
+    keyring_entry_free(keyring->mode, old);
+    keyring_mutex_unlock(&keyring->write_lock);
+
+    return 0;
+}
+
+int
+ipcrypt_keyring_promote(IPCryptKeyring *keyring, uint32_t key_id)
+{
+    int ret = -1;
+
+    keyring_mutex_lock(&keyring->write_lock);
+    if (keyring_lookup(keyring, key_id) != NULL) {
+        atomic_store(&keyring->current, CURRENT_VALID | key_id);
+        ret = 0;
+    }
+    keyring_mutex_unlock(&keyring->write_lock);
+
+    return ret;
+}
+
+int
+ipcrypt_keyring_current(IPCryptKeyring *keyring, uint32_t *key_id)
+{
+    const uint64_t current = atomic_load(&keyring->current);
+
+    if (!(current & CURRENT_VALID)) {
+        return -1;
+    }
+    *key_id = (uint32_t) current;
+
+    return 0;
+}
+
+size_t
+ipcrypt_keyring_encrypt_ip_str(IPCryptKeyring *keyring, uint32_t *key_id,
+                               char        encrypted_ip_str[IPCRYPT_NDX_NDIP_STR_BYTES],
+                               const char *ip_str, const uint8_t *random)
+{
+    const KeyringEntry *entry;
+    size_t              len = 0;
+    unsigned int        epoch;
+
+    epoch = keyring_read_lock(keyring);
+    entry = keyring_lookup_current(keyring);
+    STATS_KEYRING_LOOKUP(entry != NULL);
+    if (entry != NULL) {
+        *key_id = entry->key_id;
+        switch (keyring->mode) {
+        case IPCRYPT_MODE_DETERMINISTIC:
+            len = ipcrypt_encrypt_ip_str(&entry->ctx.ipcrypt, encrypted_ip_str, ip_str);
+            break;
+        case IPCRYPT_MODE_PFX:
+            len = ipcrypt_pfx_encrypt_ip_str(&entry->ctx.ipcrypt_pfx, encrypted_ip_str, ip_str);
+            break;
+        case IPCRYPT_MODE_ND:
+            if (random != NULL) {
+                len = ipcrypt_nd_encrypt_ip_str(&entry->ctx.ipcrypt, encrypted_ip_str, ip_str,
+                                                random);
+            }
+            break;
+        case IPCRYPT_MODE_NDX:
+            if (random != NULL) {
+                len = ipcrypt_ndx_encrypt_ip_str(&entry->ctx.ipcrypt_ndx, encrypted_ip_str,
+                                                 ip_str, random);
+            }
+            break;
+        }
+    }
+    keyring_read_unlock(keyring, epoch);
+
+    return len;
+}
+
+size_t
+ipcrypt_keyring_decrypt_ip_str(IPCryptKeyring *keyring, uint32_t key_id,
+                               char        ip_str[IPCRYPT_MAX_IP_STR_BYTES],
+                               const char *encrypted_ip_str)
+{
+    const KeyringEntry *entry;
+    size_t              len = 0;
+    unsigned int        epoch;
+
+    epoch = keyring_read_lock(keyring);
+    entry = keyring_lookup(keyring, key_id);
+    STATS_KEYRING_LOOKUP(entry != NULL);
+    if (entry != NULL) {
+        switch (keyring->mode) {
+        case IPCRYPT_MODE_DETERMINISTIC:
+            len = ipcrypt_decrypt_ip_str(&entry->ctx.ipcrypt, ip_str, encrypted_ip_str);
+            break;
+        case IPCRYPT_MODE_PFX:
+            len = ipcrypt_pfx_decrypt_ip_str(&entry->ctx.ipcrypt_pfx, ip_str, encrypted_ip_str);
+            break;
+        case IPCRYPT_MODE_ND:
+            len = ipcrypt_nd_decrypt_ip_str(&entry->ctx.ipcrypt, ip_str, encrypted_ip_str);
+            break;
+        case IPCRYPT_MODE_NDX:
+            len = ipcrypt_ndx_decrypt_ip_str(&entry->ctx.ipcrypt_ndx, ip_str, encrypted_ip_str);
+            break;
+        }
+    }
+    keyring_read_unlock(keyring, epoch);
+
+    return len;
+}
+
+int
+ipcrypt_keyring_encrypt_ip16_strided(IPCryptKeyring *keyring, void *base, size_t count,
+                                     size_t stride, size_t key_id_offset, size_t field_offset,
+                                     size_t field_bytes)
+{
+    uint8_t            *records = (uint8_t *) base;
+    const KeyringEntry *entry;
+    size_t              i;
+    unsigned int        epoch;
+    int                 ret = -1;
+
+    if (keyring_check_layout(keyring->mode, stride, key_id_offset, field_offset, field_bytes) !=
+        0) {
+        return -1;
+    }
+    epoch = keyring_read_lock(keyring);
+    entry = keyring_lookup_current(keyring);
+    STATS_KEYRING_LOOKUP(entry != NULL);
+    if (entry != NULL) {
+        ret = keyring_strided(keyring->mode, entry, 0, records, count, stride, field_offset,
+                              field_bytes);
+        for (i = 0; i < count; i++) {
+            memcpy(&records[i * stride + key_id_offset], &entry->key_id, sizeof entry->key_id);
+        }
+    }
+    keyring_read_unlock(keyring, epoch);
+
+    return ret;
+}
+
+int
+ipcrypt_keyring_decrypt_ip16_strided(IPCryptKeyring *keyring, void *base, size_t count,
+                                     size_t stride, size_t key_id_offset, size_t field_offset,
+                                     size_t field_bytes, size_t *skipped)
+{
+    uint8_t            *records = (uint8_t *) base;
+    const KeyringEntry *entry;
+    size_t              missing = 0;
+    size_t              i, j;
+    uint32_t            key_id, next_key_id;
+    unsigned int        epoch;
+
+    if (keyring_check_layout(keyring->mode, stride, key_id_offset, field_offset, field_bytes) !=
+        0) {
+        return -1;
+    }
+    epoch = keyring_read_lock(keyring);
+    for (i = 0; i < count; i = j) {
+        memcpy(&key_id, &records[i * stride + key_id_offset], sizeof key_id);
+        for (j = i + 1; j < count; j++) {
+            memcpy(&next_key_id, &records[j * stride + key_id_offset], sizeof next_key_id);
+            if (next_key_id != key_id) {
+                break;
+            }
+        }
+        entry = keyring_lookup(keyring, key_id);
+        STATS_KEYRING_LOOKUP(entry != NULL);
+        if (entry == NULL) {
+            missing += j - i;
+            continue;
+        }
+        (void) keyring_strided(keyring->mode, entry, 1, &records[i * stride], j - i, stride,
+                               field_offset, field_bytes);
+    }
+    keyring_read_unlock(keyring, epoch);
+    if (skipped != NULL) {
+        *skipped = missing;
+    }
+    return 0;
+}
@@ -0,0 +1,1050 @@
+/**
+ * Streaming log anonymizer for IPCrypt2.
+ *
+ * Text is scanned 16 bytes at a time with SIMD comparisons, to find anchors: digits and colons.
+ * Every IPv4 address contains a digit, and every IPv6 address contains a colon, so the bytes that
+ * are not anchors are skipped without further inspection.
+ *
+ * From an anchor, the surrounding run of characters that can appear in an address (hex digits,
+ * dots and colons) is delimited and parsed. Addresses are collected into a batch, encrypted
+ * together with the strided functions, and the output is then assembled in a single pass, copying
+ * the text between the addresses and their encrypted replacements. A batch can span multiple
+ * independent messages.
+ *
+ * When decrypting ND and NDX tokens, the text is scanned for 16-byte blocks made only of hex
+ * digits instead. A token is at least 48 characters long, so it always contains such a block at
+ * a multiple of 16 bytes from where the scan started, and the other blocks are skipped at once.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#    include <emmintrin.h>
+#    define LOG_SSE2
+#elif defined(__ARM_NEON) || defined(__aarch64__) || defined(_M_ARM64)
+#    include <arm_neon.h>
+#    define LOG_NEON
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#    include <intrin.h>
+#endif
+
+#include "include/ipcrypt2_log.h"
+
+/** Number of addresses encrypted together. */
+#define LOG_BATCH_TOKENS 256
+
+/** Maximum length of an IPv6 address, with an embedded IPv4 address. */
+#define LOG_MAX_IPV6_CHARS 45
+
+/** Minimum length of an address: "::1". */
+#define LOG_MIN_TOKEN_CHARS 3
+
+/** Maximum length of a token: a hex-encoded NDX ciphertext. */
+#define LOG_MAX_TOKEN_CHARS (IPCRYPT_NDX_NDIP_STR_BYTES - 1)
+
+/** Runs of hex digits this long that are not ND or NDX tokens are reported as invalid tokens. */
+#define LOG_MIN_HEX_RUN_CHARS 32
+
+/** Offset of the address within the field of a token. */
+#define LOG_IP16_OFFSET IPCRYPT_NDX_TWEAKBYTES
+
+/**
+ * LogToken is an address found in the input.
+ *
+ * The field holds the tweak followed by the address, in the layout expected by the strided
+ * functions of every mode: ND uses the last 8 bytes of the tweak, and the deterministic and PFX
+ * modes only the address.
+ *
+ * When the address is the host of a "host:port" pair, `host_port` is set, and the brackets around
+ * the host, if any, are part of the token. `region` is the index of the region it was found in.
+ */
+typedef struct LogToken {
+    uint8_t field[IPCRYPT_NDX_NDIP_BYTES];
+    size_t  region;
+    size_t  start;
+    size_t  len;
+    int     host_port;
+} LogToken;
+
+struct IPCryptLog {
+    IPCryptMode mode;
+    union {
+        IPCrypt    ipcrypt;
+        IPCryptPFX ipcrypt_pfx;
+        IPCryptNDX ipcrypt_ndx;
+    } ctx;
+    int                 decrypt;
+    int                 hex_tokens;
+    IPCryptLogRandomFn  random;
+    IPCryptLogInvalidFn invalid;
+    void               *opaque;
+    uint64_t            tokens_count;
+    uint64_t            invalid_count;
+    size_t              carry_len;
+    char                carry_prev;
+    char                carry[IPCRYPT_LOG_MAX_LINE_BYTES];
+    uint8_t             tweaks[LOG_BATCH_TOKENS * IPCRYPT_NDX_TWEAKBYTES];
+    LogToken            tokens[LOG_BATCH_TOKENS];
+};
+
+static inline unsigned int
+log_ctz32(uint32_t x)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long i;
+
+    _BitScanForward(&i, x);
+    return (unsigned int) i;
+#else
+    return (unsigned int) __builtin_ctz(x);
+#endif
+}
+
+static inline unsigned int
+log_ctz64(uint64_t x)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long i;
+
+    _BitScanForward64(&i, x);
+    return (unsigned int) i;
+#else
+    return (unsigned int) __builtin_ctzll(x);
+#endif
+}
+
+static inline int
+log_is_digit(int c)
+{
+    return (unsigned int) (c - '0') < 10U;
+}
+
+static inline int
+log_is_hex(int c)
+{
+    return log_is_digit(c) || (unsigned int) ((c | 0x20) - 'a') < 6U;
+}
+
+/** Characters that can appear in an address. */
+static inline int
+log_is_token_char(int c)
+{
+    return log_is_hex(c) || c == '.' || c == ':';
+}
+
+/** Characters that can appear in a word. An address must not be adjacent to them. */
+static inline int
+log_is_word_char(int c)
+{
+    return log_is_digit(c) || (unsigned int) ((c | 0x20) - 'a') < 26U || c == '_';
+}
+
+/**
+ * log_next_anchor returns the position of the first digit or colon of `in` at or after `pos`, or
+ * `len` if there is none.
+ */
+static size_t
+log_next_anchor(const char *in, size_t pos, size_t len)
+{
+#if defined(LOG_SSE2)
+    const __m128i zero  = _mm_set1_epi8('0');
+    const __m128i nine  = _mm_set1_epi8(9);
+    const __m128i colon = _mm_set1_epi8(':');
+
+    while (len - pos >= 16) {
+        const __m128i v     = _mm_loadu_si128((const __m128i *) (const void *) (in + pos));
+        const __m128i d     = _mm_sub_epi8(v, zero);
+        const __m128i digit = _mm_cmpeq_epi8(_mm_min_epu8(d, nine), d);
+        const uint32_t mask =
+            (uint32_t) _mm_movemask_epi8(_mm_or_si128(digit, _mm_cmpeq_epi8(v, colon)));
+
+        if (mask != 0) {
+            return pos + log_ctz32(mask);
+        }
+        pos += 16;
+    }
+#elif defined(LOG_NEON)
+    const uint8x16_t zero  = vdupq_n_u8('0');
+    const uint8x16_t ten   = vdupq_n_u8(10);
+    const uint8x16_t colon = vdupq_n_u8(':');
+
+    while (len - pos >= 16) {
+        const uint8x16_t v = vld1q_u8((const uint8_t *) in + pos);
+        const uint8x16_t m = vorrq_u8(vcltq_u8(vsubq_u8(v, zero), ten), vceqq_u8(v, colon));
+        // Narrow the comparison result to 4 bits per byte.
+        const uint64_t mask =
+            vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+
+        if (mask != 0) {
+            return pos + (log_ctz64(mask) >> 2);
+        }
+        pos += 16;
+    }
+#endif
+    while (pos < len && !log_is_digit(in[pos]) && in[pos] != ':') {
+        pos++;
+    }
+    return pos;
+}
+
+/**
+ * log_next_hex_block returns the position of the first block of 16 hex digits of `in`, checking
+ * blocks at `pos`, `pos + 16`, and so on. Returns `len` if there is none.
+ */
+static size_t
+log_next_hex_block(const char *in, size_t pos, size_t len)
+{
+#if defined(LOG_SSE2)
+    const __m128i zero  = _mm_set1_epi8('0');
+    const __m128i lower = _mm_set1_epi8(0x20);
+    const __m128i a     = _mm_set1_epi8('a');
+    const __m128i nine  = _mm_set1_epi8(9);
+    const __m128i five  = _mm_set1_epi8(5);
+
+    for (; len - pos >= 16; pos += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i *) (const void *) (in + pos));
+        const __m128i d = _mm_sub_epi8(v, zero);
+        const __m128i l = _mm_sub_epi8(_mm_or_si128(v, lower), a);
+        const __m128i m = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(d, nine), d),
+                                       _mm_cmpeq_epi8(_mm_min_epu8(l, five), l));
+
+        if (_mm_movemask_epi8(m) == 0xffff) {
+            return pos;
+        }
+    }
+#elif defined(LOG_NEON)
+    const uint8x16_t zero  = vdupq_n_u8('0');
+    const uint8x16_t lower = vdupq_n_u8(0x20);
+    const uint8x16_t a     = vdupq_n_u8('a');
+    const uint8x16_t ten   = vdupq_n_u8(10);
+    const uint8x16_t six   = vdupq_n_u8(6);
+
+    for (; len - pos >= 16; pos += 16) {
+        const uint8x16_t v = vld1q_u8((const uint8_t *) in + pos);
+        const uint8x16_t m = vorrq_u8(vcltq_u8(vsubq_u8(v, zero), ten),
+                                      vcltq_u8(vsubq_u8(vorrq_u8(v, lower), a), six));
+
+        if (vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0) ==
+            ~(uint64_t) 0) {
+            return pos;
+        }
+    }
+#else
+    size_t i;
+
+    for (; len - pos >= 16; pos += 16) {
+        for (i = 0; i < 16 && log_is_hex(in[pos + i]); i++) {
+        }
+        if (i == 16) {
+            return pos;
+        }
+    }
+#endif
+    return len;
+}
+
+/**
+ * log_hex_decode decodes `bin_len` bytes, a multiple of 8, from hex digits already known to be
+ * valid, in lowercase or uppercase.
+ */
+static void
+log_hex_decode(uint8_t *bin, const char *hex, size_t bin_len)
+{
+    size_t i;
+
+#if defined(LOG_SSE2)
+    const __m128i lower = _mm_set1_epi8(0x20);
+    const __m128i zero  = _mm_set1_epi8('0');
+    const __m128i nine  = _mm_set1_epi8(9);
+    const __m128i gap   = _mm_set1_epi8('a' - '0' - 10);
+    const __m128i low   = _mm_set1_epi16(0xff);
+
+    for (i = 0; i < bin_len; i += 8) {
+        const __m128i v = _mm_loadu_si128((const __m128i *) (const void *) (hex + 2 * i));
+        __m128i       n = _mm_sub_epi8(_mm_or_si128(v, lower), zero);
+
+        n = _mm_sub_epi8(n, _mm_and_si128(_mm_cmpgt_epi8(n, nine), gap));
+        // Each 16-bit lane holds the high nibble in its low byte.
+        n = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(n, low), 4), _mm_srli_epi16(n, 8));
+        _mm_storel_epi64((__m128i *) (void *) (bin + i), _mm_packus_epi16(n, n));
+    }
+#elif defined(LOG_NEON)
+    const uint8x8_t lower = vdup_n_u8(0x20);
+    const uint8x8_t zero  = vdup_n_u8('0');
+    const uint8x8_t nine  = vdup_n_u8(9);
+    const uint8x8_t gap   = vdup_n_u8('a' - '0' - 10);
+
+    for (i = 0; i < bin_len; i += 8) {
+        const uint8x8x2_t v  = vld2_u8((const uint8_t *) hex + 2 * i);
+        uint8x8_t         hi = vsub_u8(vorr_u8(v.val[0], lower), zero);
+        uint8x8_t         lo = vsub_u8(vorr_u8(v.val[1], lower), zero);
+
+        hi = vsub_u8(hi, vand_u8(vcgt_u8(hi, nine), gap));
+        lo = vsub_u8(lo, vand_u8(vcgt_u8(lo, nine), gap));
+        vst1_u8(bin + i, vorr_u8(vshl_n_u8(hi, 4), lo));
+    }
+#else
+    unsigned int c;
+    unsigned int n[2];
+    int          j;
+
+    for (i = 0; i < bin_len; i++) {
+        for (j = 0; j < 2; j++) {
+            c    = (unsigned int) (unsigned char) hex[2 * i + (size_t) j] | 0x20U;
+            n[j] = c <= '9' ? c - '0' : c - 'a' + 10U;
+        }
+        bin[i] = (uint8_t) (n[0] << 4 | n[1]);
+    }
+#endif
+}
+
+/**
+ * log_scan_hex finds the next ND or NDX token at or after `*pos`, and decodes it into `token`.
+ * Runs of hex digits of another length are reported as invalid tokens, and left untouched.
+ *
+ * Returns 1 if a token was found, or 0 otherwise. `*pos` is set to the end of the last run.
+ */
+static int
+log_scan_hex(IPCryptLog *log, LogToken *token, const char *in, size_t len, size_t *pos, int prev,
+             int next)
+{
+    const size_t token_bytes =
+        log->mode == IPCRYPT_MODE_ND ? IPCRYPT_NDIP_BYTES : IPCRYPT_NDX_NDIP_BYTES;
+    size_t start;
+    size_t end;
+
+    while ((start = log_next_hex_block(in, *pos, len)) < len) {
+        end = start + 16;
+        while (start > 0 && log_is_hex(in[start - 1])) {
+            start--;
+        }
+        while (end < len && log_is_hex(in[end])) {
+            end++;
+        }
+        *pos = end;
+        if (log_is_word_char(start > 0 ? in[start - 1] : prev) ||
+            log_is_word_char(end < len ? in[end] : next)) {
+            continue;
+        }
+        if (end - start == 2 * token_bytes) {
+            log_hex_decode(token->field + sizeof token->field - token_bytes, in + start,
+                           token_bytes);
+            token->start = start;
+            token->len   = end - start;
+            return 1;
+        }
+        if (end - start >= LOG_MIN_HEX_RUN_CHARS) {
+            log->invalid_count++;
+            if (log->invalid != NULL) {
+                log->invalid(log->opaque, in + start, end - start);
+            }
+        }
+    }
+    *pos = len;
+
+    return 0;
+}
+
+/**
+ * log_parse_ipv4 parses a dotted-quad IPv4 address at the beginning of `in`, and stores it as an
+ * IPv4-mapped address into `ip16`. Leading zeros are rejected, as with inet_pton().
+ *
+ * Returns the length of the address, or 0 if there is none.
+ */
+static size_t
+log_parse_ipv4(uint8_t ip16[16], const char *in, size_t len)
+{
+    size_t       pos = 0;
+    size_t       digits;
+    unsigned int octet;
+    int          i;
+
+    for (i = 0; i < 4; i++) {
+        if (i > 0) {
+            if (pos >= len || in[pos] != '.') {
+                return 0;
+            }
+            pos++;
+        }
+        octet = 0;
+        for (digits = 0; pos < len && digits < 3 && log_is_digit(in[pos]); digits++) {
+            octet = octet * 10 + (unsigned int) (in[pos++] - '0');
+        }
+        if (digits == 0 || octet > 255 || (digits > 1 && in[pos - digits] == '0')) {
+            return 0;
+        }
+        ip16[12 + i] = (uint8_t) octet;
+    }
+    if (pos < len && log_is_digit(in[pos])) {
+        return 0;
+    }
+    memset(ip16, 0, 10);
+    ip16[10] = 0xff;
+    ip16[11] = 0xff;
+
+    return pos;
+}
+
+static int
+log_parse_ipv6(uint8_t ip16[16], const char *in, size_t len)
+{
+    char   str[LOG_MAX_IPV6_CHARS + 1];
+    size_t colons = 0;
+    size_t dots   = 0;
+    int    elided = 0;
+    size_t i;
+
+    if (len < LOG_MIN_TOKEN_CHARS || len > LOG_MAX_IPV6_CHARS) {
+        return -1;
+    }
+    for (i = 0; i < len; i++) {
+        if (in[i] == ':') {
+            elided |= i > 0 && in[i - 1] == ':';
+            colons++;
+        } else {
+            dots += in[i] == '.';
+        }
+    }
+    // Reject times and MAC addresses before calling inet_pton(): without "::", an address has
+    // 8 groups, or 6 groups and an IPv4 address.
+    if (colons < 2 || (!elided && colons != (dots == 0 ? 7 : 6))) {
+        return -1;
+    }
+    memcpy(str, in, len);
+    str[len] = 0;
+
+    return ipcrypt_str_to_ip16(ip16, str);
+}
+
+/**
+ * log_tokenize delimits the run of address characters around the anchor at `*pos`, and checks
+ * whether it contains an address. `prev` and `next` are the characters before and after `in`.
+ *
+ * Returns 1 and fills `token` if an address was found, or 0 otherwise. `*pos` is always set to the
+ * end of the run.
+ */
+static int
+log_tokenize(LogToken *token, const char *in, size_t len, size_t *pos, int prev, int next)
+{
+    uint8_t *const ip16  = token->field + LOG_IP16_OFFSET;
+    size_t         start = *pos;
+    size_t         end   = *pos;
+    size_t         n;
+    int            left;
+    int            right;
+
+    while (start > 0 && log_is_token_char(in[start - 1])) {
+        start--;
+    }
+    while (end < len && log_is_token_char(in[end])) {
+        end++;
+    }
+    *pos  = end;
+    left  = start > 0 ? in[start - 1] : prev;
+    right = end < len ? in[end] : next;
+
+    // A single colon or trailing dots are punctuation: "client:10.0.0.1", "from 10.0.0.1."
+    if (end - start >= 2 && in[start] == ':' && in[start + 1] != ':') {
+        left = in[start++];
+    }
+    while (end > start && in[end - 1] == '.') {
+        right = in[--end];
+    }
+    if (end - start >= 2 && in[end - 1] == ':' && in[end - 2] != ':') {
+        right = in[--end];
+    }
+    if (end - start < LOG_MIN_TOKEN_CHARS || log_is_word_char(left)) {
+        return 0;
+    }
+    if (memchr(in + start, ':', end - start) == NULL) {
+        if (log_parse_ipv4(ip16, in + start, end - start) != end - start ||
+            log_is_word_char(right)) {
+            return 0;
+        }
+    } else if (log_parse_ipv6(ip16, in + start, end - start) == 0) {
+        if (log_is_word_char(right)) {
+            return 0;
+        }
+    } else if ((n = log_parse_ipv4(ip16, in + start, end - start)) != 0 && in[start + n] == ':') {
+        // IPv4 address followed by a port number.
+        end = start + n;
+    } else {
+        return 0;
+    }
+    token->start = start;
+    token->len   = end - start;
+
+    return 1;
+}
+
+/**
+ * log_host_port checks whether a token is the host of a "host:port" pair: "10.0.0.1:80",
+ * "[2001:db8::1]:80", or the same with a hex token. The brackets are then included in the token,
+ * so that they can be written only around replacements that contain colons.
+ */
+static void
+log_host_port(LogToken *token, const char *in, size_t len)
+{
+    const size_t end = token->start + token->len;
+
+    token->host_port = 0;
+    if (end + 1 >= len) {
+        return;
+    }
+    if (in[end] == ']' && in[end + 1] == ':' && token->start > 0 && in[token->start - 1] == '[') {
+        token->start--;
+        token->len += 2;
+        token->host_port = 1;
+    } else if (in[end] == ':' && log_is_token_char(in[end + 1])) {
+        token->host_port = 1;
+    }
+}
+
+/**
+ * log_scan_address finds the next address at or after `*pos`.
+ *
+ * Returns 1 and fills `token` if an address was found, or 0 otherwise. `*pos` is set to the end
+ * of the last run of address characters that was inspected.
+ */
+static int
+log_scan_address(LogToken *token, const char *in, size_t len, size_t *pos, int prev, int next)
+{
+    while ((*pos = log_next_anchor(in, *pos, len)) < len) {
+        if (log_tokenize(token, in, len, pos, prev, next)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void
+log_decrypt_tokens(IPCryptLog *log, size_t count)
+{
+    const size_t stride = sizeof(LogToken);
+    size_t       offset;
+
+    switch (log->mode) {
+    case IPCRYPT_MODE_DETERMINISTIC:
+        offset = LOG_IP16_OFFSET;
+        (void) ipcrypt_decrypt_ip16_strided(&log->ctx.ipcrypt, log->tokens, count, stride, &offset,
+                                            1, 16);
+        break;
+    case IPCRYPT_MODE_PFX:
+        offset = LOG_IP16_OFFSET;
+        (void) ipcrypt_pfx_decrypt_ip16_strided(&log->ctx.ipcrypt_pfx, log->tokens, count, stride,
+                                                &offset, 1, 16);
+        break;
+    case IPCRYPT_MODE_ND:
+        offset = LOG_IP16_OFFSET - IPCRYPT_TWEAKBYTES;
+        (void) ipcrypt_nd_decrypt_ip16_strided(&log->ctx.ipcrypt, log->tokens, count, stride,
+                                               &offset, 1, IPCRYPT_NDIP_BYTES);
+        break;
+    case IPCRYPT_MODE_NDX:
+        offset = 0;
+        (void) ipcrypt_ndx_decrypt_ip16_strided(&log->ctx.ipcrypt_ndx, log->tokens, count, stride,
+                                                &offset, 1, IPCRYPT_NDX_NDIP_BYTES);
+        break;
+    }
+}
+
+static void
+log_encrypt_tokens(IPCryptLog *log, size_t count)
+{
+    const size_t stride = sizeof(LogToken);
+    size_t       offset;
+    size_t       i;
+
+    switch (log->mode) {
+    case IPCRYPT_MODE_DETERMINISTIC:
+        offset = LOG_IP16_OFFSET;
+        (void) ipcrypt_encrypt_ip16_strided(&log->ctx.ipcrypt, log->tokens, count, stride, &offset,
+                                            1, 16);
+        break;
+    case IPCRYPT_MODE_PFX:
+        offset = LOG_IP16_OFFSET;
+        (void) ipcrypt_pfx_encrypt_ip16_strided(&log->ctx.ipcrypt_pfx, log->tokens, count, stride,
+                                                &offset, 1, 16);
+        break;
+    case IPCRYPT_MODE_ND:
+        log->random(log->opaque, log->tweaks, count * IPCRYPT_TWEAKBYTES);
+        for (i = 0; i < count; i++) {
+            memcpy(log->tokens[i].field + LOG_IP16_OFFSET - IPCRYPT_TWEAKBYTES,
+                   log->tweaks + i * IPCRYPT_TWEAKBYTES, IPCRYPT_TWEAKBYTES);
+        }
+        offset = LOG_IP16_OFFSET - IPCRYPT_TWEAKBYTES;
+        (void) ipcrypt_nd_encrypt_ip16_strided(&log->ctx.ipcrypt, log->tokens, count, stride,
+                                               &offset, 1, IPCRYPT_NDIP_BYTES);
+        break;
+    case IPCRYPT_MODE_NDX:
+        log->random(log->opaque, log->tweaks, count * IPCRYPT_NDX_TWEAKBYTES);
+        for (i = 0; i < count; i++) {
+            memcpy(log->tokens[i].field, log->tweaks + i * IPCRYPT_NDX_TWEAKBYTES,
+                   IPCRYPT_NDX_TWEAKBYTES);
+        }
+        offset = 0;
+        (void) ipcrypt_ndx_encrypt_ip16_strided(&log->ctx.ipcrypt_ndx, log->tokens, count, stride,
+                                                &offset, 1, IPCRYPT_NDX_NDIP_BYTES);
+        break;
+    }
+}
+
+static const char log_hex_digits[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
+                                         '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
+
+static size_t
+log_format_hex(char *out, const uint8_t *bin, size_t bin_len)
+{
+    size_t i;
+
+    for (i = 0; i < bin_len; i++) {
+        out[2 * i]     = log_hex_digits[bin[i] >> 4];
+        out[2 * i + 1] = log_hex_digits[bin[i] & 0xf];
+    }
+    return 2 * bin_len;
+}
+
+/**
+ * log_format_ipv6 writes the RFC 5952 text form of an IPv6 address, as inet_ntop() does, but
+ * without formatting each group with sprintf(). Addresses starting with 5 or more zero groups,
+ * that inet_ntop() may print with an embedded IPv4 address, are left to ipcrypt_ip16_to_str().
+ */
+static size_t
+log_format_ipv6(char *out, const uint8_t ip16[16])
+{
+    char         str[IPCRYPT_MAX_IP_STR_BYTES];
+    unsigned int word;
+    size_t       len        = 0;
+    int          best_start = -1;
+    int          best_len   = 1;
+    int          run_len    = 0;
+    int          shift;
+    int          i;
+
+    // Find the first longest run of at least two zero groups.
+    for (i = 0; i < 8; i++) {
+        if ((ip16[2 * i] | ip16[2 * i + 1]) != 0) {
+            run_len = 0;
+        } else if (++run_len > best_len) {
+            best_len   = run_len;
+            best_start = i + 1 - run_len;
+        }
+    }
+    if (best_start == 0 && best_len >= 5) {
+        len = ipcrypt_ip16_to_str(str, ip16);
+        memcpy(out, str, len);
+        return len;
+    }
+    for (i = 0; i < 8; i++) {
+        if (best_start >= 0 && i >= best_start && i < best_start + best_len) {
+            if (i == best_start) {
+                out[len++] = ':';
+            }
+            continue;
+        }
+        if (i != 0) {
+            out[len++] = ':';
+        }
+        word = (unsigned int) ip16[2 * i] << 8 | ip16[2 * i + 1];
+        for (shift = 12; shift > 0 && (word >> shift) == 0; shift -= 4) {
+        }
+        for (; shift >= 0; shift -= 4) {
+            out[len++] = log_hex_digits[(word >> shift) & 0xf];
+        }
+    }
+    if (best_start >= 0 && best_start + best_len == 8) {
+        out[len++] = ':';
+    }
+    return len;
+}
+
+/**
+ * log_format_ip writes the text form of an address, without a terminating NUL.
+ */
+static size_t
+log_format_ip(char *out, const uint8_t ip16[16])
+{
+    static const uint8_t ipv4_mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+    size_t               len             = 0;
+    unsigned int         octet;
+    int                  i;
+
+    if (memcmp(ip16, ipv4_mapped, sizeof ipv4_mapped) != 0) {
+        return log_format_ipv6(out, ip16);
+    }
+    for (i = 12; i < 16; i++) {
+        octet = ip16[i];
+        if (octet >= 100) {
+            out[len++] = (char) ('0' + octet / 100);
+        }
+        if (octet >= 10) {
+            out[len++] = (char) ('0' + octet / 10 % 10);
+        }
+        out[len++] = (char) ('0' + octet % 10);
+        out[len++] = '.';
+    }
+    return len - 1;
+}
+
+static size_t
+log_format_replacement(const IPCryptLog *log, char *out, const LogToken *token)
+{
+    if (log->decrypt) {
+        return log_format_ip(out, token->field + LOG_IP16_OFFSET);
+    }
+    switch (log->mode) {
+    case IPCRYPT_MODE_ND:
+        return log_format_hex(out, token->field + LOG_IP16_OFFSET - IPCRYPT_TWEAKBYTES,
+                              IPCRYPT_NDIP_BYTES);
+    case IPCRYPT_MODE_NDX:
+        return log_format_hex(out, token->field, IPCRYPT_NDX_NDIP_BYTES);
+    default:
+        return log_format_ip(out, token->field + LOG_IP16_OFFSET);
+    }
+}
+
+/**
+ * log_format_token writes the replacement of a token. The host of a "host:port" pair is written
+ * within brackets if it contains colons, as "[2001:db8::1]:80", and without brackets otherwise, as
+ * "10.0.0.1:80", so that an IPv4 address encrypted as an IPv6 address can still be found and
+ * decrypted.
+ */
+static size_t
+log_format_token(const IPCryptLog *log, char *out, const LogToken *token)
+{
+    size_t len;
+
+    if (!token->host_port) {
+        return log_format_replacement(log, out, token);
+    }
+    len = log_format_replacement(log, out + 1, token);
+    if (memchr(out + 1, ':', len) == NULL) {
+        memmove(out, out + 1, len);
+        return len;
+    }
+    out[0]       = '[';
+    out[len + 1] = ']';
+
+    return len + 2;
+}
+
+/**
+ * log_process_regions processes `regions` independent texts that don't end in the middle of a
+ * token. `prev` and `next` are the characters before and after every region. The tokens of all the
+ * regions are collected into the same batches, so that short regions, such as datagrams, are not
+ * encrypted a few addresses at a time.
+ *
+ * The number of bytes written to `outs[i]` is stored into `out_lens[i]`.
+ */
+static void
+log_process_regions(IPCryptLog *log, char *const *outs, size_t *out_lens, const char *const *ins,
+                    const size_t *lens, size_t regions, int prev, int next)
+{
+    size_t scan    = 0;
+    size_t pos     = 0;
+    size_t emit    = 0;
+    size_t written = 0;
+    size_t copied  = 0;
+    size_t count;
+    size_t i;
+
+    while (scan < regions) {
+        count = 0;
+        while (count < LOG_BATCH_TOKENS && scan < regions) {
+            LogToken *const   token = &log->tokens[count];
+            const char *const in    = ins[scan];
+            const size_t      len   = lens[scan];
+
+            if (pos >= len) {
+                scan++;
+                pos = 0;
+                continue;
+            }
+            if (log->hex_tokens ? log_scan_hex(log, token, in, len, &pos, prev, next)
+                                : log_scan_address(token, in, len, &pos, prev, next)) {
+                log_host_port(token, in, len);
+                token->region = scan;
+                count++;
+            }
+        }
+        if (count == 0) {
+            break;
+        }
+        if (log->decrypt) {
+            log_decrypt_tokens(log, count);
+        } else {
+            log_encrypt_tokens(log, count);
+        }
+        for (i = 0; i < count; i++) {
+            const LogToken *token = &log->tokens[i];
+
+            for (; emit < token->region; emit++) {
+                memcpy(outs[emit] + written, ins[emit] + copied, lens[emit] - copied);
+                out_lens[emit] = written + lens[emit] - copied;
+                written = copied = 0;
+            }
+            memcpy(outs[emit] + written, ins[emit] + copied, token->start - copied);
+            written += token->start - copied;
+            written += log_format_token(log, outs[emit] + written, token);
+            copied = token->start + token->len;
+        }
+        log->tokens_count += count;
+    }
+    for (; emit < regions; emit++) {
+        memcpy(outs[emit] + written, ins[emit] + copied, lens[emit] - copied);
+        out_lens[emit] = written + lens[emit] - copied;
+        written = copied = 0;
+    }
+}
+
+/**
+ * log_process_region processes `len` bytes of text that don't end in the middle of a token.
+ * `prev` and `next` are the characters before and after the region.
+ *
+ * Returns the number of bytes written to `out`.
+ */
+static size_t
+log_process_region(IPCryptLog *log, char *out, const char *in, size_t len, int prev, int next)
+{
+    size_t written;
+
+    log_process_regions(log, &out, &written, &in, &len, 1, prev, next);
+
+    return written;
+}
+
+/**
+ * log_carry_split processes the beginning of a full carry buffer, up to the last delimiter, and
+ * keeps the rest. Without a delimiter near the end, the whole buffer is processed; the run that
+ * was cut is then too long to be a token, and `carry_prev` ensures that its remainder isn't
+ * mistaken for one either.
+ */
+static size_t
+log_carry_split(IPCryptLog *log, char *out)
+{
+    size_t cut = log->carry_len;
+    size_t written;
+    size_t i;
+
+    for (i = log->carry_len; i > 0 && log->carry_len - i <= LOG_MAX_TOKEN_CHARS; i--) {
+        const int c = log->carry[i - 1];
+
+        if (!log_is_token_char(c) && !log_is_word_char(c)) {
+            cut = i;
+            break;
+        }
+    }
+    written = log_process_region(log, out, log->carry, cut, log->carry_prev,
+                                 cut < log->carry_len ? log->carry[cut] : '_');
+    log->carry_prev = log->carry[cut - 1];
+    memmove(log->carry, log->carry + cut, log->carry_len - cut);
+    log->carry_len -= cut;
+
+    return written;
+}
+
+static size_t
+log_carry_append(IPCryptLog *log, char *out, const char *in, size_t len)
+{
+    size_t written = 0;
+    size_t n;
+
+    while (len > 0) {
+        n = sizeof log->carry - log->carry_len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(log->carry + log->carry_len, in, n);
+        log->carry_len += n;
+        in += n;
+        len -= n;
+        if (log->carry_len == sizeof log->carry) {
+            written += log_carry_split(log, out + written);
+        }
+    }
+    return written;
+}
+
+static size_t
+log_key_bytes(IPCryptMode mode)
+{
+    switch (mode) {
+    case IPCRYPT_MODE_DETERMINISTIC:
+    case IPCRYPT_MODE_ND:
+        return IPCRYPT_KEYBYTES;
+    case IPCRYPT_MODE_PFX:
+        return IPCRYPT_PFX_KEYBYTES;
+    case IPCRYPT_MODE_NDX:
+        return IPCRYPT_NDX_KEYBYTES;
+    }
+    return 0;
+}
+
+static IPCryptLog *
+log_create(IPCryptMode mode, const uint8_t *key, size_t key_len)
+{
+    IPCryptLog *log;
+
+    if (key_len == 0 || key_len != log_key_bytes(mode)) {
+        return NULL;
+    }
+    if ((log = (IPCryptLog *) calloc(1, sizeof *log)) == NULL) {
+        return NULL;
+    }
+    switch (mode) {
+    case IPCRYPT_MODE_DETERMINISTIC:
+    case IPCRYPT_MODE_ND:
+        ipcrypt_init(&log->ctx.ipcrypt, key);
+        break;
+    case IPCRYPT_MODE_PFX:
+        ipcrypt_pfx_init(&log->ctx.ipcrypt_pfx, key);
+        break;
+    case IPCRYPT_MODE_NDX:
+        ipcrypt_ndx_init(&log->ctx.ipcrypt_ndx, key);
+        break;
+    }
+    log->mode       = mode;
+    log->carry_prev = '\n';
+
+    return log;
+}
+
+IPCryptLog *
+ipcrypt_log_create(IPCryptMode mode, const uint8_t *key, size_t key_len, IPCryptLogRandomFn random,
+                   void *opaque)
+{
+    IPCryptLog *log;
+
+    if ((mode == IPCRYPT_MODE_ND || mode == IPCRYPT_MODE_NDX) && random == NULL) {
+        return NULL;
+    }
+    if ((log = log_create(mode, key, key_len)) == NULL) {
+        return NULL;
+    }
+    log->random = random;
+    log->opaque = opaque;
+
+    return log;
+}
+
+IPCryptLog *
+ipcrypt_log_create_decryptor(IPCryptMode mode, const uint8_t *key, size_t key_len,
+                             IPCryptLogInvalidFn invalid, void *opaque)
+{
+    IPCryptLog *log;
+
+    if ((log = log_create(mode, key, key_len)) == NULL) {
+        return NULL;
+    }
+    log->decrypt    = 1;
+    log->hex_tokens = mode == IPCRYPT_MODE_ND || mode == IPCRYPT_MODE_NDX;
+    log->invalid    = invalid;
+    log->opaque     = opaque;
+
+    return log;
+}
+
+void
+ipcrypt_log_destroy(IPCryptLog *log)
+{
+    if (log == NULL) {
+        return;
+    }
+    switch (log->mode) {
+    case IPCRYPT_MODE_DETERMINISTIC:
+    case IPCRYPT_MODE_ND:
+        ipcrypt_deinit(&log->ctx.ipcrypt);
+        break;
+    case IPCRYPT_MODE_PFX:
+        ipcrypt_pfx_deinit(&log->ctx.ipcrypt_pfx);
+        break;
+    case IPCRYPT_MODE_NDX:
+        ipcrypt_ndx_deinit(&log->ctx.ipcrypt_ndx);
+        break;
+    }
+    free(log);
+}
+
+size_t
+ipcrypt_log_max_output(const IPCryptLog *log, size_t in_len)
+{
+    const size_t len = log->carry_len + in_len;
+    size_t       token_max;
+
+    if (log->decrypt) {
+        token_max = IPCRYPT_MAX_IP_STR_BYTES - 1;
+    } else if (log->mode == IPCRYPT_MODE_ND) {
+        token_max = IPCRYPT_NDIP_STR_BYTES - 1;
+    } else if (log->mode == IPCRYPT_MODE_NDX) {
+        token_max = IPCRYPT_NDX_NDIP_STR_BYTES - 1;
+    } else {
+        token_max = IPCRYPT_MAX_IP_STR_BYTES - 1;
+    }
+    // Addresses are at least 3 characters long, and separated by at least one character. Brackets
+    // are only added around IPv4 addresses, that are at least 7 characters long.
+    return len + (len / (LOG_MIN_TOKEN_CHARS + 1) + 1) * (token_max - LOG_MIN_TOKEN_CHARS);
+}
+
+size_t
+ipcrypt_log_process(IPCryptLog *log, char *out, const char *in, size_t in_len)
+{
+    const char *nl;
+    size_t      written = 0;
+    size_t      lines_len;
+
+    if (log->carry_len > 0) {
+        // Complete the carried line first.
+        if ((nl = (const char *) memchr(in, '\n', in_len)) == NULL) {
+            return log_carry_append(log, out, in, in_len);
+        }
+        lines_len = (size_t) (nl - in) + 1;
+        written += log_carry_append(log, out, in, lines_len);
+        written += log_process_region(log, out + written, log->carry, log->carry_len,
+                                      log->carry_prev, '\n');
+        log->carry_len  = 0;
+        log->carry_prev = '\n';
+        in += lines_len;
+        in_len -= lines_len;
+    }
+    // Complete lines are processed directly from the input.
+    for (lines_len = in_len; lines_len > 0 && in[lines_len - 1] != '\n'; lines_len--) {
+    }
+    written += log_process_region(log, out + written, in, lines_len, '\n', '\n');
+    written += log_carry_append(log, out + written, in + lines_len, in_len - lines_len);
+
+    return written;
+}
+
+size_t
+ipcrypt_log_finish(IPCryptLog *log, char *out)
+{
+    const size_t written =
+        log_process_region(log, out, log->carry, log->carry_len, log->carry_prev, '\n');
+
+    log->carry_len  = 0;
+    log->carry_prev = '\n';
+
+    return written;
+}
+
+void
+ipcrypt_log_process_messages(IPCryptLog *log, char *const *outs, size_t *out_lens,
+                             const char *const *ins, const size_t *in_lens, size_t count)
+{
+    log_process_regions(log, outs, out_lens, ins, in_lens, count, '\n', '\n');
+}
+
+uint64_t
+ipcrypt_log_tokens(const IPCryptLog *log)
+{
+    return log->tokens_count;
+}
+
+uint64_t
+ipcrypt_log_invalid_tokens(const IPCryptLog *log)
+{
+    return log->invalid_count;
+}
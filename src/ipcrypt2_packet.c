@@ -0,0 +1,500 @@
+/**
+ * Packet encryption for IPCrypt2.
+ *
+ * For each packet of a vector, the network and transport headers are parsed, and every address is
+ * recorded along with the checksums that cover it. Addresses are encrypted in batches with the
+ * strided functions, then written back, and the checksums are updated incrementally (RFC 1624),
+ * without reading the payload.
+ *
+ * Encapsulated packets are parsed recursively. A valid IPv4 header, ICMPv4 message or GRE packet
+ * with a checksum sums to the same value before and after its checksum is updated, so it doesn't
+ * affect the checksums that enclose it. An inner IPv6 header, and the transport checksum of an
+ * inner packet, do: their changes are also applied to the checksum of the enclosing ICMP message
+ * or GRE packet, if there is one.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/ipcrypt2_packet.h"
+
+/** Number of addresses encrypted together. */
+#define PACKET_BATCH_ADDRESSES 256
+
+/** Number of packets to prefetch ahead when walking a vector. */
+#define PACKET_PREFETCH_PACKETS 4
+
+/** Maximum number of nested encapsulations, to bound the work done on crafted packets. */
+#define PACKET_MAX_DEPTH 4
+
+#define ETHERTYPE_IPV4   0x0800
+#define ETHERTYPE_IPV6   0x86dd
+#define ETHERTYPE_TEB    0x6558
+#define ETHERTYPE_VLAN   0x8100
+#define ETHERTYPE_QINQ   0x88a8
+#define ETHERTYPE_QINQ_1 0x9100
+
+#define PROTO_HOPOPTS  0
+#define PROTO_ICMP     1
+#define PROTO_IPIP     4
+#define PROTO_TCP      6
+#define PROTO_UDP      17
+#define PROTO_IPV6     41
+#define PROTO_ROUTING  43
+#define PROTO_FRAGMENT 44
+#define PROTO_GRE      47
+#define PROTO_AH       51
+#define PROTO_ICMPV6   58
+#define PROTO_DSTOPTS  60
+
+#define GRE_FLAG_CHECKSUM 0x8000
+#define GRE_FLAG_ROUTING  0x4000
+#define GRE_FLAG_KEY      0x2000
+#define GRE_FLAG_SEQUENCE 0x1000
+#define GRE_VERSION_MASK  0x0007
+
+#if defined(__GNUC__) || defined(__clang__)
+#    define PREFETCH_RW(p) __builtin_prefetch((p), 1, 3)
+#else
+#    define PREFETCH_RW(p) (void) (p)
+#endif
+
+/**
+ * PacketAddress is an address found in a packet, along with the checksums that cover it.
+ * The copy of the address comes first, in the layout expected by the strided functions.
+ */
+typedef struct PacketAddress {
+    uint8_t  ip16[16];
+    uint8_t *addr;
+    uint8_t *ip_csum;
+    uint8_t *l4_csum;
+    uint8_t *outer_csum;
+    uint8_t  addr_len;
+    uint8_t  udp;
+} PacketAddress;
+
+struct IPCryptPacket {
+    IPCryptMode mode;
+    union {
+        IPCrypt    ipcrypt;
+        IPCryptPFX ipcrypt_pfx;
+    } ctx;
+};
+
+/**
+ * PacketBatch collects the addresses of a vector of packets, until there are enough of them to be
+ * encrypted together.
+ */
+typedef struct PacketBatch {
+    const IPCryptPacket *packet;
+    int                  decrypt;
+    size_t               count;
+    size_t               addresses;
+    PacketAddress        items[PACKET_BATCH_ADDRESSES];
+} PacketBatch;
+
+static inline unsigned int
+load16_be(const uint8_t *p)
+{
+    return (unsigned int) p[0] << 8 | p[1];
+}
+
+/**
+ * packet_csum_update updates a checksum in-place, after `len` bytes covered by it changed from
+ * `old` to `new_`. A zero UDP checksum means that there is no checksum, and is left untouched.
+ */
+static void
+packet_csum_update(uint8_t *csum, const uint8_t *old, const uint8_t *new_, size_t len, int udp)
+{
+    uint32_t sum;
+    size_t   i;
+
+    if (udp && csum[0] == 0 && csum[1] == 0) {
+        return;
+    }
+    // HC' = ~(~HC + ~m + m')
+    sum = ~load16_be(csum) & 0xffff;
+    for (i = 0; i < len; i += 2) {
+        sum += ~load16_be(old + i) & 0xffff;
+        sum += load16_be(new_ + i);
+    }
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = ~sum & 0xffff;
+    if (udp && sum == 0) {
+        sum = 0xffff;
+    }
+    csum[0] = (uint8_t) (sum >> 8);
+    csum[1] = (uint8_t) sum;
+}
+
+/**
+ * packet_flush encrypts or decrypts the collected addresses, writes them back, and updates the
+ * checksums.
+ */
+static void
+packet_flush(PacketBatch *batch)
+{
+    const IPCryptPacket *packet = batch->packet;
+    const size_t         offset = 0;
+    PacketAddress       *a;
+    const uint8_t       *new_;
+    uint8_t              old_l4_csum[2];
+    size_t               i;
+
+    if (batch->count == 0) {
+        return;
+    }
+    if (packet->mode == IPCRYPT_MODE_PFX) {
+        if (batch->decrypt) {
+            (void) ipcrypt_pfx_decrypt_ip16_strided(&packet->ctx.ipcrypt_pfx, batch->items,
+                                                    batch->count, sizeof(PacketAddress), &offset,
+                                                    1, 16);
+        } else {
+            (void) ipcrypt_pfx_encrypt_ip16_strided(&packet->ctx.ipcrypt_pfx, batch->items,
+                                                    batch->count, sizeof(PacketAddress), &offset,
+                                                    1, 16);
+        }
+    } else if (batch->decrypt) {
+        (void) ipcrypt_decrypt_ip16_strided(&packet->ctx.ipcrypt, batch->items, batch->count,
+                                            sizeof(PacketAddress), &offset, 1, 16);
+    } else {
+        (void) ipcrypt_encrypt_ip16_strided(&packet->ctx.ipcrypt, batch->items, batch->count,
+                                            sizeof(PacketAddress), &offset, 1, 16);
+    }
+    for (i = 0; i < batch->count; i++) {
+        a    = &batch->items[i];
+        new_ = a->ip16 + 16 - a->addr_len;
+        if (a->ip_csum != NULL) {
+            packet_csum_update(a->ip_csum, a->addr, new_, a->addr_len, 0);
+        } else if (a->outer_csum != NULL) {
+            // No header checksum compensates for the change of an IPv6 address.
+            packet_csum_update(a->outer_csum, a->addr, new_, a->addr_len, 0);
+        }
+        if (a->l4_csum != NULL) {
+            memcpy(old_l4_csum, a->l4_csum, sizeof old_l4_csum);
+            packet_csum_update(a->l4_csum, a->addr, new_, a->addr_len, a->udp);
+            if (a->outer_csum != NULL) {
+                packet_csum_update(a->outer_csum, old_l4_csum, a->l4_csum, 2, 0);
+            }
+        }
+        memcpy(a->addr, new_, a->addr_len);
+    }
+    batch->addresses += batch->count;
+    batch->count = 0;
+}
+
+static void
+packet_add(PacketBatch *batch, uint8_t *addr, size_t addr_len, uint8_t *ip_csum, uint8_t *l4_csum,
+           int udp, uint8_t *outer_csum)
+{
+    PacketAddress *a;
+
+    // In the deterministic mode, IPv4 addresses are not reversible.
+    if (addr_len == 4 && batch->decrypt && batch->packet->mode != IPCRYPT_MODE_PFX) {
+        return;
+    }
+    a = &batch->items[batch->count];
+    if (addr_len == 4) {
+        memset(a->ip16, 0, 10);
+        a->ip16[10] = 0xff;
+        a->ip16[11] = 0xff;
+    }
+    memcpy(a->ip16 + 16 - addr_len, addr, addr_len);
+    a->addr       = addr;
+    a->addr_len   = (uint8_t) addr_len;
+    a->ip_csum    = ip_csum;
+    a->l4_csum    = l4_csum;
+    a->outer_csum = outer_csum;
+    a->udp        = (uint8_t) udp;
+    if (++batch->count == PACKET_BATCH_ADDRESSES) {
+        packet_flush(batch);
+    }
+}
+
+/**
+ * packet_l4_csum returns the location of the checksum of a transport header that covers the
+ * addresses through a pseudo-header, or NULL if there is none or if it was not captured.
+ */
+static uint8_t *
+packet_l4_csum(uint8_t *l4, const uint8_t *end, unsigned int proto, int ipv6, int *udp)
+{
+    size_t offset;
+
+    *udp = 0;
+    if (proto == PROTO_TCP) {
+        offset = 16;
+    } else if (proto == PROTO_UDP) {
+        offset = 6;
+        *udp   = 1;
+    } else if (proto == PROTO_ICMPV6 && ipv6) {
+        offset = 2;
+    } else {
+        return NULL;
+    }
+    if ((size_t) (end - l4) < offset + 2) {
+        return NULL;
+    }
+    return l4 + offset;
+}
+
+static void packet_ip(PacketBatch *batch, uint8_t *ip, const uint8_t *end, uint8_t *outer_csum,
+                      unsigned int depth);
+
+/**
+ * packet_gre processes the packet tunneled in a GRE packet.
+ */
+static void
+packet_gre(PacketBatch *batch, uint8_t *gre, const uint8_t *end, uint8_t *outer_csum,
+           unsigned int depth)
+{
+    uint8_t     *p;
+    size_t       hlen = 4;
+    unsigned int flags, ethertype;
+
+    if (end - gre < 4) {
+        return;
+    }
+    flags = load16_be(gre);
+    if ((flags & (GRE_FLAG_ROUTING | GRE_VERSION_MASK)) != 0) {
+        return;
+    }
+    hlen += (flags & GRE_FLAG_CHECKSUM) ? 4 : 0;
+    hlen += (flags & GRE_FLAG_KEY) ? 4 : 0;
+    hlen += (flags & GRE_FLAG_SEQUENCE) ? 4 : 0;
+    if ((size_t) (end - gre) < hlen) {
+        return;
+    }
+    // A GRE checksum covers the tunneled packet, and takes over from the enclosing checksum.
+    if (flags & GRE_FLAG_CHECKSUM) {
+        outer_csum = gre + 4;
+    }
+    ethertype = load16_be(gre + 2);
+    p         = gre + hlen;
+    if (ethertype == ETHERTYPE_TEB) {
+        if (end - p < 14) {
+            return;
+        }
+        ethertype = load16_be(p + 12);
+        p += 14;
+        while ((ethertype == ETHERTYPE_VLAN || ethertype == ETHERTYPE_QINQ ||
+                ethertype == ETHERTYPE_QINQ_1) &&
+               end - p >= 4) {
+            ethertype = load16_be(p + 2);
+            p += 4;
+        }
+    }
+    if ((ethertype == ETHERTYPE_IPV4 && end - p >= 1 && (p[0] >> 4) == 4) ||
+        (ethertype == ETHERTYPE_IPV6 && end - p >= 1 && (p[0] >> 4) == 6)) {
+        packet_ip(batch, p, end, outer_csum, depth + 1);
+    }
+}
+
+/**
+ * packet_payload processes the packets encapsulated in a transport payload: tunneled packets, and
+ * packets quoted by ICMP error messages.
+ */
+static void
+packet_payload(PacketBatch *batch, uint8_t *l4, const uint8_t *end, unsigned int proto, int ipv6,
+               uint8_t *outer_csum, unsigned int depth)
+{
+    unsigned int type;
+
+    if (depth >= PACKET_MAX_DEPTH || end - l4 < 1) {
+        return;
+    }
+    switch (proto) {
+    case PROTO_IPIP:
+        if ((l4[0] >> 4) == 4) {
+            packet_ip(batch, l4, end, outer_csum, depth + 1);
+        }
+        break;
+    case PROTO_IPV6:
+        if ((l4[0] >> 4) == 6) {
+            packet_ip(batch, l4, end, outer_csum, depth + 1);
+        }
+        break;
+    case PROTO_GRE:
+        packet_gre(batch, l4, end, outer_csum, depth);
+        break;
+    case PROTO_ICMP:
+        // Destination unreachable, source quench, redirect, time exceeded, parameter problem.
+        type = l4[0];
+        if (!ipv6 && end - l4 > 8 &&
+            (type == 3 || type == 4 || type == 5 || type == 11 || type == 12)) {
+            packet_ip(batch, l4 + 8, end, l4 + 2, depth + 1);
+        }
+        break;
+    case PROTO_ICMPV6:
+        // Destination unreachable, packet too big, time exceeded, parameter problem.
+        type = l4[0];
+        if (ipv6 && end - l4 > 8 && type >= 1 && type <= 4) {
+            packet_ip(batch, l4 + 8, end, l4 + 2, depth + 1);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void
+packet_ipv4(PacketBatch *batch, uint8_t *ip, const uint8_t *end, uint8_t *outer_csum,
+            unsigned int depth)
+{
+    uint8_t     *l4_csum = NULL;
+    size_t       ihl;
+    unsigned int proto;
+    int          first_fragment;
+    int          udp = 0;
+
+    if (end - ip < 20 || (ihl = (size_t) (ip[0] & 0xf) * 4) < 20 || (size_t) (end - ip) < ihl) {
+        return;
+    }
+    proto = ip[9];
+    // Only the first fragment contains the transport header.
+    first_fragment = (load16_be(ip + 6) & 0x1fff) == 0;
+    if (first_fragment) {
+        l4_csum = packet_l4_csum(ip + ihl, end, proto, 0, &udp);
+    }
+    packet_add(batch, ip + 12, 4, ip + 10, l4_csum, udp, outer_csum);
+    packet_add(batch, ip + 16, 4, ip + 10, l4_csum, udp, outer_csum);
+    if (first_fragment) {
+        packet_payload(batch, ip + ihl, end, proto, 0, outer_csum, depth);
+    }
+}
+
+static void
+packet_ipv6(PacketBatch *batch, uint8_t *ip, const uint8_t *end, uint8_t *outer_csum,
+            unsigned int depth)
+{
+    uint8_t     *l4_csum = NULL;
+    uint8_t     *h;
+    size_t       hlen;
+    unsigned int next;
+    int          l4_found = 0;
+    int          udp      = 0;
+
+    if (end - ip < 40) {
+        return;
+    }
+    next = ip[6];
+    h    = ip + 40;
+    for (;;) {
+        if (next == PROTO_HOPOPTS || next == PROTO_ROUTING || next == PROTO_DSTOPTS) {
+            hlen = end - h >= 2 ? ((size_t) h[1] + 1) * 8 : 0;
+        } else if (next == PROTO_AH) {
+            hlen = end - h >= 2 ? ((size_t) h[1] + 2) * 4 : 0;
+        } else if (next == PROTO_FRAGMENT) {
+            // Only the first fragment contains the transport header.
+            hlen = end - h >= 8 && (load16_be(h + 2) & 0xfff8) == 0 ? 8 : 0;
+        } else {
+            l4_csum  = packet_l4_csum(h, end, next, 1, &udp);
+            l4_found = 1;
+            break;
+        }
+        if (hlen == 0 || (size_t) (end - h) < hlen) {
+            break;
+        }
+        next = h[0];
+        h += hlen;
+    }
+    packet_add(batch, ip + 8, 16, NULL, l4_csum, udp, outer_csum);
+    packet_add(batch, ip + 24, 16, NULL, l4_csum, udp, outer_csum);
+    if (l4_found) {
+        packet_payload(batch, h, end, next, 1, outer_csum, depth);
+    }
+}
+
+/**
+ * packet_ip records the addresses of an IPv4 or IPv6 packet, and of the packets it encapsulates.
+ * `outer_csum` is the checksum of the enclosing ICMP message or GRE packet, or NULL.
+ */
+static void
+packet_ip(PacketBatch *batch, uint8_t *ip, const uint8_t *end, uint8_t *outer_csum,
+          unsigned int depth)
+{
+    if (end - ip < 1) {
+        return;
+    }
+    if ((ip[0] >> 4) == 4) {
+        packet_ipv4(batch, ip, end, outer_csum, depth);
+    } else if ((ip[0] >> 4) == 6) {
+        packet_ipv6(batch, ip, end, outer_csum, depth);
+    }
+}
+
+static size_t
+packet_process(const IPCryptPacket *packet, uint8_t *const *packets, const size_t *lengths,
+               const size_t *l3_offsets, size_t count, int decrypt)
+{
+    PacketBatch batch;
+    size_t      i, j, l3_offset;
+
+    batch.packet    = packet;
+    batch.decrypt   = decrypt;
+    batch.count     = 0;
+    batch.addresses = 0;
+    for (i = 0; i < count; i++) {
+        if (i + PACKET_PREFETCH_PACKETS < count) {
+            j = i + PACKET_PREFETCH_PACKETS;
+            PREFETCH_RW(packets[j] + (l3_offsets != NULL ? l3_offsets[j] : 0));
+        }
+        l3_offset = l3_offsets != NULL ? l3_offsets[i] : 0;
+        if (l3_offset < lengths[i]) {
+            packet_ip(&batch, packets[i] + l3_offset, packets[i] + lengths[i], NULL, 0);
+        }
+    }
+    packet_flush(&batch);
+
+    return batch.addresses;
+}
+
+IPCryptPacket *
+ipcrypt_packet_create(IPCryptMode mode, const uint8_t *key, size_t key_len)
+{
+    IPCryptPacket *packet;
+
+    if (!(mode == IPCRYPT_MODE_PFX && key_len == IPCRYPT_PFX_KEYBYTES) &&
+        !(mode == IPCRYPT_MODE_DETERMINISTIC && key_len == IPCRYPT_KEYBYTES)) {
+        return NULL;
+    }
+    if ((packet = (IPCryptPacket *) calloc(1, sizeof *packet)) == NULL) {
+        return NULL;
+    }
+    packet->mode = mode;
+    if (mode == IPCRYPT_MODE_PFX) {
+        ipcrypt_pfx_init(&packet->ctx.ipcrypt_pfx, key);
+    } else {
+        ipcrypt_init(&packet->ctx.ipcrypt, key);
+    }
+    return packet;
+}
+
+void
+ipcrypt_packet_destroy(IPCryptPacket *packet)
+{
+    if (packet == NULL) {
+        return;
+    }
+    if (packet->mode == IPCRYPT_MODE_PFX) {
+        ipcrypt_pfx_deinit(&packet->ctx.ipcrypt_pfx);
+    } else {
+        ipcrypt_deinit(&packet->ctx.ipcrypt);
+    }
+    free(packet);
+}
+
+size_t
+ipcrypt_packet_encrypt(const IPCryptPacket *packet, uint8_t *const *packets,
+                       const size_t *lengths, const size_t *l3_offsets, size_t count)
+{
+    return packet_process(packet, packets, lengths, l3_offsets, count, 0);
+}
+
+size_t
+ipcrypt_packet_decrypt(const IPCryptPacket *packet, uint8_t *const *packets,
+                       const size_t *lengths, const size_t *l3_offsets, size_t count)
+{
+    return packet_process(packet, packets, lengths, l3_offsets, count, 1);
+}
@@ -0,0 +1,311 @@
+/**
+ * Packet capture anonymizer for IPCrypt2.
+ *
+ * The record headers of the capture are walked once, to build an index of the packets. The index
+ * is then split into chunks, processed in parallel by a thread pool.
+ *
+ * For each packet, the link header is parsed to find the network header. Packets are then passed
+ * in vectors to the packet encryption functions, that rewrite the addresses and the checksums.
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/ipcrypt2_packet.h"
+#include "include/ipcrypt2_pcap.h"
+
+/** Number of packets passed together to the packet encryption functions. */
+#define PCAP_VECTOR_PACKETS 256
+
+#define PCAP_GLOBAL_HEADER_BYTES 24
+#define PCAP_RECORD_HEADER_BYTES 16
+
+#define PCAP_MAGIC_USEC 0xa1b2c3d4U
+#define PCAP_MAGIC_NSEC 0xa1b23c4dU
+
+#define LINKTYPE_ETHERNET   1
+#define LINKTYPE_RAW        101
+#define LINKTYPE_LINUX_SLL  113
+#define LINKTYPE_IPV4       228
+#define LINKTYPE_IPV6       229
+#define LINKTYPE_LINUX_SLL2 276
+
+#define ETHERTYPE_IPV4   0x0800
+#define ETHERTYPE_IPV6   0x86dd
+#define ETHERTYPE_VLAN   0x8100
+#define ETHERTYPE_QINQ   0x88a8
+#define ETHERTYPE_QINQ_1 0x9100
+
+/**
+ * PcapPacket locates a packet within the capture.
+ */
+typedef struct PcapPacket {
+    uint64_t offset;
+    uint64_t caplen;
+} PcapPacket;
+
+struct IPCryptPcap {
+    IPCryptPacket *packet;
+};
+
+/**
+ * PcapJob is a pass over the packets of a capture, shared by the workers of the pool.
+ */
+typedef struct PcapJob {
+    const IPCryptPcap    *pcap;
+    uint8_t              *data;
+    uint32_t              linktype;
+    int                   decrypt;
+    atomic_uint_least64_t ip_packets;
+    atomic_uint_least64_t addresses;
+} PcapJob;
+
+static inline unsigned int
+load16_be(const uint8_t *p)
+{
+    return (unsigned int) p[0] << 8 | p[1];
+}
+
+static inline uint32_t
+load32(const uint8_t *p, int swap)
+{
+    uint32_t x;
+
+    memcpy(&x, p, sizeof x);
+    if (swap) {
+        x = (x >> 24) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000) | (x << 24);
+    }
+    return x;
+}
+
+/**
+ * pcap_l3_offset parses the link header of a packet, and stores the offset of its network header
+ * into `l3_offset`. Returns 1 if the packet is an IPv4 or IPv6 packet, or 0 otherwise.
+ */
+static int
+pcap_l3_offset(uint32_t linktype, const uint8_t *pkt, size_t caplen, size_t *l3_offset)
+{
+    size_t       offset;
+    unsigned int ethertype;
+
+    switch (linktype) {
+    case LINKTYPE_ETHERNET:
+        if (caplen < 14) {
+            return 0;
+        }
+        ethertype = load16_be(pkt + 12);
+        offset    = 14;
+        while ((ethertype == ETHERTYPE_VLAN || ethertype == ETHERTYPE_QINQ ||
+                ethertype == ETHERTYPE_QINQ_1) &&
+               caplen - offset >= 4) {
+            ethertype = load16_be(pkt + offset + 2);
+            offset += 4;
+        }
+        break;
+    case LINKTYPE_LINUX_SLL:
+        if (caplen < 16) {
+            return 0;
+        }
+        ethertype = load16_be(pkt + 14);
+        offset    = 16;
+        break;
+    case LINKTYPE_LINUX_SLL2:
+        if (caplen < 20) {
+            return 0;
+        }
+        ethertype = load16_be(pkt);
+        offset    = 20;
+        break;
+    case LINKTYPE_RAW:
+    case LINKTYPE_IPV4:
+    case LINKTYPE_IPV6:
+        if (caplen < 1) {
+            return 0;
+        }
+        ethertype = (pkt[0] >> 4) == 6 ? ETHERTYPE_IPV6 : ETHERTYPE_IPV4;
+        offset    = 0;
+        break;
+    default:
+        return 0;
+    }
+    if (offset >= caplen) {
+        return 0;
+    }
+    if ((ethertype == ETHERTYPE_IPV4 && (pkt[offset] >> 4) == 4) ||
+        (ethertype == ETHERTYPE_IPV6 && (pkt[offset] >> 4) == 6)) {
+        *l3_offset = offset;
+        return 1;
+    }
+    return 0;
+}
+
+static size_t
+pcap_vector(const PcapJob *job, uint8_t *const *packets, const size_t *lengths,
+            const size_t *l3_offsets, size_t count)
+{
+    if (job->decrypt) {
+        return ipcrypt_packet_decrypt(job->pcap->packet, packets, lengths, l3_offsets, count);
+    }
+    return ipcrypt_packet_encrypt(job->pcap->packet, packets, lengths, l3_offsets, count);
+}
+
+/**
+ * pcap_chunk processes a chunk of the packet index. Called by the workers of the pool.
+ */
+static void
+pcap_chunk(void *ctx, void *base, size_t count, size_t stride)
+{
+    PcapJob *const          job     = (PcapJob *) ctx;
+    const PcapPacket *const packets = (const PcapPacket *) base;
+    uint8_t                *vector[PCAP_VECTOR_PACKETS];
+    size_t                  lengths[PCAP_VECTOR_PACKETS];
+    size_t                  l3_offsets[PCAP_VECTOR_PACKETS];
+    uint64_t                ip_packets = 0;
+    uint64_t                addresses  = 0;
+    size_t                  i, n = 0;
+
+    (void) stride;
+    for (i = 0; i < count; i++) {
+        vector[n]  = job->data + packets[i].offset;
+        lengths[n] = (size_t) packets[i].caplen;
+        if (!pcap_l3_offset(job->linktype, vector[n], lengths[n], &l3_offsets[n])) {
+            continue;
+        }
+        ip_packets++;
+        if (++n == PCAP_VECTOR_PACKETS) {
+            addresses += pcap_vector(job, vector, lengths, l3_offsets, n);
+            n = 0;
+        }
+    }
+    addresses += pcap_vector(job, vector, lengths, l3_offsets, n);
+    atomic_fetch_add(&job->ip_packets, ip_packets);
+    atomic_fetch_add(&job->addresses, addresses);
+}
+
+/**
+ * pcap_index parses the global header, and stores the location of every complete packet into a
+ * newly allocated array. Returns 0 on success, or -1 on error.
+ */
+static int
+pcap_index(const uint8_t *data, size_t len, uint32_t *linktype, PcapPacket **packets,
+           size_t *count)
+{
+    PcapPacket *tmp;
+    size_t      capacity = 0;
+    size_t      pos;
+    uint64_t    caplen;
+    uint32_t    magic;
+    int         swap;
+
+    *packets = NULL;
+    *count   = 0;
+    if (len < PCAP_GLOBAL_HEADER_BYTES) {
+        return -1;
+    }
+    magic = load32(data, 0);
+    if (magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC) {
+        swap = 0;
+    } else if (load32(data, 1) == PCAP_MAGIC_USEC || load32(data, 1) == PCAP_MAGIC_NSEC) {
+        swap = 1;
+    } else {
+        return -1;
+    }
+    // The upper bits of the link type field may hold FCS information.
+    *linktype = load32(data + 20, swap) & 0xffff;
+
+    for (pos = PCAP_GLOBAL_HEADER_BYTES; len - pos >= PCAP_RECORD_HEADER_BYTES;) {
+        caplen = load32(data + pos + 8, swap);
+        if (len - pos - PCAP_RECORD_HEADER_BYTES < caplen) {
+            break;
+        }
+        if (*count == capacity) {
+            capacity = capacity == 0 ? 1024 : capacity * 2;
+            if ((tmp = (PcapPacket *) realloc(*packets, capacity * sizeof *tmp)) == NULL) {
+                free(*packets);
+                *packets = NULL;
+                return -1;
+            }
+            *packets = tmp;
+        }
+        (*packets)[*count].offset = pos + PCAP_RECORD_HEADER_BYTES;
+        (*packets)[*count].caplen = caplen;
+        (*count)++;
+        pos += PCAP_RECORD_HEADER_BYTES + (size_t) caplen;
+    }
+    return 0;
+}
+
+static int
+pcap_process(const IPCryptPcap *pcap, IPCryptPool *pool, void *data, size_t len,
+             IPCryptPcapStats *stats, int decrypt)
+{
+    PcapJob     job;
+    PcapPacket *packets;
+    size_t      count;
+
+    if (pcap_index((const uint8_t *) data, len, &job.linktype, &packets, &count) != 0) {
+        return -1;
+    }
+    job.pcap    = pcap;
+    job.data    = (uint8_t *) data;
+    job.decrypt = decrypt;
+    atomic_init(&job.ip_packets, 0);
+    atomic_init(&job.addresses, 0);
+    if (pool != NULL) {
+        (void) ipcrypt_pool_for_each(pool, pcap_chunk, &job, packets, count, sizeof *packets);
+    } else if (count > 0) {
+        pcap_chunk(&job, packets, count, sizeof *packets);
+    }
+    free(packets);
+    if (stats != NULL) {
+        stats->packets    = count;
+        stats->ip_packets = atomic_load(&job.ip_packets);
+        stats->addresses  = atomic_load(&job.addresses);
+    }
+    return 0;
+}
+
+IPCryptPcap *
+ipcrypt_pcap_create(IPCryptMode mode, const uint8_t *key, size_t key_len)
+{
+    IPCryptPcap *pcap;
+
+    // The deterministic mode would merge distinct IPv4 addresses, see ipcrypt2_packet.h.
+    if (mode != IPCRYPT_MODE_PFX) {
+        return NULL;
+    }
+    if ((pcap = (IPCryptPcap *) calloc(1, sizeof *pcap)) == NULL) {
+        return NULL;
+    }
+    if ((pcap->packet = ipcrypt_packet_create(mode, key, key_len)) == NULL) {
+        free(pcap);
+        return NULL;
+    }
+    return pcap;
+}
+
+void
+ipcrypt_pcap_destroy(IPCryptPcap *pcap)
+{
+    if (pcap == NULL) {
+        return;
+    }
+    ipcrypt_packet_destroy(pcap->packet);
+    free(pcap);
+}
+
+int
+ipcrypt_pcap_encrypt(const IPCryptPcap *pcap, IPCryptPool *pool, void *data, size_t len,
+                     IPCryptPcapStats *stats)
+{
+    return pcap_process(pcap, pool, data, len, stats, 0);
+}
+
+int
+ipcrypt_pcap_decrypt(const IPCryptPcap *pcap, IPCryptPool *pool, void *data, size_t len,
+                     IPCryptPcapStats *stats)
+{
+    return pcap_process(pcap, pool, data, len, stats, 1);
+}
@@ -0,0 +1,481 @@
+/**
+ * Thread pool for IPCrypt2.
+ *
+ * Splits batch jobs into cache-sized chunks of records, and distributes them across workers.
+ * Each worker owns a range of chunks, that it consumes from the front. Workers that run out of
+ * chunks steal the second half of the remaining range of another worker.
+ *
+ * Contexts are read-only and shared; every chunk is processed by the single-threaded
+ * ipcrypt_*_ip16_strided() functions.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#    include <windows.h>
+#else
+#    include <pthread.h>
+#    include <unistd.h>
+#endif
+
+#include "include/ipcrypt2_pool.h"
+
+/** Cache line size, used to keep per-worker state on separate cache lines. */
+#define CACHE_LINE_BYTES 64
+
+#ifdef _WIN32
+typedef SRWLOCK            PoolMutex;
+typedef CONDITION_VARIABLE PoolCond;
+typedef HANDLE             PoolThread;
+
+#    define pool_mutex_init(m)     InitializeSRWLock(m)
+#    define pool_mutex_destroy(m)  (void) (m)
+#    define pool_mutex_lock(m)     AcquireSRWLockExclusive(m)
+#    define pool_mutex_unlock(m)   ReleaseSRWLockExclusive(m)
+#    define pool_cond_init(c)      InitializeConditionVariable(c)
+#    define pool_cond_destroy(c)   (void) (c)
+#    define pool_cond_wait(c, m)   SleepConditionVariableSRW((c), (m), INFINITE, 0)
+#    define pool_cond_broadcast(c) WakeAllConditionVariable(c)
+#    define pool_cond_signal(c)    WakeConditionVariable(c)
+#else
+typedef pthread_mutex_t PoolMutex;
+typedef pthread_cond_t  PoolCond;
+typedef pthread_t       PoolThread;
+
+#    define pool_mutex_init(m)     pthread_mutex_init((m), NULL)
+#    define pool_mutex_destroy(m)  pthread_mutex_destroy(m)
+#    define pool_mutex_lock(m)     pthread_mutex_lock(m)
+#    define pool_mutex_unlock(m)   pthread_mutex_unlock(m)
+#    define pool_cond_init(c)      pthread_cond_init((c), NULL)
+#    define pool_cond_destroy(c)   pthread_cond_destroy(c)
+#    define pool_cond_wait(c, m)   pthread_cond_wait((c), (m))
+#    define pool_cond_broadcast(c) pthread_cond_broadcast(c)
+#    define pool_cond_signal(c)    pthread_cond_signal(c)
+#endif
+
+/**
+ * Signature shared by the adapters of the ipcrypt_*_ip16_strided() functions.
+ */
+typedef int (*StridedFn)(const void *ctx, void *base, size_t count, size_t stride,
+                         const size_t *offsets, size_t offsets_count, size_t field_bytes);
+
+/**
+ * PoolJob describes a batch job: a strided function, and the records to process.
+ */
+typedef struct PoolJob {
+    StridedFn     fn;
+    const void   *ctx;
+    uint8_t      *base;
+    size_t        count;
+    size_t        stride;
+    const size_t *offsets;
+    size_t        offsets_count;
+    size_t        field_bytes;
+    size_t        chunk_records;
+    size_t        chunks;
+} PoolJob;
+
+/**
+ * PoolWorker holds the range of chunks [next, end) owned by a worker.
+ * The range is protected by a per-worker lock, since other workers can steal from it.
+ */
+typedef struct PoolWorker {
+    IPCryptPool  *pool;
+    PoolMutex     lock;
+    size_t        next;
+    size_t        end;
+    unsigned int  index;
+    unsigned char padding[CACHE_LINE_BYTES];
+} PoolWorker;
+
+struct IPCryptPool {
+    PoolMutex    run_lock;
+    PoolMutex    lock;
+    PoolCond     job_cond;
+    PoolCond     done_cond;
+    PoolJob      job;
+    PoolWorker  *workers;
+    PoolThread  *handles;
+    uint64_t     generation;
+    unsigned int threads;
+    unsigned int started;
+    unsigned int pending;
+    int          stop;
+};
+
+/**
+ * pool_cpus returns the number of online CPUs, or 1 if it cannot be determined.
+ */
+static unsigned int
+pool_cpus(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO si;
+
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors > 0 ? (unsigned int) si.dwNumberOfProcessors : 1U;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    const long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? (unsigned int) n : 1U;
+#else
+    return 1U;
+#endif
+}
+
+/**
+ * pool_pop takes the next chunk from the worker's own range.
+ * Returns 0 on success, or -1 if the range is empty.
+ */
+static int
+pool_pop(PoolWorker *self, size_t *chunk)
+{
+    int ret = -1;
+
+    pool_mutex_lock(&self->lock);
+    if (self->next < self->end) {
+        *chunk = self->next++;
+        ret    = 0;
+    }
+    pool_mutex_unlock(&self->lock);
+
+    return ret;
+}
+
+/**
+ * pool_steal takes the second half of the remaining chunks of another worker.
+ * The first stolen chunk is returned, and the other ones become the worker's own range.
+ * Returns 0 on success, or -1 if there is nothing left to steal.
+ */
+static int
+pool_steal(PoolWorker *self, size_t *chunk)
+{
+    IPCryptPool *pool = self->pool;
+    PoolWorker  *victim;
+    size_t       remaining;
+    size_t       start = 0, end = 0;
+    unsigned int i;
+
+    for (i = 1; i < pool->threads; i++) {
+        victim = &pool->workers[(self->index + i) % pool->threads];
+        pool_mutex_lock(&victim->lock);
+        remaining = victim->end - victim->next;
+        if (remaining > 0) {
+            end         = victim->end;
+            start       = end - (remaining + 1) / 2;
+            victim->end = start;
+        }
+        pool_mutex_unlock(&victim->lock);
+        if (start < end) {
+            break;
+        }
+    }
+    if (start >= end) {
+        return -1;
+    }
+    *chunk = start;
+    pool_mutex_lock(&self->lock);
+    self->next = start + 1;
+    self->end  = end;
+    pool_mutex_unlock(&self->lock);
+
+    return 0;
+}
+
+/**
+ * pool_work processes chunks until there is nothing left to process or to steal.
+ */
+static void
+pool_work(PoolWorker *self, const PoolJob *job)
+{
+    size_t chunk;
+    size_t start;
+    size_t n;
+
+    while (pool_pop(self, &chunk) == 0 || pool_steal(self, &chunk) == 0) {
+        start = chunk * job->chunk_records;
+        n     = job->count - start;
+        if (n > job->chunk_records) {
+            n = job->chunk_records;
+        }
+        (void) job->fn(job->ctx, job->base + start * job->stride, n, job->stride, job->offsets,
+                       job->offsets_count, job->field_bytes);
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI
+pool_thread(LPVOID arg)
+#else
+static void *
+pool_thread(void *arg)
+#endif
+{
+    PoolWorker  *self = (PoolWorker *) arg;
+    IPCryptPool *pool = self->pool;
+    PoolJob      job;
+    uint64_t     seen;
+
+    // Jobs are only submitted once all the workers have been started.
+    seen = 0;
+    pool_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->stop && pool->generation == seen) {
+            pool_cond_wait(&pool->job_cond, &pool->lock);
+        }
+        if (pool->stop) {
+            break;
+        }
+        seen = pool->generation;
+        job  = pool->job;
+        pool_mutex_unlock(&pool->lock);
+
+        pool_work(self, &job);
+
+        pool_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) {
+            pool_cond_signal(&pool->done_cond);
+        }
+    }
+    pool_mutex_unlock(&pool->lock);
+
+#ifdef _WIN32
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+/**
+ * pool_stop asks the workers to exit, and waits for them.
+ */
+static void
+pool_stop(IPCryptPool *pool)
+{
+    unsigned int i;
+
+    pool_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pool_cond_broadcast(&pool->job_cond);
+    pool_mutex_unlock(&pool->lock);
+    for (i = 0; i < pool->started; i++) {
+#ifdef _WIN32
+        WaitForSingleObject(pool->handles[i], INFINITE);
+        CloseHandle(pool->handles[i]);
+#else
+        pthread_join(pool->handles[i], NULL);
+#endif
+    }
+    pool->started = 0;
+}
+
+IPCryptPool *
+ipcrypt_pool_create(unsigned int threads)
+{
+    IPCryptPool *pool;
+    unsigned int i;
+
+    if (threads == 0) {
+        threads = pool_cpus();
+    }
+    if ((pool = (IPCryptPool *) calloc(1, sizeof *pool)) == NULL) {
+        return NULL;
+    }
+    pool->threads = threads;
+    pool->workers = (PoolWorker *) calloc(threads, sizeof *pool->workers);
+    pool->handles = (PoolThread *) calloc(threads, sizeof *pool->handles);
+    if (pool->workers == NULL || pool->handles == NULL) {
+        free(pool->workers);
+        free(pool->handles);
+        free(pool);
+        return NULL;
+    }
+    pool_mutex_init(&pool->run_lock);
+    pool_mutex_init(&pool->lock);
+    pool_cond_init(&pool->job_cond);
+    pool_cond_init(&pool->done_cond);
+    for (i = 0; i < threads; i++) {
+        pool->workers[i].pool  = pool;
+        pool->workers[i].index = i;
+        pool_mutex_init(&pool->workers[i].lock);
+    }
+    // Worker 0 is the thread submitting a job.
+    for (i = 1; i < threads; i++) {
+#ifdef _WIN32
+        pool->handles[pool->started] =
+            CreateThread(NULL, 0, pool_thread, &pool->workers[i], 0, NULL);
+        if (pool->handles[pool->started] == NULL) {
+            break;
+        }
+#else
+        if (pthread_create(&pool->handles[pool->started], NULL, pool_thread, &pool->workers[i]) !=
+            0) {
+            break;
+        }
+#endif
+        pool->started++;
+    }
+    if (pool->started != threads - 1) {
+        ipcrypt_pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void
+ipcrypt_pool_destroy(IPCryptPool *pool)
+{
+    unsigned int i;
+
+    if (pool == NULL) {
+        return;
+    }
+    pool_stop(pool);
+    for (i = 0; i < pool->threads; i++) {
+        pool_mutex_destroy(&pool->workers[i].lock);
+    }
+    pool_cond_destroy(&pool->done_cond);
+    pool_cond_destroy(&pool->job_cond);
+    pool_mutex_destroy(&pool->lock);
+    pool_mutex_destroy(&pool->run_lock);
+    free(pool->handles);
+    free(pool->workers);
+    free(pool);
+}
+
+unsigned int
+ipcrypt_pool_threads(const IPCryptPool *pool)
+{
+    return pool->threads;
+}
+
+/**
+ * pool_run validates the layout, splits the records into chunks, and processes them with all the
+ * workers. Returns 0 on success, or -1 if the layout is invalid.
+ */
+static int
+pool_run(IPCryptPool *pool, StridedFn fn, const void *ctx, void *base, size_t count,
+         size_t stride, const size_t *offsets, size_t offsets_count, size_t field_bytes)
+{
+    PoolJob      job;
+    size_t       share, extra, start;
+    unsigned int i;
+
+    // Processing zero records only validates the layout.
+    if (fn(ctx, base, 0, stride, offsets, offsets_count, field_bytes) != 0) {
+        return -1;
+    }
+    job.fn            = fn;
+    job.ctx           = ctx;
+    job.base          = (uint8_t *) base;
+    job.count         = count;
+    job.stride        = stride;
+    job.offsets       = offsets;
+    job.offsets_count = offsets_count;
+    job.field_bytes   = field_bytes;
+    job.chunk_records = stride > 0 ? IPCRYPT_POOL_CHUNK_BYTES / stride : count;
+    if (job.chunk_records == 0) {
+        job.chunk_records = 1;
+    }
+    job.chunks = count / job.chunk_records + (count % job.chunk_records != 0);
+    if (pool->threads == 1 || job.chunks <= 1) {
+        return fn(ctx, base, count, stride, offsets, offsets_count, field_bytes);
+    }
+
+    // Start with an even split. Imbalances are corrected by stealing.
+    pool_mutex_lock(&pool->run_lock);
+    pool_mutex_lock(&pool->lock);
+    share = job.chunks / pool->threads;
+    extra = job.chunks % pool->threads;
+    start = 0;
+    for (i = 0; i < pool->threads; i++) {
+        pool_mutex_lock(&pool->workers[i].lock);
+        pool->workers[i].next = start;
+        start += share + (i < extra);
+        pool->workers[i].end = start;
+        pool_mutex_unlock(&pool->workers[i].lock);
+    }
+    pool->job     = job;
+    pool->pending = pool->threads - 1;
+    pool->generation++;
+    pool_cond_broadcast(&pool->job_cond);
+    pool_mutex_unlock(&pool->lock);
+
+    pool_work(&pool->workers[0], &job);
+
+    pool_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pool_cond_wait(&pool->done_cond, &pool->lock);
+    }
+    pool_mutex_unlock(&pool->lock);
+    pool_mutex_unlock(&pool->run_lock);
+
+    return 0;
+}
+
+/**
+ * POOL_STRIDED defines ipcrypt_pool_<OP>_strided(), as a parallel version of
+ * ipcrypt_<OP>_strided(), along with an adapter to call the latter through a StridedFn.
+ */
+#define POOL_STRIDED(OP, CTX_TYPE)                                                                 \
+    static int pool_##OP##_adapter(const void *ctx, void *base, size_t count, size_t stride,       \
+                                   const size_t *offsets, size_t offsets_count,                    \
+                                   size_t field_bytes)                                             \
+    {                                                                                              \
+        return ipcrypt_##OP##_strided((const CTX_TYPE *) ctx, base, count, stride, offsets,        \
+                                      offsets_count, field_bytes);                                 \
+    }                                                                                              \
+                                                                                                   \
+    int ipcrypt_pool_##OP##_strided(IPCryptPool *pool, const CTX_TYPE *ipcrypt, void *base,        \
+                                    size_t count, size_t stride, const size_t *offsets,            \
+                                    size_t offsets_count, size_t field_bytes)                      \
+    {                                                                                              \
+        return pool_run(pool, pool_##OP##_adapter, ipcrypt, base, count, stride, offsets,          \
+                        offsets_count, field_bytes);                                               \
+    }
+
+POOL_STRIDED(encrypt_ip16, IPCrypt)
+POOL_STRIDED(decrypt_ip16, IPCrypt)
+POOL_STRIDED(pfx_encrypt_ip16, IPCryptPFX)
+POOL_STRIDED(pfx_decrypt_ip16, IPCryptPFX)
+POOL_STRIDED(nd_encrypt_ip16, IPCrypt)
+POOL_STRIDED(nd_decrypt_ip16, IPCrypt)
+POOL_STRIDED(ndx_encrypt_ip16, IPCryptNDX)
+POOL_STRIDED(ndx_decrypt_ip16, IPCryptNDX)
+
+/**
+ * PoolForEach is the context of a generic job: a function, and its own context.
+ */
+typedef struct PoolForEach {
+    IPCryptPoolFn fn;
+    void         *ctx;
+} PoolForEach;
+
+static int
+pool_for_each_adapter(const void *ctx, void *base, size_t count, size_t stride,
+                      const size_t *offsets, size_t offsets_count, size_t field_bytes)
+{
+    const PoolForEach *for_each = (const PoolForEach *) ctx;
+
+    (void) offsets;
+    (void) offsets_count;
+    (void) field_bytes;
+    if (count > 0) {
+        for_each->fn(for_each->ctx, base, count, stride);
+    }
+    return 0;
+}
+
+int
+ipcrypt_pool_for_each(IPCryptPool *pool, IPCryptPoolFn fn, void *ctx, void *base, size_t count,
+                      size_t stride)
+{
+    PoolForEach for_each;
+
+    for_each.fn  = fn;
+    for_each.ctx = ctx;
+
+    return pool_run(pool, pool_for_each_adapter, &for_each, base, count, stride, NULL, 0, 0);
+}
@@ -0,0 +1,678 @@
+/**
+ * Binary record files for IPCrypt2.
+ *
+ * The writer maps one block of the file at a time. Addresses are copied into the mapping, after
+ * their tweaks for the non-deterministic modes, and the whole block is encrypted in-place with the
+ * strided functions once it is full, so that records are never copied twice. The block index and
+ * the header are written last, so that an incomplete file is never mistaken for a valid one.
+ *
+ * The reader maps the whole file, and validates the header and the index once. The location of a
+ * record is then computed from its number alone. Deterministic and PFX ciphertexts are decrypted
+ * directly into the output; ND and NDX ciphertexts are decrypted in a scratch buffer, and the
+ * addresses are copied out of it.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#    define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "include/ipcrypt2_records.h"
+
+#define RECORDS_VERSION 1U
+
+static const uint8_t records_magic[8] = { 'I', 'P', 'C', '2', 'R', 'E', 'C', 0 };
+
+/**
+ * RecordsKey is the context of the mode of a file.
+ */
+typedef struct RecordsKey {
+    IPCryptMode mode;
+    union {
+        IPCrypt    ipcrypt;
+        IPCryptPFX ipcrypt_pfx;
+        IPCryptNDX ipcrypt_ndx;
+    } ctx;
+} RecordsKey;
+
+struct IPCryptRecordsWriter {
+    RecordsKey             key;
+    int                    fd;
+    uint32_t               key_id;
+    size_t                 record_bytes;
+    size_t                 tweak_bytes;
+    IPCryptRecordsRandomFn random;
+    void                  *opaque;
+    uint8_t               *tweaks;
+    uint8_t               *map;
+    size_t                 map_len;
+    size_t                 map_delta;
+    size_t                 block_count;
+    uint64_t               records;
+    uint64_t               blocks;
+    uint8_t               *index;
+    size_t                 index_size;
+    int                    error;
+};
+
+struct IPCryptRecordsReader {
+    RecordsKey         key;
+    IPCryptRecordsInfo info;
+    const uint8_t     *map;
+    size_t             map_len;
+    const uint8_t     *index;
+};
+
+static inline uint16_t
+records_load16(const uint8_t *p)
+{
+    return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+static inline uint32_t
+records_load32(const uint8_t *p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) |
+           ((uint32_t) p[3] << 24);
+}
+
+static inline uint64_t
+records_load64(const uint8_t *p)
+{
+    return (uint64_t) records_load32(p) | ((uint64_t) records_load32(p + 4) << 32);
+}
+
+static inline void
+records_store16(uint8_t *p, uint16_t x)
+{
+    p[0] = (uint8_t) x;
+    p[1] = (uint8_t) (x >> 8);
+}
+
+static inline void
+records_store32(uint8_t *p, uint32_t x)
+{
+    p[0] = (uint8_t) x;
+    p[1] = (uint8_t) (x >> 8);
+    p[2] = (uint8_t) (x >> 16);
+    p[3] = (uint8_t) (x >> 24);
+}
+
+static inline void
+records_store64(uint8_t *p, uint64_t x)
+{
+    records_store32(p, (uint32_t) x);
+    records_store32(p + 4, (uint32_t) (x >> 32));
+}
+
+static size_t
+records_key_bytes(IPCryptMode mode)
+{
+    switch (mode) {
+    case IPCRYPT_MODE_DETERMINISTIC:
+    case IPCRYPT_MODE_ND:
+        return IPCRYPT_KEYBYTES;
+    case IPCRYPT_MODE_PFX:
+        return IPCRYPT_PFX_KEYBYTES;
+    case IPCRYPT_MODE_NDX:
+        return IPCRYPT_NDX_KEYBYTES;
+    }
+    return 0;
+}
+
+static size_t
+records_record_bytes(IPCryptMode mode)
+{
+    switch (mode) {
+    case IPCRYPT_MODE_DETERMINISTIC:
+    case IPCRYPT_MODE_PFX:
+        return 16;
+    case IPCRYPT_MODE_ND:
+        return IPCRYPT_NDIP_BYTES;
+    case IPCRYPT_MODE_NDX:
+        return IPCRYPT_NDX_NDIP_BYTES;
+    }
+    return 0;
+}
+
+static void
+records_key_init(RecordsKey *key, IPCryptMode mode, const uint8_t *bytes)
+{
+    key->mode = mode;
+    switch (mode) {
+    case IPCRYPT_MODE_DETERMINISTIC:
+    case IPCRYPT_MODE_ND:
+        ipcrypt_init(&key->ctx.ipcrypt, bytes);
+        break;
+    case IPCRYPT_MODE_PFX:
+        ipcrypt_pfx_init(&key->ctx.ipcrypt_pfx, bytes);
+        break;
+    case IPCRYPT_MODE_NDX:
+        ipcrypt_ndx_init(&key->ctx.ipcrypt_ndx, bytes);
+        break;
+    }
+}
+
+static void
+records_key_deinit(RecordsKey *key)
+{
+    switch (key->mode) {
+    case IPCRYPT_MODE_DETERMINISTIC:
+    case IPCRYPT_MODE_ND:
+        ipcrypt_deinit(&key->ctx.ipcrypt);
+        break;
+    case IPCRYPT_MODE_PFX:
+        ipcrypt_pfx_deinit(&key->ctx.ipcrypt_pfx);
+        break;
+    case IPCRYPT_MODE_NDX:
+        ipcrypt_ndx_deinit(&key->ctx.ipcrypt_ndx);
+        break;
+    }
+}
+
+/**
+ * records_transform encrypts or decrypts `count` consecutive records in-place, with `pool` if it
+ * is not NULL.
+ */
+static void
+records_transform(const RecordsKey *key, IPCryptPool *pool, int decrypt, uint8_t *base,
+                  size_t count, size_t record_bytes)
+{
+    static const size_t offsets[1] = { 0 };
+
+    if (count == 0) {
+        return;
+    }
+    switch (key->mode) {
+    case IPCRYPT_MODE_DETERMINISTIC:
+        if (pool != NULL) {
+            (decrypt ? ipcrypt_pool_decrypt_ip16_strided
+                     : ipcrypt_pool_encrypt_ip16_strided)(pool, &key->ctx.ipcrypt, base, count,
+                                                          record_bytes, offsets, 1, record_bytes);
+        } else {
+            (decrypt ? ipcrypt_decrypt_ip16_strided
+                     : ipcrypt_encrypt_ip16_strided)(&key->ctx.ipcrypt, base, count, record_bytes,
+                                                     offsets, 1, record_bytes);
+        }
+        break;
+    case IPCRYPT_MODE_PFX:
+        if (pool != NULL) {
+            (decrypt ? ipcrypt_pool_pfx_decrypt_ip16_strided
+                     : ipcrypt_pool_pfx_encrypt_ip16_strided)(pool, &key->ctx.ipcrypt_pfx, base,
+                                                              count, record_bytes, offsets, 1,
+                                                              record_bytes);
+        } else {
+            (decrypt ? ipcrypt_pfx_decrypt_ip16_strided
+                     : ipcrypt_pfx_encrypt_ip16_strided)(&key->ctx.ipcrypt_pfx, base, count,
+                                                         record_bytes, offsets, 1, record_bytes);
+        }
+        break;
+    case IPCRYPT_MODE_ND:
+        if (pool != NULL) {
+            (decrypt ? ipcrypt_pool_nd_decrypt_ip16_strided
+                     : ipcrypt_pool_nd_encrypt_ip16_strided)(pool, &key->ctx.ipcrypt, base, count,
+                                                             record_bytes, offsets, 1,
+                                                             record_bytes);
+        } else {
+            (decrypt ? ipcrypt_nd_decrypt_ip16_strided
+                     : ipcrypt_nd_encrypt_ip16_strided)(&key->ctx.ipcrypt, base, count,
+                                                        record_bytes, offsets, 1, record_bytes);
+        }
+        break;
+    case IPCRYPT_MODE_NDX:
+        if (pool != NULL) {
+            (decrypt ? ipcrypt_pool_ndx_decrypt_ip16_strided
+                     : ipcrypt_pool_ndx_encrypt_ip16_strided)(pool, &key->ctx.ipcrypt_ndx, base,
+                                                              count, record_bytes, offsets, 1,
+                                                              record_bytes);
+        } else {
+            (decrypt ? ipcrypt_ndx_decrypt_ip16_strided
+                     : ipcrypt_ndx_encrypt_ip16_strided)(&key->ctx.ipcrypt_ndx, base, count,
+                                                         record_bytes, offsets, 1, record_bytes);
+        }
+        break;
+    }
+}
+
+/**
+ * records_parse_header validates a header, and stores its content into `info`.
+ * Returns 0 on success, or -1 if the header is invalid.
+ */
+static int
+records_parse_header(const uint8_t *h, IPCryptRecordsInfo *info, uint64_t *index_offset)
+{
+    unsigned int mode = h[10];
+    uint64_t     blocks;
+
+    if (memcmp(h, records_magic, sizeof records_magic) != 0 ||
+        records_load16(h + 8) != RECORDS_VERSION || mode > IPCRYPT_MODE_NDX) {
+        return -1;
+    }
+    info->mode          = (IPCryptMode) mode;
+    info->key_id        = records_load32(h + 12);
+    info->record_bytes  = records_load32(h + 16);
+    info->block_records = records_load32(h + 20);
+    info->records       = records_load64(h + 24);
+    info->blocks        = records_load64(h + 32);
+    *index_offset       = records_load64(h + 40);
+    if (info->record_bytes != records_record_bytes(info->mode) || info->block_records == 0) {
+        return -1;
+    }
+    blocks = info->records / info->block_records + (info->records % info->block_records != 0);
+    if (info->blocks != blocks) {
+        return -1;
+    }
+    return 0;
+}
+
+static int
+records_pwrite_all(int fd, const uint8_t *buf, size_t len, uint64_t offset)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = pwrite(fd, buf, len, (off_t) offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n == 0) {
+                errno = EIO;
+            }
+            return -1;
+        }
+        buf += (size_t) n;
+        len -= (size_t) n;
+        offset += (uint64_t) n;
+    }
+    return 0;
+}
+
+IPCryptRecordsWriter *
+ipcrypt_records_writer_create(int fd, IPCryptMode mode, const uint8_t *key, size_t key_len,
+                              uint32_t key_id, IPCryptRecordsRandomFn random, void *opaque)
+{
+    IPCryptRecordsWriter *writer;
+    struct stat           st;
+    const int             nd = mode == IPCRYPT_MODE_ND || mode == IPCRYPT_MODE_NDX;
+
+    if (key_len == 0 || key_len != records_key_bytes(mode) || (nd && random == NULL)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0) {
+        return NULL;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (ftruncate(fd, 0) != 0 || ftruncate(fd, (off_t) IPCRYPT_RECORDS_DATA_OFFSET) != 0) {
+        return NULL;
+    }
+    if ((writer = (IPCryptRecordsWriter *) calloc(1, sizeof *writer)) == NULL) {
+        return NULL;
+    }
+    writer->record_bytes = records_record_bytes(mode);
+    writer->tweak_bytes  = writer->record_bytes - 16;
+    if (writer->tweak_bytes != 0 &&
+        (writer->tweaks = (uint8_t *) malloc(IPCRYPT_RECORDS_BLOCK_RECORDS *
+                                             writer->tweak_bytes)) == NULL) {
+        free(writer);
+        return NULL;
+    }
+    records_key_init(&writer->key, mode, key);
+    writer->fd     = fd;
+    writer->key_id = key_id;
+    writer->random = random;
+    writer->opaque = opaque;
+
+    return writer;
+}
+
+/**
+ * records_writer_map maps the next block of the file. The mapping starts at the page that holds
+ * the beginning of the block, so that pages larger than the header page are supported.
+ */
+static int
+records_writer_map(IPCryptRecordsWriter *writer)
+{
+    const size_t   block_bytes = IPCRYPT_RECORDS_BLOCK_RECORDS * writer->record_bytes;
+    const uint64_t offset      = IPCRYPT_RECORDS_DATA_OFFSET + writer->blocks * block_bytes;
+    const long     page        = sysconf(_SC_PAGESIZE);
+    uint64_t       map_offset  = offset;
+    void          *map;
+
+    if (page > 0) {
+        map_offset -= offset % (uint64_t) page;
+    }
+    if (ftruncate(writer->fd, (off_t) (offset + block_bytes)) != 0) {
+        return -1;
+    }
+    writer->map_delta = (size_t) (offset - map_offset);
+    writer->map_len   = writer->map_delta + block_bytes;
+    map = mmap(NULL, writer->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, writer->fd,
+               (off_t) map_offset);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    writer->map         = (uint8_t *) map;
+    writer->block_count = 0;
+    return 0;
+}
+
+/**
+ * records_writer_flush encrypts the current block, unmaps it, and adds it to the index.
+ */
+static int
+records_writer_flush(IPCryptRecordsWriter *writer, IPCryptPool *pool)
+{
+    const size_t   block_bytes = IPCRYPT_RECORDS_BLOCK_RECORDS * writer->record_bytes;
+    const uint64_t offset      = IPCRYPT_RECORDS_DATA_OFFSET + writer->blocks * block_bytes;
+    uint8_t       *index;
+    uint8_t       *entry;
+    size_t         index_size;
+
+    records_transform(&writer->key, pool, 0, writer->map + writer->map_delta, writer->block_count,
+                      writer->record_bytes);
+    if (munmap(writer->map, writer->map_len) != 0) {
+        writer->map = NULL;
+        return -1;
+    }
+    writer->map = NULL;
+
+    index_size = (size_t) (writer->blocks + 1) * IPCRYPT_RECORDS_INDEX_ENTRY_BYTES;
+    if (index_size > writer->index_size) {
+        index_size = index_size < 4096 ? 4096 : index_size * 2;
+        if ((index = (uint8_t *) realloc(writer->index, index_size)) == NULL) {
+            return -1;
+        }
+        writer->index      = index;
+        writer->index_size = index_size;
+    }
+    entry = writer->index + (size_t) writer->blocks * IPCRYPT_RECORDS_INDEX_ENTRY_BYTES;
+    records_store64(entry, offset);
+    records_store32(entry + 8, (uint32_t) writer->block_count);
+    records_store32(entry + 12, 0);
+    writer->records += writer->block_count;
+    writer->blocks++;
+
+    return 0;
+}
+
+int
+ipcrypt_records_writer_append(IPCryptRecordsWriter *writer, IPCryptPool *pool,
+                              const uint8_t *ip16s, size_t count)
+{
+    const size_t record_bytes = writer->record_bytes;
+    const size_t tweak_bytes  = writer->tweak_bytes;
+    uint8_t     *dst;
+    size_t       n, i;
+
+    if (writer->error != 0) {
+        errno = writer->error;
+        return -1;
+    }
+    while (count > 0) {
+        if (writer->map == NULL && records_writer_map(writer) != 0) {
+            writer->error = errno;
+            return -1;
+        }
+        n = IPCRYPT_RECORDS_BLOCK_RECORDS - writer->block_count;
+        if (n > count) {
+            n = count;
+        }
+        dst = writer->map + writer->map_delta + writer->block_count * record_bytes;
+        if (tweak_bytes != 0) {
+            writer->random(writer->opaque, writer->tweaks, n * tweak_bytes);
+            for (i = 0; i < n; i++) {
+                memcpy(dst + i * record_bytes, writer->tweaks + i * tweak_bytes, tweak_bytes);
+                memcpy(dst + i * record_bytes + tweak_bytes, ip16s + i * 16, 16);
+            }
+        } else {
+            memcpy(dst, ip16s, n * 16);
+        }
+        writer->block_count += n;
+        ip16s += n * 16;
+        count -= n;
+        if (writer->block_count == IPCRYPT_RECORDS_BLOCK_RECORDS &&
+            records_writer_flush(writer, pool) != 0) {
+            writer->error = errno;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int
+ipcrypt_records_writer_close(IPCryptRecordsWriter *writer, IPCryptPool *pool)
+{
+    uint8_t  header[IPCRYPT_RECORDS_HEADER_BYTES];
+    uint64_t index_offset;
+    int      error = writer->error;
+
+    if (error == 0 && writer->map != NULL && records_writer_flush(writer, pool) != 0) {
+        error = errno;
+    }
+    if (error == 0) {
+        index_offset = IPCRYPT_RECORDS_DATA_OFFSET + writer->records * writer->record_bytes;
+        memset(header, 0, sizeof header);
+        memcpy(header, records_magic, sizeof records_magic);
+        records_store16(header + 8, RECORDS_VERSION);
+        header[10] = (uint8_t) writer->key.mode;
+        records_store32(header + 12, writer->key_id);
+        records_store32(header + 16, (uint32_t) writer->record_bytes);
+        records_store32(header + 20, IPCRYPT_RECORDS_BLOCK_RECORDS);
+        records_store64(header + 24, writer->records);
+        records_store64(header + 32, writer->blocks);
+        records_store64(header + 40, index_offset);
+        if (ftruncate(writer->fd, (off_t) index_offset) != 0 ||
+            records_pwrite_all(writer->fd, writer->index,
+                               (size_t) writer->blocks * IPCRYPT_RECORDS_INDEX_ENTRY_BYTES,
+                               index_offset) != 0 ||
+            records_pwrite_all(writer->fd, header, sizeof header, 0) != 0) {
+            error = errno;
+        }
+    }
+    if (writer->map != NULL) {
+        munmap(writer->map, writer->map_len);
+    }
+    records_key_deinit(&writer->key);
+    free(writer->tweaks);
+    free(writer->index);
+    free(writer);
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+int
+ipcrypt_records_probe(int fd, IPCryptRecordsInfo *info)
+{
+    uint8_t  header[IPCRYPT_RECORDS_HEADER_BYTES];
+    uint64_t index_offset;
+    size_t   len = 0;
+    ssize_t  n;
+
+    while (len < sizeof header) {
+        n = pread(fd, header + len, sizeof header - len, (off_t) len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        len += (size_t) n;
+    }
+    if (records_parse_header(header, info, &index_offset) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * records_validate_index checks that the index is within the file, and that every block is full,
+ * except the last one, and lies between the header page and the index.
+ */
+static int
+records_validate_index(const IPCryptRecordsReader *reader, uint64_t index_offset)
+{
+    const IPCryptRecordsInfo *info = &reader->info;
+    const uint8_t            *entry;
+    uint64_t                  b, offset, expected, left = info->records;
+
+    if (index_offset < IPCRYPT_RECORDS_DATA_OFFSET || index_offset > reader->map_len ||
+        info->blocks > (reader->map_len - index_offset) / IPCRYPT_RECORDS_INDEX_ENTRY_BYTES) {
+        return -1;
+    }
+    for (b = 0; b < info->blocks; b++) {
+        entry    = reader->index + b * IPCRYPT_RECORDS_INDEX_ENTRY_BYTES;
+        offset   = records_load64(entry);
+        expected = left < info->block_records ? left : info->block_records;
+        if (records_load32(entry + 8) != expected || offset < IPCRYPT_RECORDS_DATA_OFFSET ||
+            offset > index_offset ||
+            expected > (index_offset - offset) / info->record_bytes) {
+            return -1;
+        }
+        left -= expected;
+    }
+    return 0;
+}
+
+IPCryptRecordsReader *
+ipcrypt_records_reader_open(int fd, const uint8_t *key, size_t key_len)
+{
+    IPCryptRecordsReader *reader;
+    struct stat           st;
+    uint64_t              index_offset;
+    void                 *map;
+
+    if (fstat(fd, &st) != 0) {
+        return NULL;
+    }
+    if (!S_ISREG(st.st_mode) || (uint64_t) st.st_size < IPCRYPT_RECORDS_DATA_OFFSET ||
+        (uint64_t) st.st_size > SIZE_MAX) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if ((reader = (IPCryptRecordsReader *) calloc(1, sizeof *reader)) == NULL) {
+        return NULL;
+    }
+    reader->map_len = (size_t) st.st_size;
+    if ((map = mmap(NULL, reader->map_len, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        free(reader);
+        return NULL;
+    }
+    reader->map = (const uint8_t *) map;
+    if (records_parse_header(reader->map, &reader->info, &index_offset) != 0 ||
+        key_len == 0 || key_len != records_key_bytes(reader->info.mode)) {
+        goto invalid;
+    }
+    reader->index = reader->map + index_offset;
+    if (records_validate_index(reader, index_offset) != 0) {
+        goto invalid;
+    }
+#ifdef MADV_WILLNEED
+    (void) madvise(map, reader->map_len, MADV_WILLNEED);
+#endif
+    records_key_init(&reader->key, reader->info.mode, key);
+
+    return reader;
+
+invalid:
+    munmap(map, reader->map_len);
+    free(reader);
+    errno = EINVAL;
+    return NULL;
+}
+
+void
+ipcrypt_records_reader_close(IPCryptRecordsReader *reader)
+{
+    if (reader == NULL) {
+        return;
+    }
+    munmap((void *) reader->map, reader->map_len);
+    records_key_deinit(&reader->key);
+    free(reader);
+}
+
+void
+ipcrypt_records_reader_info(const IPCryptRecordsReader *reader, IPCryptRecordsInfo *info)
+{
+    *info = reader->info;
+}
+
+const uint8_t *
+ipcrypt_records_reader_record(const IPCryptRecordsReader *reader, uint64_t index)
+{
+    const IPCryptRecordsInfo *info = &reader->info;
+    const uint8_t            *entry;
+
+    if (index >= info->records) {
+        return NULL;
+    }
+    entry = reader->index + (index / info->block_records) * IPCRYPT_RECORDS_INDEX_ENTRY_BYTES;
+    return reader->map + records_load64(entry) + (index % info->block_records) * info->record_bytes;
+}
+
+int
+ipcrypt_records_reader_read(const IPCryptRecordsReader *reader, IPCryptPool *pool,
+                            uint64_t first, size_t count, uint8_t *ip16s)
+{
+    const IPCryptRecordsInfo *info         = &reader->info;
+    const size_t              record_bytes = info->record_bytes;
+    const size_t              tweak_bytes  = record_bytes - 16;
+    const uint8_t            *src;
+    uint8_t                  *scratch = NULL;
+    size_t                    n, i;
+
+    if (first > info->records || count > info->records - first) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (tweak_bytes != 0 && count > 0) {
+        n = count < info->block_records ? count : info->block_records;
+        if ((scratch = (uint8_t *) malloc(n * record_bytes)) == NULL) {
+            return -1;
+        }
+    }
+    while (count > 0) {
+        src = ipcrypt_records_reader_record(reader, first);
+        n   = info->block_records - (size_t) (first % info->block_records);
+        if (n > count) {
+            n = count;
+        }
+        if (scratch == NULL) {
+            memcpy(ip16s, src, n * 16);
+            records_transform(&reader->key, pool, 1, ip16s, n, 16);
+        } else {
+            memcpy(scratch, src, n * record_bytes);
+            records_transform(&reader->key, pool, 1, scratch, n, record_bytes);
+            for (i = 0; i < n; i++) {
+                memcpy(ip16s + i * 16, scratch + i * record_bytes + tweak_bytes, 16);
+            }
+        }
+        ip16s += n * 16;
+        first += n;
+        count -= n;
+    }
+    free(scratch);
+
+    return 0;
+}
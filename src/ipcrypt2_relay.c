@@ -0,0 +1,398 @@
+/**
+ * Datagram relay for IPCrypt2.
+ *
+ * Every slot of a batch has its own receive buffer, sender address and output buffer, so that a
+ * whole batch is received with a single recvmmsg() call, and sent with a single sendmmsg() call.
+ * Output buffers are large enough for the worst-case expansion of a datagram, so messages are
+ * anonymized directly into them.
+ *
+ * The payloads of a batch are passed to the log anonymizer together, as independent messages, so
+ * that their addresses are encrypted together, and text is never carried over from one datagram
+ * to the next.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#    define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "include/ipcrypt2_relay.h"
+
+#if defined(__linux__)
+#    define RELAY_HAS_MMSG 1
+typedef struct mmsghdr RelayMsg;
+#else
+typedef struct RelayMsg {
+    struct msghdr msg_hdr;
+    unsigned int  msg_len;
+} RelayMsg;
+#endif
+
+/** Size of a record of the sender addresses: a tweak followed by an address. */
+#define RELAY_PEER_RECORD_BYTES IPCRYPT_NDX_NDIP_BYTES
+
+/** Size of the largest encrypted sender address, as text, followed by a space. */
+#define RELAY_PEER_PREFIX_BYTES (IPCRYPT_NDX_NDIP_STR_BYTES + 1)
+
+struct IPCryptRelay {
+    IPCryptLog             *log;
+    union {
+        IPCrypt    ipcrypt;
+        IPCryptPFX ipcrypt_pfx;
+        IPCryptNDX ipcrypt_ndx;
+    } ctx;
+    IPCryptMode             mode;
+    IPCryptLogRandomFn      random;
+    void                   *opaque;
+    int                     in_fd;
+    int                     out_fd;
+    struct sockaddr_storage dest;
+    socklen_t               dest_len;
+    unsigned int            flags;
+    size_t                  out_bytes;
+    IPCryptRelayStats       stats;
+    uint8_t                *in;
+    uint8_t                *out;
+    RelayMsg                in_msgs[IPCRYPT_RELAY_BATCH];
+    RelayMsg                out_msgs[IPCRYPT_RELAY_BATCH];
+    struct iovec            in_iovs[IPCRYPT_RELAY_BATCH];
+    struct iovec            out_iovs[IPCRYPT_RELAY_BATCH];
+    struct sockaddr_storage peers[IPCRYPT_RELAY_BATCH];
+    uint8_t                 peer_ip16s[IPCRYPT_RELAY_BATCH][16];
+    uint8_t                 peer_records[IPCRYPT_RELAY_BATCH][RELAY_PEER_RECORD_BYTES];
+    const char             *payload_ins[IPCRYPT_RELAY_BATCH];
+    size_t                  payload_in_lens[IPCRYPT_RELAY_BATCH];
+    char                   *payload_outs[IPCRYPT_RELAY_BATCH];
+    size_t                  payload_out_lens[IPCRYPT_RELAY_BATCH];
+};
+
+static size_t
+relay_key_bytes(IPCryptMode mode)
+{
+    switch (mode) {
+    case IPCRYPT_MODE_DETERMINISTIC:
+    case IPCRYPT_MODE_ND:
+        return IPCRYPT_KEYBYTES;
+    case IPCRYPT_MODE_PFX:
+        return IPCRYPT_PFX_KEYBYTES;
+    case IPCRYPT_MODE_NDX:
+        return IPCRYPT_NDX_KEYBYTES;
+    }
+    return 0;
+}
+
+/**
+ * relay_tweak_bytes returns the size of the tweak of a mode, or 0 for the deterministic modes.
+ */
+static size_t
+relay_tweak_bytes(IPCryptMode mode)
+{
+    switch (mode) {
+    case IPCRYPT_MODE_ND:
+        return IPCRYPT_TWEAKBYTES;
+    case IPCRYPT_MODE_NDX:
+        return IPCRYPT_NDX_TWEAKBYTES;
+    default:
+        return 0;
+    }
+}
+
+static size_t
+relay_format_hex(char *out, const uint8_t *bin, size_t bin_len)
+{
+    static const char hex[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
+                                  '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
+    size_t            i;
+
+    for (i = 0; i < bin_len; i++) {
+        out[2 * i]     = hex[bin[i] >> 4];
+        out[2 * i + 1] = hex[bin[i] & 0xf];
+    }
+    return 2 * bin_len;
+}
+
+/**
+ * relay_encrypt_peers converts the sender addresses of `count` datagrams, and encrypts them with a
+ * single call to the strided function of the mode.
+ */
+static void
+relay_encrypt_peers(IPCryptRelay *relay, size_t count)
+{
+    static const size_t offsets[1]  = { 0 };
+    const size_t        tweak_bytes = relay_tweak_bytes(relay->mode);
+    size_t              i;
+
+    relay->stats.peers += ipcrypt_sockaddrs_to_ip16s(&relay->peer_ip16s[0][0], relay->peers, count);
+    switch (relay->mode) {
+    case IPCRYPT_MODE_DETERMINISTIC:
+        ipcrypt_encrypt_ip16_strided(&relay->ctx.ipcrypt, relay->peer_ip16s, count, 16, offsets, 1,
+                                     16);
+        return;
+    case IPCRYPT_MODE_PFX:
+        ipcrypt_pfx_encrypt_ip16_strided(&relay->ctx.ipcrypt_pfx, relay->peer_ip16s, count, 16,
+                                         offsets, 1, 16);
+        return;
+    default:
+        break;
+    }
+    for (i = 0; i < count; i++) {
+        relay->random(relay->opaque, relay->peer_records[i], tweak_bytes);
+        memcpy(relay->peer_records[i] + tweak_bytes, relay->peer_ip16s[i], 16);
+    }
+    if (relay->mode == IPCRYPT_MODE_ND) {
+        ipcrypt_nd_encrypt_ip16_strided(&relay->ctx.ipcrypt, relay->peer_records, count,
+                                        RELAY_PEER_RECORD_BYTES, offsets, 1, IPCRYPT_NDIP_BYTES);
+    } else {
+        ipcrypt_ndx_encrypt_ip16_strided(&relay->ctx.ipcrypt_ndx, relay->peer_records, count,
+                                         RELAY_PEER_RECORD_BYTES, offsets, 1,
+                                         IPCRYPT_NDX_NDIP_BYTES);
+    }
+}
+
+/**
+ * relay_format_peer writes the encrypted sender address of the datagram `i` to `out`, followed by
+ * a space. Returns the number of bytes written.
+ */
+static size_t
+relay_format_peer(const IPCryptRelay *relay, char *out, size_t i)
+{
+    char   ip_str[IPCRYPT_MAX_IP_STR_BYTES];
+    size_t len;
+
+    switch (relay->mode) {
+    case IPCRYPT_MODE_ND:
+        len = relay_format_hex(out, relay->peer_records[i], IPCRYPT_NDIP_BYTES);
+        break;
+    case IPCRYPT_MODE_NDX:
+        len = relay_format_hex(out, relay->peer_records[i], IPCRYPT_NDX_NDIP_BYTES);
+        break;
+    default:
+        len = ipcrypt_ip16_to_str(ip_str, relay->peer_ip16s[i]);
+        memcpy(out, ip_str, len);
+        break;
+    }
+    out[len] = ' ';
+
+    return len + 1;
+}
+
+/**
+ * relay_receive receives up to IPCRYPT_RELAY_BATCH datagrams.
+ * Returns the number of datagrams received, or -1 on error.
+ */
+static int
+relay_receive(IPCryptRelay *relay)
+{
+    size_t i;
+    int    n;
+
+    for (i = 0; i < IPCRYPT_RELAY_BATCH; i++) {
+        relay->peers[i].ss_family             = AF_UNSPEC;
+        relay->in_msgs[i].msg_hdr.msg_name    = &relay->peers[i];
+        relay->in_msgs[i].msg_hdr.msg_namelen = (socklen_t) sizeof relay->peers[i];
+        relay->in_msgs[i].msg_hdr.msg_iov     = &relay->in_iovs[i];
+        relay->in_msgs[i].msg_hdr.msg_iovlen  = 1;
+        relay->in_msgs[i].msg_hdr.msg_flags   = 0;
+    }
+#ifdef RELAY_HAS_MMSG
+    do {
+        n = recvmmsg(relay->in_fd, relay->in_msgs, IPCRYPT_RELAY_BATCH, MSG_WAITFORONE, NULL);
+    } while (n < 0 && errno == EINTR);
+#else
+    ssize_t len;
+
+    // Only the first datagram is waited for.
+    for (n = 0; n < (int) IPCRYPT_RELAY_BATCH; n++) {
+        len = recvmsg(relay->in_fd, &relay->in_msgs[n].msg_hdr, n == 0 ? 0 : MSG_DONTWAIT);
+        if (len < 0) {
+            if (errno == EINTR && n == 0) {
+                n--;
+                continue;
+            }
+            break;
+        }
+        relay->in_msgs[n].msg_len = (unsigned int) len;
+    }
+    if (n == 0) {
+        n = -1;
+    }
+#endif
+    if (n < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    }
+    return n;
+}
+
+/**
+ * relay_send sends the first `count` output messages. Messages that can't be sent are dropped.
+ */
+static void
+relay_send(IPCryptRelay *relay, size_t count)
+{
+    size_t sent = 0;
+    int    n;
+
+    while (sent < count) {
+#ifdef RELAY_HAS_MMSG
+        n = sendmmsg(relay->out_fd, relay->out_msgs + sent, (unsigned int) (count - sent), 0);
+#else
+        n = sendmsg(relay->out_fd, &relay->out_msgs[sent].msg_hdr, 0) < 0 ? -1 : 1;
+#endif
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Skip the message that couldn't be sent, and try the next ones.
+            relay->stats.dropped++;
+            sent++;
+            continue;
+        }
+        relay->stats.forwarded += (uint64_t) n;
+        sent += (size_t) n;
+    }
+}
+
+IPCryptRelay *
+ipcrypt_relay_create(int in_fd, int out_fd, const struct sockaddr *dest, socklen_t dest_len,
+                     IPCryptMode mode, const uint8_t *key, size_t key_len,
+                     IPCryptLogRandomFn random, void *opaque, unsigned int flags)
+{
+    IPCryptRelay *relay;
+    size_t        i;
+
+    if (key_len == 0 || key_len != relay_key_bytes(mode) ||
+        (relay_tweak_bytes(mode) != 0 && random == NULL) ||
+        (dest != NULL && (size_t) dest_len > sizeof relay->dest) ||
+        (flags & ~IPCRYPT_RELAY_PREPEND_PEER) != 0) {
+        return NULL;
+    }
+    if ((relay = (IPCryptRelay *) calloc(1, sizeof *relay)) == NULL) {
+        return NULL;
+    }
+    if ((relay->log = ipcrypt_log_create(mode, key, key_len, random, opaque)) == NULL) {
+        free(relay);
+        return NULL;
+    }
+    relay->out_bytes =
+        RELAY_PEER_PREFIX_BYTES + ipcrypt_log_max_output(relay->log, IPCRYPT_RELAY_DATAGRAM_BYTES);
+    relay->in  = (uint8_t *) malloc(IPCRYPT_RELAY_BATCH * IPCRYPT_RELAY_DATAGRAM_BYTES);
+    relay->out = (uint8_t *) malloc(IPCRYPT_RELAY_BATCH * relay->out_bytes);
+    if (relay->in == NULL || relay->out == NULL) {
+        ipcrypt_relay_destroy(relay);
+        return NULL;
+    }
+    switch (mode) {
+    case IPCRYPT_MODE_DETERMINISTIC:
+    case IPCRYPT_MODE_ND:
+        ipcrypt_init(&relay->ctx.ipcrypt, key);
+        break;
+    case IPCRYPT_MODE_PFX:
+        ipcrypt_pfx_init(&relay->ctx.ipcrypt_pfx, key);
+        break;
+    case IPCRYPT_MODE_NDX:
+        ipcrypt_ndx_init(&relay->ctx.ipcrypt_ndx, key);
+        break;
+    }
+    relay->mode   = mode;
+    relay->random = random;
+    relay->opaque = opaque;
+    relay->in_fd  = in_fd;
+    relay->out_fd = out_fd;
+    relay->flags  = flags;
+    if (dest != NULL) {
+        memcpy(&relay->dest, dest, (size_t) dest_len);
+        relay->dest_len = dest_len;
+    }
+    for (i = 0; i < IPCRYPT_RELAY_BATCH; i++) {
+        relay->in_iovs[i].iov_base             = relay->in + i * IPCRYPT_RELAY_DATAGRAM_BYTES;
+        relay->in_iovs[i].iov_len              = IPCRYPT_RELAY_DATAGRAM_BYTES;
+        relay->out_msgs[i].msg_hdr.msg_name    = dest != NULL ? &relay->dest : NULL;
+        relay->out_msgs[i].msg_hdr.msg_namelen = dest != NULL ? dest_len : 0;
+        relay->out_msgs[i].msg_hdr.msg_iov     = &relay->out_iovs[i];
+        relay->out_msgs[i].msg_hdr.msg_iovlen  = 1;
+    }
+    return relay;
+}
+
+void
+ipcrypt_relay_destroy(IPCryptRelay *relay)
+{
+    if (relay == NULL) {
+        return;
+    }
+    switch (relay->mode) {
+    case IPCRYPT_MODE_DETERMINISTIC:
+    case IPCRYPT_MODE_ND:
+        ipcrypt_deinit(&relay->ctx.ipcrypt);
+        break;
+    case IPCRYPT_MODE_PFX:
+        ipcrypt_pfx_deinit(&relay->ctx.ipcrypt_pfx);
+        break;
+    case IPCRYPT_MODE_NDX:
+        ipcrypt_ndx_deinit(&relay->ctx.ipcrypt_ndx);
+        break;
+    }
+    ipcrypt_log_destroy(relay->log);
+    free(relay->in);
+    free(relay->out);
+    free(relay);
+}
+
+int
+ipcrypt_relay_step(IPCryptRelay *relay)
+{
+    const uint64_t tokens = ipcrypt_log_tokens(relay->log);
+    char          *out;
+    size_t         count = 0;
+    size_t         len;
+    size_t         i;
+    int            n;
+
+    if ((n = relay_receive(relay)) <= 0) {
+        return n;
+    }
+    relay->stats.received += (uint64_t) n;
+    relay->stats.batches++;
+    if (relay->flags & IPCRYPT_RELAY_PREPEND_PEER) {
+        relay_encrypt_peers(relay, (size_t) n);
+    }
+    for (i = 0; i < (size_t) n; i++) {
+        if (relay->in_msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            relay->stats.dropped++;
+            continue;
+        }
+        out = (char *) relay->out + count * relay->out_bytes;
+        len = 0;
+        if (relay->flags & IPCRYPT_RELAY_PREPEND_PEER) {
+            len = relay_format_peer(relay, out, i);
+        }
+        relay->out_iovs[count].iov_base = out;
+        relay->out_iovs[count].iov_len  = len;
+        relay->payload_ins[count]       = (const char *) relay->in_iovs[i].iov_base;
+        relay->payload_in_lens[count]   = relay->in_msgs[i].msg_len;
+        relay->payload_outs[count]      = out + len;
+        count++;
+    }
+    ipcrypt_log_process_messages(relay->log, relay->payload_outs, relay->payload_out_lens,
+                                 relay->payload_ins, relay->payload_in_lens, count);
+    for (i = 0; i < count; i++) {
+        relay->out_iovs[i].iov_len += relay->payload_out_lens[i];
+    }
+    relay->stats.addresses += ipcrypt_log_tokens(relay->log) - tokens;
+    relay_send(relay, count);
+
+    return n;
+}
+
+void
+ipcrypt_relay_stats(const IPCryptRelay *relay, IPCryptRelayStats *stats)
+{
+    *stats = relay->stats;
+}
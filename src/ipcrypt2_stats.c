@@ -0,0 +1,193 @@
+/**
+ * Instrumentation for IPCrypt2.
+ *
+ * Threads are assigned a slot the first time they count something. Slots are linked into a list,
+ * that is only walked under a lock, by snapshots and by threads looking for a free slot. Writers
+ * never take the lock once they have a slot.
+ *
+ * Counters are never reset: ipcrypt_stats_reset() records their current sums as a baseline, that
+ * is subtracted from subsequent snapshots, so that no thread ever has to see its counters being
+ * modified by another thread.
+ */
+
+#if defined(IPCRYPT_USDT) && defined(__linux__) && !defined(_GNU_SOURCE)
+#    define _GNU_SOURCE // clock_gettime(), used by the instrumentation hooks.
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(IPCRYPT_STATS) && defined(_WIN32)
+#    include <windows.h>
+#endif
+
+#include "ipcrypt2_stats_hooks.h"
+
+#ifdef IPCRYPT_USDT
+__extension__ unsigned short ipcrypt2_batch__start_semaphore
+    __attribute__((unused, section(".probes")));
+__extension__ unsigned short ipcrypt2_batch__done_semaphore
+    __attribute__((unused, section(".probes")));
+#endif
+
+#ifdef IPCRYPT_STATS
+
+#    ifdef _WIN32
+typedef SRWLOCK StatsMutex;
+
+#        define STATS_MUTEX_INITIALIZER SRWLOCK_INIT
+#        define stats_mutex_lock(m)     AcquireSRWLockExclusive(m)
+#        define stats_mutex_unlock(m)   ReleaseSRWLockExclusive(m)
+#    else
+#        include <pthread.h>
+
+typedef pthread_mutex_t StatsMutex;
+
+#        define STATS_MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#        define stats_mutex_lock(m)     pthread_mutex_lock(m)
+#        define stats_mutex_unlock(m)   pthread_mutex_unlock(m)
+#    endif
+
+STATS_THREAD_LOCAL StatsSlot *ipcrypt_stats_thread_slot;
+
+static StatsMutex stats_lock = STATS_MUTEX_INITIALIZER;
+static StatsSlot *stats_slots;
+static uint64_t   stats_baseline[STATS_COUNTERS];
+
+#    ifndef _WIN32
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t  stats_key;
+static int            stats_key_ok;
+
+/**
+ * stats_release returns the slot of an exiting thread to the list of free slots.
+ * Its counters are kept.
+ */
+static void
+stats_release(void *slot)
+{
+    stats_mutex_lock(&stats_lock);
+    ((StatsSlot *) slot)->in_use = 0;
+    stats_mutex_unlock(&stats_lock);
+}
+
+static void
+stats_create_key(void)
+{
+    stats_key_ok = pthread_key_create(&stats_key, stats_release) == 0;
+}
+#    endif
+
+StatsSlot *
+ipcrypt_stats_register_thread(void)
+{
+    StatsSlot *slot;
+
+#    ifndef _WIN32
+    pthread_once(&stats_once, stats_create_key);
+#    endif
+    stats_mutex_lock(&stats_lock);
+    for (slot = stats_slots; slot != NULL; slot = slot->next) {
+        if (!slot->in_use) {
+            break;
+        }
+    }
+    if (slot == NULL && (slot = (StatsSlot *) calloc(1, sizeof *slot)) != NULL) {
+        slot->next  = stats_slots;
+        stats_slots = slot;
+    }
+    if (slot != NULL) {
+        slot->in_use = 1;
+    }
+    stats_mutex_unlock(&stats_lock);
+    if (slot == NULL) {
+        return NULL;
+    }
+#    ifndef _WIN32
+    // Without a destructor, the slot is never reused, but counting still works.
+    if (stats_key_ok) {
+        pthread_setspecific(stats_key, slot);
+    }
+#    endif
+    ipcrypt_stats_thread_slot = slot;
+
+    return slot;
+}
+
+/**
+ * stats_sum stores the sums of the counters of all the slots into `sums`.
+ * Must be called with the lock held.
+ */
+static void
+stats_sum(uint64_t sums[STATS_COUNTERS])
+{
+    const StatsSlot *slot;
+    size_t           i;
+
+    memset(sums, 0, STATS_COUNTERS * sizeof sums[0]);
+    for (slot = stats_slots; slot != NULL; slot = slot->next) {
+        for (i = 0; i < STATS_COUNTERS; i++) {
+            sums[i] += atomic_load_explicit(&slot->counters[i], memory_order_relaxed);
+        }
+    }
+}
+
+int
+ipcrypt_stats_enabled(void)
+{
+    return 1;
+}
+
+void
+ipcrypt_stats_snapshot(IPCryptStats *stats)
+{
+    uint64_t sums[STATS_COUNTERS];
+    size_t   i;
+
+    stats_mutex_lock(&stats_lock);
+    stats_sum(sums);
+    for (i = 0; i < STATS_COUNTERS; i++) {
+        sums[i] -= stats_baseline[i];
+    }
+    stats_mutex_unlock(&stats_lock);
+
+    for (i = 0; i < IPCRYPT_STATS_MODES; i++) {
+        stats->operations[i] = sums[STATS_OPERATIONS + i];
+        stats->bytes[i]      = sums[STATS_BYTES + i];
+        stats->batches[i]    = sums[STATS_BATCHES + i];
+    }
+    stats->errors         = sums[STATS_ERRORS];
+    stats->parse_errors   = sums[STATS_PARSE_ERRORS];
+    stats->keyring_hits   = sums[STATS_KEYRING_HITS];
+    stats->keyring_misses = sums[STATS_KEYRING_MISSES];
+}
+
+void
+ipcrypt_stats_reset(void)
+{
+    stats_mutex_lock(&stats_lock);
+    stats_sum(stats_baseline);
+    stats_mutex_unlock(&stats_lock);
+}
+
+#else
+
+int
+ipcrypt_stats_enabled(void)
+{
+    return 0;
+}
+
+void
+ipcrypt_stats_snapshot(IPCryptStats *stats)
+{
+    memset(stats, 0, sizeof *stats);
+}
+
+void
+ipcrypt_stats_reset(void)
+{
+}
+
+#endif
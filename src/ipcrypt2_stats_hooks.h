@@ -0,0 +1,165 @@
+/**
+ * Instrumentation hooks for the components of IPCrypt2. This header is not installed.
+ *
+ * Every hook compiles to nothing unless IPCRYPT_STATS or IPCRYPT_USDT is defined.
+ *
+ * With IPCRYPT_STATS, counters are updated in the slot of the calling thread. A slot is only
+ * written by its own thread, so a relaxed load followed by a relaxed store is enough, and compiles
+ * to plain memory accesses. Atomics only make concurrent snapshots well-defined.
+ *
+ * With IPCRYPT_USDT, batch functions fire static tracepoints. Durations are not counted, as reading
+ * the clock costs more than a small batch; they are only measured for attached tracers.
+ */
+
+#ifndef ipcrypt2_stats_hooks_H
+#define ipcrypt2_stats_hooks_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "include/ipcrypt2_stats.h"
+
+#ifdef IPCRYPT_STATS
+#    include <stdatomic.h>
+#endif
+#ifdef IPCRYPT_USDT
+#    include <time.h>
+#    define _SDT_HAS_SEMAPHORES 1
+#    include <sys/sdt.h>
+#endif
+
+/**
+ * Indices of the counters of a slot, in the order of the fields of IPCryptStats.
+ */
+enum {
+    STATS_OPERATIONS     = 0,
+    STATS_BYTES          = STATS_OPERATIONS + IPCRYPT_STATS_MODES,
+    STATS_BATCHES        = STATS_BYTES + IPCRYPT_STATS_MODES,
+    STATS_ERRORS         = STATS_BATCHES + IPCRYPT_STATS_MODES,
+    STATS_PARSE_ERRORS   = STATS_ERRORS + 1,
+    STATS_KEYRING_HITS   = STATS_PARSE_ERRORS + 1,
+    STATS_KEYRING_MISSES = STATS_KEYRING_HITS + 1,
+    STATS_COUNTERS       = STATS_KEYRING_MISSES + 1
+};
+
+#ifdef IPCRYPT_STATS
+
+/** Cache line size, used to keep the slots of different threads on separate cache lines. */
+#    define STATS_CACHE_LINE_BYTES 64
+
+/**
+ * StatsSlot holds the counters of a thread. Slots are never freed; the slot of a thread that has
+ * exited is reused by the next thread, which keeps adding to its counters.
+ */
+typedef struct StatsSlot {
+    unsigned char         padding_before[STATS_CACHE_LINE_BYTES];
+    atomic_uint_least64_t counters[STATS_COUNTERS];
+    struct StatsSlot     *next;
+    int                   in_use;
+    unsigned char         padding_after[STATS_CACHE_LINE_BYTES];
+} StatsSlot;
+
+#    if defined(_MSC_VER) && !defined(__clang__)
+#        define STATS_THREAD_LOCAL __declspec(thread)
+#    else
+#        define STATS_THREAD_LOCAL _Thread_local
+#    endif
+
+/** Slot of the calling thread, or NULL if it hasn't been assigned one yet. */
+extern STATS_THREAD_LOCAL StatsSlot *ipcrypt_stats_thread_slot;
+
+/**
+ * Assign a slot to the calling thread. Returns NULL if memory could not be allocated.
+ */
+StatsSlot *ipcrypt_stats_register_thread(void);
+
+static inline void
+stats_add(unsigned int counter, uint64_t n)
+{
+    StatsSlot *slot = ipcrypt_stats_thread_slot;
+
+    if (slot == NULL && (slot = ipcrypt_stats_register_thread()) == NULL) {
+        return;
+    }
+    atomic_store_explicit(&slot->counters[counter],
+                          atomic_load_explicit(&slot->counters[counter], memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+#    define STATS_ADD(counter, n) stats_add((unsigned int) (counter), (uint64_t) (n))
+#else
+#    define STATS_ADD(counter, n) ((void) 0)
+#endif
+
+/** Count a single address of `bytes` bytes processed with `mode`. */
+#define STATS_OP(mode, bytes) \
+    (STATS_ADD(STATS_OPERATIONS + (mode), 1), STATS_ADD(STATS_BYTES + (mode), (bytes)))
+
+/** Count a call rejected because of an invalid layout. */
+#define STATS_ERROR() STATS_ADD(STATS_ERRORS, 1)
+
+/** Count a string that couldn't be parsed as an address. */
+#define STATS_PARSE_ERROR() STATS_ADD(STATS_PARSE_ERRORS, 1)
+
+/** Count a keyring lookup, that found the key if `found` is not zero. */
+#define STATS_KEYRING_LOOKUP(found) \
+    STATS_ADD((found) ? STATS_KEYRING_HITS : STATS_KEYRING_MISSES, 1)
+
+#ifdef IPCRYPT_USDT
+
+/**
+ * Probe semaphores, set by tracers while they are attached, so that the clock is only read when the
+ * duration of a batch is going to be reported.
+ */
+extern unsigned short ipcrypt2_batch__start_semaphore;
+extern unsigned short ipcrypt2_batch__done_semaphore;
+
+static inline uint64_t
+stats_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000U + (uint64_t) ts.tv_nsec;
+}
+
+static inline uint64_t
+stats_batch_start(unsigned int mode, int decrypt, size_t count)
+{
+    if (ipcrypt2_batch__start_semaphore) {
+        DTRACE_PROBE3(ipcrypt2, batch__start, mode, decrypt, count);
+    }
+    return ipcrypt2_batch__done_semaphore ? stats_now_ns() : 0;
+}
+
+static inline void
+stats_batch_probe(unsigned int mode, int decrypt, size_t count, uint64_t start)
+{
+    if (ipcrypt2_batch__done_semaphore && start != 0) {
+        const uint64_t ns = stats_now_ns() - start;
+
+        DTRACE_PROBE4(ipcrypt2, batch__done, mode, decrypt, count, ns);
+    }
+}
+
+#    define STATS_BATCH_PROBE(mode, decrypt, count) \
+        stats_batch_probe((unsigned int) (mode), (decrypt), (count), stats_start)
+#else
+#    define STATS_BATCH_PROBE(mode, decrypt, count) ((void) 0)
+#endif
+
+/**
+ * STATS_BATCH_BEGIN and STATS_BATCH_END surround the work of a batch function, in the same block.
+ */
+#ifdef IPCRYPT_USDT
+#    define STATS_BATCH_BEGIN(mode, decrypt, count) \
+        const uint64_t stats_start = stats_batch_start((unsigned int) (mode), (decrypt), (count))
+#else
+#    define STATS_BATCH_BEGIN(mode, decrypt, count) ((void) 0)
+#endif
+#define STATS_BATCH_END(mode, decrypt, count, field_bytes)                               \
+    (STATS_ADD(STATS_OPERATIONS + (mode), (count)),                                     \
+     STATS_ADD(STATS_BYTES + (mode), (count) * (field_bytes)),                          \
+     STATS_ADD(STATS_BATCHES + (mode), 1), STATS_BATCH_PROBE((mode), (decrypt), (count)))
+
+#endif
@@ -0,0 +1,178 @@
+/**
+ * Tests of the C++20 interface.
+ *
+ * Every mode is checked against a test vector, and against the C API, through single addresses and
+ * through spans. The spans are long enough to span multiple batches, and spans of different
+ * lengths check that nothing is written past the shortest one.
+ *
+ * Built with -Wall -Wextra -Wpedantic, so that breakage in the templates is caught even though the
+ * library itself is written in C.
+ */
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "ipcrypt2.hpp"
+
+#define CHECK(cond)                                                                 \
+    do {                                                                            \
+        if (!(cond)) {                                                              \
+            std::fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);         \
+            failures++;                                                             \
+        }                                                                           \
+    } while (0)
+
+namespace {
+
+int failures = 0;
+
+template <std::size_t N>
+std::array<std::uint8_t, N>
+from_hex(const char *hex)
+{
+    std::array<std::uint8_t, N> bin {};
+    unsigned int                byte;
+
+    CHECK(std::strlen(hex) == 2 * N);
+    for (std::size_t i = 0; i < N; i++) {
+        CHECK(std::sscanf(hex + 2 * i, "%2x", &byte) == 1);
+        bin[i] = (std::uint8_t) byte;
+    }
+    return bin;
+}
+
+ipcrypt2::Address
+from_str(const char *str)
+{
+    ipcrypt2::Address ip {};
+
+    CHECK(ipcrypt_str_to_ip16(ip.data(), str) == 0);
+    return ip;
+}
+
+std::string
+to_str(const ipcrypt2::Address &ip)
+{
+    char str[IPCRYPT_MAX_IP_STR_BYTES];
+
+    return std::string(str, ipcrypt_ip16_to_str(str, ip.data()));
+}
+
+/** Addresses of both families, with 1 in 3 being IPv4-mapped. */
+std::vector<ipcrypt2::Address>
+addresses(std::size_t count)
+{
+    std::vector<ipcrypt2::Address> ips(count);
+
+    for (std::size_t i = 0; i < count; i++) {
+        for (std::size_t j = 0; j < 16; j++) {
+            ips[i][j] = (std::uint8_t) (i * 31 + j * 17);
+        }
+        if (i % 3 == 0) {
+            std::memset(ips[i].data(), 0, 10);
+            ips[i][10] = ips[i][11] = 0xff;
+        }
+    }
+    return ips;
+}
+
+template <typename Mode>
+void
+test_format_preserving(const char *key_hex, const char *ip, const char *expected)
+{
+    using Cipher = ipcrypt2::Cipher<Mode>;
+
+    const Cipher                         cipher(from_hex<Mode::key_bytes>(key_hex));
+    const std::vector<ipcrypt2::Address> ips = addresses(200);
+    std::vector<ipcrypt2::Address>       out(ips.size());
+    std::vector<ipcrypt2::Address>       back(ips.size());
+
+    CHECK(to_str(cipher.encrypt(from_str(ip))) == expected);
+    CHECK(cipher.decrypt(from_str(expected)) == from_str(ip));
+
+    CHECK(cipher.encrypt(ips, out) == ips.size());
+    for (std::size_t i = 0; i < ips.size(); i++) {
+        ipcrypt2::Address ip16 = ips[i];
+
+        Mode::encrypt(cipher.context(), ip16.data());
+        CHECK(out[i] == ip16);
+    }
+    CHECK(cipher.decrypt(out, back) == ips.size());
+    CHECK(back == ips);
+
+    cipher.decrypt(std::span<ipcrypt2::Address>(out));
+    CHECK(out == ips);
+
+    // Only the addresses that fit in the shortest span are processed.
+    back.assign(ips.size(), ipcrypt2::Address {});
+    CHECK(cipher.encrypt(ips, std::span<ipcrypt2::Address>(back).first(100)) == 100);
+    CHECK(cipher.encrypt(std::span<const ipcrypt2::Address>(ips).first(100), back) == 100);
+    CHECK(back[99] == cipher.encrypt(ips[99]) && back[100] == ipcrypt2::Address {});
+}
+
+template <typename Mode>
+void
+test_non_deterministic(const char *key_hex, const char *ip, const char *tweak_hex,
+                       const char *expected_hex)
+{
+    using Cipher = ipcrypt2::Cipher<Mode>;
+
+    const Cipher                             cipher(from_hex<Mode::key_bytes>(key_hex));
+    const std::vector<ipcrypt2::Address>     ips = addresses(200);
+    std::vector<typename Cipher::Tweak>      tweaks(ips.size());
+    std::vector<typename Cipher::Ciphertext> out(ips.size());
+    std::vector<ipcrypt2::Address>           back(ips.size());
+    const auto expected = from_hex<Mode::ciphertext_bytes>(expected_hex);
+
+    CHECK(cipher.encrypt(from_str(ip), from_hex<Mode::tweak_bytes>(tweak_hex)) == expected);
+    CHECK(cipher.decrypt(expected) == from_str(ip));
+
+    for (std::size_t i = 0; i < tweaks.size(); i++) {
+        tweaks[i].fill((std::uint8_t) (i * 7));
+    }
+    CHECK(cipher.encrypt(ips, tweaks, out) == ips.size());
+    for (std::size_t i = 0; i < ips.size(); i++) {
+        CHECK(out[i] == cipher.encrypt(ips[i], tweaks[i]));
+    }
+    CHECK(cipher.decrypt(out, back) == ips.size());
+    CHECK(back == ips);
+
+    // Only the ciphertexts that fit in the shortest span are processed.
+    back.assign(ips.size(), ipcrypt2::Address {});
+    CHECK(cipher.decrypt(out, std::span<ipcrypt2::Address>(back).first(130)) == 130);
+    CHECK(back[129] == ips[129] && back[130] == ipcrypt2::Address {});
+    CHECK(cipher.encrypt(ips, std::span<const typename Cipher::Tweak>(tweaks).first(10), out) ==
+          10);
+}
+
+}
+
+int
+main()
+{
+    test_format_preserving<ipcrypt2::mode::Deterministic>(
+        "0123456789abcdeffedcba9876543210", "0.0.0.0", "bde9:6789:d353:824c:d7c6:f58a:6bd2:26eb");
+    test_format_preserving<ipcrypt2::mode::Pfx>(
+        "0123456789abcdeffedcba98765432101032547698badcfeefcdab8967452301", "0.0.0.0",
+        "151.82.155.134");
+    test_non_deterministic<ipcrypt2::mode::Nd>("0123456789abcdeffedcba9876543210", "0.0.0.0",
+                                               "08e0c289bff23b7c",
+                                               "08e0c289bff23b7cb349aadfe3bcef56221c384c7c217b16");
+    test_non_deterministic<ipcrypt2::mode::Ndx>(
+        "0123456789abcdeffedcba98765432101032547698badcfeefcdab8967452301", "0.0.0.0",
+        "21bd1834bc088cd2b4ecbe30b70898d7",
+        "21bd1834bc088cd2b4ecbe30b70898d782db0d4125fdace61db35b8339f20ee5");
+
+    if (failures != 0) {
+        std::fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    std::puts("C++ interface tests passed");
+
+    return 0;
+}
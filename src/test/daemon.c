@@ -0,0 +1,547 @@
+/**
+ * Tests of the ipcryptd protocol.
+ *
+ * Starts the daemon whose path is given on the command line on a Unix socket in a temporary
+ * directory, and checks the known-answer vectors of every mode, a pipeline of random requests
+ * compared with the library, and the responses to malformed requests.
+ *
+ * Usage: test-daemon PATH-TO-IPCRYPTD
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ipcrypt2.h"
+
+/** Size of the header of requests and responses. */
+#define HEADER_BYTES 8U
+
+/** Number of requests of the pipeline. */
+#define PIPELINE 4000U
+
+#define KEY16 "0123456789abcdeffedcba9876543210"
+#define KEY32 "0123456789abcdeffedcba98765432101032547698badcfeefcdab8967452301"
+
+enum { OP_ENCRYPT, OP_DECRYPT, OP_STATS };
+
+enum { STATUS_OK, STATUS_INVALID, STATUS_NO_KEY };
+
+#define CHECK(cond)                                                                 \
+    do {                                                                            \
+        if (!(cond)) {                                                              \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);              \
+            failures++;                                                             \
+        }                                                                           \
+    } while (0)
+
+static unsigned int failures;
+static uint64_t     rng_state = 0x9e3779b97f4a7c15ULL;
+
+static IPCrypt    ipcrypt;
+static IPCryptPFX ipcrypt_pfx;
+static IPCryptNDX ipcrypt_ndx;
+
+typedef struct Response {
+    uint32_t id;
+    int      status;
+    size_t   len;
+    uint8_t  payload[65535];
+} Response;
+
+/** Expected result of a request of the pipeline. */
+typedef struct Expected {
+    unsigned int op;
+    unsigned int mode;
+    uint8_t      ip16[16];
+    uint8_t      out[IPCRYPT_NDX_NDIP_BYTES];
+    int          answered;
+} Expected;
+
+static void
+random_bytes(uint8_t *buf, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        rng_state ^= rng_state << 13;
+        rng_state ^= rng_state >> 7;
+        rng_state ^= rng_state << 17;
+        buf[i] = (uint8_t) (rng_state >> 32);
+    }
+}
+
+static size_t
+ciphertext_bytes(unsigned int mode)
+{
+    return mode == IPCRYPT_MODE_ND ? IPCRYPT_NDIP_BYTES
+           : mode == IPCRYPT_MODE_NDX ? IPCRYPT_NDX_NDIP_BYTES
+                                      : 16;
+}
+
+/**
+ * start_daemon starts ipcryptd on `socket_path`, with the given key options, and returns its
+ * process id, or -1 on error. Its standard error, where it prints statistics on exit, is discarded.
+ */
+static pid_t
+start_daemon(const char *daemon_path, const char *socket_path, const char *const *keys,
+             size_t keys_count)
+{
+    char  *argv[16];
+    size_t argc = 0;
+    size_t i;
+    pid_t  pid;
+
+    argv[argc++] = (char *) daemon_path;
+    argv[argc++] = (char *) "--socket";
+    argv[argc++] = (char *) socket_path;
+    for (i = 0; i < keys_count; i++) {
+        argv[argc++] = (char *) "--key";
+        argv[argc++] = (char *) keys[i];
+    }
+    argv[argc] = NULL;
+
+    if ((pid = fork()) == 0) {
+        if (freopen("/dev/null", "w", stderr) == NULL) {
+            _exit(127);
+        }
+        execv(daemon_path, argv);
+        _exit(127);
+    }
+    return pid;
+}
+
+/**
+ * stop_daemon terminates the daemon, and returns 0 if it exited cleanly.
+ */
+static int
+stop_daemon(pid_t pid)
+{
+    int status;
+
+    if (kill(pid, SIGTERM) != 0 || waitpid(pid, &status, 0) != pid) {
+        return -1;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+/**
+ * connect_daemon connects to the daemon, waiting up to 5 seconds for it to listen.
+ * Returns the socket, or -1 if the daemon exited or didn't listen in time.
+ */
+static int
+connect_daemon(pid_t pid, const char *socket_path)
+{
+    const struct timespec delay = { 0, 10000000 };
+    struct sockaddr_un    addr;
+    unsigned int          attempt;
+    int                   fd;
+
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof addr.sun_path) {
+        return -1;
+    }
+    memcpy(addr.sun_path, socket_path, strlen(socket_path));
+    for (attempt = 0; attempt < 500; attempt++) {
+        if (waitpid(pid, NULL, WNOHANG) != 0) {
+            return -1;
+        }
+        if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+            return -1;
+        }
+        if (connect(fd, (const struct sockaddr *) &addr, sizeof addr) == 0) {
+            return fd;
+        }
+        close(fd);
+        nanosleep(&delay, NULL);
+    }
+    return -1;
+}
+
+static int
+write_all(int fd, const uint8_t *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = write(fd, buf, len)) <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+/**
+ * read_all reads exactly `len` bytes. Returns 0 on success, 1 if the connection was closed before
+ * the first byte, or -1 on error.
+ */
+static int
+read_all(int fd, uint8_t *buf, size_t len)
+{
+    size_t  pos = 0;
+    ssize_t n;
+
+    while (pos < len) {
+        if ((n = read(fd, buf + pos, len - pos)) <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            return n == 0 && pos == 0 ? 1 : -1;
+        }
+        pos += (size_t) n;
+    }
+    return 0;
+}
+
+/**
+ * append_request appends a request to `out`, and returns its size.
+ */
+static size_t
+append_request(uint8_t *out, uint32_t id, unsigned int op, unsigned int mode,
+               const uint8_t *payload, size_t len)
+{
+    out[0] = (uint8_t) id;
+    out[1] = (uint8_t) (id >> 8);
+    out[2] = (uint8_t) (id >> 16);
+    out[3] = (uint8_t) (id >> 24);
+    out[4] = (uint8_t) op;
+    out[5] = (uint8_t) mode;
+    out[6] = (uint8_t) len;
+    out[7] = (uint8_t) (len >> 8);
+    if (len > 0) {
+        memcpy(out + HEADER_BYTES, payload, len);
+    }
+    return HEADER_BYTES + len;
+}
+
+/**
+ * read_response reads a response. Returns 0 on success, 1 if the connection was closed, or -1 on
+ * error.
+ */
+static int
+read_response(int fd, Response *response)
+{
+    uint8_t header[HEADER_BYTES];
+    int     ret;
+
+    if ((ret = read_all(fd, header, sizeof header)) != 0) {
+        return ret;
+    }
+    response->id = (uint32_t) header[0] | (uint32_t) header[1] << 8 |
+                   (uint32_t) header[2] << 16 | (uint32_t) header[3] << 24;
+    response->status = header[4];
+    response->len    = (size_t) header[6] | (size_t) header[7] << 8;
+    return read_all(fd, response->payload, response->len) == 0 ? 0 : -1;
+}
+
+/**
+ * call sends a single request, and reads its response.
+ * Returns 0 on success, 1 if the connection was closed, or -1 on error.
+ */
+static int
+call(int fd, unsigned int op, unsigned int mode, const uint8_t *payload, size_t len,
+     Response *response)
+{
+    uint8_t request[HEADER_BYTES + 64];
+    int     ret;
+
+    if (write_all(fd, request, append_request(request, 0x12345678, op, mode, payload, len)) != 0) {
+        return -1;
+    }
+    if ((ret = read_response(fd, response)) == 0 && response->id != 0x12345678) {
+        return -1;
+    }
+    return ret;
+}
+
+static void
+test_known_answers(int fd)
+{
+    static const struct {
+        unsigned int mode;
+        const char  *ciphertext;
+    } vectors[4] = {
+        { IPCRYPT_MODE_DETERMINISTIC, "bde9:6789:d353:824c:d7c6:f58a:6bd2:26eb" },
+        { IPCRYPT_MODE_PFX, "151.82.155.134" },
+        { IPCRYPT_MODE_ND, "08e0c289bff23b7cb349aadfe3bcef56221c384c7c217b16" },
+        { IPCRYPT_MODE_NDX, "21bd1834bc088cd2b4ecbe30b70898d782db0d4125fdace61db35b8339f20ee5" },
+    };
+    Response     response;
+    uint8_t      ip16[16], ciphertext[IPCRYPT_NDX_NDIP_BYTES];
+    uint8_t      decrypted[16];
+    size_t       len;
+    unsigned int i;
+
+    ipcrypt_str_to_ip16(ip16, "0.0.0.0");
+    for (i = 0; i < 4; i++) {
+        len = ciphertext_bytes(vectors[i].mode);
+        if (vectors[i].mode == IPCRYPT_MODE_ND) {
+            ipcrypt_ndip_from_hex(ciphertext, vectors[i].ciphertext, strlen(vectors[i].ciphertext));
+        } else if (vectors[i].mode == IPCRYPT_MODE_NDX) {
+            ipcrypt_ndx_ndip_from_hex(ciphertext, vectors[i].ciphertext,
+                                      strlen(vectors[i].ciphertext));
+        } else {
+            ipcrypt_str_to_ip16(ciphertext, vectors[i].ciphertext);
+        }
+
+        // The non-deterministic modes use a random tweak, so only their decryption is known.
+        CHECK(call(fd, OP_ENCRYPT, vectors[i].mode, ip16, 16, &response) == 0);
+        CHECK(response.status == STATUS_OK && response.len == len);
+        if (vectors[i].mode == IPCRYPT_MODE_DETERMINISTIC ||
+            vectors[i].mode == IPCRYPT_MODE_PFX) {
+            CHECK(memcmp(response.payload, ciphertext, 16) == 0);
+        } else if (vectors[i].mode == IPCRYPT_MODE_ND && response.len == len) {
+            ipcrypt_nd_decrypt_ip16(&ipcrypt, decrypted, response.payload);
+            CHECK(memcmp(decrypted, ip16, 16) == 0);
+        } else if (response.len == len) {
+            ipcrypt_ndx_decrypt_ip16(&ipcrypt_ndx, decrypted, response.payload);
+            CHECK(memcmp(decrypted, ip16, 16) == 0);
+        }
+
+        CHECK(call(fd, OP_DECRYPT, vectors[i].mode, ciphertext, len, &response) == 0);
+        CHECK(response.status == STATUS_OK && response.len == 16);
+        CHECK(memcmp(response.payload, ip16, 16) == 0);
+    }
+}
+
+/**
+ * test_pipeline sends requests for all modes and directions without waiting, so that they are
+ * batched, and compares the responses, that can arrive out of order, with the library.
+ */
+static void
+test_pipeline(int fd)
+{
+    Expected    *expected;
+    Response     response;
+    uint8_t     *requests;
+    uint8_t      tweak[IPCRYPT_NDX_TWEAKBYTES];
+    uint8_t      decrypted[16];
+    size_t       requests_len = 0;
+    unsigned int i;
+    int          ret;
+
+    expected = (Expected *) calloc(PIPELINE, sizeof *expected);
+    requests = (uint8_t *) malloc(PIPELINE * (HEADER_BYTES + IPCRYPT_NDX_NDIP_BYTES));
+    if (expected == NULL || requests == NULL) {
+        CHECK(0);
+        free(expected);
+        free(requests);
+        return;
+    }
+    for (i = 0; i < PIPELINE; i++) {
+        expected[i].op   = i % 2;
+        expected[i].mode = (i / 2) % 4;
+        random_bytes(expected[i].ip16, 16);
+        if (i % 3 == 0) {
+            ipcrypt_str_to_ip16(expected[i].ip16, "192.0.2.1");
+            expected[i].ip16[15] = (uint8_t) i;
+        }
+        random_bytes(tweak, sizeof tweak);
+        switch (expected[i].mode) {
+        case IPCRYPT_MODE_DETERMINISTIC:
+            memcpy(expected[i].out, expected[i].ip16, 16);
+            ipcrypt_encrypt_ip16(&ipcrypt, expected[i].out);
+            break;
+        case IPCRYPT_MODE_PFX:
+            memcpy(expected[i].out, expected[i].ip16, 16);
+            ipcrypt_pfx_encrypt_ip16(&ipcrypt_pfx, expected[i].out);
+            break;
+        case IPCRYPT_MODE_ND:
+            ipcrypt_nd_encrypt_ip16(&ipcrypt, expected[i].out, expected[i].ip16, tweak);
+            break;
+        default:
+            ipcrypt_ndx_encrypt_ip16(&ipcrypt_ndx, expected[i].out, expected[i].ip16, tweak);
+            break;
+        }
+        if (expected[i].op == OP_ENCRYPT) {
+            requests_len += append_request(requests + requests_len, i, OP_ENCRYPT,
+                                           expected[i].mode, expected[i].ip16, 16);
+        } else {
+            requests_len += append_request(requests + requests_len, i, OP_DECRYPT,
+                                           expected[i].mode, expected[i].out,
+                                           ciphertext_bytes(expected[i].mode));
+        }
+    }
+    CHECK(write_all(fd, requests, requests_len) == 0);
+
+    for (i = 0; i < PIPELINE; i++) {
+        if ((ret = read_response(fd, &response)) != 0) {
+            CHECK(ret == 0);
+            break;
+        }
+        if (response.id >= PIPELINE || expected[response.id].answered) {
+            CHECK(response.id < PIPELINE && !expected[response.id].answered);
+            continue;
+        }
+        expected[response.id].answered = 1;
+        CHECK(response.status == STATUS_OK);
+        if (expected[response.id].op == OP_DECRYPT) {
+            CHECK(response.len == 16);
+            CHECK(memcmp(response.payload, expected[response.id].ip16, 16) == 0);
+            continue;
+        }
+        CHECK(response.len == ciphertext_bytes(expected[response.id].mode));
+        if (response.len != ciphertext_bytes(expected[response.id].mode)) {
+            continue;
+        }
+        switch (expected[response.id].mode) {
+        case IPCRYPT_MODE_DETERMINISTIC:
+        case IPCRYPT_MODE_PFX:
+            CHECK(memcmp(response.payload, expected[response.id].out, 16) == 0);
+            break;
+        case IPCRYPT_MODE_ND:
+            ipcrypt_nd_decrypt_ip16(&ipcrypt, decrypted, response.payload);
+            CHECK(memcmp(decrypted, expected[response.id].ip16, 16) == 0);
+            break;
+        default:
+            ipcrypt_ndx_decrypt_ip16(&ipcrypt_ndx, decrypted, response.payload);
+            CHECK(memcmp(decrypted, expected[response.id].ip16, 16) == 0);
+            break;
+        }
+    }
+    free(expected);
+    free(requests);
+}
+
+static void
+test_invalid_requests(int fd)
+{
+    Response response;
+    uint8_t  payload[64] = { 0 };
+    uint8_t  request[HEADER_BYTES + 64];
+
+    CHECK(call(fd, 3, IPCRYPT_MODE_DETERMINISTIC, payload, 16, &response) == 0);
+    CHECK(response.status == STATUS_INVALID && response.len == 0);
+    CHECK(call(fd, OP_ENCRYPT, 4, payload, 16, &response) == 0);
+    CHECK(response.status == STATUS_INVALID && response.len == 0);
+    CHECK(call(fd, OP_ENCRYPT, IPCRYPT_MODE_PFX, payload, 4, &response) == 0);
+    CHECK(response.status == STATUS_INVALID && response.len == 0);
+    CHECK(call(fd, OP_ENCRYPT, IPCRYPT_MODE_ND, payload, IPCRYPT_NDIP_BYTES, &response) == 0);
+    CHECK(response.status == STATUS_INVALID && response.len == 0);
+    CHECK(call(fd, OP_DECRYPT, IPCRYPT_MODE_ND, payload, 16, &response) == 0);
+    CHECK(response.status == STATUS_INVALID && response.len == 0);
+    CHECK(call(fd, OP_DECRYPT, IPCRYPT_MODE_NDX, payload, IPCRYPT_NDIP_BYTES, &response) == 0);
+    CHECK(response.status == STATUS_INVALID && response.len == 0);
+    CHECK(call(fd, OP_DECRYPT, IPCRYPT_MODE_DETERMINISTIC, payload, 0, &response) == 0);
+    CHECK(response.status == STATUS_INVALID && response.len == 0);
+
+    // The connection is still usable after invalid requests.
+    CHECK(call(fd, OP_STATS, 0, NULL, 0, &response) == 0);
+    CHECK(response.status == STATUS_OK && response.len > 0);
+    response.payload[response.len < sizeof response.payload ? response.len : 0] = 0;
+    CHECK(strstr((const char *) response.payload, "deterministic encrypt:") != NULL);
+    CHECK(strstr((const char *) response.payload, "ndx decrypt:") != NULL);
+
+    // A payload larger than any request can't be skipped safely, so the connection is closed.
+    CHECK(write_all(fd, request,
+                    append_request(request, 1, OP_ENCRYPT, IPCRYPT_MODE_NDX, payload,
+                                   IPCRYPT_NDX_NDIP_BYTES + 1)) == 0);
+    CHECK(read_response(fd, &response) == 1);
+}
+
+static void
+test_missing_key(const char *daemon_path, const char *socket_path)
+{
+    static const char *const keys[1] = { "pfx=" KEY32 };
+    Response                 response;
+    uint8_t                  ip16[16] = { 0 };
+    pid_t                    pid;
+    int                      fd;
+
+    if ((pid = start_daemon(daemon_path, socket_path, keys, 1)) == -1) {
+        CHECK(pid != -1);
+        return;
+    }
+    if ((fd = connect_daemon(pid, socket_path)) == -1) {
+        CHECK(fd != -1);
+        (void) stop_daemon(pid);
+        return;
+    }
+    CHECK(call(fd, OP_ENCRYPT, IPCRYPT_MODE_ND, ip16, 16, &response) == 0);
+    CHECK(response.status == STATUS_NO_KEY && response.len == 0);
+    CHECK(call(fd, OP_ENCRYPT, IPCRYPT_MODE_DETERMINISTIC, ip16, 16, &response) == 0);
+    CHECK(response.status == STATUS_NO_KEY && response.len == 0);
+    CHECK(call(fd, OP_ENCRYPT, IPCRYPT_MODE_PFX, ip16, 16, &response) == 0);
+    CHECK(response.status == STATUS_OK && response.len == 16);
+    close(fd);
+    CHECK(stop_daemon(pid) == 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const char *const keys[4] = { "deterministic=" KEY16, "pfx=" KEY32, "nd=" KEY16,
+                                         "ndx=" KEY32 };
+    struct sigaction         sa;
+    uint8_t                  key[IPCRYPT_NDX_KEYBYTES];
+    char                     dir[] = "/tmp/ipcryptd-test-XXXXXX";
+    char                     socket_path[64];
+    pid_t                    pid;
+    int                      fd;
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s PATH-TO-IPCRYPTD\n", argv[0]);
+        return 1;
+    }
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+
+    ipcrypt_key_from_hex(key, IPCRYPT_KEYBYTES, KEY16, strlen(KEY16));
+    ipcrypt_init(&ipcrypt, key);
+    ipcrypt_key_from_hex(key, IPCRYPT_PFX_KEYBYTES, KEY32, strlen(KEY32));
+    ipcrypt_pfx_init(&ipcrypt_pfx, key);
+    ipcrypt_ndx_init(&ipcrypt_ndx, key);
+
+    if (mkdtemp(dir) == NULL) {
+        fprintf(stderr, "mkdtemp: %s\n", strerror(errno));
+        return 1;
+    }
+    snprintf(socket_path, sizeof socket_path, "%s/ipcryptd.sock", dir);
+
+    if ((pid = start_daemon(argv[1], socket_path, keys, 4)) == -1 ||
+        (fd = connect_daemon(pid, socket_path)) == -1) {
+        fprintf(stderr, "%s didn't start\n", argv[1]);
+        if (pid != -1) {
+            (void) stop_daemon(pid);
+        }
+        rmdir(dir);
+        return 1;
+    }
+    test_known_answers(fd);
+    test_pipeline(fd);
+    test_invalid_requests(fd);
+    close(fd);
+    CHECK(stop_daemon(pid) == 0);
+    CHECK(access(socket_path, F_OK) != 0);
+
+    test_missing_key(argv[1], socket_path);
+    (void) unlink(socket_path);
+    rmdir(dir);
+
+    ipcrypt_ndx_deinit(&ipcrypt_ndx);
+    ipcrypt_pfx_deinit(&ipcrypt_pfx);
+    ipcrypt_deinit(&ipcrypt);
+
+    if (failures != 0) {
+        fprintf(stderr, "%u checks failed\n", failures);
+        return 1;
+    }
+    puts("Daemon tests passed");
+
+    return 0;
+}
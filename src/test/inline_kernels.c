@@ -0,0 +1,48 @@
+/**
+ * Non-inline wrappers around the inline kernels, compiled once with AES instructions and once
+ * without. IPCRYPT_TEST_INLINE_PREFIX is the prefix of the names of the wrappers of each build.
+ */
+
+#include "ipcrypt2_inline.h"
+
+#include "inline_kernels.h"
+
+#define TEST_CONCAT_(a, b) a##b
+#define TEST_CONCAT(a, b)  TEST_CONCAT_(a, b)
+#define TEST_NAME(name)    TEST_CONCAT(IPCRYPT_TEST_INLINE_PREFIX, name)
+
+int
+TEST_NAME(_kernels)(void)
+{
+#if defined(IPCRYPT_INLINE_AESNI) || defined(IPCRYPT_INLINE_ARMAES)
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+void
+TEST_NAME(_encrypt_ip16)(const IPCrypt *ipcrypt, uint8_t ip16[16])
+{
+    ipcrypt_inline_encrypt_ip16(ipcrypt, ip16);
+}
+
+void
+TEST_NAME(_nd_encrypt_ip16)(const IPCrypt *ipcrypt, uint8_t ndip[IPCRYPT_NDIP_BYTES],
+                            const uint8_t ip16[16], const uint8_t random[IPCRYPT_TWEAKBYTES])
+{
+    ipcrypt_inline_nd_encrypt_ip16(ipcrypt, ndip, ip16, random);
+}
+
+void
+TEST_NAME(_ndx_encrypt_ip16)(const IPCryptNDX *ipcrypt, uint8_t ndip[IPCRYPT_NDX_NDIP_BYTES],
+                             const uint8_t ip16[16], const uint8_t random[IPCRYPT_NDX_TWEAKBYTES])
+{
+    ipcrypt_inline_ndx_encrypt_ip16(ipcrypt, ndip, ip16, random);
+}
+
+void
+TEST_NAME(_pfx_encrypt_ip16)(const IPCryptPFX *ipcrypt, uint8_t ip16[16])
+{
+    ipcrypt_inline_pfx_encrypt_ip16(ipcrypt, ip16);
+}
@@ -0,0 +1,39 @@
+#ifndef inline_kernels_H
+#define inline_kernels_H
+
+#include "ipcrypt2.h"
+
+/*
+ * Non-inline wrappers around the kernels of ipcrypt2_inline.h, for the tests.
+ *
+ * inline_kernels.c is compiled twice: with AES instructions, so that the kernels are used (the
+ * ipcrypt_test_inline_aes_* functions), and without, so that they call the library (the
+ * ipcrypt_test_inline_lib_* functions). The *_kernels() functions return 1 if the kernels were
+ * compiled in.
+ */
+
+int  ipcrypt_test_inline_aes_kernels(void);
+void ipcrypt_test_inline_aes_encrypt_ip16(const IPCrypt *ipcrypt, uint8_t ip16[16]);
+void ipcrypt_test_inline_aes_nd_encrypt_ip16(const IPCrypt *ipcrypt,
+                                             uint8_t        ndip[IPCRYPT_NDIP_BYTES],
+                                             const uint8_t  ip16[16],
+                                             const uint8_t  random[IPCRYPT_TWEAKBYTES]);
+void ipcrypt_test_inline_aes_ndx_encrypt_ip16(const IPCryptNDX *ipcrypt,
+                                              uint8_t           ndip[IPCRYPT_NDX_NDIP_BYTES],
+                                              const uint8_t     ip16[16],
+                                              const uint8_t     random[IPCRYPT_NDX_TWEAKBYTES]);
+void ipcrypt_test_inline_aes_pfx_encrypt_ip16(const IPCryptPFX *ipcrypt, uint8_t ip16[16]);
+
+int  ipcrypt_test_inline_lib_kernels(void);
+void ipcrypt_test_inline_lib_encrypt_ip16(const IPCrypt *ipcrypt, uint8_t ip16[16]);
+void ipcrypt_test_inline_lib_nd_encrypt_ip16(const IPCrypt *ipcrypt,
+                                             uint8_t        ndip[IPCRYPT_NDIP_BYTES],
+                                             const uint8_t  ip16[16],
+                                             const uint8_t  random[IPCRYPT_TWEAKBYTES]);
+void ipcrypt_test_inline_lib_ndx_encrypt_ip16(const IPCryptNDX *ipcrypt,
+                                              uint8_t           ndip[IPCRYPT_NDX_NDIP_BYTES],
+                                              const uint8_t     ip16[16],
+                                              const uint8_t     random[IPCRYPT_NDX_TWEAKBYTES]);
+void ipcrypt_test_inline_lib_pfx_encrypt_ip16(const IPCryptPFX *ipcrypt, uint8_t ip16[16]);
+
+#endif
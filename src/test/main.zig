@@ -1,6 +1,23 @@
-const ipcrypt = @cImport(@cInclude("ipcrypt2.h"));
+const ipcrypt = @cImport({
+    @cInclude("ipcrypt2.h");
+    @cInclude("ipcrypt2_pool.h");
+    @cInclude("ipcrypt2_keyring.h");
+    @cInclude("ipcrypt2_log.h");
+    @cInclude("ipcrypt2_packet.h");
+    @cInclude("ipcrypt2_pcap.h");
+    @cInclude("ipcrypt2_file.h");
+    @cInclude("ipcrypt2_csv.h");
+    @cInclude("ipcrypt2_dnstap.h");
+    @cInclude("ipcrypt2_records.h");
+    @cInclude("ipcrypt2_stats.h");
+    @cInclude("ipcrypt2_blob.h");
+    @cInclude("ipcrypt2_relay.h");
+    @cInclude("ipcrypt2_flow.h");
+    @cInclude("inline_kernels.h");
+});
 
 const std = @import("std");
+const builtin = @import("builtin");
 const testing = std.testing;
 
 test "ip string encryption and decryption" {
@@ -680,3 +697,1159 @@ test "ipcrypt-pfx test vectors from python reference" {
         try testing.expectEqualSlices(u8, expected, encrypted_ip);
     }
 }
+
+test "strided batch encryption of records" {
+    const Record = extern struct {
+        src: [16]u8,
+        port: u16,
+        dst: [16]u8,
+        src4: [4]u8,
+    };
+    const key = "0123456789abcdef1032547698badcfe";
+    var st: ipcrypt.IPCryptPFX = undefined;
+    ipcrypt.ipcrypt_pfx_init(&st, key);
+    defer ipcrypt.ipcrypt_pfx_deinit(&st);
+
+    var records: [11]Record = undefined;
+    for (&records, 0..) |*r, i| {
+        r.src = .{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 192, 168, 1, @intCast(i) };
+        r.port = @intCast(i);
+        r.dst = .{ 0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, @intCast(i) };
+        r.src4 = .{ 10, 0, 0, @intCast(i) };
+    }
+    const original = records;
+
+    const offsets = [_]usize{ @offsetOf(Record, "src"), @offsetOf(Record, "dst") };
+    try testing.expectEqual(0, ipcrypt.ipcrypt_pfx_encrypt_ip16_strided(&st, &records, records.len, @sizeOf(Record), &offsets, offsets.len, 16));
+    const offsets4 = [_]usize{@offsetOf(Record, "src4")};
+    try testing.expectEqual(0, ipcrypt.ipcrypt_pfx_encrypt_ip16_strided(&st, &records, records.len, @sizeOf(Record), &offsets4, offsets4.len, 4));
+    for (records, original) |r, o| {
+        var src = o.src;
+        ipcrypt.ipcrypt_pfx_encrypt_ip16(&st, &src);
+        try testing.expectEqualSlices(u8, &src, &r.src);
+        var dst = o.dst;
+        ipcrypt.ipcrypt_pfx_encrypt_ip16(&st, &dst);
+        try testing.expectEqualSlices(u8, &dst, &r.dst);
+        var src4: [16]u8 = .{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 0, 0, 0, 0 };
+        @memcpy(src4[12..], &o.src4);
+        ipcrypt.ipcrypt_pfx_encrypt_ip16(&st, &src4);
+        try testing.expectEqualSlices(u8, src4[12..], &r.src4);
+        try testing.expectEqual(o.port, r.port);
+    }
+
+    try testing.expectEqual(0, ipcrypt.ipcrypt_pfx_decrypt_ip16_strided(&st, &records, records.len, @sizeOf(Record), &offsets, offsets.len, 16));
+    try testing.expectEqual(0, ipcrypt.ipcrypt_pfx_decrypt_ip16_strided(&st, &records, records.len, @sizeOf(Record), &offsets4, offsets4.len, 4));
+    try testing.expectEqualSlices(u8, std.mem.asBytes(&original), std.mem.asBytes(&records));
+
+    // Overlapping fields are rejected.
+    const overlapping = [_]usize{ 0, 8 };
+    try testing.expectEqual(-1, ipcrypt.ipcrypt_pfx_encrypt_ip16_strided(&st, &records, records.len, @sizeOf(Record), &overlapping, overlapping.len, 16));
+}
+
+test "strided batch non-deterministic encryption" {
+    const key = "0123456789abcdef";
+    var st: ipcrypt.IPCrypt = undefined;
+    ipcrypt.ipcrypt_init(&st, key);
+    defer ipcrypt.ipcrypt_deinit(&st);
+
+    const stride = ipcrypt.IPCRYPT_NDIP_BYTES + 16;
+    var records: [7 * stride]u8 = undefined;
+    for (&records, 0..) |*b, i| {
+        b.* = @truncate(i *% 7);
+    }
+    const original = records;
+
+    const offsets = [_]usize{ 0, ipcrypt.IPCRYPT_NDIP_BYTES };
+    try testing.expectEqual(-1, ipcrypt.ipcrypt_nd_encrypt_ip16_strided(&st, &records, 7, stride, &offsets, offsets.len, ipcrypt.IPCRYPT_NDIP_BYTES));
+    try testing.expectEqual(0, ipcrypt.ipcrypt_nd_encrypt_ip16_strided(&st, &records, 7, stride, &offsets, 1, ipcrypt.IPCRYPT_NDIP_BYTES));
+    var i: usize = 0;
+    while (i < 7) : (i += 1) {
+        const field = original[i * stride ..][0..ipcrypt.IPCRYPT_NDIP_BYTES];
+        var expected: [ipcrypt.IPCRYPT_NDIP_BYTES]u8 = undefined;
+        ipcrypt.ipcrypt_nd_encrypt_ip16(&st, &expected, field[ipcrypt.IPCRYPT_TWEAKBYTES..], field[0..ipcrypt.IPCRYPT_TWEAKBYTES]);
+        try testing.expectEqualSlices(u8, &expected, records[i * stride ..][0..ipcrypt.IPCRYPT_NDIP_BYTES]);
+    }
+    try testing.expectEqual(0, ipcrypt.ipcrypt_nd_decrypt_ip16_strided(&st, &records, 7, stride, &offsets, 1, ipcrypt.IPCRYPT_NDIP_BYTES));
+    try testing.expectEqualSlices(u8, &original, &records);
+}
+
+test "thread pool batch encryption" {
+    const pool = ipcrypt.ipcrypt_pool_create(4) orelse return error.PoolCreationFailed;
+    defer ipcrypt.ipcrypt_pool_destroy(pool);
+    try testing.expectEqual(4, ipcrypt.ipcrypt_pool_threads(pool));
+
+    const key = "0123456789abcdef0123456789abcdef";
+    var st: ipcrypt.IPCryptPFX = undefined;
+    ipcrypt.ipcrypt_pfx_init(&st, key);
+    defer ipcrypt.ipcrypt_pfx_deinit(&st);
+
+    const Record = extern struct {
+        ip: [16]u8,
+        tag: u32,
+    };
+    const count = 5000;
+    const records = try testing.allocator.alloc(Record, count);
+    defer testing.allocator.free(records);
+    const expected = try testing.allocator.alloc(Record, count);
+    defer testing.allocator.free(expected);
+    for (records, 0..) |*r, i| {
+        r.ip = .{ 0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, @truncate(i >> 8), @truncate(i) };
+        if (i % 3 == 0) {
+            r.ip = .{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 10, 0, @truncate(i >> 8), @truncate(i) };
+        }
+        r.tag = @intCast(i);
+    }
+    const original = try testing.allocator.dupe(Record, records);
+    defer testing.allocator.free(original);
+    @memcpy(expected, records);
+
+    const offsets = [_]usize{@offsetOf(Record, "ip")};
+    try testing.expectEqual(0, ipcrypt.ipcrypt_pfx_encrypt_ip16_strided(&st, expected.ptr, count, @sizeOf(Record), &offsets, offsets.len, 16));
+    try testing.expectEqual(0, ipcrypt.ipcrypt_pool_pfx_encrypt_ip16_strided(pool, &st, records.ptr, count, @sizeOf(Record), &offsets, offsets.len, 16));
+    try testing.expectEqualSlices(u8, std.mem.sliceAsBytes(expected), std.mem.sliceAsBytes(records));
+
+    try testing.expectEqual(0, ipcrypt.ipcrypt_pool_pfx_decrypt_ip16_strided(pool, &st, records.ptr, count, @sizeOf(Record), &offsets, offsets.len, 16));
+    try testing.expectEqualSlices(u8, std.mem.sliceAsBytes(original), std.mem.sliceAsBytes(records));
+
+    // Invalid layouts are rejected before any work is dispatched.
+    try testing.expectEqual(-1, ipcrypt.ipcrypt_pool_pfx_encrypt_ip16_strided(pool, &st, records.ptr, count, @sizeOf(Record), &offsets, offsets.len, 8));
+}
+
+test "keyring rotation" {
+    const keyring = ipcrypt.ipcrypt_keyring_create(ipcrypt.IPCRYPT_MODE_DETERMINISTIC, 4) orelse return error.KeyringCreationFailed;
+    defer ipcrypt.ipcrypt_keyring_destroy(keyring);
+
+    var key_id: u32 = undefined;
+    try testing.expectEqual(-1, ipcrypt.ipcrypt_keyring_current(keyring, &key_id));
+    try testing.expectEqual(-1, ipcrypt.ipcrypt_keyring_add(keyring, 1, "0123456789abcdef", 15));
+    try testing.expectEqual(0, ipcrypt.ipcrypt_keyring_add(keyring, 1, "0123456789abcdef", 16));
+    try testing.expectEqual(-1, ipcrypt.ipcrypt_keyring_add(keyring, 5, "0123456789abcdef", 16));
+    try testing.expectEqual(0, ipcrypt.ipcrypt_keyring_promote(keyring, 1));
+
+    var encrypted: [ipcrypt.IPCRYPT_NDX_NDIP_STR_BYTES]u8 = undefined;
+    var decrypted: [ipcrypt.IPCRYPT_MAX_IP_STR_BYTES]u8 = undefined;
+    var old_encrypted: [ipcrypt.IPCRYPT_NDX_NDIP_STR_BYTES]u8 = undefined;
+    try testing.expect(ipcrypt.ipcrypt_keyring_encrypt_ip_str(keyring, &key_id, &old_encrypted, "192.168.1.1", null) > 0);
+    try testing.expectEqual(1, key_id);
+
+    try testing.expectEqual(0, ipcrypt.ipcrypt_keyring_add(keyring, 2, "fedcba9876543210", 16));
+    try testing.expectEqual(0, ipcrypt.ipcrypt_keyring_promote(keyring, 2));
+    try testing.expectEqual(-1, ipcrypt.ipcrypt_keyring_remove(keyring, 2));
+    try testing.expect(ipcrypt.ipcrypt_keyring_encrypt_ip_str(keyring, &key_id, &encrypted, "192.168.1.1", null) > 0);
+    try testing.expectEqual(2, key_id);
+    try testing.expect(!std.mem.eql(u8, std.mem.sliceTo(&encrypted, 0), std.mem.sliceTo(&old_encrypted, 0)));
+
+    // Data encrypted with the previous key can still be decrypted.
+    const len = ipcrypt.ipcrypt_keyring_decrypt_ip_str(keyring, 1, &decrypted, &old_encrypted);
+    try testing.expectEqualStrings("192.168.1.1", decrypted[0..len]);
+
+    const Record = extern struct {
+        key_id: u32,
+        ip: [16]u8,
+    };
+    var records: [10]Record = undefined;
+    for (&records, 0..) |*r, i| {
+        r.ip = .{ 0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, @intCast(i) };
+    }
+    const original = records;
+    try testing.expectEqual(-1, ipcrypt.ipcrypt_keyring_encrypt_ip16_strided(keyring, &records, records.len, @sizeOf(Record), 0, 2, 16));
+    try testing.expectEqual(0, ipcrypt.ipcrypt_keyring_encrypt_ip16_strided(keyring, &records, 5, @sizeOf(Record), @offsetOf(Record, "key_id"), @offsetOf(Record, "ip"), 16));
+    try testing.expectEqual(0, ipcrypt.ipcrypt_keyring_promote(keyring, 1));
+    try testing.expectEqual(0, ipcrypt.ipcrypt_keyring_remove(keyring, 2));
+    try testing.expectEqual(0, ipcrypt.ipcrypt_keyring_encrypt_ip16_strided(keyring, records[5..].ptr, 5, @sizeOf(Record), @offsetOf(Record, "key_id"), @offsetOf(Record, "ip"), 16));
+    try testing.expectEqual(2, records[0].key_id);
+    try testing.expectEqual(1, records[9].key_id);
+
+    // Records encrypted with a removed key are left untouched.
+    const encrypted_records = records;
+    var skipped: usize = undefined;
+    try testing.expectEqual(0, ipcrypt.ipcrypt_keyring_decrypt_ip16_strided(keyring, &records, records.len, @sizeOf(Record), @offsetOf(Record, "key_id"), @offsetOf(Record, "ip"), 16, &skipped));
+    try testing.expectEqual(5, skipped);
+    for (records[0..5], encrypted_records[0..5]) |r, e| {
+        try testing.expectEqualSlices(u8, &e.ip, &r.ip);
+    }
+    for (records[5..], original[5..]) |r, o| {
+        try testing.expectEqualSlices(u8, &o.ip, &r.ip);
+    }
+}
+
+test "multi-tenant batch encryption" {
+    var keys: [9 * ipcrypt.IPCRYPT_PFX_KEYBYTES]u8 = undefined;
+    for (&keys, 0..) |*b, i| {
+        b.* = @truncate(i *% 31 +% 7);
+    }
+    var ctxs: [9]ipcrypt.IPCrypt = undefined;
+    var pfx_ctxs: [9]ipcrypt.IPCryptPFX = undefined;
+    ipcrypt.ipcrypt_init_many(&ctxs, &keys, ctxs.len);
+    ipcrypt.ipcrypt_pfx_init_many(&pfx_ctxs, &keys, pfx_ctxs.len);
+    for (ctxs, pfx_ctxs, 0..) |ctx, pfx_ctx, i| {
+        var expected: ipcrypt.IPCrypt = undefined;
+        ipcrypt.ipcrypt_init(&expected, keys[i * ipcrypt.IPCRYPT_KEYBYTES ..].ptr);
+        try testing.expectEqualSlices(u8, &expected.opaque, &ctx.opaque);
+        var expected_pfx: ipcrypt.IPCryptPFX = undefined;
+        ipcrypt.ipcrypt_pfx_init(&expected_pfx, keys[i * ipcrypt.IPCRYPT_PFX_KEYBYTES ..].ptr);
+        try testing.expectEqualSlices(u8, &expected_pfx.opaque, &pfx_ctx.opaque);
+    }
+
+    const Record = extern struct {
+        ip: [16]u8,
+        tenant: u32,
+    };
+    var records: [23]Record = undefined;
+    for (&records, 0..) |*r, i| {
+        r.ip = .{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 192, 168, 1, @intCast(i) };
+        r.tenant = @intCast((i * 5) % ctxs.len);
+    }
+    const original = records;
+
+    try testing.expectEqual(0, ipcrypt.ipcrypt_encrypt_ip16_tenants(&ctxs, ctxs.len, &records, records.len, @sizeOf(Record), @offsetOf(Record, "tenant"), @offsetOf(Record, "ip"), 16));
+    for (records, original) |r, o| {
+        var ip = o.ip;
+        ipcrypt.ipcrypt_encrypt_ip16(&ctxs[o.tenant], &ip);
+        try testing.expectEqualSlices(u8, &ip, &r.ip);
+        try testing.expectEqual(o.tenant, r.tenant);
+    }
+    try testing.expectEqual(0, ipcrypt.ipcrypt_decrypt_ip16_tenants(&ctxs, ctxs.len, &records, records.len, @sizeOf(Record), @offsetOf(Record, "tenant"), @offsetOf(Record, "ip"), 16));
+    try testing.expectEqualSlices(u8, std.mem.asBytes(&original), std.mem.asBytes(&records));
+
+    try testing.expectEqual(0, ipcrypt.ipcrypt_pfx_encrypt_ip16_tenants(&pfx_ctxs, pfx_ctxs.len, &records, records.len, @sizeOf(Record), @offsetOf(Record, "tenant"), @offsetOf(Record, "ip"), 16));
+    for (records, original) |r, o| {
+        var ip = o.ip;
+        ipcrypt.ipcrypt_pfx_encrypt_ip16(&pfx_ctxs[o.tenant], &ip);
+        try testing.expectEqualSlices(u8, &ip, &r.ip);
+    }
+    try testing.expectEqual(0, ipcrypt.ipcrypt_pfx_decrypt_ip16_tenants(&pfx_ctxs, pfx_ctxs.len, &records, records.len, @sizeOf(Record), @offsetOf(Record, "tenant"), @offsetOf(Record, "ip"), 16));
+    try testing.expectEqualSlices(u8, std.mem.asBytes(&original), std.mem.asBytes(&records));
+
+    // Out of range tenants are rejected, and records are left untouched.
+    records[7].tenant = ctxs.len;
+    const invalid = records;
+    try testing.expectEqual(-1, ipcrypt.ipcrypt_encrypt_ip16_tenants(&ctxs, ctxs.len, &records, records.len, @sizeOf(Record), @offsetOf(Record, "tenant"), @offsetOf(Record, "ip"), 16));
+    try testing.expectEqualSlices(u8, std.mem.asBytes(&invalid), std.mem.asBytes(&records));
+}
+
+test "log anonymizer" {
+    const key = "0123456789abcdef0123456789abcdef";
+    const log = ipcrypt.ipcrypt_log_create(ipcrypt.IPCRYPT_MODE_PFX, key, key.len, null, null) orelse return error.LogCreationFailed;
+    defer ipcrypt.ipcrypt_log_destroy(log);
+    try testing.expect(ipcrypt.ipcrypt_log_create(ipcrypt.IPCRYPT_MODE_ND, "0123456789abcdef", 16, null, null) == null);
+
+    var st: ipcrypt.IPCryptPFX = undefined;
+    ipcrypt.ipcrypt_pfx_init(&st, key);
+    defer ipcrypt.ipcrypt_pfx_deinit(&st);
+    var ip1: [ipcrypt.IPCRYPT_MAX_IP_STR_BYTES]u8 = undefined;
+    var ip2: [ipcrypt.IPCRYPT_MAX_IP_STR_BYTES]u8 = undefined;
+    const ip1_len = ipcrypt.ipcrypt_pfx_encrypt_ip_str(&st, &ip1, "10.0.0.1");
+    const ip2_len = ipcrypt.ipcrypt_pfx_encrypt_ip_str(&st, &ip2, "2001:db8::1");
+
+    // The input is split in the middle of an address, and the last line is not terminated.
+    const chunks = [_][]const u8{ "GET from 10.0", ".0.1 v1.2.3.4\n[2001:db8::1]:443 ", "at 12:34:56" };
+    var out: [2048]u8 = undefined;
+    var out_len: usize = 0;
+    for (chunks) |chunk| {
+        try testing.expect(ipcrypt.ipcrypt_log_max_output(log, chunk.len) <= out.len - out_len);
+        out_len += ipcrypt.ipcrypt_log_process(log, out[out_len..].ptr, chunk.ptr, chunk.len);
+    }
+    out_len += ipcrypt.ipcrypt_log_finish(log, out[out_len..].ptr);
+
+    var expected: [256]u8 = undefined;
+    const expected_str = try std.fmt.bufPrint(&expected, "GET from {s} v1.2.3.4\n[{s}]:443 at 12:34:56", .{ ip1[0..ip1_len], ip2[0..ip2_len] });
+    try testing.expectEqualStrings(expected_str, out[0..out_len]);
+    try testing.expectEqual(2, ipcrypt.ipcrypt_log_tokens(log));
+}
+
+test "log decryptor" {
+    const key = "0123456789abcdef0123456789abcdef";
+    const random = struct {
+        fn fill(_: ?*anyopaque, buf: [*c]u8, len: usize) callconv(.c) void {
+            std.crypto.random.bytes(buf[0..len]);
+        }
+    };
+    const log = ipcrypt.ipcrypt_log_create(ipcrypt.IPCRYPT_MODE_NDX, key, key.len, &random.fill, null) orelse return error.LogCreationFailed;
+    defer ipcrypt.ipcrypt_log_destroy(log);
+    const decryptor = ipcrypt.ipcrypt_log_create_decryptor(ipcrypt.IPCRYPT_MODE_NDX, key, key.len, null, null) orelse return error.LogCreationFailed;
+    defer ipcrypt.ipcrypt_log_destroy(decryptor);
+
+    const text = "GET from 10.0.0.1 and [2001:db8::1]:443\n";
+    var encrypted: [4096]u8 = undefined;
+    var encrypted_len = ipcrypt.ipcrypt_log_process(log, &encrypted, text, text.len);
+    encrypted_len += ipcrypt.ipcrypt_log_finish(log, encrypted[encrypted_len..].ptr);
+    try testing.expectEqual(text.len - "10.0.0.1".len - "2001:db8::1".len + 2 * 64, encrypted_len);
+
+    // A run of hex digits that is too short to be a token is reported, and left untouched.
+    const digest = "sha1 da39a3ee5e6b4b0d3255bfef95601890afd80709\n";
+    var decrypted: [8192]u8 = undefined;
+    var decrypted_len = ipcrypt.ipcrypt_log_process(decryptor, &decrypted, &encrypted, encrypted_len);
+    decrypted_len += ipcrypt.ipcrypt_log_process(decryptor, decrypted[decrypted_len..].ptr, digest, digest.len);
+    decrypted_len += ipcrypt.ipcrypt_log_finish(decryptor, decrypted[decrypted_len..].ptr);
+    try testing.expectEqualStrings(text ++ digest, decrypted[0..decrypted_len]);
+    try testing.expectEqual(2, ipcrypt.ipcrypt_log_tokens(decryptor));
+    try testing.expectEqual(1, ipcrypt.ipcrypt_log_invalid_tokens(decryptor));
+}
+
+test "log anonymizer with host:port pairs" {
+    // In deterministic mode, IPv4 addresses are usually encrypted as IPv6 addresses, that are
+    // written within brackets when a port number follows, and can then be decrypted.
+    const key = "0123456789abcdef";
+    const log = ipcrypt.ipcrypt_log_create(ipcrypt.IPCRYPT_MODE_DETERMINISTIC, key, key.len, null, null) orelse return error.LogCreationFailed;
+    defer ipcrypt.ipcrypt_log_destroy(log);
+    const decryptor = ipcrypt.ipcrypt_log_create_decryptor(ipcrypt.IPCRYPT_MODE_DETERMINISTIC, key, key.len, null, null) orelse return error.LogCreationFailed;
+    defer ipcrypt.ipcrypt_log_destroy(decryptor);
+
+    var st: ipcrypt.IPCrypt = undefined;
+    ipcrypt.ipcrypt_init(&st, key);
+    defer ipcrypt.ipcrypt_deinit(&st);
+    var ip1: [ipcrypt.IPCRYPT_MAX_IP_STR_BYTES]u8 = undefined;
+    var ip2: [ipcrypt.IPCRYPT_MAX_IP_STR_BYTES]u8 = undefined;
+    const ip1_len = ipcrypt.ipcrypt_encrypt_ip_str(&st, &ip1, "10.0.0.1");
+    const ip2_len = ipcrypt.ipcrypt_encrypt_ip_str(&st, &ip2, "2001:db8::1");
+    try testing.expect(std.mem.indexOfScalar(u8, ip1[0..ip1_len], ':') != null);
+
+    const text = "client=10.0.0.1:8080 upstream=[2001:db8::1]:443 from 10.0.0.1: refused\n";
+    var encrypted: [1024]u8 = undefined;
+    var encrypted_len = ipcrypt.ipcrypt_log_process(log, &encrypted, text, text.len);
+    encrypted_len += ipcrypt.ipcrypt_log_finish(log, encrypted[encrypted_len..].ptr);
+    var expected: [512]u8 = undefined;
+    const expected_str = try std.fmt.bufPrint(&expected, "client=[{s}]:8080 upstream=[{s}]:443 from {s}: refused\n", .{ ip1[0..ip1_len], ip2[0..ip2_len], ip1[0..ip1_len] });
+    try testing.expectEqualStrings(expected_str, encrypted[0..encrypted_len]);
+
+    var decrypted: [1024]u8 = undefined;
+    var decrypted_len = ipcrypt.ipcrypt_log_process(decryptor, &decrypted, &encrypted, encrypted_len);
+    decrypted_len += ipcrypt.ipcrypt_log_finish(decryptor, decrypted[decrypted_len..].ptr);
+    try testing.expectEqualStrings(text, decrypted[0..decrypted_len]);
+    try testing.expectEqual(3, ipcrypt.ipcrypt_log_tokens(decryptor));
+}
+
+test "log anonymizer with independent messages" {
+    const key = "0123456789abcdef0123456789abcdef";
+    const log = ipcrypt.ipcrypt_log_create(ipcrypt.IPCRYPT_MODE_PFX, key, key.len, null, null) orelse return error.LogCreationFailed;
+    defer ipcrypt.ipcrypt_log_destroy(log);
+    const reference = ipcrypt.ipcrypt_log_create(ipcrypt.IPCRYPT_MODE_PFX, key, key.len, null, null) orelse return error.LogCreationFailed;
+    defer ipcrypt.ipcrypt_log_destroy(reference);
+
+    // The last message holds more addresses than a batch, so that batches span multiple messages.
+    var long: [8192]u8 = undefined;
+    var long_len: usize = 0;
+    for (0..300) |i| {
+        long_len += (try std.fmt.bufPrint(long[long_len..], "10.0.{d}.{d} ", .{ i / 256, i % 256 })).len;
+    }
+    const messages = [_][]const u8{ "from 10.0.0.1", "", "10.0.0.1:80 v1.2.3.4\n[2001:db8::1]:443\n", "no address", long[0..long_len] };
+
+    // Data carried over by ipcrypt_log_process() is left alone.
+    var carried: [256]u8 = undefined;
+    try testing.expectEqual(0, ipcrypt.ipcrypt_log_process(log, &carried, "src 192.0", 9));
+
+    var outs_buf: [messages.len][16384]u8 = undefined;
+    var outs: [messages.len][*c]u8 = undefined;
+    var out_lens: [messages.len]usize = undefined;
+    var ins: [messages.len][*c]const u8 = undefined;
+    var in_lens: [messages.len]usize = undefined;
+    for (messages, 0..) |message, i| {
+        try testing.expect(ipcrypt.ipcrypt_log_max_output(log, message.len) <= outs_buf[i].len);
+        outs[i] = &outs_buf[i];
+        ins[i] = message.ptr;
+        in_lens[i] = message.len;
+    }
+    ipcrypt.ipcrypt_log_process_messages(log, &outs, &out_lens, &ins, &in_lens, messages.len);
+
+    // Every message is processed as a complete stream.
+    var expected: [16384]u8 = undefined;
+    for (messages, 0..) |message, i| {
+        var expected_len = ipcrypt.ipcrypt_log_process(reference, &expected, message.ptr, message.len);
+        expected_len += ipcrypt.ipcrypt_log_finish(reference, expected[expected_len..].ptr);
+        try testing.expectEqualStrings(expected[0..expected_len], outs_buf[i][0..out_lens[i]]);
+    }
+    try testing.expectEqual(303, ipcrypt.ipcrypt_log_tokens(log));
+
+    var carried_len = ipcrypt.ipcrypt_log_process(log, &carried, ".2.1\n", 5);
+    var reference_len = ipcrypt.ipcrypt_log_process(reference, &expected, "src 192.0.2.1\n", 14);
+    carried_len += ipcrypt.ipcrypt_log_finish(log, carried[carried_len..].ptr);
+    reference_len += ipcrypt.ipcrypt_log_finish(reference, expected[reference_len..].ptr);
+    try testing.expectEqualStrings(expected[0..reference_len], carried[0..carried_len]);
+}
+
+fn onesComplementSum(initial: u32, data: []const u8) u32 {
+    var sum = initial;
+    var i: usize = 0;
+    while (i + 1 < data.len) : (i += 2) {
+        sum += @as(u32, data[i]) << 8 | data[i + 1];
+    }
+    if (data.len % 2 == 1) {
+        sum += @as(u32, data[data.len - 1]) << 8;
+    }
+    return sum;
+}
+
+fn checksum(sum: u32) u16 {
+    var folded = sum;
+    while (folded > 0xffff) {
+        folded = (folded & 0xffff) + (folded >> 16);
+    }
+    return @truncate(~folded);
+}
+
+test "pcap anonymizer" {
+    const key = "0123456789abcdef0123456789abcdef";
+    const pcap = ipcrypt.ipcrypt_pcap_create(ipcrypt.IPCRYPT_MODE_PFX, key, key.len) orelse return error.PcapCreationFailed;
+    defer ipcrypt.ipcrypt_pcap_destroy(pcap);
+    try testing.expect(ipcrypt.ipcrypt_pcap_create(ipcrypt.IPCRYPT_MODE_NDX, key, key.len) == null);
+    // The deterministic mode would merge distinct IPv4 addresses.
+    try testing.expect(ipcrypt.ipcrypt_pcap_create(ipcrypt.IPCRYPT_MODE_DETERMINISTIC, key, ipcrypt.IPCRYPT_KEYBYTES) == null);
+
+    // A capture with a single Ethernet frame: VLAN tag, IPv4 and UDP headers, 4-byte payload.
+    const frame = [_]u8{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 0x81, 0x00, 0x00, 0x05, 0x08, 0x00 } ++
+        [_]u8{ 0x45, 0, 0, 32, 0, 0, 0, 0, 64, 17, 0, 0, 10, 0, 0, 1, 192, 168, 1, 2 } ++
+        [_]u8{ 0x30, 0x39, 0, 53, 0, 12, 0, 0, 't', 'e', 's', 't' };
+    var file: [24 + 16 + frame.len]u8 = undefined;
+    @memset(&file, 0);
+    std.mem.writeInt(u32, file[0..4], 0xa1b2c3d4, .little);
+    std.mem.writeInt(u16, file[4..6], 2, .little);
+    std.mem.writeInt(u16, file[6..8], 4, .little);
+    std.mem.writeInt(u32, file[16..20], 65535, .little);
+    std.mem.writeInt(u32, file[20..24], 1, .little);
+    std.mem.writeInt(u32, file[32..36], frame.len, .little);
+    std.mem.writeInt(u32, file[36..40], frame.len, .little);
+    @memcpy(file[40..], &frame);
+    const ip = file[58..78];
+    const udp = file[78..];
+    std.mem.writeInt(u16, ip[10..12], checksum(onesComplementSum(0, ip)), .big);
+    std.mem.writeInt(u16, udp[6..8], checksum(onesComplementSum(onesComplementSum(17 + udp.len, ip[12..20]), udp)), .big);
+    const original = file;
+
+    var stats: ipcrypt.IPCryptPcapStats = undefined;
+    try testing.expectEqual(0, ipcrypt.ipcrypt_pcap_encrypt(pcap, null, &file, file.len, &stats));
+    try testing.expectEqual(1, stats.packets);
+    try testing.expectEqual(1, stats.ip_packets);
+    try testing.expectEqual(2, stats.addresses);
+
+    var st: ipcrypt.IPCryptPFX = undefined;
+    ipcrypt.ipcrypt_pfx_init(&st, key);
+    defer ipcrypt.ipcrypt_pfx_deinit(&st);
+    var ip16: [16]u8 = undefined;
+    try testing.expectEqual(0, ipcrypt.ipcrypt_str_to_ip16(&ip16, "10.0.0.1"));
+    ipcrypt.ipcrypt_pfx_encrypt_ip16(&st, &ip16);
+    try testing.expectEqualSlices(u8, ip16[12..16], ip[12..16]);
+
+    // The checksums remain valid, and the payload is untouched.
+    try testing.expectEqual(0, checksum(onesComplementSum(0, ip)));
+    try testing.expectEqual(0, checksum(onesComplementSum(onesComplementSum(17 + udp.len, ip[12..20]), udp)));
+    try testing.expectEqualSlices(u8, "test", udp[8..12]);
+
+    const pool = ipcrypt.ipcrypt_pool_create(2) orelse return error.PoolCreationFailed;
+    defer ipcrypt.ipcrypt_pool_destroy(pool);
+    try testing.expectEqual(0, ipcrypt.ipcrypt_pcap_decrypt(pcap, pool, &file, file.len, null));
+    try testing.expectEqualSlices(u8, &original, &file);
+
+    try testing.expectEqual(-1, ipcrypt.ipcrypt_pcap_encrypt(pcap, null, &file, 8, null));
+}
+
+test "packet vector with an ICMP error message" {
+    const key = "0123456789abcdef0123456789abcdef";
+    const packet = ipcrypt.ipcrypt_packet_create(ipcrypt.IPCRYPT_MODE_PFX, key, key.len) orelse return error.PacketCreationFailed;
+    defer ipcrypt.ipcrypt_packet_destroy(packet);
+
+    // IPv4 header, ICMP destination unreachable message, quoting an IPv4 header and a UDP datagram.
+    var frame = [_]u8{ 0x45, 0, 0, 68, 0, 0, 0, 0, 64, 1, 0, 0, 192, 0, 2, 1, 10, 0, 0, 1 } ++
+        [_]u8{ 3, 3, 0, 0, 0, 0, 0, 0 } ++
+        [_]u8{ 0x45, 0, 0, 40, 0, 0, 0, 0, 64, 17, 0, 0, 10, 0, 0, 1, 198, 51, 100, 7 } ++
+        [_]u8{ 0x30, 0x39, 0, 53, 0, 20, 0, 0, 'q', 'u', 'e', 'r', 'y', 0, 0, 0, 0, 0, 0, 0 };
+    const ip = frame[0..20];
+    const icmp = frame[20..];
+    const inner_ip = frame[28..48];
+    const inner_udp = frame[48..];
+    std.mem.writeInt(u16, inner_ip[10..12], checksum(onesComplementSum(0, inner_ip)), .big);
+    std.mem.writeInt(u16, inner_udp[6..8], checksum(onesComplementSum(onesComplementSum(17 + inner_udp.len, inner_ip[12..20]), inner_udp)), .big);
+    std.mem.writeInt(u16, icmp[2..4], checksum(onesComplementSum(0, icmp)), .big);
+    std.mem.writeInt(u16, ip[10..12], checksum(onesComplementSum(0, ip)), .big);
+    const original = frame;
+
+    const packets = [_][*c]u8{&frame};
+    const lengths = [_]usize{frame.len};
+    try testing.expectEqual(4, ipcrypt.ipcrypt_packet_encrypt(packet, &packets, &lengths, null, packets.len));
+
+    // The quoted destination address is encrypted like the outer one, and all checksums remain valid.
+    try testing.expectEqualSlices(u8, ip[16..20], inner_ip[12..16]);
+    try testing.expect(!std.mem.eql(u8, original[16..20], ip[16..20]));
+    try testing.expectEqual(0, checksum(onesComplementSum(0, ip)));
+    try testing.expectEqual(0, checksum(onesComplementSum(0, icmp)));
+    try testing.expectEqual(0, checksum(onesComplementSum(0, inner_ip)));
+    try testing.expectEqual(0, checksum(onesComplementSum(onesComplementSum(17 + inner_udp.len, inner_ip[12..20]), inner_udp)));
+
+    try testing.expectEqual(4, ipcrypt.ipcrypt_packet_decrypt(packet, &packets, &lengths, null, packets.len));
+    try testing.expectEqualSlices(u8, &original, &frame);
+}
+
+fn encryptFileBlock(ctx: ?*anyopaque, block: [*c]u8, len: usize, offset: u64) callconv(.c) c_int {
+    _ = offset;
+    const st: *const ipcrypt.IPCryptPFX = @ptrCast(@alignCast(ctx));
+    const offsets = [_]usize{0};
+    return ipcrypt.ipcrypt_pfx_encrypt_ip16_strided(st, block, len / 20, 20, &offsets, 1, 16);
+}
+
+test "file pipeline" {
+    if (comptime builtin.os.tag == .windows) return error.SkipZigTest;
+
+    const key = "0123456789abcdef0123456789abcdef";
+    var st: ipcrypt.IPCryptPFX = undefined;
+    ipcrypt.ipcrypt_pfx_init(&st, key);
+    defer ipcrypt.ipcrypt_pfx_deinit(&st);
+
+    // 20-byte records: a 16-byte address followed by a counter.
+    var records: [1000 * 20]u8 = undefined;
+    for (0..1000) |i| {
+        const record = records[i * 20 ..][0..20];
+        @memset(record[0..16], 0);
+        std.mem.writeInt(u32, record[12..16], 0x0a000000 + @as(u32, @intCast(i)), .big);
+        std.mem.writeInt(u32, record[16..20], @intCast(i), .little);
+    }
+    var expected = records;
+    const offsets = [_]usize{0};
+    try testing.expectEqual(0, ipcrypt.ipcrypt_pfx_encrypt_ip16_strided(&st, &expected, 1000, 20, &offsets, 1, 16));
+
+    var tmp = testing.tmpDir(.{});
+    defer tmp.cleanup();
+    for ([_]c_uint{ 0, ipcrypt.IPCRYPT_FILE_NO_IO_URING }) |flags| {
+        const in = try tmp.dir.createFile("records.in", .{ .read = true });
+        defer in.close();
+        try in.writeAll(&records);
+        const out = try tmp.dir.createFile("records.out", .{ .read = true });
+        defer out.close();
+        try out.writeAll("stale content, longer than the input" ** 1000);
+
+        var stats: ipcrypt.IPCryptFileStats = undefined;
+        try testing.expectEqual(0, ipcrypt.ipcrypt_file_process(in.handle, out.handle, 20, flags, encryptFileBlock, &st, &stats));
+        try testing.expectEqual(records.len, stats.bytes);
+
+        var result: [records.len]u8 = undefined;
+        try testing.expectEqual(records.len, (try out.stat()).size);
+        try testing.expectEqual(records.len, try out.preadAll(&result, 0));
+        try testing.expectEqualSlices(u8, &expected, &result);
+    }
+}
+
+const CsvOutput = struct {
+    buf: [1024]u8 = undefined,
+    len: usize = 0,
+
+    fn write(opaque_ptr: ?*anyopaque, data: [*c]const u8, len: usize) callconv(.c) c_int {
+        const self: *CsvOutput = @ptrCast(@alignCast(opaque_ptr));
+        if (len > self.buf.len - self.len) return -1;
+        @memcpy(self.buf[self.len..][0..len], data[0..len]);
+        self.len += len;
+        return 0;
+    }
+};
+
+test "csv anonymizer" {
+    const key = "0123456789abcdeffedcba9876543210";
+    const columns = [_]usize{1};
+    const csv = ipcrypt.ipcrypt_csv_create(ipcrypt.IPCRYPT_MODE_PFX, key, key.len, '\t', &columns, columns.len, ipcrypt.IPCRYPT_CSV_HEADER, null, null) orelse return error.CsvCreationFailed;
+    defer ipcrypt.ipcrypt_csv_destroy(csv);
+    const decryptor = ipcrypt.ipcrypt_csv_create(ipcrypt.IPCRYPT_MODE_PFX, key, key.len, '\t', &columns, columns.len, ipcrypt.IPCRYPT_CSV_HEADER | ipcrypt.IPCRYPT_CSV_DECRYPT, null, null) orelse return error.CsvCreationFailed;
+    defer ipcrypt.ipcrypt_csv_destroy(decryptor);
+
+    var st: ipcrypt.IPCryptPFX = undefined;
+    ipcrypt.ipcrypt_pfx_init(&st, key);
+    defer ipcrypt.ipcrypt_pfx_deinit(&st);
+    var ip1: [ipcrypt.IPCRYPT_MAX_IP_STR_BYTES]u8 = undefined;
+    var ip2: [ipcrypt.IPCRYPT_MAX_IP_STR_BYTES]u8 = undefined;
+    const ip1_len = ipcrypt.ipcrypt_pfx_encrypt_ip_str(&st, &ip1, "10.0.0.1");
+    const ip2_len = ipcrypt.ipcrypt_pfx_encrypt_ip_str(&st, &ip2, "2001:db8::1");
+
+    // The quoted newline and tab don't end the record or the field, and the last record is not
+    // terminated.
+    const text = "time\taddress\tnote\n1\t10.0.0.1\t\"a\tb\nc\"\r\n2\tunknown\t\n3\t\"2001:db8::1\"";
+    var out = CsvOutput{};
+    var stats: ipcrypt.IPCryptCsvStats = undefined;
+    try testing.expectEqual(0, ipcrypt.ipcrypt_csv_process(csv, null, text, text.len, &CsvOutput.write, &out, &stats));
+    try testing.expectEqual(4, stats.records);
+    try testing.expectEqual(2, stats.fields);
+    try testing.expectEqual(1, stats.invalid_fields);
+
+    var expected: [256]u8 = undefined;
+    const expected_str = try std.fmt.bufPrint(&expected, "time\taddress\tnote\n1\t{s}\t\"a\tb\nc\"\r\n2\tunknown\t\n3\t\"{s}\"", .{ ip1[0..ip1_len], ip2[0..ip2_len] });
+    try testing.expectEqualStrings(expected_str, out.buf[0..out.len]);
+
+    const pool = ipcrypt.ipcrypt_pool_create(2) orelse return error.PoolCreationFailed;
+    defer ipcrypt.ipcrypt_pool_destroy(pool);
+    var decrypted = CsvOutput{};
+    try testing.expectEqual(0, ipcrypt.ipcrypt_csv_process(decryptor, pool, &out.buf, out.len, &CsvOutput.write, &decrypted, null));
+    try testing.expectEqualStrings(text, decrypted.buf[0..decrypted.len]);
+}
+
+test "dnstap anonymizer" {
+    const key = "0123456789abcdeffedcba9876543210";
+    const dnstap = ipcrypt.ipcrypt_dnstap_create(ipcrypt.IPCRYPT_MODE_PFX, key, key.len) orelse return error.DnstapCreationFailed;
+    defer ipcrypt.ipcrypt_dnstap_destroy(dnstap);
+    try testing.expect(ipcrypt.ipcrypt_dnstap_create(ipcrypt.IPCRYPT_MODE_ND, key, 16) == null);
+
+    // A START control frame, and a Dnstap message with a Message holding the type, the socket
+    // family, the query and response addresses, and the query port.
+    const content_type = "protobuf:dnstap.Dnstap";
+    const control = [_]u8{ 0, 0, 0, 0, 0, 0, 0, 12 + content_type.len, 0, 0, 0, 2, 0, 0, 0, 1, 0, 0, 0, content_type.len } ++ content_type.*;
+    const message = [_]u8{ 0x08, 5, 0x10, 1, 0x22, 4, 10, 0, 0, 1, 0x2a, 4, 192, 0, 2, 53, 0x30, 0xb9, 0x60 };
+    const data = [_]u8{ 0x0a, 2, 'n', 's', 0x72, message.len } ++ message ++ [_]u8{ 0x78, 1 };
+    const stream = control ++ [_]u8{ 0, 0, 0, data.len } ++ data;
+    var buf = stream;
+
+    // Only complete frames are processed.
+    try testing.expectEqual(control.len, ipcrypt.ipcrypt_dnstap_encrypt(dnstap, &buf, buf.len - 1));
+    try testing.expectEqual(buf.len, ipcrypt.ipcrypt_dnstap_encrypt(dnstap, &buf, buf.len));
+    try testing.expectEqual(buf.len - control.len - 4, ipcrypt.ipcrypt_dnstap_encrypt(dnstap, buf[control.len + 4 ..].ptr, buf.len - control.len - 4));
+
+    var stats: ipcrypt.IPCryptDnstapStats = undefined;
+    ipcrypt.ipcrypt_dnstap_stats(dnstap, &stats);
+    try testing.expectEqual(2, stats.frames);
+    try testing.expectEqual(2, stats.control_frames);
+    try testing.expectEqual(1, stats.skipped_frames);
+    try testing.expectEqual(2, stats.addresses);
+
+    var st: ipcrypt.IPCryptPFX = undefined;
+    ipcrypt.ipcrypt_pfx_init(&st, key);
+    defer ipcrypt.ipcrypt_pfx_deinit(&st);
+    var ip16: [16]u8 = undefined;
+    try testing.expectEqual(0, ipcrypt.ipcrypt_str_to_ip16(&ip16, "192.0.2.53"));
+    ipcrypt.ipcrypt_pfx_encrypt_ip16(&st, &ip16);
+    const response_address = control.len + 4 + 6 + 12;
+    try testing.expectEqualSlices(u8, ip16[12..16], buf[response_address..][0..4]);
+
+    ipcrypt.ipcrypt_dnstap_reset(dnstap);
+    try testing.expectEqual(buf.len, ipcrypt.ipcrypt_dnstap_decrypt(dnstap, &buf, buf.len));
+    try testing.expectEqualSlices(u8, &stream, &buf);
+}
+
+test "record files" {
+    if (comptime builtin.os.tag == .windows) return error.SkipZigTest;
+
+    const key = "0123456789abcdeffedcba9876543210";
+    const random = struct {
+        fn fill(_: ?*anyopaque, buf: [*c]u8, len: usize) callconv(.c) void {
+            std.crypto.random.bytes(buf[0..len]);
+        }
+    };
+    const count = ipcrypt.IPCRYPT_RECORDS_BLOCK_RECORDS * 2 + 100;
+    const ip16s = try testing.allocator.alloc(u8, count * 16);
+    defer testing.allocator.free(ip16s);
+    for (0..count) |i| {
+        @memset(ip16s[i * 16 ..][0..16], 0);
+        std.mem.writeInt(u32, ip16s[i * 16 + 12 ..][0..4], @intCast(i), .big);
+    }
+    const decrypted = try testing.allocator.alloc(u8, count * 16);
+    defer testing.allocator.free(decrypted);
+
+    const pool = ipcrypt.ipcrypt_pool_create(2) orelse return error.PoolCreationFailed;
+    defer ipcrypt.ipcrypt_pool_destroy(pool);
+    var tmp = testing.tmpDir(.{});
+    defer tmp.cleanup();
+    const file = try tmp.dir.createFile("records.bin", .{ .read = true });
+    defer file.close();
+
+    const writer = ipcrypt.ipcrypt_records_writer_create(file.handle, ipcrypt.IPCRYPT_MODE_NDX, key, key.len, 42, &random.fill, null) orelse return error.RecordsCreationFailed;
+    try testing.expectEqual(0, ipcrypt.ipcrypt_records_writer_append(writer, pool, ip16s.ptr, 1000));
+    try testing.expectEqual(0, ipcrypt.ipcrypt_records_writer_append(writer, null, ip16s[1000 * 16 ..].ptr, count - 1000));
+    try testing.expectEqual(0, ipcrypt.ipcrypt_records_writer_close(writer, pool));
+
+    var info: ipcrypt.IPCryptRecordsInfo = undefined;
+    try testing.expectEqual(0, ipcrypt.ipcrypt_records_probe(file.handle, &info));
+    try testing.expectEqual(ipcrypt.IPCRYPT_MODE_NDX, info.mode);
+    try testing.expectEqual(42, info.key_id);
+    try testing.expectEqual(ipcrypt.IPCRYPT_NDX_NDIP_BYTES, info.record_bytes);
+    try testing.expectEqual(count, info.records);
+    try testing.expectEqual(3, info.blocks);
+    try testing.expect(ipcrypt.ipcrypt_records_reader_open(file.handle, key, 16) == null);
+
+    const reader = ipcrypt.ipcrypt_records_reader_open(file.handle, key, key.len) orelse return error.RecordsOpenFailed;
+    defer ipcrypt.ipcrypt_records_reader_close(reader);
+    try testing.expectEqual(0, ipcrypt.ipcrypt_records_reader_read(reader, pool, 0, count, decrypted.ptr));
+    try testing.expectEqualSlices(u8, ip16s, decrypted);
+
+    // Any record can be decrypted on its own.
+    const index = ipcrypt.IPCRYPT_RECORDS_BLOCK_RECORDS + 7;
+    var st: ipcrypt.IPCryptNDX = undefined;
+    ipcrypt.ipcrypt_ndx_init(&st, key);
+    defer ipcrypt.ipcrypt_ndx_deinit(&st);
+    var ip16: [16]u8 = undefined;
+    ipcrypt.ipcrypt_ndx_decrypt_ip16(&st, &ip16, ipcrypt.ipcrypt_records_reader_record(reader, index));
+    try testing.expectEqualSlices(u8, ip16s[index * 16 ..][0..16], &ip16);
+    try testing.expectEqual(0, ipcrypt.ipcrypt_records_reader_read(reader, null, index, 1, &ip16));
+    try testing.expectEqualSlices(u8, ip16s[index * 16 ..][0..16], &ip16);
+    try testing.expectEqual(-1, ipcrypt.ipcrypt_records_reader_read(reader, null, count, 1, &ip16));
+    try testing.expect(ipcrypt.ipcrypt_records_reader_record(reader, count) == null);
+}
+
+test "base64url and base32 ciphertext strings" {
+    const key = "0123456789abcdef";
+    var st: ipcrypt.IPCrypt = undefined;
+    ipcrypt.ipcrypt_init(&st, key);
+    defer ipcrypt.ipcrypt_deinit(&st);
+    const tweak = [_]u8{ 1, 2, 3, 4, 5, 6, 7, 8 };
+
+    var hex: [ipcrypt.IPCRYPT_NDIP_STR_BYTES]u8 = undefined;
+    _ = ipcrypt.ipcrypt_nd_encrypt_ip_str(&st, &hex, "192.0.2.1", &tweak);
+    var ndip: [ipcrypt.IPCRYPT_NDIP_BYTES]u8 = undefined;
+    try testing.expectEqual(0, ipcrypt.ipcrypt_ndip_from_hex(&ndip, &hex, hex.len - 1));
+
+    var b64: [ipcrypt.IPCRYPT_NDIP_B64_STR_BYTES]u8 = undefined;
+    try testing.expectEqual(b64.len - 1, ipcrypt.ipcrypt_nd_encrypt_ip_str_b64(&st, &b64, "192.0.2.1", &tweak));
+    var expected: [b64.len - 1]u8 = undefined;
+    try testing.expectEqualStrings(std.base64.url_safe_no_pad.Encoder.encode(&expected, &ndip), b64[0 .. b64.len - 1]);
+    var ip_str: [ipcrypt.IPCRYPT_MAX_IP_STR_BYTES]u8 = undefined;
+    const ip_len = ipcrypt.ipcrypt_nd_decrypt_ip_str_b64(&st, &ip_str, &b64);
+    try testing.expectEqualStrings("192.0.2.1", ip_str[0..ip_len]);
+
+    var b32: [ipcrypt.IPCRYPT_NDIP_B32_STR_BYTES]u8 = undefined;
+    try testing.expectEqual(b32.len - 1, ipcrypt.ipcrypt_nd_encrypt_ip_str_b32(&st, &b32, "192.0.2.1", &tweak));
+    var decoded: [ipcrypt.IPCRYPT_NDIP_BYTES]u8 = undefined;
+    try testing.expectEqual(0, ipcrypt.ipcrypt_ndip_from_b32(&decoded, &b32, b32.len - 1));
+    try testing.expectEqualSlices(u8, &ndip, &decoded);
+
+    // Characters outside of the alphabet, and non-zero trailing bits, are rejected.
+    b64[0] = '+';
+    try testing.expectEqual(-1, ipcrypt.ipcrypt_ndip_from_b64(&decoded, &b64, b64.len - 1));
+    b32[b32.len - 2] += 1;
+    try testing.expectEqual(-1, ipcrypt.ipcrypt_ndip_from_b32(&decoded, &b32, b32.len - 1));
+}
+
+test "instrumentation counters" {
+    const key = "0123456789abcdef";
+    var st: ipcrypt.IPCrypt = undefined;
+    ipcrypt.ipcrypt_init(&st, key);
+    defer ipcrypt.ipcrypt_deinit(&st);
+
+    ipcrypt.ipcrypt_stats_reset();
+    var ip16s = [_]u8{0} ** (16 * 8);
+    const offset: usize = 0;
+    try testing.expectEqual(0, ipcrypt.ipcrypt_encrypt_ip16_strided(&st, &ip16s, 8, 16, &offset, 1, 16));
+    try testing.expectEqual(-1, ipcrypt.ipcrypt_encrypt_ip16_strided(&st, &ip16s, 8, 16, &offset, 1, 4));
+    ipcrypt.ipcrypt_encrypt_ip16(&st, &ip16s);
+    var ip16: [16]u8 = undefined;
+    try testing.expectEqual(-1, ipcrypt.ipcrypt_str_to_ip16(&ip16, "not an address"));
+
+    var stats: ipcrypt.IPCryptStats = undefined;
+    ipcrypt.ipcrypt_stats_snapshot(&stats);
+    const mode = ipcrypt.IPCRYPT_MODE_DETERMINISTIC;
+    if (ipcrypt.ipcrypt_stats_enabled() == 0) {
+        try testing.expectEqual(0, stats.operations[mode]);
+        try testing.expectEqual(0, stats.errors);
+        return;
+    }
+    try testing.expectEqual(9, stats.operations[mode]);
+    try testing.expectEqual(9 * 16, stats.bytes[mode]);
+    try testing.expectEqual(1, stats.batches[mode]);
+    try testing.expectEqual(1, stats.errors);
+    try testing.expectEqual(1, stats.parse_errors);
+
+    ipcrypt.ipcrypt_stats_reset();
+    ipcrypt.ipcrypt_stats_snapshot(&stats);
+    try testing.expectEqual(0, stats.operations[mode]);
+}
+
+test "context blobs" {
+    var st: ipcrypt.IPCrypt = undefined;
+    ipcrypt.ipcrypt_init(&st, "0123456789abcdef");
+    defer ipcrypt.ipcrypt_deinit(&st);
+    var st_pfx: ipcrypt.IPCryptPFX = undefined;
+    ipcrypt.ipcrypt_pfx_init(&st_pfx, "0123456789abcdef0123456789abcdef");
+    defer ipcrypt.ipcrypt_pfx_deinit(&st_pfx);
+
+    const entries = [_]ipcrypt.IPCryptBlobEntry{
+        .{ .key_id = 7, .mode = ipcrypt.IPCRYPT_MODE_DETERMINISTIC, .ctx = &st },
+        .{ .key_id = 9, .mode = ipcrypt.IPCRYPT_MODE_PFX, .ctx = &st_pfx },
+    };
+    var buf: [4096]u8 align(64) = undefined;
+    const size = ipcrypt.ipcrypt_blob_export(&buf, buf.len, &entries, entries.len);
+    try testing.expectEqual(ipcrypt.ipcrypt_blob_size(&entries, entries.len), size);
+    try testing.expectEqual(0, ipcrypt.ipcrypt_blob_export(&buf, size - 1, &entries, entries.len));
+
+    const blob = ipcrypt.ipcrypt_blob_open(&buf, size) orelse return error.BlobOpenFailed;
+    defer ipcrypt.ipcrypt_blob_close(blob);
+    try testing.expectEqual(2, ipcrypt.ipcrypt_blob_count(blob));
+    try testing.expect(ipcrypt.ipcrypt_blob_find(blob, ipcrypt.IPCRYPT_MODE_PFX, 7) == null);
+
+    // Contexts are used in place, and encrypt like the original ones.
+    const ctx: *const ipcrypt.IPCryptPFX = @ptrCast(@alignCast(ipcrypt.ipcrypt_blob_find(blob, ipcrypt.IPCRYPT_MODE_PFX, 9) orelse return error.ContextNotFound));
+    var ip16 = [_]u8{ 0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 };
+    var expected = ip16;
+    ipcrypt.ipcrypt_pfx_encrypt_ip16(&st_pfx, &expected);
+    ipcrypt.ipcrypt_pfx_encrypt_ip16(ctx, &ip16);
+    try testing.expectEqualSlices(u8, &expected, &ip16);
+
+    const keyring = ipcrypt.ipcrypt_keyring_create(ipcrypt.IPCRYPT_MODE_DETERMINISTIC, 4) orelse return error.KeyringCreationFailed;
+    defer ipcrypt.ipcrypt_keyring_destroy(keyring);
+    try testing.expectEqual(1, ipcrypt.ipcrypt_blob_load_keyring(blob, keyring));
+    var encrypted: [ipcrypt.IPCRYPT_NDX_NDIP_STR_BYTES]u8 = undefined;
+    var expected_str: [ipcrypt.IPCRYPT_MAX_IP_STR_BYTES]u8 = undefined;
+    try testing.expectEqual(0, ipcrypt.ipcrypt_keyring_promote(keyring, 7));
+    var key_id: u32 = undefined;
+    const len = ipcrypt.ipcrypt_keyring_encrypt_ip_str(keyring, &key_id, &encrypted, "192.168.1.1", null);
+    const expected_len = ipcrypt.ipcrypt_encrypt_ip_str(&st, &expected_str, "192.168.1.1");
+    try testing.expectEqualStrings(expected_str[0..expected_len], encrypted[0..len]);
+
+    // Any corruption is detected.
+    buf[size - 1] ^= 1;
+    try testing.expect(ipcrypt.ipcrypt_blob_open(&buf, size) == null);
+    buf[size - 1] ^= 1;
+    try testing.expect(ipcrypt.ipcrypt_blob_open(&buf, size - 64) == null);
+}
+
+test "datagram relay" {
+    if (comptime builtin.os.tag == .windows) return error.SkipZigTest;
+
+    // Sender addresses of a batch are converted at once, and unsupported families are zeroed.
+    var sas: [3 * 128]u8 align(8) = undefined; // 128 bytes per sockaddr_storage
+    const ip16s_in = [_]u8{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 127, 0, 0, 1 } ++
+        [_]u8{ 0x20, 0x01, 0x0d, 0xb8 } ++ [_]u8{0} ** 11 ++ [_]u8{1} ++ [_]u8{0xaa} ** 16;
+    ipcrypt.ipcrypt_ip16s_to_sockaddrs(@ptrCast(&sas), &ip16s_in, 2);
+    @memset(sas[256..], 0);
+    var ip16s: [48]u8 = undefined;
+    try testing.expectEqual(2, ipcrypt.ipcrypt_sockaddrs_to_ip16s(&ip16s, @ptrCast(&sas), 3));
+    try testing.expectEqualSlices(u8, ip16s_in[0..32], ip16s[0..32]);
+    try testing.expectEqualSlices(u8, &([_]u8{0} ** 16), ip16s[32..48]);
+
+    const posix = std.posix;
+    var addrs: [3]std.net.Address = undefined;
+    var fds: [3]posix.socket_t = undefined;
+    for (&fds, &addrs) |*fd, *addr| {
+        fd.* = try posix.socket(posix.AF.INET, posix.SOCK.DGRAM, 0);
+        addr.* = std.net.Address.initIp4(.{ 127, 0, 0, 1 }, 0);
+        try posix.bind(fd.*, &addr.any, addr.getOsSockLen());
+        var len = addr.getOsSockLen();
+        try posix.getsockname(fd.*, &addr.any, &len);
+    }
+    defer for (fds) |fd| posix.close(fd);
+    const relay_fd, const dest_fd, const sender_fd = fds;
+
+    const key = "0123456789abcdef0123456789abcdef";
+    const relay = ipcrypt.ipcrypt_relay_create(relay_fd, relay_fd, @ptrCast(&addrs[1].any), addrs[1].getOsSockLen(), ipcrypt.IPCRYPT_MODE_PFX, key, key.len, null, null, ipcrypt.IPCRYPT_RELAY_PREPEND_PEER) orelse return error.RelayCreationFailed;
+    defer ipcrypt.ipcrypt_relay_destroy(relay);
+
+    const message = "<13>sshd: failed login from 192.0.2.1 port 22\n";
+    for (0..3) |_| {
+        _ = try posix.sendto(sender_fd, message, 0, &addrs[0].any, addrs[0].getOsSockLen());
+    }
+    var received: c_int = 0;
+    while (received < 3) {
+        const n = ipcrypt.ipcrypt_relay_step(relay);
+        try testing.expect(n > 0);
+        received += n;
+    }
+
+    // Both the sender and the address in the payload are encrypted with the key of the relay.
+    var st: ipcrypt.IPCryptPFX = undefined;
+    ipcrypt.ipcrypt_pfx_init(&st, key);
+    defer ipcrypt.ipcrypt_pfx_deinit(&st);
+    var peer_buf: [ipcrypt.IPCRYPT_MAX_IP_STR_BYTES]u8 = undefined;
+    var ip_buf: [ipcrypt.IPCRYPT_MAX_IP_STR_BYTES]u8 = undefined;
+    const peer = peer_buf[0..ipcrypt.ipcrypt_pfx_encrypt_ip_str(&st, &peer_buf, "127.0.0.1")];
+    const ip = ip_buf[0..ipcrypt.ipcrypt_pfx_encrypt_ip_str(&st, &ip_buf, "192.0.2.1")];
+    var expected_buf: [256]u8 = undefined;
+    const expected = try std.fmt.bufPrint(&expected_buf, "{s} <13>sshd: failed login from {s} port 22\n", .{ peer, ip });
+    var buf: [256]u8 = undefined;
+    for (0..3) |_| {
+        const len = try posix.recv(dest_fd, &buf, 0);
+        try testing.expectEqualStrings(expected, buf[0..len]);
+    }
+
+    var stats: ipcrypt.IPCryptRelayStats = undefined;
+    ipcrypt.ipcrypt_relay_stats(relay, &stats);
+    try testing.expectEqual(3, stats.received);
+    try testing.expectEqual(3, stats.forwarded);
+    try testing.expectEqual(0, stats.dropped);
+    try testing.expectEqual(3, stats.peers);
+    try testing.expectEqual(3, stats.addresses);
+
+    // In deterministic mode, the IPv4 hosts of host:port pairs are usually encrypted as IPv6
+    // addresses, that are written within brackets so that they can still be decrypted.
+    const det_key = "0123456789abcdef";
+    const det_relay = ipcrypt.ipcrypt_relay_create(relay_fd, relay_fd, @ptrCast(&addrs[1].any), addrs[1].getOsSockLen(), ipcrypt.IPCRYPT_MODE_DETERMINISTIC, det_key, det_key.len, null, null, 0) orelse return error.RelayCreationFailed;
+    defer ipcrypt.ipcrypt_relay_destroy(det_relay);
+    const host_port_message = "<13>proxy: src=10.0.0.1:8080 dst=[2001:db8::1]:443\n";
+    _ = try posix.sendto(sender_fd, host_port_message, 0, &addrs[0].any, addrs[0].getOsSockLen());
+    try testing.expectEqual(1, ipcrypt.ipcrypt_relay_step(det_relay));
+
+    var det_st: ipcrypt.IPCrypt = undefined;
+    ipcrypt.ipcrypt_init(&det_st, det_key);
+    defer ipcrypt.ipcrypt_deinit(&det_st);
+    const src = peer_buf[0..ipcrypt.ipcrypt_encrypt_ip_str(&det_st, &peer_buf, "10.0.0.1")];
+    const dst = ip_buf[0..ipcrypt.ipcrypt_encrypt_ip_str(&det_st, &ip_buf, "2001:db8::1")];
+    const host_port_expected = try std.fmt.bufPrint(&expected_buf, "<13>proxy: src=[{s}]:8080 dst=[{s}]:443\n", .{ src, dst });
+    const host_port_len = try posix.recv(dest_fd, &buf, 0);
+    try testing.expectEqualStrings(host_port_expected, buf[0..host_port_len]);
+
+    const decryptor = ipcrypt.ipcrypt_log_create_decryptor(ipcrypt.IPCRYPT_MODE_DETERMINISTIC, det_key, det_key.len, null, null) orelse return error.LogCreationFailed;
+    defer ipcrypt.ipcrypt_log_destroy(decryptor);
+    var decrypted: [1024]u8 = undefined;
+    var decrypted_len = ipcrypt.ipcrypt_log_process(decryptor, &decrypted, &buf, host_port_len);
+    decrypted_len += ipcrypt.ipcrypt_log_finish(decryptor, decrypted[decrypted_len..].ptr);
+    try testing.expectEqualStrings(host_port_message, decrypted[0..decrypted_len]);
+}
+
+test "netflow v9 and ipfix anonymizer" {
+    const key = "0123456789abcdeffedcba9876543210";
+    const flow = ipcrypt.ipcrypt_flow_create(ipcrypt.IPCRYPT_MODE_PFX, key, key.len, ipcrypt.IPCRYPT_FLOW_STRIP_UNKNOWN) orelse return error.FlowCreationFailed;
+    defer ipcrypt.ipcrypt_flow_destroy(flow);
+    try testing.expect(ipcrypt.ipcrypt_flow_create(ipcrypt.IPCRYPT_MODE_NDX, key, key.len, 0) == null);
+    try testing.expect(ipcrypt.ipcrypt_flow_create(ipcrypt.IPCRYPT_MODE_DETERMINISTIC, key, ipcrypt.IPCRYPT_KEYBYTES, 0) == null);
+
+    var st: ipcrypt.IPCryptPFX = undefined;
+    ipcrypt.ipcrypt_pfx_init(&st, key);
+    defer ipcrypt.ipcrypt_pfx_deinit(&st);
+
+    // NetFlow v9: a template with the source address, a packet counter and the destination
+    // address, followed by two records.
+    const v9_header = [_]u8{ 0, 9, 0, 3, 0, 0, 0, 1, 0, 0, 0, 2, 0, 0, 0, 3, 0, 0, 0, 42 };
+    const v9_template = [_]u8{ 0, 0, 0, 20, 1, 0, 0, 3, 0, 8, 0, 4, 0, 2, 0, 4, 0, 12, 0, 4 };
+    const v9_data = [_]u8{ 1, 0, 0, 28, 192, 0, 2, 1, 0, 0, 0, 100, 10, 0, 0, 1, 192, 0, 2, 2, 0, 0, 0, 7, 10, 0, 0, 2 };
+
+    // Data sets are removed until their template is known.
+    var early = v9_header ++ v9_data;
+    try testing.expectEqual(v9_header.len, ipcrypt.ipcrypt_flow_encrypt(flow, &early, early.len, null));
+
+    const packet = v9_header ++ v9_template ++ v9_data;
+    var buf = packet;
+    try testing.expectEqual(buf.len, ipcrypt.ipcrypt_flow_encrypt(flow, &buf, buf.len, null));
+    const records = v9_header.len + v9_template.len + 4;
+    for (0..2) |i| {
+        const record = buf[records + i * 12 ..][0..12];
+        var ip16: [16]u8 = undefined;
+        try testing.expectEqual(0, ipcrypt.ipcrypt_str_to_ip16(&ip16, if (i == 0) "192.0.2.1" else "192.0.2.2"));
+        ipcrypt.ipcrypt_pfx_encrypt_ip16(&st, &ip16);
+        try testing.expectEqualSlices(u8, ip16[12..16], record[0..4]);
+        try testing.expectEqualSlices(u8, packet[records + i * 12 + 4 ..][0..4], record[4..8]);
+    }
+
+    // Templates are scoped by exporter.
+    const exporter = [_]u8{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 198, 51, 100, 1 };
+    early = v9_header ++ v9_data;
+    try testing.expectEqual(v9_header.len, ipcrypt.ipcrypt_flow_encrypt(flow, &early, early.len, &exporter));
+
+    try testing.expectEqual(buf.len, ipcrypt.ipcrypt_flow_decrypt(flow, &buf, buf.len, null));
+    try testing.expectEqualSlices(u8, &packet, &buf);
+
+    // IPFIX: a template with an IPv6 source address, an enterprise-specific variable-length field
+    // and an IPv6 destination address, followed by a record with a 3-byte variable-length field.
+    const ipfix_template = [_]u8{ 0, 2, 0, 24, 1, 44, 0, 3, 0, 27, 0, 16, 0x80, 5, 0xff, 0xff, 0, 0, 0x27, 0x0f, 0, 28, 0, 16 };
+    const ipfix_data = [_]u8{ 1, 44, 0, 40 } ++ [_]u8{ 0x20, 0x01, 0x0d, 0xb8 } ++ [_]u8{0} ** 11 ++ [_]u8{1} ++
+        [_]u8{ 3, 'a', 'b', 'c' } ++ [_]u8{ 0x20, 0x01, 0x0d, 0xb8 } ++ [_]u8{0} ** 11 ++ [_]u8{2};
+    const ipfix_len = 16 + ipfix_template.len + ipfix_data.len;
+    const message = [_]u8{ 0, 10, 0, ipfix_len, 0, 0, 0, 1, 0, 0, 0, 2, 0, 0, 0, 7 } ++ ipfix_template ++ ipfix_data;
+    var ipfix = message;
+    try testing.expectEqual(ipfix.len, ipcrypt.ipcrypt_flow_encrypt(flow, &ipfix, ipfix.len, null));
+    const destination = 16 + ipfix_template.len + 4 + 20;
+    var ip16: [16]u8 = message[destination..][0..16].*;
+    ipcrypt.ipcrypt_pfx_encrypt_ip16(&st, &ip16);
+    try testing.expectEqualSlices(u8, &ip16, ipfix[destination..][0..16]);
+    try testing.expectEqualSlices(u8, "abc", ipfix[destination - 3 ..][0..3]);
+
+    // Packets with invalid set lengths are left untouched.
+    ipfix[16 + ipfix_template.len + 3] += 1;
+    try testing.expectEqual(0, ipcrypt.ipcrypt_flow_encrypt(flow, &ipfix, ipfix.len, null));
+
+    var stats: ipcrypt.IPCryptFlowStats = undefined;
+    ipcrypt.ipcrypt_flow_stats(flow, &stats);
+    try testing.expectEqual(6, stats.packets);
+    try testing.expectEqual(1, stats.invalid_packets);
+    try testing.expectEqual(3, stats.templates);
+    try testing.expectEqual(5, stats.records);
+    try testing.expectEqual(2, stats.unknown_sets);
+    try testing.expectEqual(10, stats.addresses);
+}
+
+test "shared-tweak sessions" {
+    var st: ipcrypt.IPCrypt = undefined;
+    ipcrypt.ipcrypt_init(&st, "0123456789abcdef");
+    defer ipcrypt.ipcrypt_deinit(&st);
+    var st_ndx: ipcrypt.IPCryptNDX = undefined;
+    ipcrypt.ipcrypt_ndx_init(&st_ndx, "0123456789abcdef0123456789abcdef");
+    defer ipcrypt.ipcrypt_ndx_deinit(&st_ndx);
+
+    const tweak = [_]u8{ 0x21, 0xbd, 0x18, 0x34, 0xbc, 0x08, 0x8c, 0xd2, 0xb4, 0xec, 0xbe, 0x30, 0xb7, 0x08, 0x98, 0xd7 };
+    var session: ipcrypt.IPCryptNDSession = undefined;
+    ipcrypt.ipcrypt_nd_session_init(&session, &st, &tweak);
+    defer ipcrypt.ipcrypt_nd_session_deinit(&session);
+    var session_ndx: ipcrypt.IPCryptNDXSession = undefined;
+    ipcrypt.ipcrypt_ndx_session_init(&session_ndx, &st_ndx, &tweak);
+    defer ipcrypt.ipcrypt_ndx_session_deinit(&session_ndx);
+
+    // Sessions encrypt like the single-address functions, with the same tweak.
+    const ip16 = [_]u8{ 0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 };
+    var expected: [ipcrypt.IPCRYPT_NDIP_BYTES]u8 = undefined;
+    var ndip: [ipcrypt.IPCRYPT_NDIP_BYTES]u8 = undefined;
+    ipcrypt.ipcrypt_nd_encrypt_ip16(&st, &expected, &ip16, &tweak);
+    ipcrypt.ipcrypt_nd_session_encrypt_ip16(&session, &ndip, &ip16);
+    try testing.expectEqualSlices(u8, &expected, &ndip);
+    var decrypted: [16]u8 = undefined;
+    try testing.expectEqual(0, ipcrypt.ipcrypt_nd_session_decrypt_ip16(&session, &decrypted, &ndip));
+    try testing.expectEqualSlices(u8, &ip16, &decrypted);
+    ndip[0] ^= 1;
+    try testing.expectEqual(-1, ipcrypt.ipcrypt_nd_session_decrypt_ip16(&session, &decrypted, &ndip));
+
+    var expected_ndx: [ipcrypt.IPCRYPT_NDX_NDIP_BYTES]u8 = undefined;
+    var ndip_ndx: [ipcrypt.IPCRYPT_NDX_NDIP_BYTES]u8 = undefined;
+    ipcrypt.ipcrypt_ndx_encrypt_ip16(&st_ndx, &expected_ndx, &ip16, &tweak);
+    ipcrypt.ipcrypt_ndx_session_encrypt_ip16(&session_ndx, &ndip_ndx, &ip16);
+    try testing.expectEqualSlices(u8, &expected_ndx, &ndip_ndx);
+    try testing.expectEqual(0, ipcrypt.ipcrypt_ndx_session_decrypt_ip16(&session_ndx, &decrypted, &ndip_ndx));
+    try testing.expectEqualSlices(u8, &ip16, &decrypted);
+
+    // Strided, with the tweak written in front of every address.
+    const stride = ipcrypt.IPCRYPT_NDX_NDIP_BYTES + 4;
+    var records: [9 * stride]u8 = undefined;
+    for (&records, 0..) |*b, i| {
+        b.* = @truncate(i *% 13);
+    }
+    const original = records;
+    const offsets = [_]usize{4};
+    try testing.expectEqual(0, ipcrypt.ipcrypt_ndx_session_encrypt_ip16_strided(&session_ndx, &records, 9, stride, &offsets, offsets.len, ipcrypt.IPCRYPT_NDX_NDIP_BYTES));
+    var i: usize = 0;
+    while (i < 9) : (i += 1) {
+        const field = original[i * stride + 4 ..][ipcrypt.IPCRYPT_NDX_TWEAKBYTES..][0..16];
+        ipcrypt.ipcrypt_ndx_encrypt_ip16(&st_ndx, &expected_ndx, field, &tweak);
+        try testing.expectEqualSlices(u8, &expected_ndx, records[i * stride + 4 ..][0..ipcrypt.IPCRYPT_NDX_NDIP_BYTES]);
+    }
+    records[2 * stride + 4] ^= 1;
+    const tampered = records;
+    try testing.expectEqual(-1, ipcrypt.ipcrypt_ndx_session_decrypt_ip16_strided(&session_ndx, &records, 9, stride, &offsets, offsets.len, ipcrypt.IPCRYPT_NDX_NDIP_BYTES));
+    try testing.expectEqualSlices(u8, &tampered, &records);
+    records[2 * stride + 4] ^= 1;
+    try testing.expectEqual(0, ipcrypt.ipcrypt_ndx_session_decrypt_ip16_strided(&session_ndx, &records, 9, stride, &offsets, offsets.len, ipcrypt.IPCRYPT_NDX_NDIP_BYTES));
+    i = 0;
+    while (i < 9) : (i += 1) {
+        try testing.expectEqualSlices(u8, original[i * stride + 4 + ipcrypt.IPCRYPT_NDX_TWEAKBYTES ..][0..16], records[i * stride + 4 + ipcrypt.IPCRYPT_NDX_TWEAKBYTES ..][0..16]);
+    }
+
+    // In place, only the addresses are encrypted.
+    records = original;
+    try testing.expectEqual(0, ipcrypt.ipcrypt_nd_session_encrypt_ip16_strided(&session, &records, 9, stride, &offsets, offsets.len, 16));
+    try testing.expectEqual(0, ipcrypt.ipcrypt_nd_session_decrypt_ip16_strided(&session, &records, 9, stride, &offsets, offsets.len, 16));
+    try testing.expectEqualSlices(u8, &original, &records);
+    try testing.expectEqual(-1, ipcrypt.ipcrypt_nd_session_encrypt_ip16_strided(&session, &records, 9, stride, &offsets, offsets.len, 4));
+}
+
+test "inline kernels produce the same output as the library" {
+    // Keys, addresses and tweaks of the test vectors. ND and deterministic mode use the first half
+    // of the keys and tweaks.
+    const keys = [_][]const u8{
+        "0123456789abcdeffedcba98765432101032547698badcfeefcdab8967452301",
+        "1032547698badcfeefcdab89674523010123456789abcdeffedcba9876543210",
+        "2b7e151628aed2a6abf7158809cf4f3c3c4fcf098815f7aba6d2ae2816157e2b",
+        "2b7e151628aed2a6abf7158809cf4f3ca9f5ba40db214c3798f2e1c23456789a",
+    };
+    const tweaks = [_][]const u8{
+        "08e0c289bff23b7cb4ecbe30b70898d7",
+        "21bd1834bc088cd2b4ecbe30b70898d7",
+    };
+    const ips = [_][*:0]const u8{
+        "0.0.0.0",                       "255.255.255.255",
+        "192.0.2.1",                     "10.0.0.47",
+        "172.16.5.193",                  "2001:db8::1",
+        "2001:db8::a5c9:4e2f:bb91:5a7d", "2001:db8:3a5c::e7d1:4b9f:2c8a:f673",
+    };
+    // Built with AES instructions, and without: the second build calls the library.
+    const builds = .{
+        .{
+            .encrypt = ipcrypt.ipcrypt_test_inline_aes_encrypt_ip16,
+            .nd_encrypt = ipcrypt.ipcrypt_test_inline_aes_nd_encrypt_ip16,
+            .ndx_encrypt = ipcrypt.ipcrypt_test_inline_aes_ndx_encrypt_ip16,
+            .pfx_encrypt = ipcrypt.ipcrypt_test_inline_aes_pfx_encrypt_ip16,
+        },
+        .{
+            .encrypt = ipcrypt.ipcrypt_test_inline_lib_encrypt_ip16,
+            .nd_encrypt = ipcrypt.ipcrypt_test_inline_lib_nd_encrypt_ip16,
+            .ndx_encrypt = ipcrypt.ipcrypt_test_inline_lib_ndx_encrypt_ip16,
+            .pfx_encrypt = ipcrypt.ipcrypt_test_inline_lib_pfx_encrypt_ip16,
+        },
+    };
+    if (comptime builtin.cpu.arch == .x86_64 or builtin.cpu.arch == .x86) {
+        try testing.expectEqual(1, ipcrypt.ipcrypt_test_inline_aes_kernels());
+    }
+    try testing.expectEqual(0, ipcrypt.ipcrypt_test_inline_lib_kernels());
+
+    // Contexts must be 16-byte aligned for the kernels to be used.
+    var st: ipcrypt.IPCrypt align(16) = undefined;
+    var st_ndx: ipcrypt.IPCryptNDX align(16) = undefined;
+    var st_pfx: ipcrypt.IPCryptPFX align(16) = undefined;
+    for (keys) |key_hex| {
+        var key: [32]u8 = undefined;
+        _ = try std.fmt.hexToBytes(&key, key_hex);
+        ipcrypt.ipcrypt_init(&st, &key);
+        defer ipcrypt.ipcrypt_deinit(&st);
+        ipcrypt.ipcrypt_ndx_init(&st_ndx, &key);
+        defer ipcrypt.ipcrypt_ndx_deinit(&st_ndx);
+        ipcrypt.ipcrypt_pfx_init(&st_pfx, &key);
+        defer ipcrypt.ipcrypt_pfx_deinit(&st_pfx);
+
+        for (ips, 0..) |ip_str, i| {
+            var ip: [16]u8 = undefined;
+            try testing.expectEqual(0, ipcrypt.ipcrypt_str_to_ip16(&ip, ip_str));
+            var tweak: [16]u8 = undefined;
+            _ = try std.fmt.hexToBytes(&tweak, tweaks[i % tweaks.len]);
+
+            var expected = ip;
+            ipcrypt.ipcrypt_encrypt_ip16(&st, &expected);
+            var expected_pfx = ip;
+            ipcrypt.ipcrypt_pfx_encrypt_ip16(&st_pfx, &expected_pfx);
+            var expected_nd: [ipcrypt.IPCRYPT_NDIP_BYTES]u8 = undefined;
+            ipcrypt.ipcrypt_nd_encrypt_ip16(&st, &expected_nd, &ip, &tweak);
+            var expected_ndx: [ipcrypt.IPCRYPT_NDX_NDIP_BYTES]u8 = undefined;
+            ipcrypt.ipcrypt_ndx_encrypt_ip16(&st_ndx, &expected_ndx, &ip, &tweak);
+
+            inline for (builds) |kernels| {
+                var out = ip;
+                kernels.encrypt(&st, &out);
+                try testing.expectEqualSlices(u8, &expected, &out);
+                out = ip;
+                kernels.pfx_encrypt(&st_pfx, &out);
+                try testing.expectEqualSlices(u8, &expected_pfx, &out);
+                var out_nd: [ipcrypt.IPCRYPT_NDIP_BYTES]u8 = undefined;
+                kernels.nd_encrypt(&st, &out_nd, &ip, &tweak);
+                try testing.expectEqualSlices(u8, &expected_nd, &out_nd);
+                var out_ndx: [ipcrypt.IPCRYPT_NDX_NDIP_BYTES]u8 = undefined;
+                kernels.ndx_encrypt(&st_ndx, &out_ndx, &ip, &tweak);
+                try testing.expectEqualSlices(u8, &expected_ndx, &out_ndx);
+            }
+        }
+    }
+}
+
+test "ipcrypt-pfx anchored test vectors" {
+    const Vector = struct {
+        key: []const u8,
+        ip: [:0]const u8,
+        ipv4_prefix_len: c_uint,
+        ipv6_prefix_len: c_uint,
+        encrypted: []const u8,
+    };
+    const key1 = "0123456789abcdeffedcba98765432101032547698badcfeefcdab8967452301";
+    const key2 = "2b7e151628aed2a6abf7158809cf4f3ca9f5ba40db214c3798f2e1c23456789a";
+    const vectors = [_]Vector{
+        .{ .key = key1, .ip = "192.0.2.1", .ipv4_prefix_len = 0, .ipv6_prefix_len = 0, .encrypted = "100.115.72.131" },
+        .{ .key = key1, .ip = "192.0.2.1", .ipv4_prefix_len = 24, .ipv6_prefix_len = 32, .encrypted = "192.0.2.131" },
+        .{ .key = key1, .ip = "192.0.2.1", .ipv4_prefix_len = 32, .ipv6_prefix_len = 32, .encrypted = "192.0.2.1" },
+        .{ .key = key1, .ip = "2001:db8::1", .ipv4_prefix_len = 8, .ipv6_prefix_len = 32, .encrypted = "2001:db8:2587:3524:30ab:fa65:6ab6:f88" },
+        .{ .key = key1, .ip = "2001:db8::1", .ipv4_prefix_len = 8, .ipv6_prefix_len = 48, .encrypted = "2001:db8:0:3524:30ab:fa65:6ab6:f88" },
+        .{ .key = key2, .ip = "10.0.0.47", .ipv4_prefix_len = 16, .ipv6_prefix_len = 32, .encrypted = "10.0.210.244" },
+        .{ .key = key2, .ip = "10.0.0.47", .ipv4_prefix_len = 13, .ipv6_prefix_len = 32, .encrypted = "10.6.210.244" },
+        .{ .key = key2, .ip = "2001:db8:85a3::8a2e:370:7334", .ipv4_prefix_len = 8, .ipv6_prefix_len = 35, .encrypted = "2001:db8:9ae4:dda0:e93c:16f4:8889:116e" },
+    };
+    for (vectors) |v| {
+        var key: [32]u8 = undefined;
+        _ = try std.fmt.hexToBytes(&key, v.key);
+        var st: ipcrypt.IPCryptPFX = undefined;
+        ipcrypt.ipcrypt_pfx_init(&st, &key);
+        defer ipcrypt.ipcrypt_pfx_deinit(&st);
+
+        var ip16: [16]u8 = undefined;
+        try testing.expectEqual(0, ipcrypt.ipcrypt_str_to_ip16(&ip16, v.ip.ptr));
+        const original = ip16;
+        try testing.expectEqual(0, ipcrypt.ipcrypt_pfx_encrypt_ip16_anchored(&st, &ip16, v.ipv4_prefix_len, v.ipv6_prefix_len));
+        var encrypted_buf: [ipcrypt.IPCRYPT_MAX_IP_STR_BYTES:0]u8 = undefined;
+        const encrypted_len = ipcrypt.ipcrypt_ip16_to_str(&encrypted_buf, &ip16);
+        try testing.expectEqualSlices(u8, v.encrypted, encrypted_buf[0..encrypted_len]);
+        try testing.expectEqual(0, ipcrypt.ipcrypt_pfx_decrypt_ip16_anchored(&st, &ip16, v.ipv4_prefix_len, v.ipv6_prefix_len));
+        try testing.expectEqualSlices(u8, &original, &ip16);
+        try testing.expectEqual(-1, ipcrypt.ipcrypt_pfx_encrypt_ip16_anchored(&st, &ip16, 33, v.ipv6_prefix_len));
+        try testing.expectEqual(-1, ipcrypt.ipcrypt_pfx_decrypt_ip16_anchored(&st, &ip16, v.ipv4_prefix_len, 129));
+        try testing.expectEqualSlices(u8, &original, &ip16);
+    }
+}
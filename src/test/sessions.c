@@ -0,0 +1,196 @@
+/**
+ * Tests of the shared-tweak sessions against the library.
+ *
+ * Sessions fold the tweak into the round keys, so their output must be identical to the output of
+ * ipcrypt_nd_encrypt_ip16() and ipcrypt_ndx_encrypt_ip16() with the same tweak, and they must
+ * decrypt what these functions encrypt. Random keys, tweaks and addresses are compared through
+ * single addresses and through arrays of records.
+ *
+ * This is compiled by the system compiler, with the library, so that miscompilations that the Zig
+ * tests can't see are caught.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ipcrypt2.h"
+
+#define CASES   2000U
+#define RECORDS 37U
+
+#define CHECK(cond)                                                                 \
+    do {                                                                            \
+        if (!(cond)) {                                                              \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);              \
+            failures++;                                                             \
+        }                                                                           \
+    } while (0)
+
+static unsigned int failures;
+static uint64_t     rng_state = 0x9e3779b97f4a7c15ULL;
+
+static void
+random_bytes(uint8_t *buf, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        rng_state ^= rng_state << 13;
+        rng_state ^= rng_state >> 7;
+        rng_state ^= rng_state << 17;
+        buf[i] = (uint8_t) (rng_state >> 32);
+    }
+}
+
+/**
+ * A record holds an address encrypted in-place, and an address with its tweak.
+ */
+typedef struct NDRecord {
+    uint8_t ip16[16];
+    uint8_t pad[5];
+    uint8_t ndip[IPCRYPT_NDIP_BYTES];
+} NDRecord;
+
+typedef struct NDXRecord {
+    uint8_t ip16[16];
+    uint8_t pad[3];
+    uint8_t ndip[IPCRYPT_NDX_NDIP_BYTES];
+} NDXRecord;
+
+static void
+test_nd(void)
+{
+    const size_t     ip16_offset = offsetof(NDRecord, ip16);
+    const size_t     ndip_offset = offsetof(NDRecord, ndip);
+    IPCrypt          ipcrypt;
+    IPCryptNDSession session;
+    NDRecord         records[RECORDS], encrypted[RECORDS];
+    uint8_t          key[IPCRYPT_KEYBYTES], tweak[IPCRYPT_TWEAKBYTES];
+    uint8_t          ip16[16], ndip[IPCRYPT_NDIP_BYTES], session_ndip[IPCRYPT_NDIP_BYTES];
+    unsigned int     c;
+    size_t           i;
+
+    for (c = 0; c < CASES; c++) {
+        random_bytes(key, sizeof key);
+        random_bytes(tweak, sizeof tweak);
+        random_bytes(ip16, sizeof ip16);
+        ipcrypt_init(&ipcrypt, key);
+        ipcrypt_nd_session_init(&session, &ipcrypt, tweak);
+
+        ipcrypt_nd_encrypt_ip16(&ipcrypt, ndip, ip16, tweak);
+        ipcrypt_nd_session_encrypt_ip16(&session, session_ndip, ip16);
+        CHECK(memcmp(session_ndip, ndip, sizeof ndip) == 0);
+        memset(session_ndip, 0, 16);
+        CHECK(ipcrypt_nd_session_decrypt_ip16(&session, session_ndip, ndip) == 0);
+        CHECK(memcmp(session_ndip, ip16, 16) == 0);
+        ndip[0] ^= 1;
+        CHECK(ipcrypt_nd_session_decrypt_ip16(&session, session_ndip, ndip) == -1);
+
+        random_bytes((uint8_t *) records, sizeof records);
+        memcpy(encrypted, records, sizeof records);
+        CHECK(ipcrypt_nd_session_encrypt_ip16_strided(&session, encrypted, RECORDS,
+                                                      sizeof *encrypted, &ip16_offset, 1,
+                                                      16) == 0);
+        CHECK(ipcrypt_nd_session_encrypt_ip16_strided(&session, encrypted, RECORDS,
+                                                      sizeof *encrypted, &ndip_offset, 1,
+                                                      IPCRYPT_NDIP_BYTES) == 0);
+        for (i = 0; i < RECORDS; i++) {
+            ipcrypt_nd_encrypt_ip16(&ipcrypt, ndip, records[i].ip16, tweak);
+            CHECK(memcmp(encrypted[i].ip16, ndip + IPCRYPT_TWEAKBYTES, 16) == 0);
+            ipcrypt_nd_encrypt_ip16(&ipcrypt, ndip, records[i].ndip + IPCRYPT_TWEAKBYTES, tweak);
+            CHECK(memcmp(encrypted[i].ndip, ndip, sizeof ndip) == 0);
+        }
+        CHECK(ipcrypt_nd_session_decrypt_ip16_strided(&session, encrypted, RECORDS,
+                                                      sizeof *encrypted, &ip16_offset, 1,
+                                                      16) == 0);
+        CHECK(ipcrypt_nd_session_decrypt_ip16_strided(&session, encrypted, RECORDS,
+                                                      sizeof *encrypted, &ndip_offset, 1,
+                                                      IPCRYPT_NDIP_BYTES) == 0);
+        for (i = 0; i < RECORDS; i++) {
+            CHECK(memcmp(encrypted[i].ip16, records[i].ip16, 16) == 0);
+            CHECK(memcmp(encrypted[i].ndip + IPCRYPT_TWEAKBYTES,
+                         records[i].ndip + IPCRYPT_TWEAKBYTES, 16) == 0);
+        }
+
+        ipcrypt_nd_session_deinit(&session);
+        ipcrypt_deinit(&ipcrypt);
+    }
+}
+
+static void
+test_ndx(void)
+{
+    const size_t      ip16_offset = offsetof(NDXRecord, ip16);
+    const size_t      ndip_offset = offsetof(NDXRecord, ndip);
+    IPCryptNDX        ipcrypt;
+    IPCryptNDXSession session;
+    NDXRecord         records[RECORDS], encrypted[RECORDS];
+    uint8_t           key[IPCRYPT_NDX_KEYBYTES], tweak[IPCRYPT_NDX_TWEAKBYTES];
+    uint8_t           ip16[16], ndip[IPCRYPT_NDX_NDIP_BYTES], session_ndip[IPCRYPT_NDX_NDIP_BYTES];
+    unsigned int      c;
+    size_t            i;
+
+    for (c = 0; c < CASES; c++) {
+        random_bytes(key, sizeof key);
+        random_bytes(tweak, sizeof tweak);
+        random_bytes(ip16, sizeof ip16);
+        ipcrypt_ndx_init(&ipcrypt, key);
+        ipcrypt_ndx_session_init(&session, &ipcrypt, tweak);
+
+        ipcrypt_ndx_encrypt_ip16(&ipcrypt, ndip, ip16, tweak);
+        ipcrypt_ndx_session_encrypt_ip16(&session, session_ndip, ip16);
+        CHECK(memcmp(session_ndip, ndip, sizeof ndip) == 0);
+        memset(session_ndip, 0, 16);
+        CHECK(ipcrypt_ndx_session_decrypt_ip16(&session, session_ndip, ndip) == 0);
+        CHECK(memcmp(session_ndip, ip16, 16) == 0);
+        ndip[0] ^= 1;
+        CHECK(ipcrypt_ndx_session_decrypt_ip16(&session, session_ndip, ndip) == -1);
+
+        random_bytes((uint8_t *) records, sizeof records);
+        memcpy(encrypted, records, sizeof records);
+        CHECK(ipcrypt_ndx_session_encrypt_ip16_strided(&session, encrypted, RECORDS,
+                                                       sizeof *encrypted, &ip16_offset, 1,
+                                                       16) == 0);
+        CHECK(ipcrypt_ndx_session_encrypt_ip16_strided(&session, encrypted, RECORDS,
+                                                       sizeof *encrypted, &ndip_offset, 1,
+                                                       IPCRYPT_NDX_NDIP_BYTES) == 0);
+        for (i = 0; i < RECORDS; i++) {
+            ipcrypt_ndx_encrypt_ip16(&ipcrypt, ndip, records[i].ip16, tweak);
+            CHECK(memcmp(encrypted[i].ip16, ndip + IPCRYPT_NDX_TWEAKBYTES, 16) == 0);
+            ipcrypt_ndx_encrypt_ip16(&ipcrypt, ndip, records[i].ndip + IPCRYPT_NDX_TWEAKBYTES,
+                                     tweak);
+            CHECK(memcmp(encrypted[i].ndip, ndip, sizeof ndip) == 0);
+        }
+        CHECK(ipcrypt_ndx_session_decrypt_ip16_strided(&session, encrypted, RECORDS,
+                                                       sizeof *encrypted, &ip16_offset, 1,
+                                                       16) == 0);
+        CHECK(ipcrypt_ndx_session_decrypt_ip16_strided(&session, encrypted, RECORDS,
+                                                       sizeof *encrypted, &ndip_offset, 1,
+                                                       IPCRYPT_NDX_NDIP_BYTES) == 0);
+        for (i = 0; i < RECORDS; i++) {
+            CHECK(memcmp(encrypted[i].ip16, records[i].ip16, 16) == 0);
+            CHECK(memcmp(encrypted[i].ndip + IPCRYPT_NDX_TWEAKBYTES,
+                         records[i].ndip + IPCRYPT_NDX_TWEAKBYTES, 16) == 0);
+        }
+
+        ipcrypt_ndx_session_deinit(&session);
+        ipcrypt_ndx_deinit(&ipcrypt);
+    }
+}
+
+int
+main(void)
+{
+    test_nd();
+    test_ndx();
+
+    if (failures != 0) {
+        fprintf(stderr, "%u checks failed\n", failures);
+        return 1;
+    }
+    puts("Session tests passed");
+
+    return 0;
+}
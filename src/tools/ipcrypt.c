@@ -0,0 +1,870 @@
+/**
+ * Command-line IP address encryption.
+ *
+ * Reads addresses from files or from the standard input, and writes the encrypted (or decrypted)
+ * result to the standard output, in the same order.
+ *
+ * The input is read in large chunks that end on a line boundary. Chunks are processed in parallel
+ * by worker threads, and written in their original order by a writer thread, so that reading,
+ * processing and writing overlap.
+ *
+ * Input formats:
+ * - text: free-form text, such as logs; every address found in the text is replaced
+ *   (see ipcrypt2_log.h);
+ * - list: one address per line;
+ * - csv: delimited records, with the addresses in the columns given with --columns.
+ *
+ * Usage: ipcrypt [options] --key HEX [FILE...]
+ *   --mode M           deterministic, pfx, nd or ndx (default: deterministic)
+ *   --decrypt          decrypt instead of encrypting
+ *   --format F         text, list or csv (default: text)
+ *   --columns N[,N...] columns holding addresses, starting from 1 (csv, default: 1)
+ *   --delimiter C      field delimiter (csv, default: ',')
+ *   --header           copy the first line of every file unchanged (list and csv)
+ *   --threads N        number of worker threads (default: number of CPUs)
+ *   --quiet            don't print statistics
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "ipcrypt2.h"
+#include "ipcrypt2_log.h"
+
+/** Size of the chunks read from the input. Chunks grow if a line doesn't fit. */
+#define CHUNK_BYTES (1U << 20)
+
+/** Number of chunks per worker thread, so that workers don't wait for the reader or the writer. */
+#define CHUNKS_PER_WORKER 2
+
+/** Highest column number accepted by --columns. */
+#define MAX_COLUMNS 1024
+
+/** Size of the buffer of random bytes of each worker. */
+#define RANDOM_BYTES 4096
+
+enum { MODE_DETERMINISTIC, MODE_PFX, MODE_ND, MODE_NDX };
+
+enum { FORMAT_TEXT, FORMAT_LIST, FORMAT_CSV };
+
+enum { CHUNK_FREE, CHUNK_FILLED, CHUNK_PROCESSING, CHUNK_DONE };
+
+static const char *const mode_names[4]   = { "deterministic", "pfx", "nd", "ndx" };
+static const char *const format_names[3] = { "text", "list", "csv" };
+
+typedef struct Options {
+    const char   *key_hex;
+    char *const  *files;
+    size_t        files_count;
+    size_t        columns_count;
+    unsigned int  threads;
+    int           mode;
+    int           format;
+    int           decrypt;
+    int           header;
+    int           quiet;
+    char          delimiter;
+    unsigned char columns[MAX_COLUMNS + 1];
+} Options;
+
+typedef struct Contexts {
+    IPCrypt    ipcrypt;
+    IPCryptPFX ipcrypt_pfx;
+    IPCryptNDX ipcrypt_ndx;
+} Contexts;
+
+typedef struct Chunk {
+    char    *in;
+    char    *out;
+    size_t   in_len;
+    size_t   in_cap;
+    size_t   out_len;
+    size_t   out_cap;
+    uint64_t addresses;
+    uint64_t invalid;
+    int      has_header;
+    int      state;
+} Chunk;
+
+typedef struct Pipeline {
+    const Options  *opts;
+    const Contexts *contexts;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    Chunk          *chunks;
+    size_t          chunks_count;
+    uint64_t        next_fill;
+    uint64_t        next_process;
+    uint64_t        next_write;
+    int             eof;
+    int             error;
+    int             random_fd;
+    uint64_t        bytes_in;
+    uint64_t        bytes_out;
+    uint64_t        addresses;
+    uint64_t        invalid;
+} Pipeline;
+
+typedef struct Worker {
+    Pipeline   *pl;
+    IPCryptLog *log;
+    pthread_t   thread;
+    size_t      random_pos;
+    uint8_t     random[RANDOM_BYTES];
+} Worker;
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    timespec_get(&ts, TIME_UTC);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static void
+read_random(int fd, uint8_t *buf, size_t len)
+{
+    size_t  filled;
+    ssize_t n;
+
+    for (filled = 0; filled < len; filled += (size_t) n) {
+        if ((n = read(fd, buf + filled, len - filled)) <= 0) {
+            fprintf(stderr, "Unable to read random bytes: %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+}
+
+/**
+ * Fill `buf` with secure random bytes, from the buffer of the worker.
+ */
+static void
+worker_random(void *opaque, uint8_t *buf, size_t len)
+{
+    Worker *w = (Worker *) opaque;
+
+    if (len > sizeof w->random) {
+        read_random(w->pl->random_fd, buf, len);
+        return;
+    }
+    if (len > sizeof w->random - w->random_pos) {
+        read_random(w->pl->random_fd, w->random, sizeof w->random);
+        w->random_pos = 0;
+    }
+    memcpy(buf, w->random + w->random_pos, len);
+    w->random_pos += len;
+}
+
+/**
+ * Make room for `len` more bytes in the output of a chunk. Returns 0 on success, or -1 if memory
+ * could not be allocated.
+ */
+static int
+chunk_reserve(Chunk *c, size_t len)
+{
+    char  *tmp;
+    size_t cap = c->out_cap;
+
+    if (c->out_cap - c->out_len >= len) {
+        return 0;
+    }
+    while (cap - c->out_len < len) {
+        cap = cap < CHUNK_BYTES ? CHUNK_BYTES : cap * 2;
+    }
+    if ((tmp = (char *) realloc(c->out, cap)) == NULL) {
+        return -1;
+    }
+    c->out     = tmp;
+    c->out_cap = cap;
+    return 0;
+}
+
+static void
+chunk_append(Chunk *c, const char *data, size_t len)
+{
+    memcpy(c->out + c->out_len, data, len);
+    c->out_len += len;
+}
+
+static char *
+last_newline(char *p, size_t len)
+{
+    while (len > 0) {
+        if (p[--len] == '\n') {
+            return p + len;
+        }
+    }
+    return NULL;
+}
+
+static size_t
+bin2hex(char *hex, const uint8_t *bin, size_t bin_len)
+{
+    static const char digits[] = "0123456789abcdef";
+    size_t            i;
+
+    for (i = 0; i < bin_len; i++) {
+        hex[2 * i]     = digits[bin[i] >> 4];
+        hex[2 * i + 1] = digits[bin[i] & 0xf];
+    }
+    return 2 * bin_len;
+}
+
+/**
+ * Encrypt or decrypt a single address. The result is written to `out`, which must be at least
+ * IPCRYPT_NDX_NDIP_STR_BYTES long. Returns the length of the result, or 0 if the field is not a
+ * valid address, or not a valid encrypted address.
+ */
+static size_t
+transform_field(Worker *w, char *out, const char *field, size_t len)
+{
+    const Contexts *contexts = w->pl->contexts;
+    char            in[IPCRYPT_NDX_NDIP_STR_BYTES];
+    char            tmp[IPCRYPT_NDX_NDIP_STR_BYTES];
+    uint8_t         ip16[16];
+    uint8_t         ndip[IPCRYPT_NDX_NDIP_BYTES];
+    uint8_t         tweak[IPCRYPT_NDX_TWEAKBYTES];
+    size_t          out_len = 0;
+
+    if (len == 0 || len >= sizeof in) {
+        return 0;
+    }
+    memcpy(in, field, len);
+    in[len] = 0;
+    if (w->pl->opts->decrypt) {
+        switch (w->pl->opts->mode) {
+        case MODE_DETERMINISTIC:
+            out_len = ipcrypt_decrypt_ip_str(&contexts->ipcrypt, tmp, in);
+            break;
+        case MODE_PFX:
+            out_len = ipcrypt_pfx_decrypt_ip_str(&contexts->ipcrypt_pfx, tmp, in);
+            break;
+        case MODE_ND:
+            out_len = len == IPCRYPT_NDIP_STR_BYTES - 1
+                          ? ipcrypt_nd_decrypt_ip_str(&contexts->ipcrypt, tmp, in)
+                          : 0;
+            break;
+        case MODE_NDX:
+            out_len = len == IPCRYPT_NDX_NDIP_STR_BYTES - 1
+                          ? ipcrypt_ndx_decrypt_ip_str(&contexts->ipcrypt_ndx, tmp, in)
+                          : 0;
+            break;
+        }
+        memcpy(out, tmp, out_len);
+        return out_len;
+    }
+    if (ipcrypt_str_to_ip16(ip16, in) != 0) {
+        return 0;
+    }
+    switch (w->pl->opts->mode) {
+    case MODE_DETERMINISTIC:
+        ipcrypt_encrypt_ip16(&contexts->ipcrypt, ip16);
+        out_len = ipcrypt_ip16_to_str(tmp, ip16);
+        break;
+    case MODE_PFX:
+        ipcrypt_pfx_encrypt_ip16(&contexts->ipcrypt_pfx, ip16);
+        out_len = ipcrypt_ip16_to_str(tmp, ip16);
+        break;
+    case MODE_ND:
+        worker_random(w, tweak, IPCRYPT_TWEAKBYTES);
+        ipcrypt_nd_encrypt_ip16(&contexts->ipcrypt, ndip, ip16, tweak);
+        return bin2hex(out, ndip, IPCRYPT_NDIP_BYTES);
+    case MODE_NDX:
+        worker_random(w, tweak, IPCRYPT_NDX_TWEAKBYTES);
+        ipcrypt_ndx_encrypt_ip16(&contexts->ipcrypt_ndx, ndip, ip16, tweak);
+        return bin2hex(out, ndip, IPCRYPT_NDX_NDIP_BYTES);
+    }
+    memcpy(out, tmp, out_len);
+    return out_len;
+}
+
+/**
+ * Replace a field with its encrypted or decrypted form, or copy it if it is not valid.
+ */
+static void
+process_field(Worker *w, Chunk *c, const char *field, size_t len)
+{
+    size_t out_len;
+
+    if (len > 0 && (out_len = transform_field(w, c->out + c->out_len, field, len)) > 0) {
+        c->out_len += out_len;
+        c->addresses++;
+        return;
+    }
+    if (len > 0) {
+        c->invalid++;
+    }
+    chunk_append(c, field, len);
+}
+
+/**
+ * Process a delimited record. Fields can be enclosed in double quotes, which are preserved.
+ */
+static void
+process_record(Worker *w, Chunk *c, const char *line, size_t len)
+{
+    const Options *opts   = w->pl->opts;
+    size_t         column = 1;
+    size_t         i      = 0;
+    size_t         start, end;
+    int            quoted;
+
+    for (;;) {
+        quoted = i < len && line[i] == '"';
+        start  = i + (size_t) quoted;
+        if (quoted) {
+            for (end = start; end < len; end++) {
+                if (line[end] == '"' && (end + 1 >= len || line[end + 1] != '"')) {
+                    break;
+                }
+                end += line[end] == '"';
+            }
+            i = end < len ? end + 1 : len;
+        } else {
+            for (end = start; end < len && line[end] != opts->delimiter; end++) {
+            }
+            i = end;
+        }
+        if (quoted) {
+            chunk_append(c, "\"", 1);
+        }
+        if (column <= MAX_COLUMNS && opts->columns[column]) {
+            process_field(w, c, line + start, end - start);
+        } else {
+            chunk_append(c, line + start, end - start);
+        }
+        if (quoted && end < len) {
+            chunk_append(c, "\"", 1);
+        }
+        // Anything between a closing quote and the next delimiter is copied as-is.
+        for (start = i; i < len && line[i] != opts->delimiter; i++) {
+        }
+        chunk_append(c, line + start, i - start);
+        if (i >= len) {
+            break;
+        }
+        chunk_append(c, &opts->delimiter, 1);
+        i++;
+        column++;
+    }
+}
+
+/**
+ * Process a chunk of lines in the list or csv format.
+ */
+static int
+process_lines(Worker *w, Chunk *c)
+{
+    const Options *opts = w->pl->opts;
+    const char    *p    = c->in;
+    const char    *end  = c->in + c->in_len;
+    const char    *nl;
+    size_t         len, trimmed, fields;
+
+    if (c->has_header && p < end) {
+        nl  = (const char *) memchr(p, '\n', (size_t) (end - p));
+        len = nl != NULL ? (size_t) (nl - p) + 1 : (size_t) (end - p);
+        if (chunk_reserve(c, len) != 0) {
+            return -1;
+        }
+        chunk_append(c, p, len);
+        p += len;
+    }
+    while (p < end) {
+        nl  = (const char *) memchr(p, '\n', (size_t) (end - p));
+        len = nl != NULL ? (size_t) (nl - p) : (size_t) (end - p);
+        trimmed = len;
+        if (trimmed > 0 && p[trimmed - 1] == '\r') {
+            trimmed--;
+        }
+        // Every selected field can grow to the size of an encrypted address.
+        fields = opts->format == FORMAT_CSV ? opts->columns_count : 1;
+        fields = fields < len + 1 ? fields : len + 1;
+        if (chunk_reserve(c, len + 1 + fields * IPCRYPT_NDX_NDIP_STR_BYTES) != 0) {
+            return -1;
+        }
+        if (opts->format == FORMAT_CSV) {
+            process_record(w, c, p, trimmed);
+        } else {
+            process_field(w, c, p, trimmed);
+        }
+        chunk_append(c, p + trimmed, len - trimmed + (nl != NULL));
+        p += len + (nl != NULL);
+    }
+    return 0;
+}
+
+/**
+ * Process a chunk of free-form text with the log anonymizer of the worker.
+ */
+static int
+process_text(Worker *w, Chunk *c)
+{
+    const uint64_t tokens  = ipcrypt_log_tokens(w->log);
+    const uint64_t invalid = ipcrypt_log_invalid_tokens(w->log);
+
+    if (chunk_reserve(c, ipcrypt_log_max_output(w->log, c->in_len)) != 0) {
+        return -1;
+    }
+    c->out_len += ipcrypt_log_process(w->log, c->out + c->out_len, c->in, c->in_len);
+    if (chunk_reserve(c, ipcrypt_log_max_output(w->log, 0)) != 0) {
+        return -1;
+    }
+    c->out_len += ipcrypt_log_finish(w->log, c->out + c->out_len);
+    c->addresses = ipcrypt_log_tokens(w->log) - tokens;
+    c->invalid   = ipcrypt_log_invalid_tokens(w->log) - invalid;
+    return 0;
+}
+
+static void *
+worker_run(void *arg)
+{
+    Worker   *w  = (Worker *) arg;
+    Pipeline *pl = w->pl;
+    Chunk    *c;
+    int       ret;
+
+    pthread_mutex_lock(&pl->lock);
+    for (;;) {
+        while (!pl->error && !pl->eof && pl->next_process == pl->next_fill) {
+            pthread_cond_wait(&pl->cond, &pl->lock);
+        }
+        if (pl->error || pl->next_process == pl->next_fill) {
+            break;
+        }
+        c        = &pl->chunks[pl->next_process++ % pl->chunks_count];
+        c->state = CHUNK_PROCESSING;
+        pthread_mutex_unlock(&pl->lock);
+
+        c->out_len   = 0;
+        c->addresses = 0;
+        c->invalid   = 0;
+        ret = pl->opts->format == FORMAT_TEXT ? process_text(w, c) : process_lines(w, c);
+
+        pthread_mutex_lock(&pl->lock);
+        if (ret != 0) {
+            fprintf(stderr, "Out of memory\n");
+            pl->error = 1;
+        }
+        c->state = CHUNK_DONE;
+        pthread_cond_broadcast(&pl->cond);
+    }
+    pthread_mutex_unlock(&pl->lock);
+    return NULL;
+}
+
+static void *
+writer_run(void *arg)
+{
+    Pipeline *pl = (Pipeline *) arg;
+    Chunk    *c;
+    size_t    written;
+    ssize_t   n;
+
+    pthread_mutex_lock(&pl->lock);
+    for (;;) {
+        c = &pl->chunks[pl->next_write % pl->chunks_count];
+        while (!pl->error && !(pl->next_write < pl->next_fill && c->state == CHUNK_DONE) &&
+               !(pl->eof && pl->next_write == pl->next_fill)) {
+            pthread_cond_wait(&pl->cond, &pl->lock);
+        }
+        if (pl->error || pl->next_write == pl->next_fill) {
+            break;
+        }
+        pthread_mutex_unlock(&pl->lock);
+
+        for (written = 0, n = 0; written < c->out_len; written += (size_t) n) {
+            if ((n = write(STDOUT_FILENO, c->out + written, c->out_len - written)) <= 0) {
+                break;
+            }
+        }
+
+        pthread_mutex_lock(&pl->lock);
+        if (written < c->out_len) {
+            fprintf(stderr, "Write error: %s\n", strerror(errno));
+            pl->error = 1;
+        }
+        pl->bytes_in += c->in_len;
+        pl->bytes_out += c->out_len;
+        pl->addresses += c->addresses;
+        pl->invalid += c->invalid;
+        c->state = CHUNK_FREE;
+        pl->next_write++;
+        pthread_cond_broadcast(&pl->cond);
+    }
+    pthread_mutex_unlock(&pl->lock);
+    return NULL;
+}
+
+/**
+ * Fill a chunk from `fd`, with the bytes carried over from the previous chunk first. The chunk
+ * ends after the last complete line; the remaining bytes are carried over to the next chunk.
+ * Sets `*eof` at the end of the file. Returns 0 on success, or -1 on error.
+ */
+static int
+chunk_fill(Chunk *c, int fd, char **carry, size_t *carry_len, size_t *carry_cap, int *eof)
+{
+    char   *tmp;
+    char   *nl;
+    size_t  tail;
+    ssize_t n;
+
+    c->in_len = 0;
+    if (c->in_cap < CHUNK_BYTES || c->in_cap < *carry_len) {
+        free(c->in);
+        c->in_cap = *carry_len > CHUNK_BYTES ? *carry_len * 2 : CHUNK_BYTES;
+        if ((c->in = (char *) malloc(c->in_cap)) == NULL) {
+            return -1;
+        }
+    }
+    if (*carry_len > 0) {
+        memcpy(c->in, *carry, *carry_len);
+    }
+    c->in_len  = *carry_len;
+    *carry_len = 0;
+    for (;;) {
+        while (c->in_len < c->in_cap) {
+            n = read(fd, c->in + c->in_len, c->in_cap - c->in_len);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                return -1;
+            }
+            if (n == 0) {
+                *eof = 1;
+                return 0;
+            }
+            c->in_len += (size_t) n;
+        }
+        if ((nl = last_newline(c->in, c->in_len)) != NULL) {
+            break;
+        }
+        // A line doesn't fit in the chunk.
+        if ((tmp = (char *) realloc(c->in, c->in_cap * 2)) == NULL) {
+            return -1;
+        }
+        c->in = tmp;
+        c->in_cap *= 2;
+    }
+    tail = c->in_len - (size_t) (nl + 1 - c->in);
+    if (tail > *carry_cap) {
+        free(*carry);
+        *carry_cap = tail;
+        if ((*carry = (char *) malloc(*carry_cap)) == NULL) {
+            return -1;
+        }
+    }
+    memcpy(*carry, nl + 1, tail);
+    *carry_len = tail;
+    c->in_len -= tail;
+    return 0;
+}
+
+/**
+ * Read all the input files, and hand the chunks to the workers. Returns 0 on success, or -1 on
+ * error.
+ */
+static int
+read_input(Pipeline *pl)
+{
+    const Options *opts      = pl->opts;
+    char          *carry     = NULL;
+    size_t         carry_len = 0, carry_cap = 0;
+    size_t         i;
+    Chunk         *c;
+    const char    *file;
+    int            fd, eof, first, ret = 0;
+
+    for (i = 0; i < (opts->files_count > 0 ? opts->files_count : 1) && ret == 0; i++) {
+        file = opts->files_count > 0 ? opts->files[i] : "-";
+        fd   = strcmp(file, "-") == 0 ? STDIN_FILENO : open(file, O_RDONLY);
+        if (fd == -1) {
+            fprintf(stderr, "%s: %s\n", file, strerror(errno));
+            ret = -1;
+            break;
+        }
+        for (eof = 0, first = 1; !eof;) {
+            pthread_mutex_lock(&pl->lock);
+            c = &pl->chunks[pl->next_fill % pl->chunks_count];
+            while (!pl->error && c->state != CHUNK_FREE) {
+                pthread_cond_wait(&pl->cond, &pl->lock);
+            }
+            pthread_mutex_unlock(&pl->lock);
+            if (pl->error) {
+                ret = -1;
+                break;
+            }
+            if (chunk_fill(c, fd, &carry, &carry_len, &carry_cap, &eof) != 0) {
+                fprintf(stderr, "%s: %s\n", file, strerror(errno));
+                ret = -1;
+                break;
+            }
+            if (c->in_len == 0) {
+                continue;
+            }
+            c->has_header = first && opts->header;
+            first         = 0;
+
+            pthread_mutex_lock(&pl->lock);
+            c->state = CHUNK_FILLED;
+            pl->next_fill++;
+            pthread_cond_broadcast(&pl->cond);
+            pthread_mutex_unlock(&pl->lock);
+        }
+        if (fd != STDIN_FILENO) {
+            close(fd);
+        }
+    }
+    free(carry);
+
+    pthread_mutex_lock(&pl->lock);
+    pl->eof = 1;
+    if (ret != 0) {
+        pl->error = 1;
+    }
+    pthread_cond_broadcast(&pl->cond);
+    pthread_mutex_unlock(&pl->lock);
+
+    return ret;
+}
+
+static int
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [--mode deterministic|pfx|nd|ndx] [--decrypt] [--format text|list|csv]\n"
+            "       [--columns N[,N...]] [--delimiter C] [--header] [--threads N] [--quiet]\n"
+            "       --key HEX [FILE...]\n",
+            prog);
+    return 1;
+}
+
+static int
+parse_columns(Options *opts, const char *list)
+{
+    unsigned long column;
+    char         *end;
+
+    memset(opts->columns, 0, sizeof opts->columns);
+    opts->columns_count = 0;
+    for (;;) {
+        column = strtoul(list, &end, 10);
+        if (end == list || column == 0 || column > MAX_COLUMNS) {
+            return -1;
+        }
+        opts->columns_count += !opts->columns[column];
+        opts->columns[column] = 1;
+        if (*end == 0) {
+            return 0;
+        }
+        if (*end != ',') {
+            return -1;
+        }
+        list = end + 1;
+    }
+}
+
+static int
+parse_options(Options *opts, int argc, char *argv[])
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int  arg;
+    int  i;
+
+    memset(opts, 0, sizeof *opts);
+    opts->threads       = cpus > 0 ? (unsigned int) cpus : 1;
+    opts->mode          = MODE_DETERMINISTIC;
+    opts->format        = FORMAT_TEXT;
+    opts->delimiter     = ',';
+    opts->columns[1]    = 1;
+    opts->columns_count = 1;
+    for (arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "--") == 0 || argv[arg][0] != '-' || argv[arg][1] == 0) {
+            arg += strcmp(argv[arg], "--") == 0;
+            break;
+        }
+        if (strcmp(argv[arg], "--decrypt") == 0) {
+            opts->decrypt = 1;
+            continue;
+        }
+        if (strcmp(argv[arg], "--header") == 0) {
+            opts->header = 1;
+            continue;
+        }
+        if (strcmp(argv[arg], "--quiet") == 0) {
+            opts->quiet = 1;
+            continue;
+        }
+        if (arg + 1 >= argc) {
+            return -1;
+        }
+        if (strcmp(argv[arg], "--key") == 0) {
+            opts->key_hex = argv[++arg];
+        } else if (strcmp(argv[arg], "--threads") == 0) {
+            opts->threads = (unsigned int) strtoul(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "--mode") == 0) {
+            arg++;
+            for (opts->mode = -1, i = 0; i < 4; i++) {
+                if (strcmp(argv[arg], mode_names[i]) == 0) {
+                    opts->mode = i;
+                }
+            }
+            if (opts->mode < 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[arg], "--format") == 0) {
+            arg++;
+            for (opts->format = -1, i = 0; i < 3; i++) {
+                if (strcmp(argv[arg], format_names[i]) == 0) {
+                    opts->format = i;
+                }
+            }
+            if (opts->format < 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[arg], "--columns") == 0) {
+            if (parse_columns(opts, argv[++arg]) != 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[arg], "--delimiter") == 0) {
+            arg++;
+            if (strlen(argv[arg]) != 1 || argv[arg][0] == '"' || argv[arg][0] == '\n') {
+                return -1;
+            }
+            opts->delimiter = argv[arg][0];
+        } else {
+            return -1;
+        }
+    }
+    opts->files       = argv + arg;
+    opts->files_count = (size_t) (argc - arg);
+    if (opts->key_hex == NULL || opts->threads == 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static Contexts contexts;
+    Options         opts;
+    Pipeline        pl;
+    Worker         *workers;
+    pthread_t       writer;
+    uint8_t         key[IPCRYPT_NDX_KEYBYTES];
+    size_t          key_len;
+    double          t0, elapsed;
+    unsigned int    i;
+    int             ret;
+
+    if (parse_options(&opts, argc, argv) != 0) {
+        return usage(argv[0]);
+    }
+    key_len = opts.mode == MODE_PFX || opts.mode == MODE_NDX ? IPCRYPT_NDX_KEYBYTES
+                                                             : IPCRYPT_KEYBYTES;
+    if (ipcrypt_key_from_hex(key, key_len, opts.key_hex, strlen(opts.key_hex)) != 0) {
+        fprintf(stderr, "Invalid key: %zu hex characters are required for the %s mode\n",
+                key_len * 2, mode_names[opts.mode]);
+        return 1;
+    }
+    switch (opts.mode) {
+    case MODE_DETERMINISTIC:
+    case MODE_ND:
+        ipcrypt_init(&contexts.ipcrypt, key);
+        break;
+    case MODE_PFX:
+        ipcrypt_pfx_init(&contexts.ipcrypt_pfx, key);
+        break;
+    case MODE_NDX:
+        ipcrypt_ndx_init(&contexts.ipcrypt_ndx, key);
+        break;
+    }
+
+    memset(&pl, 0, sizeof pl);
+    pl.opts         = &opts;
+    pl.contexts     = &contexts;
+    pl.chunks_count = (size_t) opts.threads * CHUNKS_PER_WORKER + 2;
+    pl.random_fd    = -1;
+    if ((opts.mode == MODE_ND || opts.mode == MODE_NDX) && !opts.decrypt &&
+        (pl.random_fd = open("/dev/urandom", O_RDONLY)) == -1) {
+        fprintf(stderr, "/dev/urandom: %s\n", strerror(errno));
+        return 1;
+    }
+    pl.chunks = (Chunk *) calloc(pl.chunks_count, sizeof *pl.chunks);
+    workers   = (Worker *) calloc(opts.threads, sizeof *workers);
+    if (pl.chunks == NULL || workers == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    pthread_mutex_init(&pl.lock, NULL);
+    pthread_cond_init(&pl.cond, NULL);
+    for (i = 0; i < opts.threads; i++) {
+        workers[i].pl         = &pl;
+        workers[i].random_pos = sizeof workers[i].random;
+        if (opts.format == FORMAT_TEXT) {
+            workers[i].log =
+                opts.decrypt
+                    ? ipcrypt_log_create_decryptor((IPCryptMode) opts.mode, key, key_len, NULL,
+                                                   NULL)
+                    : ipcrypt_log_create((IPCryptMode) opts.mode, key, key_len, worker_random,
+                                         &workers[i]);
+            if (workers[i].log == NULL) {
+                fprintf(stderr, "Out of memory\n");
+                return 1;
+            }
+        }
+    }
+    memset(key, 0, sizeof key);
+
+    t0 = now();
+    for (i = 0; i < opts.threads; i++) {
+        if (pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]) != 0) {
+            fprintf(stderr, "Unable to start the worker threads\n");
+            return 1;
+        }
+    }
+    if (pthread_create(&writer, NULL, writer_run, &pl) != 0) {
+        fprintf(stderr, "Unable to start the writer thread\n");
+        return 1;
+    }
+    ret = read_input(&pl);
+    for (i = 0; i < opts.threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        ipcrypt_log_destroy(workers[i].log);
+    }
+    pthread_join(writer, NULL);
+    elapsed = now() - t0;
+
+    if (!opts.quiet) {
+        fprintf(stderr,
+                "%llu bytes in, %llu bytes out, %llu addresses, %llu invalid, %.3f s, "
+                "%.1f MB/s on %u threads\n",
+                (unsigned long long) pl.bytes_in, (unsigned long long) pl.bytes_out,
+                (unsigned long long) pl.addresses, (unsigned long long) pl.invalid, elapsed,
+                elapsed > 0 ? (double) pl.bytes_in / elapsed / 1e6 : 0.0, opts.threads);
+    }
+    for (i = 0; i < pl.chunks_count; i++) {
+        free(pl.chunks[i].in);
+        free(pl.chunks[i].out);
+    }
+    free(pl.chunks);
+    free(workers);
+    ipcrypt_deinit(&contexts.ipcrypt);
+    ipcrypt_pfx_deinit(&contexts.ipcrypt_pfx);
+    ipcrypt_ndx_deinit(&contexts.ipcrypt_ndx);
+    if (pl.random_fd != -1) {
+        close(pl.random_fd);
+    }
+    return ret != 0 || pl.error ? 1 : 0;
+}
@@ -0,0 +1,973 @@
+/**
+ * Local encryption service.
+ *
+ * Serves encryption and decryption requests over a Unix domain socket, for programs that process
+ * one address at a time, such as bindings for other languages. Concurrent requests for the same
+ * mode and direction are coalesced into micro-batches, that are processed with the strided batch
+ * functions.
+ *
+ * A batch is processed as soon as it is full, or when its deadline expires. The deadline adapts to
+ * the load: it is the time the batch is expected to take to fill up, given the average interval
+ * between recent requests and the number of connections that could still send one, capped by
+ * --max-delay. When requests are rare, or when every client is waiting for a response, batches are
+ * processed right after the requests available on the sockets have been read, without waiting.
+ *
+ * Protocol. All integers are little-endian. Clients can send any number of requests without
+ * waiting for responses.
+ *
+ *   request:  id (4 bytes), operation (1 byte), mode (1 byte), payload length (2 bytes), payload
+ *   response: id (4 bytes), status (1 byte), 0 (1 byte), payload length (2 bytes), payload
+ *
+ * The id is chosen by the client, and copied into the response. Responses to requests for
+ * different modes or directions can be sent out of order.
+ *
+ * Operations:
+ * - 0 (encrypt): the payload is a 16-byte address. The response is the 16-byte encrypted address
+ *   for the deterministic and PFX modes, or the IPCRYPT_NDIP_BYTES or IPCRYPT_NDX_NDIP_BYTES
+ *   ciphertext for the ND and NDX modes, with a random tweak.
+ * - 1 (decrypt): the payload is a 16-byte encrypted address, or a ciphertext. The response is the
+ *   16-byte address.
+ * - 2 (statistics): the payload is empty, and the mode is ignored. The response is a text report
+ *   of the number of requests and batches, and of the latency histograms, for every mode and
+ *   direction.
+ *
+ * Modes are IPCryptMode values. The status is 0 on success, 1 if the request is invalid, and 2 if
+ * no key was given for the mode.
+ *
+ * Usage: ipcryptd --socket PATH --key MODE=HEX [--key MODE=HEX...]
+ *                 [--max-batch N] [--max-delay MICROSECONDS]
+ *
+ * Modes are deterministic, pfx, nd and ndx. Statistics are printed on the standard error on exit.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#    define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ipcrypt2.h"
+
+/** Highest value accepted by --max-batch. */
+#define MAX_BATCH 1024U
+
+/** Size of a record of a batch: the largest ciphertext. */
+#define RECORD_BYTES IPCRYPT_NDX_NDIP_BYTES
+
+/** Size of the header of requests and responses. */
+#define HEADER_BYTES 8U
+
+/** Largest payload of a request. */
+#define MAX_REQUEST_PAYLOAD RECORD_BYTES
+
+/** Size of the input buffer of a connection. */
+#define IN_BUFFER_BYTES 65536U
+
+/** Connections with more unsent output than this are not read until the output is sent. */
+#define OUT_HIGH_WATER (1U << 20)
+
+/** Number of buckets of a histogram. Bucket `i` counts values between 2^i and 2^(i+1) - 1. */
+#define HIST_BUCKETS 40
+
+/** Size of the buffer of random bytes. */
+#define RANDOM_BYTES 4096
+
+enum { OP_ENCRYPT, OP_DECRYPT, OP_STATS };
+
+enum { STATUS_OK, STATUS_INVALID, STATUS_NO_KEY };
+
+static const char *const mode_names[4] = { "deterministic", "pfx", "nd", "ndx" };
+static const char *const op_names[2]   = { "encrypt", "decrypt" };
+
+typedef struct Histogram {
+    uint64_t buckets[HIST_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+} Histogram;
+
+/**
+ * Conn is a client connection. A closed connection is freed once it has no requests left in any
+ * batch.
+ */
+typedef struct Conn {
+    int      fd;
+    size_t   pending;
+    size_t   in_len;
+    uint8_t *out;
+    size_t   out_len;
+    size_t   out_pos;
+    size_t   out_cap;
+    uint8_t  in[IN_BUFFER_BYTES];
+} Conn;
+
+/**
+ * Batch holds the pending requests for a mode and a direction, stored as records for the strided
+ * functions.
+ */
+typedef struct Batch {
+    size_t    count;
+    uint64_t  first_ns;
+    uint64_t  last_ns;
+    uint64_t  gap_ns;
+    uint64_t  requests;
+    uint64_t  batches;
+    Histogram latency;
+    Histogram sizes;
+    Conn     *conns[MAX_BATCH];
+    uint32_t  ids[MAX_BATCH];
+    uint64_t  arrivals[MAX_BATCH];
+    uint8_t   records[MAX_BATCH][RECORD_BYTES];
+} Batch;
+
+typedef struct Server {
+    IPCrypt    ipcrypt;
+    IPCrypt    ipcrypt_nd;
+    IPCryptPFX ipcrypt_pfx;
+    IPCryptNDX ipcrypt_ndx;
+    int        has_key[4];
+    size_t     max_batch;
+    uint64_t   max_delay_ns;
+    int        listen_fd;
+    int        random_fd;
+    Conn     **conns;
+    size_t     conns_count;
+    size_t     conns_cap;
+    Batch      batches[2][4];
+    size_t     random_pos;
+    uint8_t    random[RANDOM_BYTES];
+} Server;
+
+typedef struct Options {
+    const char  *socket_path;
+    const char  *keys[4];
+    size_t       max_batch;
+    unsigned int max_delay_us;
+} Options;
+
+static volatile sig_atomic_t stop;
+
+static void
+on_signal(int sig)
+{
+    (void) sig;
+    stop = 1;
+}
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000U + (uint64_t) ts.tv_nsec;
+}
+
+static inline uint16_t
+load16(const uint8_t *p)
+{
+    return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+static inline uint32_t
+load32(const uint8_t *p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) |
+           ((uint32_t) p[3] << 24);
+}
+
+static inline void
+store16(uint8_t *p, uint16_t x)
+{
+    p[0] = (uint8_t) x;
+    p[1] = (uint8_t) (x >> 8);
+}
+
+static inline void
+store32(uint8_t *p, uint32_t x)
+{
+    p[0] = (uint8_t) x;
+    p[1] = (uint8_t) (x >> 8);
+    p[2] = (uint8_t) (x >> 16);
+    p[3] = (uint8_t) (x >> 24);
+}
+
+static void
+hist_add(Histogram *h, uint64_t x)
+{
+    unsigned int i = 0;
+
+    while (i < HIST_BUCKETS - 1 && (x >> (i + 1)) != 0) {
+        i++;
+    }
+    h->buckets[i]++;
+    h->count++;
+    h->sum += x;
+}
+
+/**
+ * hist_percentile returns the upper bound of the bucket that contains the `q` quantile.
+ */
+static uint64_t
+hist_percentile(const Histogram *h, double q)
+{
+    const uint64_t target = (uint64_t) ((double) h->count * q);
+    uint64_t       seen   = 0;
+    unsigned int   i;
+
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen > target) {
+            break;
+        }
+    }
+    return ((uint64_t) 2 << (i < HIST_BUCKETS ? i : HIST_BUCKETS - 1)) - 1;
+}
+
+/**
+ * mode_ciphertext_bytes returns the size of a ciphertext of a mode.
+ */
+static size_t
+mode_ciphertext_bytes(unsigned int mode)
+{
+    switch (mode) {
+    case IPCRYPT_MODE_ND:
+        return IPCRYPT_NDIP_BYTES;
+    case IPCRYPT_MODE_NDX:
+        return IPCRYPT_NDX_NDIP_BYTES;
+    }
+    return 16;
+}
+
+/**
+ * mode_tweak_bytes returns the size of the tweak that precedes the address in a ciphertext.
+ */
+static size_t
+mode_tweak_bytes(unsigned int mode)
+{
+    return mode_ciphertext_bytes(mode) - 16;
+}
+
+static void
+server_random(Server *server, uint8_t *buf, size_t len)
+{
+    size_t  done;
+    ssize_t n;
+
+    if (len > sizeof server->random - server->random_pos) {
+        for (done = 0; done < sizeof server->random; done += (size_t) n) {
+            if ((n = read(server->random_fd, server->random + done,
+                          sizeof server->random - done)) <= 0) {
+                fprintf(stderr, "Unable to read random bytes: %s\n", strerror(errno));
+                exit(1);
+            }
+        }
+        server->random_pos = 0;
+    }
+    memcpy(buf, server->random + server->random_pos, len);
+    server->random_pos += len;
+}
+
+static void
+conn_close(Conn *conn)
+{
+    if (conn->fd != -1) {
+        close(conn->fd);
+        conn->fd = -1;
+    }
+}
+
+/**
+ * conn_respond appends a response to the output buffer of a connection.
+ * Responses to closed connections are dropped.
+ */
+static void
+conn_respond(Conn *conn, uint32_t id, unsigned int status, const void *payload, size_t len)
+{
+    uint8_t *out;
+    size_t   cap;
+
+    if (conn->fd == -1) {
+        return;
+    }
+    if (conn->out_pos > 0 && conn->out_cap - conn->out_len < HEADER_BYTES + len) {
+        memmove(conn->out, conn->out + conn->out_pos, conn->out_len - conn->out_pos);
+        conn->out_len -= conn->out_pos;
+        conn->out_pos = 0;
+    }
+    if (conn->out_cap - conn->out_len < HEADER_BYTES + len) {
+        cap = conn->out_cap == 0 ? 4096 : conn->out_cap * 2;
+        while (cap - conn->out_len < HEADER_BYTES + len) {
+            cap *= 2;
+        }
+        if ((out = (uint8_t *) realloc(conn->out, cap)) == NULL) {
+            conn_close(conn);
+            return;
+        }
+        conn->out     = out;
+        conn->out_cap = cap;
+    }
+    out = conn->out + conn->out_len;
+    store32(out, id);
+    out[4] = (uint8_t) status;
+    out[5] = 0;
+    store16(out + 6, (uint16_t) len);
+    if (len > 0) {
+        memcpy(out + HEADER_BYTES, payload, len);
+    }
+    conn->out_len += HEADER_BYTES + len;
+}
+
+/**
+ * conn_flush sends as much of the output of a connection as the socket accepts.
+ */
+static void
+conn_flush(Conn *conn)
+{
+    ssize_t n;
+
+    while (conn->fd != -1 && conn->out_pos < conn->out_len) {
+        n = send(conn->fd, conn->out + conn->out_pos, conn->out_len - conn->out_pos, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                conn_close(conn);
+            }
+            return;
+        }
+        conn->out_pos += (size_t) n;
+    }
+    conn->out_pos = conn->out_len = 0;
+}
+
+/**
+ * batch_process encrypts or decrypts all the records of a batch at once, and answers the requests.
+ */
+static void
+batch_process(Server *server, unsigned int op, unsigned int mode)
+{
+    static const size_t offsets[1] = { 0 };
+    Batch *const        batch      = &server->batches[op][mode];
+    const size_t        ct_bytes   = mode_ciphertext_bytes(mode);
+    uint64_t            now;
+    size_t              i;
+
+    if (batch->count == 0) {
+        return;
+    }
+    switch (mode) {
+    case IPCRYPT_MODE_DETERMINISTIC:
+        (op == OP_ENCRYPT ? ipcrypt_encrypt_ip16_strided : ipcrypt_decrypt_ip16_strided)(
+            &server->ipcrypt, batch->records, batch->count, RECORD_BYTES, offsets, 1, ct_bytes);
+        break;
+    case IPCRYPT_MODE_PFX:
+        (op == OP_ENCRYPT ? ipcrypt_pfx_encrypt_ip16_strided : ipcrypt_pfx_decrypt_ip16_strided)(
+            &server->ipcrypt_pfx, batch->records, batch->count, RECORD_BYTES, offsets, 1,
+            ct_bytes);
+        break;
+    case IPCRYPT_MODE_ND:
+        (op == OP_ENCRYPT ? ipcrypt_nd_encrypt_ip16_strided : ipcrypt_nd_decrypt_ip16_strided)(
+            &server->ipcrypt_nd, batch->records, batch->count, RECORD_BYTES, offsets, 1,
+            ct_bytes);
+        break;
+    case IPCRYPT_MODE_NDX:
+        (op == OP_ENCRYPT ? ipcrypt_ndx_encrypt_ip16_strided : ipcrypt_ndx_decrypt_ip16_strided)(
+            &server->ipcrypt_ndx, batch->records, batch->count, RECORD_BYTES, offsets, 1,
+            ct_bytes);
+        break;
+    }
+    now = now_ns();
+    for (i = 0; i < batch->count; i++) {
+        if (op == OP_ENCRYPT) {
+            conn_respond(batch->conns[i], batch->ids[i], STATUS_OK, batch->records[i], ct_bytes);
+        } else {
+            conn_respond(batch->conns[i], batch->ids[i], STATUS_OK,
+                         batch->records[i] + mode_tweak_bytes(mode), 16);
+        }
+        batch->conns[i]->pending--;
+        hist_add(&batch->latency, now - batch->arrivals[i]);
+    }
+    hist_add(&batch->sizes, batch->count);
+    batch->requests += batch->count;
+    batch->batches++;
+    batch->count = 0;
+}
+
+/**
+ * batch_deadline returns the time at which a non-empty batch has to be processed.
+ *
+ * `idle` is the number of connections without any pending request. Clients that wait for their
+ * responses before sending new requests can't add anything to a batch, so there is no point in
+ * waiting for more requests than there are idle connections.
+ */
+static uint64_t
+batch_deadline(const Server *server, const Batch *batch, size_t idle)
+{
+    uint64_t expected;
+    uint64_t wait;
+
+    if (idle == 0 || batch->gap_ns >= server->max_delay_ns) {
+        return batch->first_ns;
+    }
+    expected = server->max_batch - batch->count;
+    if (expected > idle) {
+        expected = idle;
+    }
+    wait = batch->gap_ns * expected;
+    if (wait > server->max_delay_ns) {
+        wait = server->max_delay_ns;
+    }
+    return batch->first_ns + wait;
+}
+
+/**
+ * batch_add queues a valid request, and processes the batch if it is full.
+ */
+static void
+batch_add(Server *server, Conn *conn, uint32_t id, unsigned int op, unsigned int mode,
+          const uint8_t *payload, size_t len, uint64_t now)
+{
+    Batch *const batch = &server->batches[op][mode];
+    uint64_t     gap;
+    uint8_t     *record;
+
+    // The average interval between requests is tracked with an exponential moving average.
+    // Long idle periods are clamped, so that the average quickly follows a new burst.
+    if (batch->last_ns != 0) {
+        gap = now - batch->last_ns;
+        if (gap > 2 * server->max_delay_ns) {
+            gap = 2 * server->max_delay_ns;
+        }
+        batch->gap_ns = batch->gap_ns - batch->gap_ns / 8 + gap / 8;
+    }
+    batch->last_ns = now;
+    if (batch->count == 0) {
+        batch->first_ns = now;
+    }
+    record = batch->records[batch->count];
+    if (op == OP_ENCRYPT && mode_tweak_bytes(mode) > 0) {
+        server_random(server, record, mode_tweak_bytes(mode));
+        memcpy(record + mode_tweak_bytes(mode), payload, len);
+    } else {
+        memcpy(record, payload, len);
+    }
+    batch->conns[batch->count]    = conn;
+    batch->ids[batch->count]      = id;
+    batch->arrivals[batch->count] = now;
+    batch->count++;
+    conn->pending++;
+    if (batch->count == server->max_batch) {
+        batch_process(server, op, mode);
+    }
+}
+
+/**
+ * stats_format writes the statistics of the server as text into `buf`.
+ * Returns the length of the text.
+ */
+static size_t
+stats_format(const Server *server, char *buf, size_t buf_len)
+{
+    const Batch *batch;
+    size_t       len = 0;
+    unsigned int op, mode, i;
+    int          n;
+
+#define STATS_PRINTF(...)                                             \
+    do {                                                              \
+        n = snprintf(buf + len, buf_len - len, __VA_ARGS__);          \
+        if (n < 0 || (size_t) n >= buf_len - len) {                   \
+            return len;                                               \
+        }                                                             \
+        len += (size_t) n;                                            \
+    } while (0)
+
+    for (op = OP_ENCRYPT; op <= OP_DECRYPT; op++) {
+        for (mode = 0; mode < 4; mode++) {
+            batch = &server->batches[op][mode];
+            if (batch->requests == 0) {
+                continue;
+            }
+            STATS_PRINTF("%s %s: %llu requests, %llu batches, %.1f requests/batch, "
+                         "latency p50 %.1f us, p99 %.1f us, p99.9 %.1f us, mean %.1f us\n",
+                         mode_names[mode], op_names[op], (unsigned long long) batch->requests,
+                         (unsigned long long) batch->batches,
+                         (double) batch->requests / (double) batch->batches,
+                         (double) hist_percentile(&batch->latency, 0.5) / 1e3,
+                         (double) hist_percentile(&batch->latency, 0.99) / 1e3,
+                         (double) hist_percentile(&batch->latency, 0.999) / 1e3,
+                         (double) batch->latency.sum / (double) batch->latency.count / 1e3);
+            for (i = 0; i < HIST_BUCKETS; i++) {
+                if (batch->latency.buckets[i] != 0) {
+                    STATS_PRINTF("  latency < %10llu ns: %llu\n",
+                                 (unsigned long long) ((uint64_t) 2 << i),
+                                 (unsigned long long) batch->latency.buckets[i]);
+                }
+            }
+            for (i = 0; i < HIST_BUCKETS; i++) {
+                if (batch->sizes.buckets[i] != 0) {
+                    STATS_PRINTF("  batch size < %5llu: %llu\n",
+                                 (unsigned long long) ((uint64_t) 2 << i),
+                                 (unsigned long long) batch->sizes.buckets[i]);
+                }
+            }
+        }
+    }
+#undef STATS_PRINTF
+
+    return len;
+}
+
+/**
+ * handle_request answers an invalid or statistics request immediately, or queues the request.
+ */
+static void
+handle_request(Server *server, Conn *conn, const uint8_t *request, uint64_t now)
+{
+    const uint32_t     id      = load32(request);
+    const unsigned int op      = request[4];
+    const unsigned int mode    = request[5];
+    const size_t       len     = load16(request + 6);
+    const uint8_t     *payload = request + HEADER_BYTES;
+    char               report[65535];
+
+    if (op == OP_STATS) {
+        conn_respond(conn, id, STATUS_OK, report, stats_format(server, report, sizeof report));
+        return;
+    }
+    if (op > OP_DECRYPT || mode > 3 ||
+        len != (op == OP_ENCRYPT ? 16 : mode_ciphertext_bytes(mode))) {
+        conn_respond(conn, id, STATUS_INVALID, NULL, 0);
+        return;
+    }
+    if (!server->has_key[mode]) {
+        conn_respond(conn, id, STATUS_NO_KEY, NULL, 0);
+        return;
+    }
+    batch_add(server, conn, id, op, mode, payload, len, now);
+}
+
+/**
+ * conn_read reads the available requests of a connection, and handles them.
+ */
+static void
+conn_read(Server *server, Conn *conn)
+{
+    uint64_t now;
+    size_t   pos = 0;
+    size_t   len;
+    ssize_t  n;
+
+    n = recv(conn->fd, conn->in + conn->in_len, sizeof conn->in - conn->in_len, 0);
+    if (n <= 0) {
+        if (n == 0 || (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            conn_close(conn);
+        }
+        return;
+    }
+    conn->in_len += (size_t) n;
+    now = now_ns();
+    while (conn->in_len - pos >= HEADER_BYTES) {
+        len = load16(conn->in + pos + 6);
+        if (len > MAX_REQUEST_PAYLOAD) {
+            conn_close(conn);
+            return;
+        }
+        if (conn->in_len - pos < HEADER_BYTES + len) {
+            break;
+        }
+        handle_request(server, conn, conn->in + pos, now);
+        pos += HEADER_BYTES + len;
+    }
+    memmove(conn->in, conn->in + pos, conn->in_len - pos);
+    conn->in_len -= pos;
+}
+
+static void
+server_accept(Server *server)
+{
+    Conn **conns;
+    Conn  *conn;
+    int    fd;
+
+    while ((fd = accept(server->listen_fd, NULL, NULL)) != -1) {
+        if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+            close(fd);
+            continue;
+        }
+        if (server->conns_count == server->conns_cap) {
+            const size_t cap = server->conns_cap == 0 ? 16 : server->conns_cap * 2;
+
+            if ((conns = (Conn **) realloc(server->conns, cap * sizeof *conns)) == NULL) {
+                close(fd);
+                continue;
+            }
+            server->conns     = conns;
+            server->conns_cap = cap;
+        }
+        if ((conn = (Conn *) calloc(1, sizeof *conn)) == NULL) {
+            close(fd);
+            continue;
+        }
+        conn->fd                             = fd;
+        server->conns[server->conns_count++] = conn;
+    }
+}
+
+/**
+ * server_reap frees the closed connections that have no pending requests.
+ */
+static void
+server_reap(Server *server)
+{
+    size_t i = 0;
+    Conn  *conn;
+
+    while (i < server->conns_count) {
+        conn = server->conns[i];
+        if (conn->fd != -1 || conn->pending != 0) {
+            i++;
+            continue;
+        }
+        free(conn->out);
+        free(conn);
+        server->conns[i] = server->conns[--server->conns_count];
+    }
+}
+
+/**
+ * server_idle_conns returns the number of open connections without any pending request.
+ */
+static size_t
+server_idle_conns(const Server *server)
+{
+    size_t idle = 0;
+    size_t i;
+
+    for (i = 0; i < server->conns_count; i++) {
+        idle += server->conns[i]->fd != -1 && server->conns[i]->pending == 0;
+    }
+    return idle;
+}
+
+/**
+ * server_timeout_ns returns the time until the next deadline, or -1 if no batch is pending.
+ */
+static int64_t
+server_timeout_ns(const Server *server, uint64_t now)
+{
+    const size_t idle = server_idle_conns(server);
+
+    int64_t      timeout = -1;
+    uint64_t     deadline;
+    unsigned int op, mode;
+
+    for (op = OP_ENCRYPT; op <= OP_DECRYPT; op++) {
+        for (mode = 0; mode < 4; mode++) {
+            if (server->batches[op][mode].count == 0) {
+                continue;
+            }
+            deadline = batch_deadline(server, &server->batches[op][mode], idle);
+            if (deadline <= now) {
+                return 0;
+            }
+            if (timeout == -1 || (int64_t) (deadline - now) < timeout) {
+                timeout = (int64_t) (deadline - now);
+            }
+        }
+    }
+    return timeout;
+}
+
+/**
+ * wait_events waits for events on the sockets, for at most `timeout_ns` nanoseconds, or
+ * indefinitely if `timeout_ns` is -1.
+ */
+static int
+wait_events(struct pollfd *fds, nfds_t nfds, int64_t timeout_ns)
+{
+#ifdef __linux__
+    struct timespec ts;
+
+    if (timeout_ns < 0) {
+        return ppoll(fds, nfds, NULL, NULL);
+    }
+    ts.tv_sec  = (time_t) (timeout_ns / 1000000000);
+    ts.tv_nsec = (long) (timeout_ns % 1000000000);
+    return ppoll(fds, nfds, &ts, NULL);
+#else
+    return poll(fds, nfds, timeout_ns < 0 ? -1 : (int) ((timeout_ns + 999999) / 1000000));
+#endif
+}
+
+static int
+server_run(Server *server)
+{
+    struct pollfd *fds = NULL;
+    size_t         fds_cap = 0;
+    size_t         polled;
+    size_t         idle;
+    size_t         i;
+    uint64_t       now;
+    unsigned int   op, mode;
+    Conn          *conn;
+
+    while (!stop) {
+        if (fds_cap < server->conns_count + 1) {
+            fds_cap = (server->conns_count + 1) * 2;
+            if ((fds = (struct pollfd *) realloc(fds, fds_cap * sizeof *fds)) == NULL) {
+                fprintf(stderr, "Out of memory\n");
+                return -1;
+            }
+        }
+        fds[0].fd     = server->listen_fd;
+        fds[0].events = POLLIN;
+        for (i = 0; i < server->conns_count; i++) {
+            conn          = server->conns[i];
+            fds[i + 1].fd = conn->fd;
+            fds[i + 1].events =
+                (short) ((conn->out_len - conn->out_pos < OUT_HIGH_WATER ? POLLIN : 0) |
+                         (conn->out_pos < conn->out_len ? POLLOUT : 0));
+        }
+        if (wait_events(fds, (nfds_t) (server->conns_count + 1),
+                        server_timeout_ns(server, now_ns())) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "poll: %s\n", strerror(errno));
+            free(fds);
+            return -1;
+        }
+        // Connections accepted now are not in `fds`, and are polled in the next iteration.
+        polled = server->conns_count;
+        if (fds[0].revents & POLLIN) {
+            server_accept(server);
+        }
+        for (i = 0; i < polled; i++) {
+            conn = server->conns[i];
+            if (conn->fd != -1 && (fds[i + 1].revents & POLLOUT)) {
+                conn_flush(conn);
+            }
+            if (conn->fd != -1 && (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))) {
+                conn_read(server, conn);
+            }
+        }
+        now  = now_ns();
+        idle = server_idle_conns(server);
+        for (op = OP_ENCRYPT; op <= OP_DECRYPT; op++) {
+            for (mode = 0; mode < 4; mode++) {
+                if (server->batches[op][mode].count != 0 &&
+                    batch_deadline(server, &server->batches[op][mode], idle) <= now) {
+                    batch_process(server, op, mode);
+                }
+            }
+        }
+        for (i = 0; i < server->conns_count; i++) {
+            conn_flush(server->conns[i]);
+        }
+        server_reap(server);
+    }
+    free(fds);
+
+    return 0;
+}
+
+static int
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s --socket PATH --key MODE=HEX [--key MODE=HEX...]\n"
+            "       [--max-batch N] [--max-delay MICROSECONDS]\n"
+            "Modes: deterministic, pfx, nd, ndx\n",
+            prog);
+    return 1;
+}
+
+static int
+parse_options(Options *opts, int argc, char *argv[])
+{
+    const char  *eq;
+    unsigned int mode;
+    int          arg;
+    int          has_key = 0;
+
+    memset(opts, 0, sizeof *opts);
+    opts->max_batch    = 256;
+    opts->max_delay_us = 200;
+    for (arg = 1; arg < argc; arg++) {
+        if (arg + 1 >= argc) {
+            return -1;
+        }
+        if (strcmp(argv[arg], "--socket") == 0) {
+            opts->socket_path = argv[++arg];
+        } else if (strcmp(argv[arg], "--max-batch") == 0) {
+            opts->max_batch = (size_t) strtoul(argv[++arg], NULL, 10);
+            if (opts->max_batch == 0 || opts->max_batch > MAX_BATCH) {
+                return -1;
+            }
+        } else if (strcmp(argv[arg], "--max-delay") == 0) {
+            opts->max_delay_us = (unsigned int) strtoul(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "--key") == 0) {
+            if ((eq = strchr(argv[++arg], '=')) == NULL) {
+                return -1;
+            }
+            for (mode = 0; mode < 4; mode++) {
+                if (strlen(mode_names[mode]) == (size_t) (eq - argv[arg]) &&
+                    strncmp(argv[arg], mode_names[mode], (size_t) (eq - argv[arg])) == 0) {
+                    break;
+                }
+            }
+            if (mode == 4) {
+                return -1;
+            }
+            opts->keys[mode] = eq + 1;
+            has_key          = 1;
+        } else {
+            return -1;
+        }
+    }
+    return opts->socket_path != NULL && has_key ? 0 : -1;
+}
+
+/**
+ * server_init_keys expands the keys given on the command line.
+ * Returns 0 on success, or -1 if a key is invalid.
+ */
+static int
+server_init_keys(Server *server, const Options *opts)
+{
+    static const size_t key_bytes[4] = { IPCRYPT_KEYBYTES, IPCRYPT_PFX_KEYBYTES, IPCRYPT_KEYBYTES,
+                                         IPCRYPT_NDX_KEYBYTES };
+    uint8_t             key[IPCRYPT_NDX_KEYBYTES];
+    unsigned int        mode;
+
+    for (mode = 0; mode < 4; mode++) {
+        if (opts->keys[mode] == NULL) {
+            continue;
+        }
+        if (ipcrypt_key_from_hex(key, key_bytes[mode], opts->keys[mode],
+                                 strlen(opts->keys[mode])) != 0) {
+            fprintf(stderr, "Invalid %s key: %u hex characters are required\n",
+                    mode_names[mode], (unsigned int) (2 * key_bytes[mode]));
+            return -1;
+        }
+        switch (mode) {
+        case IPCRYPT_MODE_DETERMINISTIC:
+            ipcrypt_init(&server->ipcrypt, key);
+            break;
+        case IPCRYPT_MODE_PFX:
+            ipcrypt_pfx_init(&server->ipcrypt_pfx, key);
+            break;
+        case IPCRYPT_MODE_ND:
+            ipcrypt_init(&server->ipcrypt_nd, key);
+            break;
+        case IPCRYPT_MODE_NDX:
+            ipcrypt_ndx_init(&server->ipcrypt_ndx, key);
+            break;
+        }
+        server->has_key[mode] = 1;
+    }
+    memset(key, 0, sizeof key);
+
+    return 0;
+}
+
+static int
+server_listen(Server *server, const char *path)
+{
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof addr.sun_path) {
+        fprintf(stderr, "%s: path too long\n", path);
+        return -1;
+    }
+    memcpy(addr.sun_path, path, strlen(path));
+    if ((server->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        fprintf(stderr, "socket: %s\n", strerror(errno));
+        return -1;
+    }
+    (void) unlink(path);
+    if (bind(server->listen_fd, (const struct sockaddr *) &addr, sizeof addr) != 0 ||
+        listen(server->listen_fd, SOMAXCONN) != 0 ||
+        fcntl(server->listen_fd, F_SETFL, O_NONBLOCK) == -1) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    Options          opts;
+    Server          *server;
+    struct sigaction sa;
+    char             report[65536];
+    size_t           i;
+    int              ret;
+
+    if (parse_options(&opts, argc, argv) != 0) {
+        return usage(argv[0]);
+    }
+    if ((server = (Server *) calloc(1, sizeof *server)) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    server->max_batch    = opts.max_batch;
+    server->max_delay_ns = (uint64_t) opts.max_delay_us * 1000U;
+    server->random_pos   = sizeof server->random;
+    for (i = 0; i < 8; i++) {
+        server->batches[i / 4][i % 4].gap_ns = server->max_delay_ns;
+    }
+    if (server_init_keys(server, &opts) != 0) {
+        return 1;
+    }
+    if ((server->random_fd = open("/dev/urandom", O_RDONLY)) == -1) {
+        fprintf(stderr, "/dev/urandom: %s\n", strerror(errno));
+        return 1;
+    }
+    if (server_listen(server, opts.socket_path) != 0) {
+        return 1;
+    }
+
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+
+    ret = server_run(server);
+
+    fwrite(report, 1, stats_format(server, report, sizeof report), stderr);
+    for (i = 0; i < server->conns_count; i++) {
+        conn_close(server->conns[i]);
+        free(server->conns[i]->out);
+        free(server->conns[i]);
+    }
+    free(server->conns);
+    close(server->listen_fd);
+    (void) unlink(opts.socket_path);
+    close(server->random_fd);
+    ipcrypt_deinit(&server->ipcrypt);
+    ipcrypt_deinit(&server->ipcrypt_nd);
+    ipcrypt_pfx_deinit(&server->ipcrypt_pfx);
+    ipcrypt_ndx_deinit(&server->ipcrypt_ndx);
+    free(server);
+
+    return ret == 0 ? 0 : 1;
+}
@@ -0,0 +1,221 @@
+/**
+ * Packet capture anonymizer.
+ *
+ * Copies a pcap file, maps the copy into memory, and encrypts or decrypts the addresses of its
+ * packets in-place. On Linux, the copy is made by the kernel with copy_file_range(), which can
+ * share the blocks of the input on filesystems that support it; only the pages holding rewritten
+ * headers are then modified.
+ *
+ * Usage: ipcrypt-pcap [--decrypt] [--threads N] --key HEX INPUT [OUTPUT]
+ *
+ * Addresses are encrypted with the PFX mode. Without OUTPUT, the input file is modified in-place.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#    define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ipcrypt2_pcap.h"
+
+typedef struct Options {
+    const char  *key_hex;
+    const char  *input;
+    const char  *output;
+    unsigned int threads;
+    int          decrypt;
+} Options;
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    timespec_get(&ts, TIME_UTC);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static int
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [--decrypt] [--threads N] --key HEX INPUT [OUTPUT]\n",
+            prog);
+    return 1;
+}
+
+static int
+parse_options(Options *opts, int argc, char *argv[])
+{
+    int arg;
+
+    opts->key_hex = NULL;
+    opts->input   = NULL;
+    opts->output  = NULL;
+    opts->threads = 0;
+    opts->decrypt = 0;
+    for (arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "--decrypt") == 0) {
+            opts->decrypt = 1;
+            continue;
+        }
+        if (argv[arg][0] != '-') {
+            if (opts->input == NULL) {
+                opts->input = argv[arg];
+            } else if (opts->output == NULL) {
+                opts->output = argv[arg];
+            } else {
+                return -1;
+            }
+            continue;
+        }
+        if (arg + 1 >= argc) {
+            return -1;
+        }
+        if (strcmp(argv[arg], "--key") == 0) {
+            opts->key_hex = argv[++arg];
+        } else if (strcmp(argv[arg], "--threads") == 0) {
+            opts->threads = (unsigned int) strtoul(argv[++arg], NULL, 10);
+        } else {
+            return -1;
+        }
+    }
+    return opts->key_hex != NULL && opts->input != NULL ? 0 : -1;
+}
+
+/**
+ * copy_file copies `size` bytes from `in` to `out`, preferably without going through user space.
+ */
+static int
+copy_file(int in, int out, off_t size)
+{
+    static char buf[1 << 20];
+    ssize_t     n;
+    size_t      written;
+
+#ifdef __linux__
+    while (size > 0) {
+        if ((n = copy_file_range(in, NULL, out, NULL, (size_t) size, 0)) <= 0) {
+            break;
+        }
+        size -= n;
+    }
+    if (size == 0) {
+        return 0;
+    }
+#endif
+    while (size > 0) {
+        if ((n = read(in, buf, sizeof buf)) <= 0) {
+            return -1;
+        }
+        for (written = 0; written < (size_t) n;) {
+            const ssize_t w = write(out, buf + written, (size_t) n - written);
+
+            if (w <= 0) {
+                return -1;
+            }
+            written += (size_t) w;
+        }
+        size -= n;
+    }
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    Options          opts;
+    IPCryptPcapStats stats;
+    IPCryptPcap     *pcap;
+    IPCryptPool     *pool;
+    struct stat      st;
+    struct stat      out_st;
+    uint8_t          key[IPCRYPT_PFX_KEYBYTES];
+    void            *data;
+    double           t0, elapsed;
+    unsigned int     threads;
+    int              in, fd;
+    int              ret;
+
+    if (parse_options(&opts, argc, argv) != 0) {
+        return usage(argv[0]);
+    }
+    if (ipcrypt_key_from_hex(key, IPCRYPT_PFX_KEYBYTES, opts.key_hex, strlen(opts.key_hex)) != 0 ||
+        (pcap = ipcrypt_pcap_create(IPCRYPT_MODE_PFX, key, IPCRYPT_PFX_KEYBYTES)) == NULL) {
+        fprintf(stderr, "Invalid key: %u hex characters are required\n", 2 * IPCRYPT_PFX_KEYBYTES);
+        return 1;
+    }
+    memset(key, 0, sizeof key);
+
+    if ((in = open(opts.input, opts.output == NULL ? O_RDWR : O_RDONLY)) == -1 ||
+        fstat(in, &st) != 0) {
+        fprintf(stderr, "%s: %s\n", opts.input, strerror(errno));
+        return 1;
+    }
+    fd = in;
+    if (opts.output != NULL) {
+        // The output is only truncated once it is known not to be the input.
+        if ((fd = open(opts.output, O_RDWR | O_CREAT, 0644)) == -1 || fstat(fd, &out_st) != 0) {
+            fprintf(stderr, "%s: %s\n", opts.output, strerror(errno));
+            return 1;
+        }
+        if (out_st.st_dev == st.st_dev && out_st.st_ino == st.st_ino) {
+            fprintf(stderr, "%s: same file as the input; omit OUTPUT to modify it in-place\n",
+                    opts.output);
+            return 1;
+        }
+        if (ftruncate(fd, 0) != 0 || copy_file(in, fd, st.st_size) != 0) {
+            fprintf(stderr, "%s: %s\n", opts.output, strerror(errno));
+            return 1;
+        }
+        close(in);
+    }
+    if (st.st_size == 0) {
+        fprintf(stderr, "%s: not a pcap file\n", opts.input);
+        return 1;
+    }
+    data = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "mmap: %s\n", strerror(errno));
+        return 1;
+    }
+    if ((pool = ipcrypt_pool_create(opts.threads)) == NULL) {
+        fprintf(stderr, "Unable to create the thread pool\n");
+        return 1;
+    }
+
+    t0  = now();
+    ret = opts.decrypt ? ipcrypt_pcap_decrypt(pcap, pool, data, (size_t) st.st_size, &stats)
+                       : ipcrypt_pcap_encrypt(pcap, pool, data, (size_t) st.st_size, &stats);
+    elapsed = now() - t0;
+    threads = ipcrypt_pool_threads(pool);
+
+    ipcrypt_pool_destroy(pool);
+    ipcrypt_pcap_destroy(pcap);
+    if (munmap(data, (size_t) st.st_size) != 0 || close(fd) != 0) {
+        fprintf(stderr, "%s: %s\n", opts.output != NULL ? opts.output : opts.input,
+                strerror(errno));
+        return 1;
+    }
+    if (ret != 0) {
+        fprintf(stderr, "%s: not a pcap file\n", opts.input);
+        return 1;
+    }
+    fprintf(stderr,
+            "%llu packets, %llu IP packets, %llu addresses, %.1f MB/s on %u threads\n",
+            (unsigned long long) stats.packets, (unsigned long long) stats.ip_packets,
+            (unsigned long long) stats.addresses,
+            elapsed > 0 ? (double) st.st_size / elapsed / 1e6 : 0.0, threads);
+
+    return 0;
+}